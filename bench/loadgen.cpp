@@ -0,0 +1,297 @@
+#include "httplib.h"
+#include "json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load generator for the producer -> processor -> consumer chain.
+//
+// Closed-loop mode (--concurrency N) keeps N requests outstanding; open-loop
+// mode (--rate R) sends on a fixed schedule regardless of how fast responses
+// come back. Either way the latency report is corrected for coordinated
+// omission: in rate mode each request is timed from when it was *meant* to
+// be sent, and in concurrency mode every response slower than the expected
+// interval back-fills the samples that a stalled worker failed to take.
+// The report is a single JSON object so CI can diff it between builds.
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string url = "http://localhost:8081";
+    std::string path = "/process";
+    httplib::Headers headers;
+    int concurrency = 8;
+    double rate = 0;              // requests/sec; 0 = closed loop
+    double durationSeconds = 10;
+    double warmupSeconds = 2;
+    int64_t expectedIntervalMicros = 0;  // closed loop only; 0 = warmup median
+    int timeoutMs = 2000;
+    std::string label;
+    std::string output;
+    double maxP99Ms = 0;
+    double maxErrorRate = -1;
+    double minRps = 0;
+};
+
+void usage() {
+    std::cerr <<
+        "Usage: loadgen [options]\n"
+        "  --url URL                  service base URL (default http://localhost:8081)\n"
+        "  --path PATH                request path: /process, /data, /consume, ... (default /process)\n"
+        "  --header 'K: V'            extra request header, repeatable (e.g. Accept: application/x-binary)\n"
+        "  --concurrency N            workers / outstanding requests (default 8)\n"
+        "  --rate R                   fixed rate in requests/sec (open loop); 0 = closed loop\n"
+        "  --duration S               measured seconds (default 10)\n"
+        "  --warmup S                 unrecorded seconds before measuring (default 2)\n"
+        "  --expected-interval-us U   closed-loop correction interval (default: warmup median)\n"
+        "  --timeout-ms MS            per-request timeout (default 2000)\n"
+        "  --label NAME               free-form build/run label copied into the report\n"
+        "  --output FILE              write the JSON report to FILE as well as stdout\n"
+        "  --max-p99-ms MS            exit 2 if corrected p99 exceeds MS\n"
+        "  --max-error-rate F         exit 2 if the error rate exceeds F (0..1)\n"
+        "  --min-rps R                exit 2 if throughput falls below R\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") return false;
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        try {
+            if (arg == "--url") opts.url = value;
+            else if (arg == "--path") opts.path = value;
+            else if (arg == "--header") {
+                size_t colon = value.find(':');
+                if (colon == std::string::npos) throw std::invalid_argument("header");
+                size_t start = value.find_first_not_of(' ', colon + 1);
+                opts.headers.emplace(value.substr(0, colon),
+                                     start == std::string::npos ? "" : value.substr(start));
+            }
+            else if (arg == "--concurrency") opts.concurrency = std::stoi(value);
+            else if (arg == "--rate") opts.rate = std::stod(value);
+            else if (arg == "--duration") opts.durationSeconds = std::stod(value);
+            else if (arg == "--warmup") opts.warmupSeconds = std::stod(value);
+            else if (arg == "--expected-interval-us") opts.expectedIntervalMicros = std::stoll(value);
+            else if (arg == "--timeout-ms") opts.timeoutMs = std::stoi(value);
+            else if (arg == "--label") opts.label = value;
+            else if (arg == "--output") opts.output = value;
+            else if (arg == "--max-p99-ms") opts.maxP99Ms = std::stod(value);
+            else if (arg == "--max-error-rate") opts.maxErrorRate = std::stod(value);
+            else if (arg == "--min-rps") opts.minRps = std::stod(value);
+            else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+    if (opts.concurrency < 1 || opts.durationSeconds <= 0 || opts.rate < 0) {
+        std::cerr << "concurrency must be >= 1, duration > 0 and rate >= 0" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Samples taken by one worker; merged after the run so recording is lock-free
+struct WorkerStats {
+    std::vector<int64_t> corrected;    // micros, coordinated-omission corrected
+    std::vector<int64_t> uncorrected;  // micros, as observed by the client
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+};
+
+int64_t micros(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+json summarize(std::vector<int64_t>& samples) {
+    json out;
+    if (samples.empty()) return out;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) {
+        size_t rank = static_cast<size_t>(q * static_cast<double>(samples.size() - 1) + 0.5);
+        return static_cast<double>(samples[rank]) / 1000.0;
+    };
+    double sum = 0;
+    for (int64_t s : samples) sum += static_cast<double>(s);
+    out["p50"] = at(0.50);
+    out["p90"] = at(0.90);
+    out["p99"] = at(0.99);
+    out["p999"] = at(0.999);
+    out["max"] = static_cast<double>(samples.back()) / 1000.0;
+    out["mean"] = sum / static_cast<double>(samples.size()) / 1000.0;
+    return out;
+}
+
+class LoadGenerator {
+public:
+    explicit LoadGenerator(const Options& opts) : opts_(opts) {}
+
+    json run() {
+        if (opts_.rate == 0 && opts_.expectedIntervalMicros == 0 && opts_.warmupSeconds > 0) {
+            // Closed loop: whatever a healthy request takes during warmup is
+            // the pace each worker would have kept without stalls
+            std::vector<WorkerStats> warm = phase(opts_.warmupSeconds, 0);
+            std::vector<int64_t> all;
+            for (auto& w : warm) all.insert(all.end(), w.uncorrected.begin(), w.uncorrected.end());
+            if (!all.empty()) {
+                std::nth_element(all.begin(), all.begin() + all.size() / 2, all.end());
+                expectedInterval_ = std::max<int64_t>(all[all.size() / 2], 1);
+            }
+        } else {
+            expectedInterval_ = opts_.expectedIntervalMicros;
+            if (opts_.warmupSeconds > 0) phase(opts_.warmupSeconds, 0);
+        }
+
+        auto started = Clock::now();
+        std::vector<WorkerStats> stats = phase(opts_.durationSeconds, expectedInterval_);
+        double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+        WorkerStats total;
+        for (auto& w : stats) {
+            total.requests += w.requests;
+            total.errors += w.errors;
+            total.corrected.insert(total.corrected.end(), w.corrected.begin(), w.corrected.end());
+            total.uncorrected.insert(total.uncorrected.end(), w.uncorrected.begin(), w.uncorrected.end());
+        }
+
+        json report;
+        report["label"] = opts_.label;
+        report["target"] = opts_.url + opts_.path;
+        report["mode"] = opts_.rate > 0 ? "rate" : "concurrency";
+        report["concurrency"] = opts_.concurrency;
+        report["rate"] = opts_.rate;
+        report["duration_s"] = elapsed;
+        report["requests"] = total.requests;
+        report["errors"] = total.errors;
+        report["error_rate"] = total.requests
+            ? static_cast<double>(total.errors) / static_cast<double>(total.requests) : 0.0;
+        report["throughput_rps"] = static_cast<double>(total.requests) / elapsed;
+        report["expected_interval_us"] = opts_.rate > 0 ? 1e6 / opts_.rate
+                                                        : static_cast<double>(expectedInterval_);
+        report["latency_ms"] = summarize(total.corrected);
+        report["uncorrected_latency_ms"] = summarize(total.uncorrected);
+        return report;
+    }
+
+private:
+    // Run every worker for `seconds`; interval 0 disables closed-loop back-fill
+    std::vector<WorkerStats> phase(double seconds, int64_t interval) {
+        auto start = Clock::now();
+        auto end = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(seconds));
+        next_ = 0;
+
+        std::vector<WorkerStats> stats(static_cast<size_t>(opts_.concurrency));
+        std::vector<std::thread> workers;
+        for (int i = 0; i < opts_.concurrency; ++i) {
+            workers.emplace_back([this, &stats, i, start, end, interval] {
+                work(stats[static_cast<size_t>(i)], start, end, interval);
+            });
+        }
+        for (auto& t : workers) t.join();
+        return stats;
+    }
+
+    void work(WorkerStats& stats, Clock::time_point start, Clock::time_point end,
+              int64_t interval) {
+        httplib::Client cli(opts_.url);
+        cli.set_keep_alive(true);
+        cli.set_tcp_nodelay(true);
+        cli.set_connection_timeout(std::chrono::milliseconds(opts_.timeoutMs));
+        cli.set_read_timeout(std::chrono::milliseconds(opts_.timeoutMs));
+
+        auto period = opts_.rate > 0
+            ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / opts_.rate))
+            : Clock::duration::zero();
+
+        while (true) {
+            Clock::time_point intended;
+            if (opts_.rate > 0) {
+                // Open loop: claim the next slot of the global schedule
+                uint64_t slot = next_.fetch_add(1, std::memory_order_relaxed);
+                intended = start + period * static_cast<int64_t>(slot);
+                if (intended >= end) break;
+                std::this_thread::sleep_until(intended);
+            } else {
+                intended = Clock::now();
+                if (intended >= end) break;
+            }
+
+            auto sent = Clock::now();
+            auto res = cli.Get(opts_.path, opts_.headers);
+            auto done = Clock::now();
+
+            ++stats.requests;
+            if (!res || res->status != 200) ++stats.errors;
+
+            int64_t observed = micros(done - sent);
+            int64_t corrected = micros(done - intended);
+            stats.uncorrected.push_back(observed);
+            stats.corrected.push_back(corrected);
+
+            // Closed loop: a stall hid the requests this worker would have sent
+            for (int64_t missing = corrected - interval; interval > 0 && missing >= interval;
+                 missing -= interval) {
+                stats.corrected.push_back(missing);
+            }
+        }
+    }
+
+    const Options opts_;
+    int64_t expectedInterval_ = 0;
+    std::atomic<uint64_t> next_{0};
+};
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        usage();
+        return 1;
+    }
+
+    std::cerr << "Load: " << opts.url << opts.path << ", ";
+    if (opts.rate > 0) std::cerr << opts.rate << " req/s over ";
+    else std::cerr << "closed loop with ";
+    std::cerr << opts.concurrency << " workers, " << opts.durationSeconds << "s" << std::endl;
+
+    LoadGenerator generator(opts);
+    json report = generator.run();
+    std::cout << report.dump(2) << std::endl;
+    if (!opts.output.empty()) {
+        std::ofstream(opts.output) << report.dump(2) << std::endl;
+    }
+
+    // Regression gates for CI
+    bool failed = false;
+    double p99 = report["latency_ms"].value("p99", 0.0);
+    if (opts.maxP99Ms > 0 && p99 > opts.maxP99Ms) {
+        std::cerr << "FAIL: p99 " << p99 << "ms exceeds " << opts.maxP99Ms << "ms" << std::endl;
+        failed = true;
+    }
+    if (opts.maxErrorRate >= 0 && report["error_rate"].get<double>() > opts.maxErrorRate) {
+        std::cerr << "FAIL: error rate " << report["error_rate"].get<double>()
+                  << " exceeds " << opts.maxErrorRate << std::endl;
+        failed = true;
+    }
+    if (opts.minRps > 0 && report["throughput_rps"].get<double>() < opts.minRps) {
+        std::cerr << "FAIL: throughput " << report["throughput_rps"].get<double>()
+                  << " req/s below " << opts.minRps << std::endl;
+        failed = true;
+    }
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,562 @@
+#include "common/endpoint_set.h"
+#include "common/fast_json.h"
+#include "common/json_extract.h"
+#include "common/logger.h"
+#include "common/upstream_pool.h"
+#include "json.hpp"
+#include "processor/transform.h"
+#include "producer/random_source.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Component benchmarks for the per-request hot path.
+//
+// bench/loadgen measures the services end to end; this times the pieces a
+// request goes through on its own, so a change to one of them can be shown
+// to pay off (or not) without the noise of sockets and scheduling:
+//
+//   producer/   RandomSource::next and fill for each RNG_ENGINE
+//   json/       json::dump() against the fastjson serializers, and
+//               json::parse against jsonextract::FieldReader, for the
+//               {"value"}, {"original","processed"} and batch shapes
+//   transform/  Pipeline::run for each ISA the CPU has, the default and a
+//               multi-stage pipeline, at batch sizes 1 to 4096
+//   logging/    LOG_* call sites below the level and sampled, and lines
+//               through the async writer
+//   pool/       UpstreamPool checkout and the pick + checkout an upstream
+//               call makes through EndpointSet
+//
+// As in Google Benchmark, each case first grows its iteration count until a
+// run takes a tenth of --min-time, then repeats a run of about --min-time
+// --repetitions times; the report has the median time per operation and
+// the spread between repetitions. The JSON report on stdout is meant to be
+// kept per commit: --compare reads an earlier one and prints the change
+// for every case the two have in common, and --max-regression turns that
+// into an exit code for CI. The cases are built against the release flags
+// of common/build.mk, i.e. the code the images run.
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string filter;
+    double minTimeSeconds = 0.2;
+    int repetitions = 3;
+    bool list = false;
+    std::string label;
+    std::string output;
+    std::string compare;
+    double maxRegressionPercent = 0;
+};
+
+void usage() {
+    std::cerr <<
+        "Usage: microbench [options]\n"
+        "  --filter REGEX             run only the cases whose name matches (e.g. '^json/')\n"
+        "  --min-time S               seconds per repetition (default 0.2)\n"
+        "  --repetitions N            timed runs per case; the median is reported (default 3)\n"
+        "  --list                     print the case names and exit\n"
+        "  --label NAME               free-form build/run label copied into the report\n"
+        "  --output FILE              write the JSON report to FILE as well as stdout\n"
+        "  --compare FILE             print the change against an earlier report\n"
+        "  --max-regression PCT       with --compare, exit 2 if a case got PCT% slower\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") return false;
+        if (arg == "--list") {
+            opts.list = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        try {
+            if (arg == "--filter") opts.filter = value;
+            else if (arg == "--min-time") opts.minTimeSeconds = std::stod(value);
+            else if (arg == "--repetitions") opts.repetitions = std::stoi(value);
+            else if (arg == "--label") opts.label = value;
+            else if (arg == "--output") opts.output = value;
+            else if (arg == "--compare") opts.compare = value;
+            else if (arg == "--max-regression") opts.maxRegressionPercent = std::stod(value);
+            else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+    if (opts.minTimeSeconds <= 0 || opts.repetitions < 1) {
+        std::cerr << "--min-time and --repetitions must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Keep `value` (and what it points to) from being optimised out of a loop
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Case {
+    std::string name;
+    std::function<void(uint64_t iterations)> run;
+    double itemsPerOp = 1;   // values generated, serialized, transformed...
+    double bytesPerOp = 0;   // body bytes written or read; 0 if not meaningful
+    int threads = 1;         // run() is called on this many threads at once
+    std::function<json()> counters;  // extra figures for the report, read after timing
+};
+
+// Time `iterations` of a case split over its threads; seconds of wall clock
+double timeRun(const Case& c, uint64_t iterations) {
+    auto start = Clock::now();
+    if (c.threads == 1) {
+        c.run(iterations);
+    } else {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < c.threads; ++t) {
+            threads.emplace_back([&c, iterations, t] {
+                uint64_t share = iterations / static_cast<uint64_t>(c.threads);
+                if (static_cast<uint64_t>(t) < iterations % static_cast<uint64_t>(c.threads)) ++share;
+                c.run(share);
+            });
+        }
+        for (auto& t : threads) t.join();
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+json measure(const Case& c, const Options& opts) {
+    // Grow the run until it is long enough to extrapolate from
+    uint64_t iterations = 1;
+    double elapsed = timeRun(c, iterations);
+    while (elapsed < opts.minTimeSeconds / 10 && iterations < (uint64_t(1) << 40)) {
+        iterations *= elapsed > 0 ? std::clamp<uint64_t>(
+                                        static_cast<uint64_t>(opts.minTimeSeconds / 10 / elapsed), 2, 10)
+                                  : 10;
+        elapsed = timeRun(c, iterations);
+    }
+    iterations = std::max<uint64_t>(1, static_cast<uint64_t>(
+                                           static_cast<double>(iterations) * opts.minTimeSeconds / elapsed));
+
+    std::vector<double> nsPerOp;
+    for (int r = 0; r < opts.repetitions; ++r) {
+        nsPerOp.push_back(timeRun(c, iterations) * 1e9 / static_cast<double>(iterations));
+    }
+    std::vector<double> sorted = nsPerOp;
+    std::sort(sorted.begin(), sorted.end());
+    double median = sorted[sorted.size() / 2];
+    if (sorted.size() % 2 == 0) median = (median + sorted[sorted.size() / 2 - 1]) / 2;
+
+    double mean = 0;
+    for (double ns : nsPerOp) mean += ns;
+    mean /= static_cast<double>(nsPerOp.size());
+    double variance = 0;
+    for (double ns : nsPerOp) variance += (ns - mean) * (ns - mean);
+    variance /= static_cast<double>(nsPerOp.size());
+
+    json result;
+    result["name"] = c.name;
+    result["threads"] = c.threads;
+    result["iterations"] = iterations;
+    result["ns_per_op"] = median;
+    result["ns_per_op_min"] = sorted.front();
+    result["cv"] = mean > 0 ? std::sqrt(variance) / mean : 0.0;
+    result["items_per_second"] = median > 0 ? c.itemsPerOp * 1e9 / median : 0.0;
+    if (c.bytesPerOp > 0) result["bytes_per_second"] = c.bytesPerOp * 1e9 / median;
+    if (c.counters) result["counters"] = c.counters();
+    return result;
+}
+
+// --- producer/ --------------------------------------------------------------
+
+constexpr int kMinValue = 1;  // the producer's value range
+constexpr int kMaxValue = 100;
+
+void producerCases(std::vector<Case>& cases) {
+    for (EngineKind kind : {EngineKind::Mt19937, EngineKind::Xoshiro256pp, EngineKind::Pcg32}) {
+        auto random = std::make_shared<RandomSource>(kind, 42);
+        std::string engine = engineName(kind);
+
+        cases.push_back({"producer/next/" + engine, [random](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) doNotOptimize(random->next(kMinValue, kMaxValue));
+        }});
+
+        for (size_t count : {16, 1000}) {
+            auto values = std::make_shared<std::vector<int>>(count);
+            cases.push_back({"producer/fill/" + engine + "/" + std::to_string(count),
+                             [random, values](uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) {
+                    random->fill(values->data(), values->size(), kMinValue, kMaxValue);
+                    doNotOptimize(values->data());
+                }
+            }, static_cast<double>(count)});
+        }
+    }
+}
+
+// --- json/ ------------------------------------------------------------------
+
+std::vector<int> sampleValues(size_t count, uint64_t seed) {
+    std::vector<int> values(count);
+    Xoshiro256x4Engine(seed).fill(values.data(), count, kMinValue, kMaxValue);
+    return values;
+}
+
+void jsonCases(std::vector<Case>& cases) {
+    // What the producer and processor send back, one value and a batch
+    const int value = 42;
+    std::string valueBody(fastjson::value(value));
+    cases.push_back({"json/dump/value", [value](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            json body;
+            body["value"] = value;
+            doNotOptimize(body.dump());
+        }
+    }, 1, static_cast<double>(valueBody.size())});
+    cases.push_back({"json/fast/value", [value](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) doNotOptimize(fastjson::value(value));
+    }, 1, static_cast<double>(valueBody.size())});
+
+    std::string processedBody(fastjson::processed(value, value * 2));
+    cases.push_back({"json/dump/processed", [value](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            json body;
+            body["original"] = value;
+            body["processed"] = value * 2;
+            doNotOptimize(body.dump());
+        }
+    }, 1, static_cast<double>(processedBody.size())});
+    cases.push_back({"json/fast/processed", [value](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) doNotOptimize(fastjson::processed(value, value * 2));
+    }, 1, static_cast<double>(processedBody.size())});
+
+    for (size_t count : {16, 1000}) {
+        auto original = std::make_shared<std::vector<int>>(sampleValues(count, 1));
+        auto processed = std::make_shared<std::vector<int>>(sampleValues(count, 2));
+        std::string suffix = "/" + std::to_string(count);
+        double items = static_cast<double>(count);
+        double bytes = static_cast<double>(
+            fastjson::processedBatch(original->data(), processed->data(), count).size());
+
+        cases.push_back({"json/dump/processed_batch" + suffix, [original, processed](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                json body;
+                body["original"] = *original;
+                body["processed"] = *processed;
+                doNotOptimize(body.dump());
+            }
+        }, items, bytes});
+        cases.push_back({"json/fast/processed_batch" + suffix, [original, processed, count](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                doNotOptimize(fastjson::processedBatch(original->data(), processed->data(), count));
+            }
+        }, items, bytes});
+    }
+
+    // Reading them back, into the same variables either way
+    cases.push_back({"json/parse/value", [valueBody](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            json doc = json::parse(valueBody);
+            doNotOptimize(doc["value"].get<int>());
+        }
+    }, 1, static_cast<double>(valueBody.size())});
+    cases.push_back({"json/extract/value", [valueBody](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            int result = 0;
+            jsonextract::FieldReader reader;
+            reader.bind("value", &result);
+            reader.feed(valueBody);
+            doNotOptimize(reader.finish());
+            doNotOptimize(result);
+        }
+    }, 1, static_cast<double>(valueBody.size())});
+
+    for (size_t count : {16, 1000}) {
+        auto original = sampleValues(count, 1);
+        auto processed = sampleValues(count, 2);
+        std::string body(fastjson::processedBatch(original.data(), processed.data(), count));
+        std::string suffix = "/" + std::to_string(count);
+        double items = static_cast<double>(count);
+        double bytes = static_cast<double>(body.size());
+
+        cases.push_back({"json/parse/processed_batch" + suffix, [body, count](uint64_t n) {
+            std::vector<int> original, processed;
+            original.reserve(count);
+            processed.reserve(count);
+            for (uint64_t i = 0; i < n; ++i) {
+                json doc = json::parse(body);
+                original.clear();
+                processed.clear();
+                for (const auto& v : doc["original"]) original.push_back(v.get<int>());
+                for (const auto& v : doc["processed"]) processed.push_back(v.get<int>());
+                doNotOptimize(original.data());
+                doNotOptimize(processed.data());
+            }
+        }, items, bytes});
+        cases.push_back({"json/extract/processed_batch" + suffix, [body, count](uint64_t n) {
+            std::vector<int> original, processed;
+            original.reserve(count);
+            processed.reserve(count);
+            for (uint64_t i = 0; i < n; ++i) {
+                jsonextract::FieldReader reader;
+                reader.bind("original", &original);
+                reader.bind("processed", &processed);
+                reader.feed(body);
+                doNotOptimize(reader.finish());
+                doNotOptimize(original.data());
+                doNotOptimize(processed.data());
+            }
+        }, items, bytes});
+    }
+}
+
+// --- transform/ -------------------------------------------------------------
+
+void transformCases(std::vector<Case>& cases) {
+    // The ConfigMap default, and the pipeline bench/pgo.sh trains with
+    const std::pair<const char*, const char*> specs[] = {
+        {"scale", "scale:2"},
+        {"multi", "scale:3,offset:-1,clamp:0:250,filter:10:200,stats"},
+    };
+    std::vector<transform::Isa> isas = {transform::Isa::Scalar};
+    transform::Isa best = transform::detectIsa();
+    if (best >= transform::Isa::Sse41) isas.push_back(transform::Isa::Sse41);
+    if (best >= transform::Isa::Avx2) isas.push_back(transform::Isa::Avx2);
+
+    for (transform::Isa isa : isas) {
+        for (const auto& spec : specs) {
+            auto pipeline = std::make_shared<transform::Pipeline>(spec.second, isa);
+            for (size_t count : {1, 16, 256, 1000, 4096}) {
+                // Filter stages compact the input in place, so later runs see
+                // a prefix of survivors; every value is still a producer value
+                auto original = std::make_shared<std::vector<int>>(sampleValues(count, 3));
+                auto processed = std::make_shared<std::vector<int>>(count);
+                cases.push_back({std::string("transform/") + transform::isaName(isa) + "/" + spec.first +
+                                     "/" + std::to_string(count),
+                                 [pipeline, original, processed](uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                        doNotOptimize(pipeline->run(original->data(), processed->data(), original->size()));
+                        doNotOptimize(processed->data());
+                    }
+                }, static_cast<double>(count)});
+            }
+        }
+    }
+}
+
+// --- logging/ ---------------------------------------------------------------
+
+void loggingCases(std::vector<Case>& cases) {
+    cases.push_back({"logging/suppressed", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) LOG_DEBUG << "Generated: " << static_cast<int>(i);
+    }});
+
+    auto sampler = std::make_shared<logging::Sampler>(100);
+    cases.push_back({"logging/sampled/100", [sampler](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            LOG_SAMPLED(*sampler, logging::Level::Info) << "Generated: " << static_cast<int>(i);
+        }
+    }});
+
+    // A batch that fits the ring, then wait for the writer to put it out:
+    // lines per second through the whole logger, with the caller's half on
+    // the same core as the writer's. Lines that found the ring full anyway
+    // are counted rather than waited for.
+    struct Lines {
+        std::atomic<uint64_t> submitted{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+    auto lines = std::make_shared<Lines>();
+    const size_t batch = logging::Logger::instance().capacity() / 2;
+    cases.push_back({"logging/written/" + std::to_string(batch), [lines, batch](uint64_t n) {
+        logging::Logger& logger = logging::Logger::instance();
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t droppedBefore = logger.dropped();
+            uint64_t target = logger.written() + batch;
+            for (size_t j = 0; j < batch; ++j) {
+                LOG_INFO << "Processed: " << static_cast<int>(j) << " -> " << static_cast<int>(j * 2);
+            }
+            uint64_t dropped = logger.dropped() - droppedBefore;
+            while (logger.written() + dropped < target) std::this_thread::yield();
+            lines->submitted += batch;
+            lines->dropped += dropped;
+        }
+    }, static_cast<double>(batch), 0, 1, [lines] {
+        uint64_t submitted = lines->submitted.load();
+        return json{{"dropped", submitted ? static_cast<double>(lines->dropped.load()) /
+                                                static_cast<double>(submitted)
+                                          : 0.0}};
+    }});
+}
+
+// --- pool/ ------------------------------------------------------------------
+
+void poolCases(std::vector<Case>& cases) {
+    // Nothing is sent: a checkout only takes a client off the idle list
+    auto pool = std::make_shared<UpstreamPool>("127.0.0.1", 9, 64);
+    cases.push_back({"pool/checkout", [pool](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            UpstreamPool::Lease lease = pool->acquire();
+            doNotOptimize(&*lease);
+        }
+    }});
+    cases.push_back({"pool/checkout/threads:4", [pool](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            UpstreamPool::Lease lease = pool->acquire();
+            doNotOptimize(&*lease);
+        }
+    }, 1, 0, 4});
+
+    // What UpstreamClient does per attempt before it sends
+    auto endpoints = std::make_shared<EndpointSet>("127.0.0.1", "", 9, 64, std::chrono::seconds(5));
+    cases.push_back({"pool/pick_checkout", [endpoints](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            std::shared_ptr<EndpointSet::Endpoint> endpoint = endpoints->pick();
+            EndpointSet::Endpoint::Load load = endpoint->track();
+            UpstreamPool::Lease lease = endpoint->pool().acquire();
+            doNotOptimize(&*lease);
+            load.done(true);
+        }
+    }});
+}
+
+std::vector<Case> allCases() {
+    std::vector<Case> cases;
+    producerCases(cases);
+    jsonCases(cases);
+    transformCases(cases);
+    loggingCases(cases);
+    poolCases(cases);
+    return cases;
+}
+
+// Change against `baseline` for each case both reports have; false if one
+// got slower than the allowed regression
+bool compare(const json& report, const json& baseline, double maxRegressionPercent) {
+    std::map<std::string, double> before;
+    for (const auto& b : baseline.value("benchmarks", json::array())) {
+        before[b.value("name", "")] = b.value("ns_per_op", 0.0);
+    }
+
+    bool ok = true;
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-44s %12s %12s %9s", "case", "base ns/op", "ns/op", "change");
+    std::cerr << "\nAgainst " << baseline.value("label", "baseline") << ":\n" << line << "\n";
+    for (const auto& b : report["benchmarks"]) {
+        auto it = before.find(b["name"].get<std::string>());
+        if (it == before.end() || it->second <= 0) continue;
+        double now = b["ns_per_op"].get<double>();
+        double change = (now - it->second) / it->second * 100;
+        bool regressed = maxRegressionPercent > 0 && change > maxRegressionPercent;
+        ok = ok && !regressed;
+        std::snprintf(line, sizeof(line), "%-44s %12.1f %12.1f %+8.1f%%%s", it->first.c_str(),
+                      it->second, now, change, regressed ? "  FAIL" : "");
+        std::cerr << line << "\n";
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        usage();
+        return 1;
+    }
+
+    json baseline;
+    if (!opts.compare.empty()) {
+        std::ifstream in(opts.compare);
+        baseline = json::parse(in, nullptr, false);
+        if (!in || baseline.is_discarded()) {
+            std::cerr << "Cannot read report " << opts.compare << std::endl;
+            return 1;
+        }
+    }
+
+    std::regex filter;
+    try {
+        filter = std::regex(opts.filter);
+    } catch (const std::regex_error&) {
+        std::cerr << "Invalid --filter " << opts.filter << std::endl;
+        return 1;
+    }
+
+    std::vector<Case> cases;
+    for (Case& c : allCases()) {
+        if (std::regex_search(c.name, filter)) cases.push_back(std::move(c));
+    }
+    if (opts.list) {
+        for (const Case& c : cases) std::cout << c.name << "\n";
+        return 0;
+    }
+
+    // The logging cases write real lines; they go to /dev/null, and the
+    // report to the stdout we were given once the logger has drained
+    std::fflush(stdout);
+    int reportFd = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (reportFd >= 0 && devNull >= 0) dup2(devNull, STDOUT_FILENO);
+    if (devNull >= 0) close(devNull);
+
+    std::cerr << "Microbench: " << cases.size() << " cases, " << opts.repetitions << " x "
+              << opts.minTimeSeconds << "s each, transform ISA up to "
+              << transform::isaName(transform::detectIsa()) << std::endl;
+
+    json report;
+    report["label"] = opts.label;
+    report["compiler"] = __VERSION__;
+    report["cpus"] = std::thread::hardware_concurrency();
+    report["isa"] = transform::isaName(transform::detectIsa());
+    report["min_time_s"] = opts.minTimeSeconds;
+    report["repetitions"] = opts.repetitions;
+    report["benchmarks"] = json::array();
+    for (const Case& c : cases) {
+        json result = measure(c, opts);
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-44s %12.1f ns/op %14.4g items/s  cv %.3f",
+                      c.name.c_str(), result["ns_per_op"].get<double>(),
+                      result["items_per_second"].get<double>(), result["cv"].get<double>());
+        std::cerr << line << std::endl;
+        report["benchmarks"].push_back(std::move(result));
+    }
+
+    logging::Logger::instance().flush();
+    std::fflush(stdout);
+    if (reportFd >= 0) {
+        dup2(reportFd, STDOUT_FILENO);
+        close(reportFd);
+    }
+
+    std::cout << report.dump(2) << std::endl;
+    if (!opts.output.empty()) {
+        std::ofstream(opts.output) << report.dump(2) << std::endl;
+    }
+    if (!baseline.is_null() && !compare(report, baseline, opts.maxRegressionPercent)) {
+        std::cerr << "FAIL: a case regressed by more than " << opts.maxRegressionPercent << "%" << std::endl;
+        return 2;
+    }
+    return 0;
+}
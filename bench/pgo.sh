@@ -0,0 +1,75 @@
+#!/bin/sh
+# Profile-guided release build of the services.
+#
+# Builds instrumented binaries of all three services, runs them as a local
+# stack, drives a representative traffic mix through it with bench/loadgen,
+# stops them (which writes the profiles) and rebuilds the requested services
+# with `make profile-use`. libcommon's profile is shared and collects the
+# traffic of all three services.
+#
+#   bench/pgo.sh                  # producer, processor and consumer
+#   bench/pgo.sh processor        # only rebuild the processor
+#   PGO_DURATION=20 bench/pgo.sh  # seconds per training phase (default 5)
+set -e
+cd "$(dirname "$0")/.."
+
+SERVICES=${*:-producer processor consumer}
+DURATION=${PGO_DURATION:-5}
+BASE_PORT=${PGO_BASE_PORT:-18480}
+PRODUCER_PORT=$BASE_PORT
+PROCESSOR_PORT=$((BASE_PORT + 1))
+CONSUMER_PORT=$((BASE_PORT + 2))
+
+make -s -C bench
+make -s -C common clean-profile
+for s in producer processor consumer; do
+    make -s -C "$s" clean-profile profile-generate
+done
+
+PIDS=""
+stop_stack() {
+    if [ -n "$PIDS" ]; then
+        kill -TERM $PIDS 2>/dev/null || true
+        wait $PIDS 2>/dev/null || true
+        PIDS=""
+    fi
+}
+trap stop_stack EXIT
+
+# Same shape as the k8s ConfigMaps: binary internal hops and a multi-stage
+# pipeline, so the hot paths being profiled are the ones that run in the cluster
+LOG_LEVEL=warn PORT=$PRODUCER_PORT ./producer/producer-instrumented >/dev/null &
+PIDS="$PIDS $!"
+LOG_LEVEL=warn PORT=$PROCESSOR_PORT PRODUCER_HOST=127.0.0.1 PRODUCER_PORT=$PRODUCER_PORT \
+    WIRE_FORMAT=binary TRANSFORM_PIPELINE="scale:2,offset:1,clamp:0:250,stats" \
+    ./processor/processor-instrumented >/dev/null &
+PIDS="$PIDS $!"
+LOG_LEVEL=warn PORT=$CONSUMER_PORT PROCESSOR_HOST=127.0.0.1 PROCESSOR_PORT=$PROCESSOR_PORT \
+    WIRE_FORMAT=binary CONSUMER_WORKERS=2 TARGET_RPS=200 \
+    ./consumer/consumer-instrumented >/dev/null &
+PIDS="$PIDS $!"
+sleep 1
+
+train() {
+    url=$1
+    shift
+    echo "Training: $url $*"
+    ./bench/loadgen --url "$url" --duration "$DURATION" --warmup 0 --concurrency 8 "$@" >/dev/null
+}
+
+BINARY="Accept: application/x-binary"
+train "http://127.0.0.1:$PROCESSOR_PORT" --path /process
+train "http://127.0.0.1:$PROCESSOR_PORT" --path /process --header "$BINARY"
+train "http://127.0.0.1:$PROCESSOR_PORT" --path "/process_batch?count=100" --header "$BINARY"
+train "http://127.0.0.1:$PROCESSOR_PORT" --path "/process_batch?count=100"
+train "http://127.0.0.1:$PROCESSOR_PORT" --path "/process/stream?limit=2000" --concurrency 2
+train "http://127.0.0.1:$CONSUMER_PORT" --path /consume
+train "http://127.0.0.1:$CONSUMER_PORT" --path "/consume?count=50"
+
+stop_stack
+trap - EXIT
+
+for s in $SERVICES; do
+    echo "Rebuilding $s with its profile"
+    make -s -C "$s" profile-use
+done
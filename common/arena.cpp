@@ -0,0 +1,57 @@
+#include "arena.h"
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace arena {
+
+namespace {
+
+// Plain thread_locals with constant initialisers: operator new can touch
+// them on any thread, at any point of its life, without TLS init hooks
+thread_local uint64_t allocations = 0;
+thread_local uint64_t allocatedBytes = 0;
+thread_local int depth = 0;
+
+// The block comes from malloc so that setting it up is not put down to
+// whichever request happens to be first on the thread
+struct ThreadArena {
+    std::unique_ptr<char, decltype(&std::free)> block{static_cast<char*>(std::malloc(kBlockBytes)),
+                                                      &std::free};
+    std::pmr::monotonic_buffer_resource resource{block.get(), block ? kBlockBytes : 0,
+                                                 std::pmr::new_delete_resource()};
+};
+
+ThreadArena& threadArena() {
+    thread_local ThreadArena arena;
+    return arena;
+}
+
+}  // namespace
+
+std::pmr::memory_resource* resource() { return &threadArena().resource; }
+
+Scope::Scope() { ++depth; }
+
+Scope::~Scope() {
+    // Back to the start of the block; spilled chunks go back to the heap
+    if (--depth == 0) threadArena().resource.release();
+}
+
+Usage threadUsage() { return {allocations, allocatedBytes}; }
+
+}  // namespace arena
+
+// The other forms (array, nothrow) go through this one in libstdc++, and
+// the default operator delete frees what malloc returned
+void* operator new(std::size_t size) {
+    ++arena::allocations;
+    arena::allocatedBytes += size;
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* p = std::malloc(size)) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
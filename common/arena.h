@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// Per-request scratch memory and allocation accounting.
+//
+// Each worker thread owns a monotonic arena over a fixed block it allocates
+// once. metrics::instrument() opens a Scope around every handler it wraps,
+// and the Scope rewinds the arena when the handler returns, so scratch that
+// only lives for the request (the value columns of a batch, say) costs a
+// pointer bump instead of a malloc and free. Requests that need more than
+// the block spill over to the heap, and that memory is released with the
+// scope as well.
+//
+// Nothing allocated from the arena may outlive the handler: not the response
+// body, headers or anything handed to another thread or kept across an
+// EventServer::await() suspension (a suspended pass returns, and its scope
+// ends, before the request is resumed).
+//
+// libcommon also replaces the global operator new with one that counts the
+// allocations each thread makes. instrument() reports the handler's share on
+// /metrics, which shows what the remaining per-request mallocs are.
+namespace arena {
+
+// Block reserved per thread; enough for two columns of a 1000-value batch
+// several times over
+constexpr size_t kBlockBytes = 64 * 1024;
+
+// The calling thread's arena. Only valid for use inside a Scope.
+std::pmr::memory_resource* resource();
+
+// Rewind the thread's arena when the outermost Scope on it ends
+class Scope {
+public:
+    Scope();
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+template <typename T>
+using Vector = std::pmr::vector<T>;
+
+// operator new calls made on this thread so far, and the bytes they asked for
+struct Usage {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+
+    Usage operator-(const Usage& earlier) const {
+        return {allocations - earlier.allocations, bytes - earlier.bytes};
+    }
+};
+
+Usage threadUsage();
+
+}  // namespace arena
@@ -0,0 +1,971 @@
+#include "async_client.h"
+#include "http2.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+namespace upstream {
+
+namespace {
+
+// A reply head that has not ended by this size is not one we accept
+constexpr size_t kMaxHeadBytes = 64 * 1024;
+constexpr size_t kReadChunk = 16 * 1024;
+
+// Receive windows for HTTP/2 replies, per stream and for the connection,
+// topped up once half has been taken
+constexpr uint32_t kStreamWindow = 1 << 20;
+constexpr uint32_t kConnectionWindow = 16 << 20;
+// A host whose h2c connection failed outright stays on HTTP/1.1 this long
+constexpr auto kHttp2Retry = std::chrono::seconds(30);
+
+bool iequals(const std::string& a, const char* b) {
+    return strcasecmp(a.c_str(), b) == 0;
+}
+
+std::string trim(const std::string& s, size_t begin, size_t end) {
+    while (begin < end && (s[begin] == ' ' || s[begin] == '\t')) ++begin;
+    while (end > begin && (s[end - 1] == ' ' || s[end - 1] == '\t')) --end;
+    return s.substr(begin, end - begin);
+}
+
+std::string lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+}  // namespace
+
+struct AsyncClient::Exchange {
+    std::string key;  // host:port, the pool the connection comes from
+    std::string host;
+    int port = 0;
+    std::string path;
+    httplib::Headers headers;
+    std::string request;  // as HTTP/1.1 bytes, once it goes out on a connection of that kind
+    httplib::ContentReceiver receiver;
+    Done done;
+    Clock::time_point deadline;
+    uint64_t id = 0;
+    bool retried = false;  // already replayed once after a stale keep-alive connection
+};
+
+struct AsyncClient::Conn {
+    enum class Phase { Head, Fixed, ChunkSize, ChunkData, ChunkEnd, Trailer, UntilClose };
+
+    int fd = -1;
+    std::string key;
+    bool connecting = false;
+    bool reused = false;
+
+    // The call in progress, if any, and its reply so far
+    std::shared_ptr<Exchange> exchange;
+    size_t sent = 0;
+    std::string in;
+    size_t pos = 0;
+    bool received = false;
+    Phase phase = Phase::Head;
+    uint64_t remaining = 0;
+    bool keepAlive = true;
+    std::unique_ptr<httplib::Response> res;
+
+    std::unique_ptr<Session> h2;  // set on an HTTP/2 connection, which uses none of the above
+
+    void begin(std::shared_ptr<Exchange> next) {
+        exchange = std::move(next);
+        sent = 0;
+        in.clear();
+        pos = 0;
+        received = false;
+        phase = Phase::Head;
+        remaining = 0;
+        keepAlive = true;
+        res = std::make_unique<httplib::Response>();
+    }
+};
+
+// The calls on an HTTP/2 connection by stream id, and its end of the
+// connection state
+struct AsyncClient::Session {
+    struct Stream {
+        std::shared_ptr<Exchange> exchange;
+        std::unique_ptr<httplib::Response> res = std::make_unique<httplib::Response>();
+        bool answered = false;  // the reply's HEADERS have arrived
+        uint32_t unacked = 0;   // DATA taken since this stream's last WINDOW_UPDATE
+    };
+
+    http2::Encoder encoder;
+    http2::Decoder decoder;
+    std::string in;
+    std::string out;
+    std::unordered_map<uint32_t, Stream> streams;
+    std::deque<std::shared_ptr<Exchange>> waiting;  // past the server's stream limit
+    uint32_t nextStream = 1;
+    size_t maxStreams = 100;  // until the server's SETTINGS say otherwise
+    size_t maxFrame = http2::kDefaultMaxFrame;
+    bool settled = false;     // the server's SETTINGS have arrived
+    bool goingAway = false;   // no new streams: GOAWAY received, or ids used up
+    uint32_t unacked = 0;     // DATA taken since the connection's last WINDOW_UPDATE
+
+    // Header block being collected across CONTINUATION frames
+    std::string block;
+    uint32_t blockStream = 0;
+    bool blockEndStream = false;
+};
+
+AsyncClient::AsyncClient(size_t idlePerHost, bool http2)
+    : idlePerHost_(std::max<size_t>(idlePerHost, 1)),
+      http2_(http2),
+      epoll_(epoll_create1(EPOLL_CLOEXEC)),
+      wake_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev);
+    loop_ = std::thread([this] { run(); });
+}
+
+AsyncClient::~AsyncClient() {
+    stopping_.store(true, std::memory_order_release);
+    wake();
+    loop_.join();
+    // Calls still in progress are dropped without their callbacks: whatever
+    // they would report to may already be gone
+    for (auto& entry : conns_) ::close(entry.first->fd);
+    ::close(wake_);
+    ::close(epoll_);
+}
+
+void AsyncClient::get(const std::string& host, int port, AsyncRequest request,
+                      httplib::Headers headers, Clock::time_point deadline, Done done) {
+    auto exchange = std::make_shared<Exchange>();
+    exchange->key = host + ":" + std::to_string(port);
+    exchange->host = host;
+    exchange->port = port;
+    exchange->path = std::move(request.path);
+    exchange->headers = std::move(headers);
+    exchange->receiver = std::move(request.receiver);
+    exchange->done = std::move(done);
+    exchange->deadline = deadline;
+    post([this, exchange] { start(exchange); });
+}
+
+void AsyncClient::after(std::chrono::milliseconds delay, std::function<void()> fn) {
+    auto at = Clock::now() + delay;
+    post([this, at, fn = std::move(fn)] { timers_.emplace(at, fn); });
+}
+
+void AsyncClient::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_.push_back(std::move(fn));
+    }
+    wake();
+}
+
+void AsyncClient::wake() {
+    uint64_t one = 1;
+    ssize_t written = ::write(wake_, &one, sizeof(one));
+    (void)written;
+}
+
+void AsyncClient::run() {
+    epoll_event events[64];
+    std::vector<std::function<void()>> ready;
+    while (!stopping_.load(std::memory_order_acquire)) {
+        // Sleep until the next timer or call deadline, at most a second
+        int timeoutMs = 1000;
+        auto now = Clock::now();
+        for (auto next : {timers_.empty() ? Clock::time_point::max() : timers_.begin()->first,
+                          deadlines_.empty() ? Clock::time_point::max() : deadlines_.begin()->first}) {
+            if (next == Clock::time_point::max()) continue;
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+            timeoutMs = std::min<int>(timeoutMs, static_cast<int>(std::max<int64_t>(wait, 0)));
+        }
+
+        int n = epoll_wait(epoll_, events, 64, timeoutMs);
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t count;
+                ssize_t got = ::read(wake_, &count, sizeof(count));
+                (void)got;
+                continue;
+            }
+            auto* conn = static_cast<Conn*>(events[i].data.ptr);
+            // An earlier event in this batch may have closed it
+            if (conns_.count(conn)) onEvent(conn, events[i].events);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready.swap(queued_);
+        }
+        for (auto& fn : ready) fn();
+        ready.clear();
+        expire(Clock::now());
+    }
+}
+
+void AsyncClient::start(std::shared_ptr<Exchange> exchange) {
+    if (Clock::now() >= exchange->deadline) {
+        exchange->done(httplib::Result(nullptr, httplib::Error::Timeout));
+        return;
+    }
+
+    if (http2_ && h2Hosts_.count(exchange->key)) {
+        httplib::Error error = httplib::Error::Success;
+        Conn* conn = session(exchange, error);
+        if (!conn) {
+            exchange->done(httplib::Result(nullptr, error));
+            return;
+        }
+        exchange->id = ++nextExchange_;
+        deadlines_.emplace(exchange->deadline, std::make_pair(conn, exchange->id));
+        openStream(conn, std::move(exchange));
+        if (!conn->connecting && !flushSession(conn)) failSession(conn, httplib::Error::Write);
+        return;
+    }
+
+    std::string& out = exchange->request;
+    if (out.empty()) {
+        out.reserve(128 + exchange->path.size());
+        out += "GET ";
+        out += exchange->path;
+        out += " HTTP/1.1\r\nHost: ";
+        out += exchange->key;
+        out += "\r\n";
+        if (exchange->headers.find("Accept") == exchange->headers.end()) out += "Accept: */*\r\n";
+        for (const auto& header : exchange->headers) {
+            out += header.first;
+            out += ": ";
+            out += header.second;
+            out += "\r\n";
+        }
+        out += "\r\n";
+    }
+
+    Conn* conn = nullptr;
+    auto pooled = idle_.find(exchange->key);
+    if (pooled != idle_.end() && !pooled->second.empty() && !exchange->retried) {
+        conn = pooled->second.back();
+        pooled->second.pop_back();
+        conn->reused = true;
+        reuses_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        httplib::Error error = httplib::Error::Success;
+        conn = connect(exchange->key, exchange->host, exchange->port, error);
+        if (!conn) {
+            exchange->done(httplib::Result(nullptr, error));
+            return;
+        }
+    }
+
+    exchange->id = ++nextExchange_;
+    deadlines_.emplace(exchange->deadline, std::make_pair(conn, exchange->id));
+    conn->begin(std::move(exchange));
+    if (conn->connecting) {
+        arm(conn, EPOLLOUT, EPOLL_CTL_MOD);
+    } else if (!sendPending(conn)) {
+        finish(conn, httplib::Error::Write);
+    }
+}
+
+AsyncClient::Conn* AsyncClient::connect(const std::string& key, const std::string& host, int port,
+                                        httplib::Error& error) {
+    // Numeric only: a name would be resolved here, stalling every call on
+    // the loop, so EndpointSet resolves names on its own thread instead
+    addrinfo* result = nullptr;
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0) {
+        error = httplib::Error::Connection;
+        return nullptr;
+    }
+
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool started = fd >= 0 && (::connect(fd, result->ai_addr, result->ai_addrlen) == 0 ||
+                               errno == EINPROGRESS);
+    freeaddrinfo(result);
+    if (!started) {
+        if (fd >= 0) ::close(fd);
+        error = httplib::Error::Connection;
+        return nullptr;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    auto owned = std::make_unique<Conn>();
+    Conn* conn = owned.get();
+    conn->fd = fd;
+    conn->key = key;
+    conn->connecting = true;
+    conns_.emplace(conn, std::move(owned));
+    open_.fetch_add(1, std::memory_order_relaxed);
+    connects_.fetch_add(1, std::memory_order_relaxed);
+    arm(conn, EPOLLOUT, EPOLL_CTL_ADD);
+    return conn;
+}
+
+void AsyncClient::arm(Conn* conn, uint32_t events, int op) {
+    epoll_event ev{};
+    ev.events = events | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    epoll_ctl(epoll_, op, conn->fd, &ev);
+}
+
+void AsyncClient::onEvent(Conn* conn, uint32_t events) {
+    if (conn->h2) {
+        onSessionEvent(conn, events);
+        return;
+    }
+    // Anything on a parked connection means the server closed it
+    if (!conn->exchange) {
+        destroy(conn);
+        return;
+    }
+
+    if (conn->connecting) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+            finish(conn, httplib::Error::Connection);
+            return;
+        }
+        if (!(events & EPOLLOUT)) return;
+        conn->connecting = false;
+        if (!sendPending(conn)) {
+            finish(conn, httplib::Error::Write);
+            return;
+        }
+    } else if ((events & EPOLLOUT) && !sendPending(conn)) {
+        finish(conn, httplib::Error::Write);
+        return;
+    }
+
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) return;
+    bool finished = false;
+    if (!receive(conn, finished)) return;  // receive() has already failed the call
+    if (finished) finish(conn, httplib::Error::Success);
+}
+
+// Write what is left of the request, waiting for EPOLLOUT if the socket is full
+bool AsyncClient::sendPending(Conn* conn) {
+    const std::string& out = conn->exchange->request;
+    while (conn->sent < out.size()) {
+        ssize_t n = ::send(conn->fd, out.data() + conn->sent, out.size() - conn->sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->sent += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            arm(conn, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+            return true;
+        }
+        return false;
+    }
+    arm(conn, EPOLLIN, EPOLL_CTL_MOD);
+    return true;
+}
+
+// Read and parse whatever has arrived. False once the call has been failed
+// (or replayed); `finished` once the whole reply is in.
+bool AsyncClient::receive(Conn* conn, bool& finished) {
+    char buf[kReadChunk];
+    while (!finished) {
+        ssize_t n = recv(conn->fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            if (n == 0 && conn->phase == Conn::Phase::UntilClose) {
+                conn->keepAlive = false;
+                finished = true;
+                break;
+            }
+            // A pooled connection the server had already closed: try once
+            // more on a fresh one, as httplib::Client does
+            if (n == 0 && conn->reused && !conn->received && !conn->exchange->retried) {
+                auto exchange = std::move(conn->exchange);
+                exchange->retried = true;
+                destroy(conn);
+                start(std::move(exchange));
+                return false;
+            }
+            finish(conn, n == 0 ? httplib::Error::ConnectionClosed : httplib::Error::Read);
+            return false;
+        }
+        conn->received = true;
+        conn->in.append(buf, static_cast<size_t>(n));
+        if (conn->phase == Conn::Phase::Head && !parseHead(conn)) return false;
+        if (conn->phase != Conn::Phase::Head && !parseBody(conn, finished)) return false;
+        conn->in.erase(0, conn->pos);
+        conn->pos = 0;
+        if (static_cast<size_t>(n) < sizeof(buf)) break;
+    }
+    // Bytes past the end of the reply leave the connection in an unknown state
+    if (finished && conn->pos < conn->in.size()) conn->keepAlive = false;
+    return true;
+}
+
+bool AsyncClient::parseHead(Conn* conn) {
+    size_t end = conn->in.find("\r\n\r\n", conn->pos);
+    if (end == std::string::npos) {
+        if (conn->in.size() - conn->pos <= kMaxHeadBytes) return true;
+        finish(conn, httplib::Error::Read);
+        return false;
+    }
+
+    httplib::Response& res = *conn->res;
+    size_t lineEnd = conn->in.find("\r\n", conn->pos);
+    const std::string line = conn->in.substr(conn->pos, lineEnd - conn->pos);
+    size_t space = line.find(' ');
+    if (line.compare(0, 5, "HTTP/") != 0 || space == std::string::npos) {
+        finish(conn, httplib::Error::Read);
+        return false;
+    }
+    res.version = line.substr(0, space);
+    res.status = std::atoi(line.c_str() + space + 1);
+    size_t reason = line.find(' ', space + 1);
+    if (reason != std::string::npos) res.reason = line.substr(reason + 1);
+
+    for (size_t at = lineEnd + 2; at < end;) {
+        size_t next = conn->in.find("\r\n", at);
+        size_t colon = conn->in.find(':', at);
+        if (colon != std::string::npos && colon < next) {
+            res.headers.emplace(trim(conn->in, at, colon), trim(conn->in, colon + 1, next));
+        }
+        at = next + 2;
+    }
+    conn->pos = end + 4;
+
+    // The server takes h2c as well: later calls to it go over HTTP/2. The
+    // advertised port is not used; the same host:port is assumed to serve it.
+    if (http2_ && !h2Hosts_.count(conn->key) &&
+        res.get_header_value("Alt-Svc").find("h2c=") != std::string::npos) {
+        auto failed = h2Failed_.find(conn->key);
+        if (failed == h2Failed_.end() || Clock::now() >= failed->second) {
+            h2Hosts_.insert(conn->key);
+            if (failed != h2Failed_.end()) h2Failed_.erase(failed);
+        }
+    }
+
+    // Interim replies (100 Continue) come before the real one
+    if (res.status >= 100 && res.status < 200) {
+        conn->res = std::make_unique<httplib::Response>();
+        return parseHead(conn);
+    }
+
+    std::string connection = res.get_header_value("Connection");
+    conn->keepAlive = res.version == "HTTP/1.1" ? !iequals(connection, "close")
+                                                : iequals(connection, "keep-alive");
+    if (res.status == 204 || res.status == 304) {
+        conn->phase = Conn::Phase::Fixed;
+        conn->remaining = 0;
+    } else if (res.get_header_value("Transfer-Encoding").find("chunked") != std::string::npos) {
+        conn->phase = Conn::Phase::ChunkSize;
+    } else if (res.has_header("Content-Length")) {
+        conn->phase = Conn::Phase::Fixed;
+        conn->remaining = std::strtoull(res.get_header_value("Content-Length").c_str(), nullptr, 10);
+    } else {
+        conn->phase = Conn::Phase::UntilClose;
+        conn->keepAlive = false;
+    }
+    return true;
+}
+
+bool AsyncClient::parseBody(Conn* conn, bool& finished) {
+    std::string& in = conn->in;
+    while (!finished) {
+        size_t available = in.size() - conn->pos;
+        switch (conn->phase) {
+        case Conn::Phase::Fixed:
+        case Conn::Phase::ChunkData: {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(conn->remaining, available));
+            if (take > 0 && !deliver(conn, in.data() + conn->pos, take)) return false;
+            conn->pos += take;
+            conn->remaining -= take;
+            if (conn->remaining > 0) return true;
+            if (conn->phase == Conn::Phase::Fixed) {
+                finished = true;
+            } else {
+                conn->phase = Conn::Phase::ChunkEnd;
+            }
+            break;
+        }
+        case Conn::Phase::UntilClose:
+            if (available > 0 && !deliver(conn, in.data() + conn->pos, available)) return false;
+            conn->pos = in.size();
+            return true;
+        case Conn::Phase::ChunkEnd:
+            if (available < 2) return true;
+            conn->pos += 2;
+            conn->phase = Conn::Phase::ChunkSize;
+            break;
+        case Conn::Phase::ChunkSize:
+        case Conn::Phase::Trailer: {
+            size_t eol = in.find("\r\n", conn->pos);
+            if (eol == std::string::npos) return true;
+            if (conn->phase == Conn::Phase::Trailer) {
+                finished = eol == conn->pos;  // trailer fields are skipped
+            } else {
+                // Chunk extensions after ';' are ignored
+                conn->remaining = std::strtoull(in.c_str() + conn->pos, nullptr, 16);
+                conn->phase = conn->remaining == 0 ? Conn::Phase::Trailer : Conn::Phase::ChunkData;
+            }
+            conn->pos = eol + 2;
+            break;
+        }
+        case Conn::Phase::Head:
+            return true;
+        }
+    }
+    return true;
+}
+
+bool AsyncClient::deliver(Conn* conn, const char* data, size_t size) {
+    if (!conn->exchange->receiver) {
+        conn->res->body.append(data, size);
+        return true;
+    }
+    if (conn->exchange->receiver(data, size)) return true;
+    finish(conn, httplib::Error::Canceled);
+    return false;
+}
+
+void AsyncClient::finish(Conn* conn, httplib::Error error) {
+    auto exchange = std::move(conn->exchange);
+    auto res = std::move(conn->res);
+    bool ok = error == httplib::Error::Success;
+    if (ok && conn->keepAlive) {
+        release(conn);
+    } else {
+        destroy(conn);
+    }
+    exchange->done(httplib::Result(ok ? std::move(res) : nullptr, error));
+}
+
+// Park a connection for the next call to the same host:port
+void AsyncClient::release(Conn* conn) {
+    auto& parked = idle_[conn->key];
+    if (parked.size() >= idlePerHost_) {
+        destroy(conn);
+        return;
+    }
+    parked.push_back(conn);
+    arm(conn, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+void AsyncClient::destroy(Conn* conn) {
+    if (conn->h2) {
+        retireSession(conn);
+        sessionCount_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    auto parked = idle_.find(conn->key);
+    if (parked != idle_.end()) {
+        auto& list = parked->second;
+        list.erase(std::remove(list.begin(), list.end(), conn), list.end());
+    }
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    open_.fetch_sub(1, std::memory_order_relaxed);
+    conns_.erase(conn);
+}
+
+void AsyncClient::expire(Clock::time_point now) {
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+        auto fn = std::move(timers_.begin()->second);
+        timers_.erase(timers_.begin());
+        fn();
+    }
+    // Entries for calls that already finished are skipped: their connection
+    // is gone or has moved on to another exchange
+    while (!deadlines_.empty() && deadlines_.begin()->first <= now) {
+        auto [conn, id] = deadlines_.begin()->second;
+        deadlines_.erase(deadlines_.begin());
+        if (!conns_.count(conn)) continue;
+        if (!conn->h2) {
+            if (conn->exchange && conn->exchange->id == id) finish(conn, httplib::Error::Timeout);
+            continue;
+        }
+
+        // Cancel the stream and leave the connection to the others
+        Session& s = *conn->h2;
+        auto waiting = std::find_if(s.waiting.begin(), s.waiting.end(),
+                                    [id = id](const auto& exchange) { return exchange->id == id; });
+        if (waiting != s.waiting.end()) {
+            auto exchange = std::move(*waiting);
+            s.waiting.erase(waiting);
+            exchange->done(httplib::Result(nullptr, httplib::Error::Timeout));
+            continue;
+        }
+        auto stream = std::find_if(s.streams.begin(), s.streams.end(),
+                                   [id = id](const auto& entry) { return entry.second.exchange->id == id; });
+        if (stream == s.streams.end()) continue;
+        http2::appendRstStream(s.out, stream->first, http2::kCancel);
+        finishStream(conn, stream->first, httplib::Error::Timeout);
+        if (s.goingAway && s.streams.empty() && s.waiting.empty()) {
+            destroy(conn);
+        } else if (!conn->connecting && !flushSession(conn)) {
+            failSession(conn, httplib::Error::Write);
+        }
+    }
+}
+
+// The HTTP/2 connection new calls to this host:port go on, opened if need be
+AsyncClient::Conn* AsyncClient::session(const std::shared_ptr<Exchange>& exchange,
+                                        httplib::Error& error) {
+    auto open = sessions_.find(exchange->key);
+    if (open != sessions_.end()) {
+        reuses_.fetch_add(1, std::memory_order_relaxed);
+        return open->second;
+    }
+    Conn* conn = connect(exchange->key, exchange->host, exchange->port, error);
+    if (!conn) return nullptr;
+    conn->h2 = std::make_unique<Session>();
+    std::string& out = conn->h2->out;
+    out.assign(http2::kPreface, http2::kPrefaceSize);
+    http2::appendSettings(out, {{http2::kEnablePush, 0}, {http2::kInitialWindowSize, kStreamWindow}});
+    http2::appendWindowUpdate(out, 0, kConnectionWindow - http2::kDefaultWindow);
+    sessions_[exchange->key] = conn;
+    sessionCount_.fetch_add(1, std::memory_order_relaxed);
+    return conn;
+}
+
+// Queue the call's HEADERS, or the call itself while the server's stream
+// limit is reached; the caller sends what is queued
+void AsyncClient::openStream(Conn* conn, std::shared_ptr<Exchange> exchange) {
+    Session& s = *conn->h2;
+    if (s.streams.size() >= s.maxStreams) {
+        s.waiting.push_back(std::move(exchange));
+        return;
+    }
+    uint32_t id = s.nextStream;
+    s.nextStream += 2;
+    if (s.nextStream > 0x7fffffff) retireSession(conn);  // stream ids used up
+
+    http2::HeaderList headers{{":method", "GET"},
+                              {":scheme", "http"},
+                              {":authority", exchange->key},
+                              {":path", exchange->path}};
+    bool accept = false;
+    for (const auto& header : exchange->headers) {
+        std::string name = lower(header.first);
+        if (name == "host" || name == "connection" || name == "keep-alive" ||
+            name == "transfer-encoding" || name == "upgrade" || name == "proxy-connection") {
+            continue;
+        }
+        accept = accept || name == "accept";
+        headers.emplace_back(std::move(name), header.second);
+    }
+    if (!accept) headers.emplace_back("accept", "*/*");
+    std::string block;
+    s.encoder.encode(headers, block);
+    http2::appendHeaders(s.out, id, block, true, s.maxFrame);
+    s.streams[id].exchange = std::move(exchange);
+}
+
+void AsyncClient::onSessionEvent(Conn* conn, uint32_t events) {
+    if (conn->connecting) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+            failSession(conn, httplib::Error::Connection);
+            return;
+        }
+        if (!(events & EPOLLOUT)) return;
+        conn->connecting = false;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        Session& s = *conn->h2;
+        char buf[kReadChunk];
+        while (true) {
+            ssize_t n = recv(conn->fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                s.in.append(buf, static_cast<size_t>(n));
+                if (static_cast<size_t>(n) < sizeof(buf)) break;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            // Closed: what arrived before still counts
+            if (processFrames(conn)) {
+                failSession(conn, n == 0 ? httplib::Error::ConnectionClosed : httplib::Error::Read);
+            }
+            return;
+        }
+        if (!processFrames(conn)) return;
+    }
+    if (!flushSession(conn)) failSession(conn, httplib::Error::Write);
+}
+
+bool AsyncClient::flushSession(Conn* conn) {
+    std::string& out = conn->h2->out;
+    size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = ::send(conn->fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    out.erase(0, sent);
+    arm(conn, out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+    return true;
+}
+
+// Handle every whole frame buffered. False once the connection is gone,
+// failed or finished with.
+bool AsyncClient::processFrames(Conn* conn) {
+    Session& s = *conn->h2;
+    size_t pos = 0;
+    while (true) {
+        http2::Frame frame;
+        bool whole = http2::parseFrame(s.in.data() + pos, s.in.size() - pos, frame);
+        if (s.in.size() - pos >= http2::kFrameHeaderSize && frame.length > http2::kDefaultMaxFrame) {
+            failSession(conn, httplib::Error::Read);
+            return false;
+        }
+        if (!whole) break;
+        pos += http2::kFrameHeaderSize + frame.length;
+        if (s.blockStream != 0 &&
+            (frame.type != http2::FrameType::Continuation || frame.stream != s.blockStream)) {
+            failSession(conn, httplib::Error::Read);
+            return false;
+        }
+
+        switch (frame.type) {
+        case http2::FrameType::Settings: {
+            if (frame.flags & http2::flags::kAck) break;
+            for (size_t at = 0; at + 6 <= frame.length; at += 6) {
+                const char* p = frame.payload + at;
+                auto id = static_cast<uint16_t>((static_cast<uint8_t>(p[0]) << 8) |
+                                                static_cast<uint8_t>(p[1]));
+                uint32_t value = http2::readU32(p + 2);
+                if (id == http2::kMaxConcurrentStreams) s.maxStreams = value;
+                if (id == http2::kMaxFrameSize) s.maxFrame = std::min<size_t>(value, 1 << 20);
+                if (id == http2::kHeaderTableSize) s.encoder.setMaxTableSize(value);
+            }
+            http2::appendFrame(s.out, http2::FrameType::Settings, http2::flags::kAck, 0, "", 0);
+            s.settled = true;
+            while (!s.waiting.empty() && s.streams.size() < s.maxStreams && !s.goingAway) {
+                auto next = std::move(s.waiting.front());
+                s.waiting.pop_front();
+                openStream(conn, std::move(next));
+            }
+            break;
+        }
+        case http2::FrameType::Ping:
+            if (frame.length == 8 && !(frame.flags & http2::flags::kAck)) {
+                http2::appendFrame(s.out, http2::FrameType::Ping, http2::flags::kAck, 0, frame.payload, 8);
+            }
+            break;
+        case http2::FrameType::GoAway: {
+            if (frame.length < 8) break;
+            // Streams past the last one the server took were never seen by
+            // it, so they and the calls still waiting go to a new connection
+            uint32_t last = http2::readU32(frame.payload) & 0x7fffffff;
+            retireSession(conn);
+            std::vector<std::shared_ptr<Exchange>> unsent(s.waiting.begin(), s.waiting.end());
+            s.waiting.clear();
+            for (auto it = s.streams.begin(); it != s.streams.end();) {
+                if (it->first > last) {
+                    unsent.push_back(std::move(it->second.exchange));
+                    it = s.streams.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (auto& exchange : unsent) start(std::move(exchange));
+            break;
+        }
+        case http2::FrameType::RstStream: {
+            auto it = s.streams.find(frame.stream);
+            if (frame.length != 4 || it == s.streams.end()) break;
+            // A refused stream was not processed, so it can go again
+            if (http2::readU32(frame.payload) == http2::kRefusedStream && !it->second.exchange->retried) {
+                auto exchange = std::move(it->second.exchange);
+                s.streams.erase(it);
+                exchange->retried = true;
+                start(std::move(exchange));
+            } else {
+                finishStream(conn, frame.stream, httplib::Error::Read);
+            }
+            break;
+        }
+        case http2::FrameType::Headers:
+        case http2::FrameType::Continuation: {
+            if (frame.type == http2::FrameType::Headers) {
+                const char* data;
+                size_t size;
+                if (!http2::unpad(frame, data, size)) {
+                    failSession(conn, httplib::Error::Read);
+                    return false;
+                }
+                s.block.assign(data, size);
+                s.blockStream = frame.stream;
+                s.blockEndStream = frame.flags & http2::flags::kEndStream;
+            } else {
+                s.block.append(frame.payload, frame.length);
+            }
+            if (s.block.size() > kMaxHeadBytes) {
+                failSession(conn, httplib::Error::Read);
+                return false;
+            }
+            if ((frame.flags & http2::flags::kEndHeaders) && !onHeaderBlock(conn)) return false;
+            break;
+        }
+        case http2::FrameType::Data: {
+            const char* data;
+            size_t size;
+            if (!http2::unpad(frame, data, size)) {
+                failSession(conn, httplib::Error::Read);
+                return false;
+            }
+            s.unacked += frame.length;
+            if (s.unacked >= kConnectionWindow / 2) {
+                http2::appendWindowUpdate(s.out, 0, s.unacked);
+                s.unacked = 0;
+            }
+            auto it = s.streams.find(frame.stream);
+            if (it == s.streams.end()) break;  // cancelled already
+            Session::Stream& stream = it->second;
+            if (!stream.exchange->receiver) {
+                stream.res->body.append(data, size);
+            } else if (size > 0 && !stream.exchange->receiver(data, size)) {
+                http2::appendRstStream(s.out, frame.stream, http2::kCancel);
+                finishStream(conn, frame.stream, httplib::Error::Canceled);
+                break;
+            }
+            if (frame.flags & http2::flags::kEndStream) {
+                finishStream(conn, frame.stream, httplib::Error::Success);
+                break;
+            }
+            stream.unacked += frame.length;
+            if (stream.unacked >= kStreamWindow / 2) {
+                http2::appendWindowUpdate(s.out, frame.stream, stream.unacked);
+                stream.unacked = 0;
+            }
+            break;
+        }
+        case http2::FrameType::PushPromise:
+            failSession(conn, httplib::Error::Read);  // push was turned off in our SETTINGS
+            return false;
+        default:
+            break;  // WINDOW_UPDATE (we send no bodies), PRIORITY, unknown types
+        }
+    }
+    s.in.erase(0, pos);
+    if (s.goingAway && s.streams.empty() && s.waiting.empty()) {
+        destroy(conn);
+        return false;
+    }
+    return true;
+}
+
+bool AsyncClient::onHeaderBlock(Conn* conn) {
+    Session& s = *conn->h2;
+    uint32_t id = s.blockStream;
+    s.blockStream = 0;
+    http2::HeaderList fields;
+    bool decoded = s.decoder.decode(s.block.data(), s.block.size(), fields, kMaxHeadBytes);
+    s.block.clear();
+    if (!decoded) {
+        failSession(conn, httplib::Error::Read);
+        return false;
+    }
+
+    auto it = s.streams.find(id);
+    if (it == s.streams.end()) return true;
+    Session::Stream& stream = it->second;
+    if (!stream.answered) {
+        httplib::Response& res = *stream.res;
+        for (auto& [name, value] : fields) {
+            if (name == ":status") {
+                res.status = std::atoi(value.c_str());
+            } else if (name.empty() || name[0] != ':') {
+                res.headers.emplace(std::move(name), std::move(value));
+            }
+        }
+        // Interim replies (100 Continue) come before the real one
+        if (res.status >= 100 && res.status < 200) {
+            stream.res = std::make_unique<httplib::Response>();
+            return true;
+        }
+        res.version = "HTTP/2";
+        stream.answered = true;
+    }
+    // Trailers, if any, are dropped
+    if (s.blockEndStream) finishStream(conn, id, httplib::Error::Success);
+    return true;
+}
+
+// End one call; the stream it frees goes to the next call waiting for one
+void AsyncClient::finishStream(Conn* conn, uint32_t id, httplib::Error error) {
+    Session& s = *conn->h2;
+    auto it = s.streams.find(id);
+    if (it == s.streams.end()) return;
+    auto exchange = std::move(it->second.exchange);
+    auto res = std::move(it->second.res);
+    s.streams.erase(it);
+    if (!s.waiting.empty() && !s.goingAway) {
+        auto next = std::move(s.waiting.front());
+        s.waiting.pop_front();
+        openStream(conn, std::move(next));
+    }
+    bool ok = error == httplib::Error::Success;
+    exchange->done(httplib::Result(ok ? std::move(res) : nullptr, error));
+}
+
+// Take no new streams on this connection; those open run to completion
+void AsyncClient::retireSession(Conn* conn) {
+    conn->h2->goingAway = true;
+    auto current = sessions_.find(conn->key);
+    if (current != sessions_.end() && current->second == conn) sessions_.erase(current);
+}
+
+void AsyncClient::failSession(Conn* conn, httplib::Error error) {
+    Session& s = *conn->h2;
+    // Connected but never got the server's SETTINGS: it does not speak h2c
+    // after all, so the host goes back to HTTP/1.1 and every call on here is
+    // replayed there. A refused connect says nothing either way.
+    bool fallback = !s.settled && !conn->connecting;
+    if (fallback) {
+        h2Hosts_.erase(conn->key);
+        h2Failed_[conn->key] = Clock::now() + kHttp2Retry;
+    }
+    // Calls with no reply yet are tried once more on a fresh connection, as
+    // a stale HTTP/1.1 keep-alive connection's are
+    std::vector<std::shared_ptr<Exchange>> replay, failed;
+    auto sort = [&](std::shared_ptr<Exchange> exchange, bool answered) {
+        if (fallback || (!answered && !exchange->retried)) {
+            if (!fallback) exchange->retried = true;
+            replay.push_back(std::move(exchange));
+        } else {
+            failed.push_back(std::move(exchange));
+        }
+    };
+    for (auto& exchange : s.waiting) sort(std::move(exchange), false);
+    for (auto& entry : s.streams) sort(std::move(entry.second.exchange), entry.second.answered);
+    destroy(conn);
+    for (auto& exchange : replay) start(std::move(exchange));
+    for (auto& exchange : failed) exchange->done(httplib::Result(nullptr, error));
+}
+
+}  // namespace upstream
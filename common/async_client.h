@@ -0,0 +1,127 @@
+#pragma once
+
+#include "httplib.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Non-blocking HTTP/1.1 GETs multiplexed on one epoll thread.
+//
+// httplib::Client is synchronous: the calling thread sits in recv() for the
+// whole round trip, so a caller needs one thread per call in flight. Here
+// get() only queues the request; the loop thread connects, writes, and
+// parses the reply as it arrives, so that one thread carries any number of
+// calls at once. Keep-alive connections are pooled per host:port on the
+// loop and never shared between calls in progress. `done` runs on the loop
+// thread, once, with the response or an error, and must not block for long:
+// every other call on the loop waits while it runs.
+//
+// With `http2`, a host:port whose replies carry an Alt-Svc h2c
+// advertisement (EventServer with SERVER_HTTP2) gets its later calls as
+// streams on one cleartext HTTP/2 connection instead, as many at once as the
+// server allows. If that connection fails before the server has sent its
+// SETTINGS, the host goes back to HTTP/1.1 for a while.
+namespace upstream {
+
+struct AsyncRequest {
+    std::string path;
+    httplib::ContentReceiver receiver;  // body as it arrives; empty keeps it in res.body
+};
+
+class AsyncClient {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Done = std::function<void(httplib::Result)>;
+
+    // `idlePerHost` caps the keep-alive connections parked per host:port
+    AsyncClient(size_t idlePerHost, bool http2);
+    ~AsyncClient();
+
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    // Send GET `request.path` to host:port; fails with Error::Timeout if the
+    // reply has not fully arrived by `deadline`. `host` must be a numeric
+    // address (as EndpointSet hands out): names fail with Error::Connection
+    void get(const std::string& host, int port, AsyncRequest request, httplib::Headers headers,
+             Clock::time_point deadline, Done done);
+
+    // Run `fn` on the loop thread once `delay` has passed
+    void after(std::chrono::milliseconds delay, std::function<void()> fn);
+
+    size_t connections() const { return open_.load(std::memory_order_relaxed); }
+    size_t sessions() const { return sessionCount_.load(std::memory_order_relaxed); }
+    uint64_t connects() const { return connects_.load(std::memory_order_relaxed); }
+    uint64_t reuses() const { return reuses_.load(std::memory_order_relaxed); }
+
+private:
+    struct Exchange;
+    struct Conn;
+    struct Session;
+
+    void run();
+    void wake();
+    void post(std::function<void()> fn);
+
+    // Loop thread only
+    void start(std::shared_ptr<Exchange> exchange);
+    Conn* connect(const std::string& key, const std::string& host, int port, httplib::Error& error);
+    void arm(Conn* conn, uint32_t events, int op);
+    void onEvent(Conn* conn, uint32_t events);
+    bool sendPending(Conn* conn);
+    bool receive(Conn* conn, bool& finished);
+    bool parseHead(Conn* conn);
+    bool parseBody(Conn* conn, bool& finished);
+    bool deliver(Conn* conn, const char* data, size_t size);
+    void finish(Conn* conn, httplib::Error error);
+    void release(Conn* conn);
+    void destroy(Conn* conn);
+    void expire(Clock::time_point now);
+
+    // HTTP/2 connections (loop thread only)
+    Conn* session(const std::shared_ptr<Exchange>& exchange, httplib::Error& error);
+    void openStream(Conn* conn, std::shared_ptr<Exchange> exchange);
+    void onSessionEvent(Conn* conn, uint32_t events);
+    bool flushSession(Conn* conn);
+    bool processFrames(Conn* conn);
+    bool onHeaderBlock(Conn* conn);
+    void finishStream(Conn* conn, uint32_t id, httplib::Error error);
+    void retireSession(Conn* conn);
+    void failSession(Conn* conn, httplib::Error error);
+
+    const size_t idlePerHost_;
+    const bool http2_;
+    const int epoll_;
+    const int wake_;
+
+    std::mutex mutex_;
+    std::vector<std::function<void()>> queued_;
+    std::atomic<bool> stopping_{false};
+
+    // Owned by the loop thread
+    std::unordered_map<Conn*, std::unique_ptr<Conn>> conns_;
+    std::unordered_map<std::string, std::vector<Conn*>> idle_;
+    std::multimap<Clock::time_point, std::function<void()>> timers_;
+    std::multimap<Clock::time_point, std::pair<Conn*, uint64_t>> deadlines_;
+    uint64_t nextExchange_ = 0;
+    std::unordered_set<std::string> h2Hosts_;  // advertised h2c
+    std::unordered_map<std::string, Clock::time_point> h2Failed_;  // not retried until then
+    std::unordered_map<std::string, Conn*> sessions_;  // taking new streams, per host:port
+
+    std::atomic<size_t> open_{0};
+    std::atomic<size_t> sessionCount_{0};
+    std::atomic<uint64_t> connects_{0};
+    std::atomic<uint64_t> reuses_{0};
+    std::thread loop_;
+};
+
+}  // namespace upstream
@@ -0,0 +1,32 @@
+# Build settings shared by common/ and the service Makefiles, which all
+# include this file from one directory below the repo root.
+#
+# The service code and common/ are compiled against the declaration half of
+# httplib (common/build/include/httplib.h, generated by common/Makefile), and
+# the implementation half is compiled once into libcommon.a together with the
+# shared runtime in common/*.cpp, so each service TU no longer recompiles the
+# whole of httplib.
+CXX = g++
+AR = gcc-ar
+CXXFLAGS = -std=c++17 -Wall -I../common/build/include -I.. -pthread
+
+COMMON_DIR = ../common
+COMMON_HEADERS = $(wildcard $(COMMON_DIR)/*.h)
+COMMON_LIB = $(COMMON_DIR)/build/debug/libcommon.a
+COMMON_RELEASE_LIB = $(COMMON_DIR)/build/release/libcommon.a
+
+# Release profile: -O3 with LTO, statically linked and stripped. MARCH sets
+# the baseline CPU (the SIMD kernels still pick AVX2/SSE4.1 at runtime). The
+# stack-size note raises musl's 128KiB default thread stack in the images.
+MARCH ?= $(if $(filter x86_64,$(shell uname -m)),x86-64-v2,native)
+RELEASE_FLAGS = -O3 -march=$(MARCH) -flto=auto -DNDEBUG
+RELEASE_LDFLAGS = -static -s -Wl,-z,stack-size=1048576
+
+# Profile-guided optimisation, selected with PGO=generate or PGO=use. Each
+# directory keeps its own profiles; libcommon's are written by all three
+# instrumented services and so merge their traffic.
+PGO ?=
+PROFILE_DIR ?= $(CURDIR)/pgo
+PGO_FLAGS_generate = -fprofile-generate=$(PROFILE_DIR) -fprofile-update=atomic
+PGO_FLAGS_use = -fprofile-use=$(PROFILE_DIR) -fprofile-partial-training
+PGO_FLAGS = $(PGO_FLAGS_$(PGO))
@@ -0,0 +1,18 @@
+#include "config.h"
+#include <cstdlib>  // for getenv
+
+std::string getEnv(const char* name, const std::string& defaultValue) {
+    const char* value = std::getenv(name);
+    return value ? std::string(value) : defaultValue;
+}
+
+int getEnvInt(const char* name, int defaultValue) {
+    std::string value = getEnv(name, "");
+    return value.empty() ? defaultValue : std::stoi(value);
+}
+
+bool getEnvBool(const char* name, bool defaultValue) {
+    std::string value = getEnv(name, "");
+    if (value.empty()) return defaultValue;
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
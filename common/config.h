@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+// Helper function to get env var with default
+std::string getEnv(const char* name, const std::string& defaultValue);
+
+int getEnvInt(const char* name, int defaultValue);
+
+bool getEnvBool(const char* name, bool defaultValue);
@@ -0,0 +1,111 @@
+#include "endpoint_set.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+
+EndpointSet::EndpointSet(std::string host, std::string discoveryHost, int port,
+                         size_t capacity, std::chrono::seconds refresh)
+    : host_(std::move(host)),
+      discoveryHost_(std::move(discoveryHost)),
+      port_(port),
+      capacity_(capacity),
+      refresh_(std::max(refresh, std::chrono::seconds(1))) {
+    // An IPv4 literal needs no resolving and is never refreshed
+    in_addr literal{};
+    bool numeric = discoveryHost_.empty() && inet_pton(AF_INET, host_.c_str(), &literal) == 1;
+
+    List initial;
+    if (!numeric) {
+        for (const std::string& address : lookup()) {
+            initial.push_back(std::make_shared<Endpoint>(address, port_, capacity_));
+        }
+        if (initial.empty()) {
+            // Until it resolves, only synchronous calls get through
+            LOG_WARN << "No endpoints resolved for " << source() << ", using " << host_;
+        }
+    }
+    if (initial.empty()) initial.push_back(std::make_shared<Endpoint>(host_, port_, capacity_));
+    std::atomic_store(&endpoints_, std::make_shared<const List>(std::move(initial)));
+
+    if (!numeric) {
+        refresher_ = std::thread([this] { run(); });
+    }
+}
+
+EndpointSet::~EndpointSet() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (refresher_.joinable()) refresher_.join();
+}
+
+std::string EndpointSet::describe() const {
+    if (discoveryHost_.empty()) return host_ + ":" + std::to_string(port_);
+    return discoveryHost_ + ":" + std::to_string(port_) + " (" + std::to_string(size()) +
+           " endpoints, refresh " + std::to_string(refresh_.count()) + "s)";
+}
+
+std::vector<std::string> EndpointSet::resolve(const std::string& name) {
+    std::vector<std::string> addresses;
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(name.c_str(), nullptr, &hints, &result) != 0) return addresses;
+    for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+        char text[INET_ADDRSTRLEN];
+        auto* in = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+        if (inet_ntop(AF_INET, &in->sin_addr, text, sizeof(text))) addresses.push_back(text);
+    }
+    freeaddrinfo(result);
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+    return addresses;
+}
+
+std::vector<std::string> EndpointSet::lookup() const {
+    std::vector<std::string> addresses = resolve(source());
+    if (discoveryHost_.empty() && addresses.size() > 1) addresses.resize(1);
+    return addresses;
+}
+
+void EndpointSet::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, refresh_, [this] { return stopping_; })) {
+        lock.unlock();
+        update(lookup());
+        lock.lock();
+    }
+}
+
+void EndpointSet::update(const std::vector<std::string>& addresses) {
+    if (addresses.empty()) {
+        LOG_WARN << "No endpoints resolved for " << source() << ", keeping " << size();
+        return;
+    }
+
+    std::shared_ptr<const List> current = snapshot();
+    List next;
+    for (const std::string& address : addresses) {
+        auto existing = std::find_if(current->begin(), current->end(),
+                                     [&](const auto& e) { return e->address() == address; });
+        next.push_back(existing != current->end()
+                           ? *existing
+                           : std::make_shared<Endpoint>(address, port_, capacity_));
+    }
+
+    bool changed = next.size() != current->size() ||
+                   !std::equal(next.begin(), next.end(), current->begin());
+    if (!changed) return;
+    LOG_INFO << "Endpoints for " << source() << ": " << current->size() << " -> "
+             << next.size();
+    for (const auto& e : *current) {
+        if (std::find(next.begin(), next.end(), e) != next.end()) continue;
+        retiredHits_ += e->pool().hits();
+        retiredMisses_ += e->pool().misses();
+    }
+    // Removed pods stay alive until their last outstanding lease is returned
+    std::atomic_store(&endpoints_, std::make_shared<const List>(std::move(next)));
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "upstream_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Client-side load balancing across the pods behind a Service.
+//
+// Dialling the ClusterIP name lets kube-proxy pick a pod once per TCP
+// connection, and with keep-alive that choice sticks, so extra replicas sit
+// idle. Given the name of a headless Service, this resolves the pod
+// addresses directly, keeps a connection pool per pod and re-resolves every
+// few seconds so scaled or rescheduled pods are picked up. Each call goes to
+// the cheaper of two randomly chosen pods (power of two choices), where the
+// cost is the pod's latency EWMA scaled by its outstanding calls; that keeps
+// load even without any shared state between callers and steers away from
+// slow or failing pods. Without a discovery name it is a single pool on the
+// Service name, as before. Either way endpoints are numeric addresses
+// wherever the name resolves: a plain host name is resolved here, at
+// construction and then on the refresher thread, so AsyncClient can connect
+// without ever waiting on DNS from its loop.
+class EndpointSet {
+public:
+    class Endpoint {
+    public:
+        Endpoint(std::string address, int port, size_t capacity)
+            : address_(std::move(address)), pool_(address_, port, capacity) {}
+
+        Endpoint(const Endpoint&) = delete;
+        Endpoint& operator=(const Endpoint&) = delete;
+
+        // Counts one outstanding call until done(success) or scope exit
+        class Load {
+        public:
+            explicit Load(Endpoint& e) : e_(e), start_(std::chrono::steady_clock::now()) {
+                e_.inFlight_.fetch_add(1, std::memory_order_relaxed);
+            }
+            ~Load() { if (!finished_) done(false); }
+
+            Load(const Load&) = delete;
+            Load& operator=(const Load&) = delete;
+
+            void done(bool success) {
+                finished_ = true;
+                e_.inFlight_.fetch_sub(1, std::memory_order_relaxed);
+                e_.observe(std::chrono::steady_clock::now() - start_, success);
+            }
+
+        private:
+            Endpoint& e_;
+            std::chrono::steady_clock::time_point start_;
+            bool finished_ = false;
+        };
+
+        Load track() { return Load(*this); }
+
+        UpstreamPool& pool() { return pool_; }
+        const UpstreamPool& pool() const { return pool_; }
+        const std::string& address() const { return address_; }
+        int inFlight() const { return inFlight_.load(std::memory_order_relaxed); }
+        double latencyMs() const { return latencyNs_.load(std::memory_order_relaxed) / 1e6; }
+
+        // Expected wait for one more call; pods not yet measured cost nothing
+        double cost() const {
+            return static_cast<double>(latencyNs_.load(std::memory_order_relaxed)) *
+                   (inFlight() + 1);
+        }
+
+    private:
+        void observe(std::chrono::steady_clock::duration elapsed, bool success) {
+            int64_t sample = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            // A failure is scored as a slow call so the pod loses traffic quickly
+            if (!success) sample = std::max<int64_t>(sample * 4, 50'000'000);
+            int64_t current = latencyNs_.load(std::memory_order_relaxed);
+            int64_t next = current == 0 ? sample : current + (sample - current) / 4;
+            latencyNs_.store(next, std::memory_order_relaxed);
+        }
+
+        const std::string address_;
+        UpstreamPool pool_;
+        std::atomic<int> inFlight_{0};
+        std::atomic<int64_t> latencyNs_{0};
+    };
+
+    using List = std::vector<std::shared_ptr<Endpoint>>;
+
+    // `discoveryHost` is the headless Service to resolve; empty dials `host`
+    EndpointSet(std::string host, std::string discoveryHost, int port, size_t capacity,
+                std::chrono::seconds refresh);
+
+    EndpointSet(const EndpointSet&) = delete;
+    EndpointSet& operator=(const EndpointSet&) = delete;
+
+    ~EndpointSet();
+
+    // Power of two choices over the current endpoints
+    std::shared_ptr<Endpoint> pick() const {
+        std::shared_ptr<const List> list = snapshot();
+        if (list->size() == 1) return list->front();
+
+        thread_local std::minstd_rand rng(std::random_device{}());
+        size_t a = rng() % list->size();
+        size_t b = rng() % (list->size() - 1);
+        if (b >= a) ++b;
+        const auto& first = (*list)[a];
+        const auto& second = (*list)[b];
+        return first->cost() <= second->cost() ? first : second;
+    }
+
+    std::shared_ptr<const List> snapshot() const { return std::atomic_load(&endpoints_); }
+
+    size_t size() const { return snapshot()->size(); }
+    int port() const { return port_; }
+    bool discovering() const { return !discoveryHost_.empty(); }
+
+    // Where endpoints come from, for startup banners
+    std::string describe() const;
+
+    // Pool statistics summed over all endpoints
+    size_t capacity() const { return sum([](const Endpoint& e) { return e.pool().capacity(); }); }
+    size_t idle() const { return sum([](const Endpoint& e) { return e.pool().idle(); }); }
+    // Counts from removed pods are kept so the totals never go backwards
+    uint64_t hits() const {
+        return retiredHits_.load() + sum([](const Endpoint& e) { return e.pool().hits(); });
+    }
+    uint64_t misses() const {
+        return retiredMisses_.load() + sum([](const Endpoint& e) { return e.pool().misses(); });
+    }
+
+private:
+    template <typename Fn>
+    uint64_t sum(Fn&& field) const {
+        uint64_t total = 0;
+        for (const auto& e : *snapshot()) total += field(*e);
+        return total;
+    }
+
+    // IPv4 addresses behind a DNS name, sorted; empty if it does not resolve
+    static std::vector<std::string> resolve(const std::string& name);
+
+    // What to dial: every pod behind the discovery name, or the first
+    // address of a plain host
+    std::vector<std::string> lookup() const;
+
+    // The name endpoints are resolved from
+    const std::string& source() const { return discoveryHost_.empty() ? host_ : discoveryHost_; }
+
+    void run();
+
+    // Swap in the new address set, keeping pools (and their warm
+    // connections) for pods that are still there
+    void update(const std::vector<std::string>& addresses);
+
+    const std::string host_;
+    const std::string discoveryHost_;
+    const int port_;
+    const size_t capacity_;
+    const std::chrono::seconds refresh_;
+
+    std::shared_ptr<const List> endpoints_;
+    std::atomic<uint64_t> retiredHits_{0};
+    std::atomic<uint64_t> retiredMisses_{0};
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread refresher_;
+};
@@ -0,0 +1,1555 @@
+#include "event_server.h"
+#include "http2.h"
+#include "logger.h"
+#include "server_options.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A request head that has not ended by this size is not one we serve
+constexpr size_t kMaxHeadBytes = 64 * 1024;
+constexpr size_t kReadChunk = 16 * 1024;
+
+// What we announce to HTTP/2 clients: streams in progress per connection,
+// and the window for request bodies, per stream and for the connection
+constexpr uint32_t kMaxStreams = 256;
+constexpr uint32_t kRequestWindow = 1 << 20;
+// Largest DATA frame we send, whatever the client allows
+constexpr size_t kMaxDataFrame = 256 * 1024;
+// Output a connection may have unsent before its workers wait for it
+constexpr size_t kMaxQueuedOut = 1 << 20;
+
+// Sentinel epoll tags; every other tag is a Connection
+char listenTag;
+
+bool waitFor(int fd, short events, int timeoutMs) {
+    pollfd p{fd, events, 0};
+    int ready;
+    do {
+        ready = poll(&p, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0 && !(p.revents & (POLLERR | POLLNVAL));
+}
+
+std::string numericHost(const sockaddr_storage& addr, socklen_t len, int& port) {
+    char host[NI_MAXHOST] = "";
+    char service[NI_MAXSERV] = "";
+    if (getnameinfo(reinterpret_cast<const sockaddr*>(&addr), len, host, sizeof(host), service,
+                    sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        port = 0;
+        return "";
+    }
+    port = std::atoi(service);
+    return host;
+}
+
+int openListener(const std::string& host, int port, int backlog) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) return -1;
+
+    int fd = -1;
+    for (addrinfo* ai = result; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        // The same reuse option as httplib's listener, so either backend can
+        // rebind a port the other left connections in TIME_WAIT on
+        httplib::default_socket_options(fd);
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 ||
+            listen(fd, backlog > 0 ? backlog : SOMAXCONN) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+bool isToken(const std::string& s, bool lower) {
+    if (s.empty()) return false;
+    for (unsigned char c : s) {
+        if (c == 0 || (std::isalnum(c) ? lower && std::isupper(c) : !std::strchr("!#$%&'*+-.^_`|~", c))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The HTTP/1.1 request an HTTP/2 one stands for; false if it is malformed
+// (RFC 7540 8.1.2) or holds anything that would not survive being written
+// out as an HTTP/1.1 head, such as a line break in a value
+bool toHttp1(const http2::HeaderList& headers, const std::string& body, std::string& out, bool& head) {
+    std::string method, path, authority, fields;
+    bool regular = false;
+    bool hasLength = false;
+    for (const auto& [name, value] : headers) {
+        if (value.find_first_of(std::string("\r\n\0", 3)) != std::string::npos) return false;
+        if (!name.empty() && name[0] == ':') {
+            if (regular) return false;  // pseudo-headers come first
+            if (name == ":method") {
+                method = value;
+            } else if (name == ":path") {
+                path = value;
+            } else if (name == ":authority") {
+                authority = value;
+            } else if (name != ":scheme") {
+                return false;
+            }
+            continue;
+        }
+        regular = true;
+        if (!isToken(name, true) || name == "connection" || name == "keep-alive" ||
+            name == "proxy-connection" || name == "transfer-encoding" || name == "upgrade") {
+            return false;
+        }
+        if (name == "te" || (name == "host" && !authority.empty())) continue;
+        if (name == "content-length") {
+            if (value != std::to_string(body.size())) return false;
+            hasLength = true;
+        }
+        fields += name;
+        fields += ": ";
+        fields += value;
+        fields += "\r\n";
+    }
+    if (!isToken(method, false) || path.empty()) return false;
+    for (unsigned char c : path) {
+        if (c <= ' ' || c == 0x7f) return false;
+    }
+
+    out.reserve(method.size() + path.size() + authority.size() + fields.size() + body.size() + 64);
+    out = method + " " + path + " HTTP/1.1\r\n";
+    if (!authority.empty()) out += "Host: " + authority + "\r\n";
+    out += fields;
+    if (!hasLength && !body.empty()) out += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    out += "\r\n";
+    out += body;
+    head = method == "HEAD";
+    return true;
+}
+
+std::string trimmed(const std::string& s, size_t begin, size_t end) {
+    while (begin < end && (s[begin] == ' ' || s[begin] == '\t')) ++begin;
+    while (end > begin && (s[end - 1] == ' ' || s[end - 1] == '\t')) --end;
+    return s.substr(begin, end - begin);
+}
+
+}  // namespace
+
+// A request await() can park: the one in progress on an HTTP/1.1
+// connection, or an HTTP/2 stream. Holds the values answered so far, how
+// many this pass has taken, and the hand-off between the worker leaving a
+// suspended pass and `done` (whichever is second resumes).
+class EventServer::Exchange {
+public:
+    explicit Exchange(EventServer& server) : server_(server) {}
+    virtual ~Exchange() = default;
+
+    EventServer& server() const { return server_; }
+
+    // Whether the request can still be read again from the start
+    virtual bool rewindable() const = 0;
+    // Serve the request again, now that its await() has a value
+    virtual void resume() = 0;
+
+    Clock::time_point arrived;
+    uint64_t id = 0;  // from requestId(); 0 until asked for
+    std::vector<std::shared_ptr<void>> results;
+    size_t cursor = 0;
+    bool suspended = false;
+    bool resuming = false;
+    std::shared_ptr<void> resumeValue;
+    std::atomic<int> parkRefs{0};
+
+private:
+    EventServer& server_;
+};
+
+// One accepted socket. The reactor reads into `in_` until a request head is
+// complete; the worker then reads the request back out through the Stream
+// interface httplib's request processing expects, falling back to the socket
+// for a body that had not fully arrived. A request still wholly in `in_` can
+// be read again from the start, which is what resuming after await() does.
+// A connection that opens with the HTTP/2 preface is handed to a Session
+// instead, and from then on only carries its socket and addresses.
+class EventServer::Connection final : public httplib::Stream, public Exchange {
+public:
+    Connection(int fd, Reactor* reactor, EventServer& server, int readTimeoutMs, int writeTimeoutMs)
+        : Exchange(server),
+          fd_(fd),
+          reactor_(reactor),
+          readTimeoutMs_(readTimeoutMs),
+          writeTimeoutMs_(writeTimeoutMs) {}
+
+    ~Connection() override;
+
+    int fd() const { return fd_; }
+    Reactor* reactor() const { return reactor_; }
+
+    // Reactor side: take whatever has arrived without blocking; false once
+    // the peer has closed or the socket failed
+    bool receive() {
+        char buf[kReadChunk];
+        while (true) {
+            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+            if (n > 0) {
+                in_.append(buf, static_cast<size_t>(n));
+                if (static_cast<size_t>(n) < sizeof(buf)) return true;
+                continue;
+            }
+            if (n == 0) return false;
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+
+    bool headComplete() const { return in_.find("\r\n\r\n", pos_) != std::string::npos; }
+    size_t buffered() const { return in_.size() - pos_; }
+
+    // How much of the HTTP/2 connection preface the buffer starts with
+    enum class Preface { None, Partial, Full };
+    Preface preface() const {
+        size_t n = std::min(buffered(), http2::kPrefaceSize);
+        if (n == 0 || in_.compare(pos_, n, http2::kPreface, n) != 0) return Preface::None;
+        return n == http2::kPrefaceSize ? Preface::Full : Preface::Partial;
+    }
+
+    // What arrived after the preface, for the Session taking over
+    std::string takeFrames() {
+        std::string frames = in_.substr(pos_ + http2::kPrefaceSize);
+        in_.clear();
+        pos_ = 0;
+        return frames;
+    }
+
+    void compact() {
+        in_.erase(0, pos_);
+        pos_ = 0;
+    }
+
+    // Mark where the next request starts, for rewind()
+    void startRequest() {
+        requestStart_ = pos_;
+        rewindable_ = true;
+        results.clear();
+        arrived = Clock::now();
+        id = 0;
+    }
+
+    bool rewindable() const override { return rewindable_; }
+    void rewind() { pos_ = requestStart_; }
+    void resume() override { server().dispatch(this); }
+
+    // Hold back the next response's first write (httplib's status line and
+    // headers) so it goes out in one packet with the body
+    void beginResponse() { holdNext_ = true; }
+
+    // Drop what a suspended pass wrote
+    void discard() {
+        holdNext_ = false;
+        held_.clear();
+    }
+
+    bool flush() {
+        holdNext_ = false;
+        if (held_.empty()) return true;
+        iovec iov{held_.data(), held_.size()};
+        bool ok = sendAll(&iov, 1);
+        held_.clear();
+        return ok;
+    }
+
+    bool is_readable() const override { return pos_ < in_.size(); }
+
+    bool wait_readable() const override {
+        return is_readable() || waitFor(fd_, POLLIN, readTimeoutMs_);
+    }
+
+    bool wait_writable() const override { return waitFor(fd_, POLLOUT, writeTimeoutMs_); }
+
+    ssize_t read(char* ptr, size_t size) override {
+        if (pos_ == in_.size()) {
+            in_.clear();
+            pos_ = 0;
+            rewindable_ = false;
+            char buf[kReadChunk];
+            ssize_t n;
+            do {
+                if (!waitFor(fd_, POLLIN, readTimeoutMs_)) {
+                    error_ = httplib::Error::Timeout;
+                    return -1;
+                }
+                n = recv(fd_, buf, sizeof(buf), 0);
+            } while (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK));
+            if (n <= 0) {
+                error_ = n == 0 ? httplib::Error::ConnectionClosed : httplib::Error::Read;
+                return n;
+            }
+            in_.append(buf, static_cast<size_t>(n));
+        }
+        size_t n = std::min(size, in_.size() - pos_);
+        std::memcpy(ptr, in_.data() + pos_, n);
+        pos_ += n;
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t write(const char* ptr, size_t size) override {
+        if (suspended) return static_cast<ssize_t>(size);
+        if (holdNext_) {
+            held_.assign(ptr, size);
+            holdNext_ = false;
+            return static_cast<ssize_t>(size);
+        }
+        iovec iov[2] = {{held_.data(), held_.size()}, {const_cast<char*>(ptr), size}};
+        bool ok = held_.empty() ? sendAll(iov + 1, 1) : sendAll(iov, 2);
+        held_.clear();
+        if (!ok) {
+            error_ = httplib::Error::Write;
+            return -1;
+        }
+        return static_cast<ssize_t>(size);
+    }
+
+    void get_remote_ip_and_port(std::string& ip, int& port) const override {
+        ip = remoteAddr;
+        port = remotePort;
+    }
+
+    void get_local_ip_and_port(std::string& ip, int& port) const override {
+        ip = localAddr;
+        port = localPort;
+    }
+
+    socket_t socket() const override { return fd_; }
+    time_t duration() const override { return 0; }
+
+    std::string remoteAddr;
+    int remotePort = 0;
+    std::string localAddr;
+    int localPort = 0;
+    size_t served = 0;
+
+    // Set by whoever last had the connection before it went back to epoll;
+    // read by the reactor's idle sweep
+    Clock::time_point lastActive = Clock::now();
+    std::atomic<bool> idle{true};
+
+    // Set once the connection has turned out to be HTTP/2; reactor only
+    std::shared_ptr<Session> h2;
+
+private:
+    // The socket is non-blocking; wait out a full send buffer up to the
+    // write timeout
+    bool sendAll(iovec* iov, int count) {
+        while (count > 0) {
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = static_cast<size_t>(count);
+            ssize_t n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+                    waitFor(fd_, POLLOUT, writeTimeoutMs_)) {
+                    continue;
+                }
+                return false;
+            }
+            auto sent = static_cast<size_t>(n);
+            while (count > 0 && sent >= iov->iov_len) {
+                sent -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+                iov->iov_len -= sent;
+            }
+        }
+        return true;
+    }
+
+    const int fd_;
+    Reactor* const reactor_;
+    const int readTimeoutMs_;
+    const int writeTimeoutMs_;
+    std::string in_;
+    size_t pos_ = 0;
+    std::string held_;
+    bool holdNext_ = false;
+    size_t requestStart_ = 0;
+    bool rewindable_ = false;
+};
+
+// The HTTP/2 side of a connection that opened with the h2c preface. The
+// reactor keeps reading it while its streams are in progress, parses the
+// frames and hands each complete request to a worker as an Http2Stream;
+// workers send their responses back through here. Nothing here blocks the
+// reactor: frames queue in `out_`, what the socket does not take at once
+// goes out when it turns writable, and it is the workers that wait, on
+// flow-control windows and on a full queue. `mutex_` guards all of it but
+// `in_` and the decoder, which only the reactor touches.
+class EventServer::Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(EventServer& server, Connection* conn);
+
+    // Reactor side: start on what followed the preface, then take each
+    // event; false once the connection should be closed
+    bool start(std::string frames);
+    bool onEvent(uint32_t events);
+    bool expired(Clock::time_point now, std::chrono::milliseconds idleLimit);
+
+    // The connection is closing; the socket must not be touched again
+    void abandon();
+
+    // Worker side, for one stream's response. False once the stream has
+    // been reset or the connection has gone. Headers can be held back to
+    // go out with the first DATA frame, as HTTP/1.1 holds its head.
+    bool sendHeaders(uint32_t id, const http2::HeaderList& headers, bool endStream, bool flush);
+    bool sendData(uint32_t id, const char* data, size_t size, bool endStream);
+    bool writable(uint32_t id);
+
+    // The stream's handler is done with it; an incomplete response is
+    // reset. `goAway` asks the client to move to another connection.
+    void finish(uint32_t id, bool complete, bool goAway);
+
+    int fd() const { return fd_; }
+
+private:
+    struct StreamState {
+        http2::HeaderList headers;
+        std::string body;
+        int64_t window = 0;  // what this stream may still send
+        bool headersDone = false;
+        bool dispatched = false;
+        bool reset = false;
+    };
+
+    bool receive();
+    bool process();
+    bool onSettings(const http2::Frame& frame);
+    bool onHeaders(const http2::Frame& frame);
+    bool onHeaderBlock();
+    bool onData(const http2::Frame& frame);
+    bool onWindowUpdate(const http2::Frame& frame);
+    void onRequest(uint32_t id, StreamState& stream);
+    bool fail(uint32_t code);
+    void reset(uint32_t id, uint32_t code);
+    void flushLocked();
+    bool finishedLocked() const;
+
+    EventServer& server_;
+    Connection* conn_;  // null once abandoned
+    const int fd_;
+    const std::string remoteAddr_;
+    const int remotePort_;
+    const std::string localAddr_;
+    const int localPort_;
+
+    // Reactor only
+    std::string in_;
+    http2::Decoder decoder_;
+    std::string block_;  // header block being collected across CONTINUATION frames
+    uint32_t blockStream_ = 0;
+    bool blockEndStream_ = false;
+    bool blockRefused_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::string out_;
+    size_t outPos_ = 0;
+    bool watchingOut_ = false;
+    http2::Encoder encoder_;
+    std::unordered_map<uint32_t, StreamState> streams_;
+    uint32_t lastStream_ = 0;
+    size_t opened_ = 0;
+    int64_t window_ = http2::kDefaultWindow;  // connection-level send window
+    int64_t peerInitialWindow_ = http2::kDefaultWindow;
+    size_t peerMaxFrame_ = http2::kDefaultMaxFrame;
+    bool goingAway_ = false;   // GOAWAY sent; no new streams
+    bool peerGoingAway_ = false;
+    bool fatal_ = false;       // a connection error; close once GOAWAY is out
+    bool closed_ = false;
+    Clock::time_point lastActive_ = Clock::now();
+};
+
+// One HTTP/2 request, presented to httplib's request processing as the
+// HTTP/1.1 message it is equivalent to. The response httplib writes back
+// is read the other way: its head becomes a HEADERS frame and its body,
+// fixed-length or chunked, DATA frames. The request is always wholly in
+// memory, so an await() can always park the stream.
+class EventServer::Http2Stream final : public httplib::Stream,
+                                       public Exchange,
+                                       public std::enable_shared_from_this<Http2Stream> {
+public:
+    Http2Stream(EventServer& server, std::shared_ptr<Session> session, uint32_t id, std::string request,
+                bool head, const std::string& remoteAddr, int remotePort, const std::string& localAddr,
+                int localPort)
+        : Exchange(server),
+          remoteAddr(remoteAddr),
+          remotePort(remotePort),
+          localAddr(localAddr),
+          localPort(localPort),
+          session_(std::move(session)),
+          id_(id),
+          request_(std::move(request)),
+          headRequest_(head) {}
+
+    void startRequest() {
+        pos_ = 0;
+        results.clear();
+        arrived = Clock::now();
+        id = 0;
+    }
+
+    void rewind() { pos_ = 0; }
+    bool rewindable() const override { return true; }
+
+    // Keeps the stream alive while it is parked, with no worker holding it
+    void park() { self_ = shared_from_this(); }
+    void resume() override {
+        std::shared_ptr<Http2Stream> self = std::move(self_);
+        if (!server().dispatchStream(self)) session_->finish(id_, false, false);
+    }
+
+    // After the handler: end the stream, or reset it if the response did
+    // not get written out whole
+    void finish();
+
+    bool is_readable() const override { return pos_ < request_.size(); }
+    bool wait_readable() const override { return is_readable(); }
+    bool wait_writable() const override { return session_->writable(id_); }
+
+    ssize_t read(char* ptr, size_t size) override {
+        size_t n = std::min(size, request_.size() - pos_);
+        std::memcpy(ptr, request_.data() + pos_, n);
+        pos_ += n;
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t write(const char* ptr, size_t size) override {
+        if (suspended) return static_cast<ssize_t>(size);
+        if (failed_ || !(phase_ == Phase::Head ? writeHead(ptr, size) : writeBody(ptr, size))) {
+            failed_ = true;
+            return -1;
+        }
+        return static_cast<ssize_t>(size);
+    }
+
+    void get_remote_ip_and_port(std::string& ip, int& port) const override {
+        ip = remoteAddr;
+        port = remotePort;
+    }
+
+    void get_local_ip_and_port(std::string& ip, int& port) const override {
+        ip = localAddr;
+        port = localPort;
+    }
+
+    socket_t socket() const override { return session_->fd(); }
+    time_t duration() const override { return 0; }
+
+    const std::string remoteAddr;
+    const int remotePort;
+    const std::string localAddr;
+    const int localPort;
+
+private:
+    enum class Phase { Head, Fixed, ChunkSize, ChunkData, ChunkEnd, Trailer, UntilEnd, Done };
+
+    bool writeHead(const char* ptr, size_t size);
+    bool writeBody(const char* ptr, size_t size);
+    bool endBody() {
+        phase_ = Phase::Done;
+        return session_->sendData(id_, nullptr, 0, true);
+    }
+
+    const std::shared_ptr<Session> session_;
+    const uint32_t id_;
+    const std::string request_;
+    const bool headRequest_;  // the response has a length but no body
+    size_t pos_ = 0;
+    std::shared_ptr<Http2Stream> self_;
+
+    Phase phase_ = Phase::Head;
+    std::string headBytes_;
+    std::string line_;  // chunk-size or trailer line so far
+    uint64_t remaining_ = 0;
+    bool failed_ = false;
+    bool goAway_ = false;
+};
+
+// An epoll set of connections. Connections are armed one-shot, so while a
+// worker has one its events stay off until the worker re-arms it.
+class EventServer::Reactor {
+public:
+    explicit Reactor(EventServer& server)
+        : server_(server),
+          epoll_(epoll_create1(EPOLL_CLOEXEC)),
+          wake_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev);
+    }
+
+    ~Reactor() {
+        for (Connection* conn : connections_) delete conn;
+        ::close(wake_);
+        ::close(epoll_);
+    }
+
+    EventServer& server() const { return server_; }
+
+    void watchListener(int fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &listenTag;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+        listenFd_ = fd;
+    }
+
+    void add(Connection* conn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connections_.insert(conn);
+        }
+        arm(conn, EPOLL_CTL_ADD);
+    }
+
+    void arm(Connection* conn, int op) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        epoll_ctl(epoll_, op, conn->fd(), &ev);
+    }
+
+    // An HTTP/2 connection stays armed, level-triggered, as its streams
+    // are served; any thread may change what it waits for
+    void watch(Connection* conn, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        epoll_ctl(epoll_, EPOLL_CTL_MOD, conn->fd(), &ev);
+    }
+
+    void close(Connection* conn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connections_.erase(conn);
+        }
+        delete conn;
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t written = ::write(wake_, &one, sizeof(one));
+        (void)written;
+    }
+
+    void run() {
+        epoll_event events[64];
+        auto lastSweep = Clock::now();
+        while (!server_.stopping_.load(std::memory_order_acquire)) {
+            int n = epoll_wait(epoll_, events, 64, 1000);
+            for (int i = 0; i < n; ++i) {
+                void* tag = events[i].data.ptr;
+                if (tag == nullptr) {
+                    uint64_t count;
+                    ssize_t got = ::read(wake_, &count, sizeof(count));
+                    (void)got;
+                } else if (tag == &listenTag) {
+                    server_.acceptAll(listenFd_);
+                } else {
+                    onEvent(static_cast<Connection*>(tag), events[i].events);
+                }
+            }
+            auto now = Clock::now();
+            if (now - lastSweep >= std::chrono::seconds(1)) {
+                sweep(now);
+                lastSweep = now;
+            }
+        }
+    }
+
+    std::thread thread;
+
+private:
+    void onEvent(Connection* conn, uint32_t events) {
+        if (conn->h2) {
+            if (!conn->h2->onEvent(events)) close(conn);
+            return;
+        }
+        bool open = conn->receive();
+        if (open && server_.http2_ && conn->served == 0) {
+            Connection::Preface preface = conn->preface();
+            if (preface == Connection::Preface::Partial) {
+                arm(conn, EPOLL_CTL_MOD);
+                return;
+            }
+            if (preface == Connection::Preface::Full) {
+                conn->h2 = std::make_shared<Session>(server_, conn);
+                if (!conn->h2->start(conn->takeFrames())) close(conn);
+                return;
+            }
+        }
+        if (open && conn->headComplete()) {
+            server_.dispatch(conn);
+        } else if (!open || conn->buffered() > kMaxHeadBytes) {
+            close(conn);
+        } else {
+            arm(conn, EPOLL_CTL_MOD);
+        }
+    }
+
+    // Close connections idle past the keep-alive timeout, or stuck
+    // mid-head past the read timeout. An HTTP/2 connection is idle once it
+    // has no streams in progress.
+    void sweep(Clock::time_point now) {
+        auto idleLimit = std::chrono::milliseconds(server_.keepAliveTimeoutMs_);
+        auto readLimit = std::chrono::milliseconds(server_.readTimeoutMs_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            Connection* conn = *it;
+            bool expired = conn->h2 ? conn->h2->expired(now, idleLimit)
+                                    : conn->idle.load(std::memory_order_acquire) &&
+                                          now - conn->lastActive >
+                                              (conn->buffered() > 0 ? readLimit : idleLimit);
+            if (expired) {
+                delete conn;
+                it = connections_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    EventServer& server_;
+    const int epoll_;
+    const int wake_;
+    int listenFd_ = -1;
+    std::mutex mutex_;
+    std::unordered_set<Connection*> connections_;
+};
+
+EventServer::Connection::~Connection() {
+    if (h2) h2->abandon();
+    ::close(fd_);
+}
+
+EventServer::Session::Session(EventServer& server, Connection* conn)
+    : server_(server),
+      conn_(conn),
+      fd_(conn->fd()),
+      remoteAddr_(conn->remoteAddr),
+      remotePort_(conn->remotePort),
+      localAddr_(conn->localAddr),
+      localPort_(conn->localPort) {}
+
+bool EventServer::Session::start(std::string frames) {
+    in_ = std::move(frames);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        http2::appendSettings(out_, {{http2::kMaxConcurrentStreams, kMaxStreams},
+                                     {http2::kInitialWindowSize, kRequestWindow},
+                                     {http2::kMaxHeaderListSize, kMaxHeadBytes}});
+        http2::appendWindowUpdate(out_, 0, kRequestWindow - http2::kDefaultWindow);
+        conn_->reactor()->watch(conn_, EPOLLIN);
+    }
+    return process();
+}
+
+bool EventServer::Session::onEvent(uint32_t events) {
+    if (events & EPOLLOUT) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flushLocked();
+        cv_.notify_all();
+    }
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !receive()) return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !finishedLocked();
+}
+
+bool EventServer::Session::expired(Clock::time_point now, std::chrono::milliseconds idleLimit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_.empty() && now - lastActive_ > idleLimit;
+}
+
+void EventServer::Session::abandon() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    conn_ = nullptr;
+    cv_.notify_all();
+}
+
+bool EventServer::Session::receive() {
+    char buf[kReadChunk];
+    bool open = true;
+    while (true) {
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n > 0) {
+            in_.append(buf, static_cast<size_t>(n));
+            if (static_cast<size_t>(n) < sizeof(buf)) break;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        break;
+    }
+    return process() && open;
+}
+
+// Handle every whole frame buffered; false on a connection error
+bool EventServer::Session::process() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastActive_ = Clock::now();
+    size_t pos = 0;
+    bool ok = true;
+    while (ok) {
+        http2::Frame frame;
+        bool whole = http2::parseFrame(in_.data() + pos, in_.size() - pos, frame);
+        if (in_.size() - pos >= http2::kFrameHeaderSize && frame.length > http2::kDefaultMaxFrame) {
+            ok = fail(http2::kFrameSizeError);
+            break;
+        }
+        if (!whole) break;
+        pos += http2::kFrameHeaderSize + frame.length;
+
+        // A header block's CONTINUATION frames follow it with nothing in between
+        if (blockStream_ != 0 &&
+            (frame.type != http2::FrameType::Continuation || frame.stream != blockStream_)) {
+            ok = fail(http2::kProtocolError);
+            break;
+        }
+        switch (frame.type) {
+        case http2::FrameType::Settings:
+            ok = onSettings(frame);
+            break;
+        case http2::FrameType::Ping:
+            if (frame.stream != 0 || frame.length != 8) {
+                ok = fail(http2::kProtocolError);
+            } else if (!(frame.flags & http2::flags::kAck)) {
+                http2::appendFrame(out_, http2::FrameType::Ping, http2::flags::kAck, 0, frame.payload, 8);
+            }
+            break;
+        case http2::FrameType::WindowUpdate:
+            ok = onWindowUpdate(frame);
+            break;
+        case http2::FrameType::Headers:
+            ok = onHeaders(frame);
+            break;
+        case http2::FrameType::Continuation:
+            if (frame.stream == 0 || frame.stream != blockStream_) {
+                ok = fail(http2::kProtocolError);
+                break;
+            }
+            block_.append(frame.payload, frame.length);
+            if (block_.size() > kMaxHeadBytes) {
+                ok = fail(http2::kProtocolError);
+            } else if (frame.flags & http2::flags::kEndHeaders) {
+                ok = onHeaderBlock();
+            }
+            break;
+        case http2::FrameType::Data:
+            ok = onData(frame);
+            break;
+        case http2::FrameType::RstStream: {
+            if (frame.stream == 0 || frame.length != 4) {
+                ok = fail(http2::kProtocolError);
+                break;
+            }
+            auto it = streams_.find(frame.stream);
+            if (it != streams_.end()) {
+                if (it->second.dispatched) {
+                    it->second.reset = true;  // its worker finds out on its next write
+                } else {
+                    streams_.erase(it);
+                }
+            }
+            cv_.notify_all();
+            break;
+        }
+        case http2::FrameType::GoAway:
+            if (frame.stream != 0) {
+                ok = fail(http2::kProtocolError);
+            } else {
+                peerGoingAway_ = true;
+            }
+            break;
+        case http2::FrameType::PushPromise:
+            ok = fail(http2::kProtocolError);  // clients cannot push
+            break;
+        default:
+            break;  // PRIORITY, and frame types we do not know, are ignored
+        }
+    }
+    in_.erase(0, pos);
+    flushLocked();
+    return ok;
+}
+
+bool EventServer::Session::onSettings(const http2::Frame& frame) {
+    if (frame.stream != 0) return fail(http2::kProtocolError);
+    if (frame.flags & http2::flags::kAck) return frame.length == 0 || fail(http2::kFrameSizeError);
+    if (frame.length % 6 != 0) return fail(http2::kFrameSizeError);
+    for (size_t at = 0; at < frame.length; at += 6) {
+        const char* p = frame.payload + at;
+        uint16_t id = static_cast<uint16_t>((static_cast<uint8_t>(p[0]) << 8) | static_cast<uint8_t>(p[1]));
+        uint32_t value = http2::readU32(p + 2);
+        switch (id) {
+        case http2::kHeaderTableSize:
+            encoder_.setMaxTableSize(value);
+            break;
+        case http2::kEnablePush:
+            if (value > 1) return fail(http2::kProtocolError);
+            break;
+        case http2::kInitialWindowSize: {
+            if (value > http2::kMaxWindow) return fail(http2::kFlowControlError);
+            // Applies to the windows of streams already open, too
+            int64_t delta = static_cast<int64_t>(value) - peerInitialWindow_;
+            for (auto& entry : streams_) entry.second.window += delta;
+            peerInitialWindow_ = value;
+            cv_.notify_all();
+            break;
+        }
+        case http2::kMaxFrameSize:
+            if (value < http2::kDefaultMaxFrame || value > 0xffffff) return fail(http2::kProtocolError);
+            peerMaxFrame_ = std::min<size_t>(value, kMaxDataFrame);
+            break;
+        default:
+            break;
+        }
+    }
+    http2::appendFrame(out_, http2::FrameType::Settings, http2::flags::kAck, 0, "", 0);
+    return true;
+}
+
+bool EventServer::Session::onWindowUpdate(const http2::Frame& frame) {
+    if (frame.length != 4) return fail(http2::kFrameSizeError);
+    uint32_t increment = http2::readU32(frame.payload) & 0x7fffffff;
+    if (frame.stream == 0) {
+        if (increment == 0) return fail(http2::kProtocolError);
+        window_ += increment;
+        if (window_ > http2::kMaxWindow) return fail(http2::kFlowControlError);
+    } else {
+        auto it = streams_.find(frame.stream);
+        if (it != streams_.end()) {
+            it->second.window += increment;
+            if (increment == 0) {
+                reset(frame.stream, http2::kProtocolError);
+            } else if (it->second.window > http2::kMaxWindow) {
+                reset(frame.stream, http2::kFlowControlError);
+            }
+        }
+    }
+    cv_.notify_all();
+    return true;
+}
+
+bool EventServer::Session::onHeaders(const http2::Frame& frame) {
+    uint32_t id = frame.stream;
+    if (id == 0 || id % 2 == 0) return fail(http2::kProtocolError);
+    const char* data;
+    size_t size;
+    if (!http2::unpad(frame, data, size)) return fail(http2::kProtocolError);
+
+    // A new stream, or trailers for one still sending its body. Blocks for
+    // streams that are refused or already gone are decoded all the same,
+    // to keep the header table in step with the client's.
+    blockRefused_ = false;
+    if (!streams_.count(id) && id > lastStream_) {
+        lastStream_ = id;
+        if (goingAway_ || streams_.size() >= kMaxStreams) {
+            blockRefused_ = true;
+        } else {
+            streams_[id].window = peerInitialWindow_;
+        }
+    }
+    block_.assign(data, size);
+    blockStream_ = id;
+    blockEndStream_ = frame.flags & http2::flags::kEndStream;
+    return (frame.flags & http2::flags::kEndHeaders) ? onHeaderBlock() : true;
+}
+
+bool EventServer::Session::onHeaderBlock() {
+    uint32_t id = blockStream_;
+    blockStream_ = 0;
+    http2::HeaderList headers;
+    bool decoded = decoder_.decode(block_.data(), block_.size(), headers, kMaxHeadBytes);
+    block_.clear();
+    if (!decoded) return fail(http2::kCompressionError);
+
+    auto it = streams_.find(id);
+    if (it == streams_.end()) {
+        if (blockRefused_) reset(id, http2::kRefusedStream);
+        return true;
+    }
+    StreamState& stream = it->second;
+    if (stream.headersDone) {
+        // Trailers: their fields are dropped, but they end the request
+        if (!blockEndStream_ || stream.dispatched) {
+            reset(id, http2::kProtocolError);
+            return true;
+        }
+    } else {
+        stream.headers = std::move(headers);
+        stream.headersDone = true;
+    }
+    if (blockEndStream_) onRequest(id, stream);
+    return true;
+}
+
+bool EventServer::Session::onData(const http2::Frame& frame) {
+    uint32_t id = frame.stream;
+    if (id == 0 || id > lastStream_) return fail(http2::kProtocolError);
+    const char* data;
+    size_t size;
+    if (!http2::unpad(frame, data, size)) return fail(http2::kProtocolError);
+
+    // Flow control counts the whole frame, padding too. Bodies are taken in
+    // as fast as they come, so the window is given straight back.
+    if (frame.length > 0) http2::appendWindowUpdate(out_, 0, frame.length);
+    auto it = streams_.find(id);
+    if (it == streams_.end() || !it->second.headersDone || it->second.dispatched) {
+        return true;  // a stream reset or refused earlier; dropped
+    }
+    StreamState& stream = it->second;
+    if (stream.body.size() + size > server_.payload_max_length_) {
+        reset(id, http2::kCancel);
+        return true;
+    }
+    stream.body.append(data, size);
+    if (frame.flags & http2::flags::kEndStream) {
+        onRequest(id, stream);
+    } else if (frame.length > 0) {
+        http2::appendWindowUpdate(out_, id, frame.length);
+    }
+    return true;
+}
+
+// The request on stream `id` has fully arrived: hand it to a worker
+void EventServer::Session::onRequest(uint32_t id, StreamState& stream) {
+    std::string request;
+    bool head = false;
+    if (!toHttp1(stream.headers, stream.body, request, head)) {
+        reset(id, http2::kProtocolError);
+        return;
+    }
+    stream.headers.clear();
+    stream.body.clear();
+    stream.dispatched = true;
+    ++opened_;
+    auto exchange = std::make_shared<Http2Stream>(server_, shared_from_this(), id, std::move(request),
+                                                  head, remoteAddr_, remotePort_, localAddr_, localPort_);
+    // A full queue (SERVER_MAX_QUEUED_REQUESTS) refuses the stream; the
+    // client may retry it
+    if (!server_.dispatchStream(std::move(exchange))) {
+        stream.dispatched = false;
+        reset(id, http2::kRefusedStream);
+    }
+}
+
+bool EventServer::Session::fail(uint32_t code) {
+    http2::appendGoAway(out_, lastStream_, code);
+    goingAway_ = true;
+    fatal_ = true;
+    return false;
+}
+
+void EventServer::Session::reset(uint32_t id, uint32_t code) {
+    http2::appendRstStream(out_, id, code);
+    auto it = streams_.find(id);
+    if (it == streams_.end()) return;
+    if (it->second.dispatched) {
+        it->second.reset = true;
+    } else {
+        streams_.erase(it);
+    }
+    cv_.notify_all();
+}
+
+// Send what the socket takes without blocking, and have the reactor wait
+// for it to turn writable if some is left (or to close the connection)
+void EventServer::Session::flushLocked() {
+    if (closed_) return;
+    while (outPos_ < out_.size()) {
+        ssize_t n = ::send(fd_, out_.data() + outPos_, out_.size() - outPos_, MSG_NOSIGNAL);
+        if (n > 0) {
+            outPos_ += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        fatal_ = true;  // the socket failed; the reactor closes it
+        outPos_ = out_.size();
+    }
+    if (outPos_ == out_.size()) {
+        out_.clear();
+        outPos_ = 0;
+    } else if (outPos_ >= kReadChunk) {
+        out_.erase(0, outPos_);
+        outPos_ = 0;
+    }
+    bool wantOut = !out_.empty() || finishedLocked();
+    if (wantOut != watchingOut_ && conn_) {
+        watchingOut_ = wantOut;
+        conn_->reactor()->watch(conn_, EPOLLIN | (wantOut ? EPOLLOUT : 0));
+    }
+}
+
+bool EventServer::Session::finishedLocked() const {
+    return fatal_ || ((goingAway_ || peerGoingAway_) && streams_.empty() && out_.empty());
+}
+
+bool EventServer::Session::writable(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    return !closed_ && !fatal_ && it != streams_.end() && !it->second.reset;
+}
+
+bool EventServer::Session::sendHeaders(uint32_t id, const http2::HeaderList& headers, bool endStream,
+                                       bool flush) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (closed_ || fatal_ || it == streams_.end() || it->second.reset) return false;
+    // Encoded under the lock: blocks have to reach the client in the order
+    // they went through the encoder
+    std::string block;
+    encoder_.encode(headers, block);
+    http2::appendHeaders(out_, id, block, endStream, peerMaxFrame_);
+    if (flush) flushLocked();
+    return true;
+}
+
+bool EventServer::Session::sendData(uint32_t id, const char* data, size_t size, bool endStream) {
+    if (size == 0 && !endStream) return true;
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto deadline = Clock::now() + std::chrono::milliseconds(server_.writeTimeoutMs_);
+    do {
+        // Wait out an exhausted window, or a client not reading what is
+        // already queued, up to the write timeout
+        StreamState* stream;
+        while (true) {
+            auto it = streams_.find(id);
+            if (closed_ || fatal_ || it == streams_.end() || it->second.reset) return false;
+            stream = &it->second;
+            if (size == 0) break;
+            if (window_ > 0 && stream->window > 0 && out_.size() - outPos_ < kMaxQueuedOut) break;
+            flushLocked();
+            if (Clock::now() >= deadline) return false;
+            cv_.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        auto allowed = static_cast<size_t>(std::min(window_, stream->window));
+        size_t take = std::min({size, allowed, peerMaxFrame_});
+        bool last = endStream && take == size;
+        http2::appendFrame(out_, http2::FrameType::Data, last ? http2::flags::kEndStream : 0, id,
+                           data ? data : "", take);
+        window_ -= static_cast<int64_t>(take);
+        stream->window -= static_cast<int64_t>(take);
+        if (data) data += take;
+        size -= take;
+    } while (size > 0);
+    flushLocked();
+    return true;
+}
+
+void EventServer::Session::finish(uint32_t id, bool complete, bool goAway) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it != streams_.end()) {
+        if (!complete && !it->second.reset) http2::appendRstStream(out_, id, http2::kInternalError);
+        streams_.erase(it);
+    }
+    lastActive_ = Clock::now();
+    // Draining, or past KEEP_ALIVE_MAX_COUNT streams: the client finishes
+    // what it has open here and takes new requests elsewhere
+    size_t maxCount = server_.keepAliveMaxCount_;
+    if (!goingAway_ && (goAway || (maxCount > 0 && opened_ >= maxCount))) {
+        http2::appendGoAway(out_, lastStream_, http2::kNoError);
+        goingAway_ = true;
+    }
+    flushLocked();
+}
+
+bool EventServer::Http2Stream::writeHead(const char* ptr, size_t size) {
+    headBytes_.append(ptr, size);
+    size_t end = headBytes_.find("\r\n\r\n");
+    if (end == std::string::npos) return headBytes_.size() <= kMaxHeadBytes;
+
+    size_t lineEnd = headBytes_.find("\r\n");
+    size_t space = headBytes_.find(' ');
+    if (headBytes_.compare(0, 5, "HTTP/") != 0 || space > lineEnd) return false;
+    int status = std::atoi(headBytes_.c_str() + space + 1);
+    std::string rest = headBytes_.substr(end + 4);
+    if (status >= 100 && status < 200) {
+        // An interim 100 Continue has nothing to say here: the body is all in
+        headBytes_.clear();
+        return rest.empty() || writeHead(rest.data(), rest.size());
+    }
+
+    // HTTP/1.1's connection-specific fields have no place in HTTP/2. A
+    // Connection: close that httplib did not add for an error status is the
+    // drain (lifecycle.h) asking clients to move on.
+    http2::HeaderList headers{{":status", std::to_string(status)}};
+    bool chunked = false;
+    bool hasLength = false;
+    uint64_t length = 0;
+    for (size_t at = lineEnd + 2; at < end;) {
+        size_t next = headBytes_.find("\r\n", at);
+        size_t colon = headBytes_.find(':', at);
+        if (colon != std::string::npos && colon < next) {
+            std::string name = trimmed(headBytes_, at, colon);
+            std::transform(name.begin(), name.end(), name.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            std::string value = trimmed(headBytes_, colon + 1, next);
+            if (name == "connection") {
+                goAway_ = goAway_ || (status < 400 && strcasecmp(value.c_str(), "close") == 0);
+            } else if (name == "transfer-encoding") {
+                chunked = value.find("chunked") != std::string::npos;
+            } else if (name != "keep-alive" && name != "alt-svc" && name != "upgrade" &&
+                       name != "proxy-connection") {
+                if (name == "content-length") {
+                    hasLength = true;
+                    length = std::strtoull(value.c_str(), nullptr, 10);
+                }
+                headers.emplace_back(std::move(name), std::move(value));
+            }
+        }
+        at = next + 2;
+    }
+    headBytes_.clear();
+
+    if (chunked) {
+        phase_ = Phase::ChunkSize;
+    } else if (hasLength) {
+        phase_ = Phase::Fixed;
+        remaining_ = length;
+    } else {
+        phase_ = Phase::UntilEnd;
+    }
+    bool empty = headRequest_ || status == 204 || status == 304 || (phase_ == Phase::Fixed && length == 0);
+    if (empty) phase_ = Phase::Done;
+    // The head waits for the first DATA frame unless nothing follows it
+    if (!session_->sendHeaders(id_, headers, empty, empty)) return false;
+    return rest.empty() || writeBody(rest.data(), rest.size());
+}
+
+// Undo httplib's body framing: a fixed length becomes DATA frames as it is
+// written, chunks lose their size lines and the last one ends the stream
+bool EventServer::Http2Stream::writeBody(const char* ptr, size_t size) {
+    while (size > 0) {
+        switch (phase_) {
+        case Phase::Fixed: {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, size));
+            remaining_ -= take;
+            if (remaining_ == 0) phase_ = Phase::Done;
+            return session_->sendData(id_, ptr, take, remaining_ == 0);
+        }
+        case Phase::UntilEnd:
+            return session_->sendData(id_, ptr, size, false);
+        case Phase::ChunkData: {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, size));
+            if (!session_->sendData(id_, ptr, take, false)) return false;
+            ptr += take;
+            size -= take;
+            remaining_ -= take;
+            if (remaining_ == 0) phase_ = Phase::ChunkEnd;
+            break;
+        }
+        case Phase::ChunkEnd:
+        case Phase::ChunkSize:
+        case Phase::Trailer: {
+            const char* eol = static_cast<const char*>(std::memchr(ptr, '\n', size));
+            size_t take = eol ? static_cast<size_t>(eol - ptr) + 1 : size;
+            line_.append(ptr, take);
+            ptr += take;
+            size -= take;
+            if (!eol) {
+                if (line_.size() > 1024) return false;
+                break;
+            }
+            if (phase_ == Phase::ChunkEnd) {
+                phase_ = Phase::ChunkSize;
+            } else if (phase_ == Phase::ChunkSize) {
+                // Chunk extensions after ';' are ignored
+                remaining_ = std::strtoull(line_.c_str(), nullptr, 16);
+                phase_ = remaining_ == 0 ? Phase::Trailer : Phase::ChunkData;
+            } else if (line_ == "\r\n") {
+                line_.clear();
+                return endBody();  // trailer fields are dropped
+            }
+            line_.clear();
+            break;
+        }
+        case Phase::Head:
+        case Phase::Done:
+            return true;  // past the end of the response; dropped
+        }
+    }
+    return true;
+}
+
+void EventServer::Http2Stream::finish() {
+    if (!failed_ && phase_ == Phase::UntilEnd) failed_ = !endBody();
+    session_->finish(id_, !failed_ && phase_ == Phase::Done, goAway_);
+}
+
+thread_local EventServer::Exchange* EventServer::current_ = nullptr;
+
+EventServer::EventServer() = default;
+
+EventServer::~EventServer() = default;
+
+bool EventServer::listenEvents(const std::string& host, int port, const ServerOptions& opts) {
+    int listenFd = openListener(host, port, opts.listenBacklog);
+    if (listenFd < 0) return false;
+    // httplib's content providers treat an invalid listening socket as
+    // shutdown and stop writing
+    svr_sock_ = listenFd;
+
+    keepAliveMaxCount_ = opts.keepAliveMaxCount;
+    keepAliveTimeoutMs_ = opts.keepAliveTimeoutSeconds * 1000;
+    readTimeoutMs_ = opts.readTimeoutSeconds * 1000;
+    writeTimeoutMs_ = opts.writeTimeoutSeconds * 1000;
+    tcpNoDelay_ = opts.tcpNoDelay;
+    http2_ = opts.http2;
+    // Tells clients on HTTP/1.1 they may open h2c to the same address
+    if (http2_) set_default_headers({{"Alt-Svc", "h2c=\":" + std::to_string(port) + "\""}});
+    workers_ = std::make_unique<httplib::ThreadPool>(opts.threads, opts.maxQueuedRequests);
+
+    {
+        std::lock_guard<std::mutex> lock(reactorsMutex_);
+        for (size_t i = 0; i < std::max<size_t>(opts.reactors, 1); ++i) {
+            reactors_.push_back(std::make_unique<Reactor>(*this));
+        }
+        reactors_.front()->watchListener(listenFd);
+        for (auto& reactor : reactors_) {
+            reactor->thread = std::thread([r = reactor.get()] { r->run(); });
+        }
+    }
+    for (auto& reactor : reactors_) reactor->thread.join();
+
+    // Connections with a request in progress are closed by their worker,
+    // suspended ones once they have resumed; their awaits have deadlines.
+    // Resuming can dispatch until the pool has shut down, so wait again
+    // after that.
+    ::close(listenFd);
+    auto awaitResumed = [this] {
+        while (suspended_.load(std::memory_order_acquire) > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    };
+    awaitResumed();
+    workers_->shutdown();
+    awaitResumed();
+    std::lock_guard<std::mutex> lock(reactorsMutex_);
+    reactors_.clear();
+    workers_.reset();
+    return true;
+}
+
+void EventServer::stop() {
+    httplib::Server::stop();
+    svr_sock_ = INVALID_SOCKET;  // ends streams, as httplib's stop does
+    stopping_.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(reactorsMutex_);
+    for (auto& reactor : reactors_) reactor->wake();
+}
+
+void EventServer::acceptAll(int listenFd) {
+    while (true) {
+        sockaddr_storage addr{};
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listenFd, reinterpret_cast<sockaddr*>(&addr), &len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                LOG_WARN << "[WARN] Out of file descriptors accepting connections";
+            }
+            return;
+        }
+        if (tcpNoDelay_) {
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+
+        Reactor* reactor = reactors_[nextReactor_++ % reactors_.size()].get();
+        auto* conn = new Connection(fd, reactor, *this, readTimeoutMs_, writeTimeoutMs_);
+        conn->remoteAddr = numericHost(addr, len, conn->remotePort);
+        sockaddr_storage local{};
+        socklen_t localLen = sizeof(local);
+        if (getsockname(fd, reinterpret_cast<sockaddr*>(&local), &localLen) == 0) {
+            conn->localAddr = numericHost(local, localLen, conn->localPort);
+        }
+        reactor->add(conn);
+    }
+}
+
+void EventServer::dispatch(Connection* conn) {
+    conn->idle.store(false, std::memory_order_relaxed);
+    // A full queue (SERVER_MAX_QUEUED_REQUESTS) refuses the connection, as
+    // httplib's own pool does
+    load_.waiting.fetch_add(1, std::memory_order_relaxed);
+    if (!workers_->enqueue([this, conn] { serveConnection(conn); })) {
+        load_.waiting.fetch_sub(1, std::memory_order_relaxed);
+        conn->reactor()->close(conn);
+    }
+}
+
+void EventServer::serveConnection(Connection* conn) {
+    WorkerLoad::Running running(load_);
+    do {
+        if (conn->resuming) {
+            conn->rewind();
+        } else {
+            ++conn->served;
+            conn->startRequest();
+        }
+        bool closeAfter = stopping_.load(std::memory_order_acquire) ||
+                          (keepAliveMaxCount_ > 0 && conn->served >= keepAliveMaxCount_);
+        bool clientClosed = false;
+        conn->beginResponse();
+        conn->cursor = 0;
+        current_ = conn;
+        bool ok = process_request(*conn, conn->remoteAddr, conn->remotePort, conn->localAddr,
+                                  conn->localPort, closeAfter, clientClosed, nullptr);
+        current_ = nullptr;
+        if (conn->suspended) {
+            // An await() is holding the request; this pass's reply is dropped
+            conn->discard();
+            release(conn);
+            return;
+        }
+        conn->resuming = false;
+        conn->results.clear();
+        ok = conn->flush() && ok;
+        if (!ok || clientClosed || closeAfter) {
+            conn->reactor()->close(conn);
+            return;
+        }
+        // Pipelined requests already buffered are served straight away
+    } while (conn->headComplete());
+
+    conn->compact();
+    conn->lastActive = Clock::now();
+    conn->idle.store(true, std::memory_order_release);
+    conn->reactor()->arm(conn, EPOLL_CTL_MOD);
+}
+
+bool EventServer::dispatchStream(std::shared_ptr<Http2Stream> stream) {
+    load_.waiting.fetch_add(1, std::memory_order_relaxed);
+    if (workers_->enqueue([this, stream] { serveStream(stream); })) return true;
+    load_.waiting.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+void EventServer::serveStream(const std::shared_ptr<Http2Stream>& stream) {
+    WorkerLoad::Running running(load_);
+    if (stream->resuming) {
+        stream->rewind();
+    } else {
+        stream->startRequest();
+    }
+    bool clientClosed = false;
+    stream->cursor = 0;
+    current_ = stream.get();
+    process_request(*stream, stream->remoteAddr, stream->remotePort, stream->localAddr,
+                    stream->localPort, false, clientClosed, nullptr);
+    current_ = nullptr;
+    if (stream->suspended) {
+        stream->park();
+        release(stream.get());
+        return;
+    }
+    stream->resuming = false;
+    stream->results.clear();
+    stream->finish();
+}
+
+bool EventServer::resumed() { return current_ && current_->resuming; }
+
+bool EventServer::suspended() { return current_ && current_->suspended; }
+
+std::chrono::steady_clock::time_point EventServer::arrived() {
+    return current_ ? current_->arrived : Clock::now();
+}
+
+uint64_t EventServer::requestId() {
+    static std::atomic<uint64_t> next{1};
+    if (!current_) return next.fetch_add(1, std::memory_order_relaxed);
+    if (current_->id == 0) current_->id = next.fetch_add(1, std::memory_order_relaxed);
+    return current_->id;
+}
+
+std::shared_ptr<void> EventServer::replayed() {
+    if (!current_ || current_->cursor >= current_->results.size()) return nullptr;
+    return current_->results[current_->cursor++];
+}
+
+std::shared_ptr<void> EventServer::settle(const std::shared_ptr<Pending>& pending) {
+    std::unique_lock<std::mutex> lock(pending->mutex);
+    if (pending->done) return std::move(pending->value);  // answered inline
+
+    Exchange* exchange = current_;
+    if (exchange && exchange->rewindable() && !exchange->suspended) {
+        // Two parties hand the request back: the worker once this pass has
+        // unwound, and complete()
+        exchange->suspended = true;
+        exchange->parkRefs.store(2, std::memory_order_relaxed);
+        exchange->server().suspended_.fetch_add(1, std::memory_order_acq_rel);
+        pending->parked = exchange;
+        return nullptr;
+    }
+
+    pending->cv.wait(lock, [&pending] { return pending->done; });
+    return std::move(pending->value);
+}
+
+void EventServer::complete(const std::shared_ptr<Pending>& pending, std::shared_ptr<void> value) {
+    Exchange* exchange;
+    {
+        std::lock_guard<std::mutex> lock(pending->mutex);
+        exchange = pending->parked;
+        if (!exchange) {
+            pending->value = std::move(value);
+            pending->done = true;
+        }
+    }
+    if (!exchange) {
+        pending->cv.notify_all();
+        return;
+    }
+    exchange->resumeValue = std::move(value);
+    exchange->server().release(exchange);
+}
+
+void EventServer::release(Exchange* exchange) {
+    if (exchange->parkRefs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    exchange->results.push_back(std::move(exchange->resumeValue));
+    exchange->suspended = false;
+    exchange->resuming = true;
+    exchange->resume();
+    suspended_.fetch_sub(1, std::memory_order_acq_rel);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "httplib.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ServerOptions;
+
+// httplib::Server with an optional event-driven connection layer.
+//
+// Routes, handlers and middleware are httplib's own, registered with the
+// usual svr.Get(...). Under httplib's listen every connection, busy or
+// idle, holds a pool thread for as long as it stays open. listenEvents()
+// instead multiplexes all connections on SERVER_REACTORS epoll threads,
+// which read each request head into a per-connection buffer and only then
+// hand the connection to a worker. The worker runs httplib's request
+// processing over that buffer, and the connection goes back to its reactor
+// once the response is written. A keep-alive connection therefore costs a
+// file descriptor and a buffer between requests rather than a parked
+// thread, and the worker pool only has to cover requests actually in
+// progress (a stream still holds a worker for its whole length).
+//
+// A handler waiting on something asynchronous (an upstream call on an
+// AsyncClient loop) need not hold its worker either:
+//
+//     auto reply = EventServer::await<Reply>([&](auto done) {
+//         client.callAsync(..., [done](Outcome o) { done(decode(o)); });
+//     });
+//     if (!reply) return;  // suspended: the handler runs again with the reply
+//
+// Under listenEvents the connection is parked and the worker moves on. Once
+// `done` is called the request is dispatched again from its buffered bytes
+// and the handler re-runs from the top, this time getting the value from
+// await(); awaits in one handler are answered in order on each re-run. So
+// work before an await is repeated (resumed() tells a re-run apart) and a
+// suspended handler must return without touching `res`. Its first pass
+// writes nothing. Under httplib's listen, or for a request whose body had to
+// be read from the socket, await() blocks the worker until `done` instead.
+//
+// With SERVER_HTTP2 the epoll backend also speaks cleartext HTTP/2 (h2c) to
+// clients that open with its connection preface, and advertises that with
+// an Alt-Svc header on HTTP/1.1 responses. Each stream is served as the
+// HTTP/1.1 request it translates to, by the same routes and on the same
+// workers, so handlers cannot tell the two apart.
+class EventServer : public httplib::Server {
+public:
+    EventServer();
+    ~EventServer() override;
+
+    // Serve on host:port with the epoll backend until stop(); false if the
+    // port could not be bound
+    bool listenEvents(const std::string& host, int port, const ServerOptions& opts);
+
+    // Stop accepting, let requests in progress finish and make the listen
+    // call return; works for either backend
+    void stop();
+
+    // Value of the asynchronous operation `start(done)` begins, or nullopt
+    // when the request has been suspended until `done(value)` is called.
+    // Handlers only; `done` may be called on any thread, or inline.
+    template <typename T, typename Start>
+    static std::optional<T> await(Start&& start) {
+        // Answered on an earlier pass; copied, as a later pass may need it again
+        if (std::shared_ptr<void> value = replayed()) return *static_cast<T*>(value.get());
+        auto pending = std::make_shared<Pending>();
+        start([pending](T value) { complete(pending, std::make_shared<T>(std::move(value))); });
+        std::shared_ptr<void> value = settle(pending);
+        if (!value) return std::nullopt;
+        return std::move(*static_cast<T*>(value.get()));
+    }
+
+    // For the handler running on this thread: whether this pass re-runs a
+    // request that an await() suspended, whether an await() has just
+    // suspended it, and when its first pass began
+    static bool resumed();
+    static bool suspended();
+    static std::chrono::steady_clock::time_point arrived();
+
+    // A number unique to the request within the process, the same on every
+    // pass; taken on first use, so requests that never ask cost nothing.
+    // Under httplib's listen each call gets a new one.
+    static uint64_t requestId();
+
+    // Tasks waiting for a pool thread, and pool threads running one: a
+    // request (or stream) pass under listenEvents, a whole connection under
+    // httplib's listen, whose pool serve() counts into the same place
+    struct WorkerLoad {
+        std::atomic<int> waiting{0};
+        std::atomic<int> busy{0};
+
+        // Held by a task while it runs: no longer waiting, busy until it returns
+        class Running {
+        public:
+            explicit Running(WorkerLoad& load) : load_(load) {
+                load_.waiting.fetch_sub(1, std::memory_order_relaxed);
+                load_.busy.fetch_add(1, std::memory_order_relaxed);
+            }
+            ~Running() { load_.busy.fetch_sub(1, std::memory_order_relaxed); }
+
+            Running(const Running&) = delete;
+            Running& operator=(const Running&) = delete;
+
+        private:
+            WorkerLoad& load_;
+        };
+    };
+    WorkerLoad& workerLoad() { return load_; }
+
+private:
+    class Exchange;
+    class Connection;
+    class Session;
+    class Http2Stream;
+    class Reactor;
+
+    // One await() between start and done
+    struct Pending {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        std::shared_ptr<void> value;
+        Exchange* parked = nullptr;  // set when the request was suspended
+    };
+
+    static std::shared_ptr<void> replayed();
+    static std::shared_ptr<void> settle(const std::shared_ptr<Pending>& pending);
+    static void complete(const std::shared_ptr<Pending>& pending, std::shared_ptr<void> value);
+    void release(Exchange* exchange);
+
+    static thread_local Exchange* current_;  // request this worker is serving
+
+    void acceptAll(int listenFd);
+    void dispatch(Connection* conn);
+    void serveConnection(Connection* conn);
+    bool dispatchStream(std::shared_ptr<Http2Stream> stream);
+    void serveStream(const std::shared_ptr<Http2Stream>& stream);
+
+    std::atomic<bool> stopping_{false};
+    std::atomic<int> suspended_{0};
+    WorkerLoad load_;
+    std::atomic<size_t> nextReactor_{0};
+    std::mutex reactorsMutex_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::unique_ptr<httplib::TaskQueue> workers_;
+    size_t keepAliveMaxCount_ = 0;
+    int keepAliveTimeoutMs_ = 0;
+    int readTimeoutMs_ = 0;
+    int writeTimeoutMs_ = 0;
+    bool tcpNoDelay_ = true;
+    bool http2_ = false;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Allocation-free serializers for the fixed response schemas.
+//
+// The hot handlers always emit one of a handful of flat shapes, so building a
+// nlohmann::json tree just to dump() it is wasted work. These functions write
+// the literal key fragments and std::to_chars digits straight into a buffer
+// owned by the calling thread and return a view of it. The output is
+// byte-identical to json::dump() for the same values (keys in the same
+// sorted order, no whitespace). json.hpp remains the tool for everything
+// else, including error bodies.
+//
+// The returned view points into the thread's buffer and is only valid until
+// that thread serializes again; hand it to Response::set_content right away.
+namespace fastjson {
+
+class Writer {
+public:
+    explicit Writer(std::string& buffer) : buf_(buffer) { buf_.clear(); }
+
+    // Literal fragments: the length is a compile-time constant
+    template <size_t N>
+    Writer& raw(const char (&literal)[N]) {
+        buf_.append(literal, N - 1);
+        return *this;
+    }
+
+    Writer& integer(long long value) {
+        char digits[20];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        buf_.append(digits, static_cast<size_t>(result.ptr - digits));
+        return *this;
+    }
+
+    Writer& intArray(const int* values, size_t count) {
+        buf_.push_back('[');
+        for (size_t i = 0; i < count; ++i) {
+            if (i) buf_.push_back(',');
+            integer(values[i]);
+        }
+        buf_.push_back(']');
+        return *this;
+    }
+
+    void reserve(size_t bytes) { buf_.reserve(bytes); }
+
+    std::string_view view() const { return std::string_view(buf_.data(), buf_.size()); }
+
+private:
+    std::string& buf_;
+};
+
+// Reused per-thread output buffer; keeps its capacity between responses
+inline std::string& threadBuffer() {
+    thread_local std::string buffer;
+    return buffer;
+}
+
+// Worst-case bytes for `count` ints: sign, ten digits and a separator each
+constexpr size_t intArrayBytes(size_t count) { return count * 12 + 2; }
+
+// {"value":N}
+inline std::string_view value(int v) {
+    Writer w(threadBuffer());
+    return w.raw("{\"value\":").integer(v).raw("}").view();
+}
+
+// {"values":[...]}
+inline std::string_view values(const int* v, size_t count) {
+    Writer w(threadBuffer());
+    w.reserve(intArrayBytes(count) + 16);
+    return w.raw("{\"values\":").intArray(v, count).raw("}").view();
+}
+
+// {"original":a,"processed":b}
+inline std::string_view processed(int original, int processed) {
+    Writer w(threadBuffer());
+    return w.raw("{\"original\":").integer(original)
+            .raw(",\"processed\":").integer(processed)
+            .raw("}").view();
+}
+
+// {"original":[...],"processed":[...]}
+inline std::string_view processedBatch(const int* original, const int* processed,
+                                       size_t count) {
+    Writer w(threadBuffer());
+    w.reserve(2 * intArrayBytes(count) + 32);
+    return w.raw("{\"original\":").intArray(original, count)
+            .raw(",\"processed\":").intArray(processed, count)
+            .raw("}").view();
+}
+
+}  // namespace fastjson
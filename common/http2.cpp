@@ -0,0 +1,532 @@
+#include "http2.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <tuple>
+#include <unordered_map>
+
+namespace http2 {
+
+namespace {
+
+struct HeaderField {
+    const char* name;
+    const char* value;
+};
+
+// RFC 7541 appendix A
+const HeaderField kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 appendix B, by symbol; EOS (256) is 30 one bits
+const uint32_t kHuffmanCodes[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+const uint8_t kHuffmanLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+constexpr uint32_t kEosCode = 0x3fffffff;
+constexpr uint8_t kEosLength = 30;
+constexpr size_t kStaticCount = sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+constexpr size_t kEntryOverhead = 32;
+
+// The decoding tree for the Huffman code: a child below zero is the leaf
+// for symbol -child - 1, and the code is complete, so no child is missing
+struct HuffmanTree {
+    std::vector<std::array<int16_t, 2>> nodes;
+
+    HuffmanTree() {
+        nodes.push_back({0, 0});
+        for (int symbol = 0; symbol <= 256; ++symbol) {
+            uint32_t code = symbol < 256 ? kHuffmanCodes[symbol] : kEosCode;
+            int length = symbol < 256 ? kHuffmanLengths[symbol] : kEosLength;
+            size_t node = 0;
+            for (int bit = length - 1; bit >= 0; --bit) {
+                int side = (code >> bit) & 1;
+                if (bit == 0) {
+                    nodes[node][side] = static_cast<int16_t>(-symbol - 1);
+                } else {
+                    if (nodes[node][side] == 0) {
+                        nodes[node][side] = static_cast<int16_t>(nodes.size());
+                        nodes.push_back({0, 0});
+                    }
+                    node = static_cast<size_t>(nodes[node][side]);
+                }
+            }
+        }
+    }
+};
+
+const HuffmanTree& huffmanTree() {
+    static const HuffmanTree tree;
+    return tree;
+}
+
+bool huffmanDecode(const uint8_t* data, size_t size, std::string& out) {
+    const auto& nodes = huffmanTree().nodes;
+    size_t node = 0;
+    int pending = 0;  // bits read since the last symbol, all of them ones
+    bool ones = true;
+    for (size_t i = 0; i < size; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            int side = (data[i] >> bit) & 1;
+            int16_t next = nodes[node][side];
+            ++pending;
+            ones = ones && side == 1;
+            if (next < 0) {
+                if (next == -257) return false;  // EOS inside a string
+                out += static_cast<char>(-next - 1);
+                node = 0;
+                pending = 0;
+                ones = true;
+            } else {
+                node = static_cast<size_t>(next);
+            }
+        }
+    }
+    // What is left has to be padding: under a byte of EOS's leading ones
+    return pending <= 7 && ones;
+}
+
+size_t huffmanLength(const std::string& s) {
+    size_t bits = 0;
+    for (unsigned char c : s) bits += kHuffmanLengths[c];
+    return (bits + 7) / 8;
+}
+
+void huffmanEncode(const std::string& s, std::string& out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    for (unsigned char c : s) {
+        acc = (acc << kHuffmanLengths[c]) | kHuffmanCodes[c];
+        bits += kHuffmanLengths[c];
+        while (bits >= 8) {
+            bits -= 8;
+            out += static_cast<char>(acc >> bits);
+        }
+    }
+    if (bits > 0) out += static_cast<char>((acc << (8 - bits)) | (0xff >> bits));
+}
+
+// RFC 7541 5.1: a value in the low `prefix` bits of the first byte, which
+// keeps the bits above it, continued in 7-bit groups once it overflows
+void encodeInteger(std::string& out, uint8_t first, int prefix, size_t value) {
+    size_t limit = (size_t{1} << prefix) - 1;
+    if (value < limit) {
+        out += static_cast<char>(first | value);
+        return;
+    }
+    out += static_cast<char>(first | limit);
+    value -= limit;
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool decodeInteger(const uint8_t* data, size_t size, size_t& pos, int prefix, size_t& value) {
+    if (pos >= size) return false;
+    size_t limit = (size_t{1} << prefix) - 1;
+    value = data[pos++] & limit;
+    if (value < limit) return true;
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (pos >= size) return false;
+        uint8_t byte = data[pos++];
+        value += static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void encodeString(std::string& out, const std::string& s) {
+    size_t huffman = huffmanLength(s);
+    if (huffman < s.size()) {
+        encodeInteger(out, 0x80, 7, huffman);
+        huffmanEncode(s, out);
+    } else {
+        encodeInteger(out, 0x00, 7, s.size());
+        out += s;
+    }
+}
+
+bool decodeString(const uint8_t* data, size_t size, size_t& pos, std::string& out) {
+    if (pos >= size) return false;
+    bool huffman = data[pos] & 0x80;
+    size_t length;
+    if (!decodeInteger(data, size, pos, 7, length) || length > size - pos) return false;
+    out.clear();
+    bool ok = true;
+    if (huffman) {
+        ok = huffmanDecode(data + pos, length, out);
+    } else {
+        out.assign(reinterpret_cast<const char*>(data + pos), length);
+    }
+    pos += length;
+    return ok;
+}
+
+// Static table lookups for the encoder: index of each field, and of the
+// first entry with each name
+struct StaticIndex {
+    std::unordered_map<std::string, size_t> fields;
+    std::unordered_map<std::string, size_t> names;
+
+    StaticIndex() {
+        for (size_t i = 0; i < kStaticCount; ++i) {
+            const HeaderField& field = kStaticTable[i];
+            fields.emplace(std::string(field.name) + '\0' + field.value, i + 1);
+            names.emplace(field.name, i + 1);
+        }
+    }
+};
+
+const StaticIndex& staticIndex() {
+    static const StaticIndex index;
+    return index;
+}
+
+// Values that change on nearly every message would only churn the table
+bool worthIndexing(const std::string& name, const std::string& value) {
+    return value.size() <= 256 && name != "content-length" && name != "date" &&
+           name != "x-deadline-ms" && name != ":path";
+}
+
+void appendU32(std::string& out, uint32_t value) {
+    out += static_cast<char>(value >> 24);
+    out += static_cast<char>(value >> 16);
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+}  // namespace
+
+uint32_t readU32(const char* p) {
+    auto b = reinterpret_cast<const uint8_t*>(p);
+    return (uint32_t{b[0]} << 24) | (uint32_t{b[1]} << 16) | (uint32_t{b[2]} << 8) | b[3];
+}
+
+bool parseFrame(const char* data, size_t size, Frame& frame) {
+    if (size < kFrameHeaderSize) return false;
+    auto b = reinterpret_cast<const uint8_t*>(data);
+    frame.length = (uint32_t{b[0]} << 16) | (uint32_t{b[1]} << 8) | b[2];
+    frame.type = static_cast<FrameType>(b[3]);
+    frame.flags = b[4];
+    frame.stream = readU32(data + 5) & 0x7fffffff;
+    frame.payload = data + kFrameHeaderSize;
+    return size - kFrameHeaderSize >= frame.length;
+}
+
+void appendFrame(std::string& out, FrameType type, uint8_t flags, uint32_t stream,
+                 const char* payload, size_t size) {
+    out += static_cast<char>(size >> 16);
+    out += static_cast<char>(size >> 8);
+    out += static_cast<char>(size);
+    out += static_cast<char>(type);
+    out += static_cast<char>(flags);
+    appendU32(out, stream & 0x7fffffff);
+    out.append(payload, size);
+}
+
+void appendSettings(std::string& out, const std::vector<std::pair<uint16_t, uint32_t>>& settings) {
+    std::string payload;
+    for (const auto& [id, value] : settings) {
+        payload += static_cast<char>(id >> 8);
+        payload += static_cast<char>(id);
+        appendU32(payload, value);
+    }
+    appendFrame(out, FrameType::Settings, 0, 0, payload.data(), payload.size());
+}
+
+void appendWindowUpdate(std::string& out, uint32_t stream, uint32_t increment) {
+    std::string payload;
+    appendU32(payload, increment & 0x7fffffff);
+    appendFrame(out, FrameType::WindowUpdate, 0, stream, payload.data(), payload.size());
+}
+
+void appendRstStream(std::string& out, uint32_t stream, uint32_t code) {
+    std::string payload;
+    appendU32(payload, code);
+    appendFrame(out, FrameType::RstStream, 0, stream, payload.data(), payload.size());
+}
+
+void appendGoAway(std::string& out, uint32_t lastStream, uint32_t code) {
+    std::string payload;
+    appendU32(payload, lastStream & 0x7fffffff);
+    appendU32(payload, code);
+    appendFrame(out, FrameType::GoAway, 0, 0, payload.data(), payload.size());
+}
+
+void appendHeaders(std::string& out, uint32_t stream, const std::string& block, bool endStream,
+                   size_t maxFrame) {
+    size_t first = std::min(block.size(), maxFrame);
+    uint8_t flags = (endStream ? flags::kEndStream : 0) | (first == block.size() ? flags::kEndHeaders : 0);
+    appendFrame(out, FrameType::Headers, flags, stream, block.data(), first);
+    for (size_t at = first; at < block.size();) {
+        size_t take = std::min(block.size() - at, maxFrame);
+        appendFrame(out, FrameType::Continuation, at + take == block.size() ? flags::kEndHeaders : 0,
+                    stream, block.data() + at, take);
+        at += take;
+    }
+}
+
+bool unpad(const Frame& frame, const char*& data, size_t& size) {
+    data = frame.payload;
+    size = frame.length;
+    size_t padding = 0;
+    if (frame.flags & flags::kPadded) {
+        if (size < 1) return false;
+        padding = static_cast<uint8_t>(data[0]);
+        ++data;
+        --size;
+    }
+    if (frame.type == FrameType::Headers && (frame.flags & flags::kPriority)) {
+        if (size < 5) return false;
+        data += 5;
+        size -= 5;
+    }
+    if (padding > size) return false;
+    size -= padding;
+    return true;
+}
+
+const std::pair<std::string, std::string>* DynamicTable::at(size_t index) const {
+    return index < entries_.size() ? &entries_[index] : nullptr;
+}
+
+void DynamicTable::add(std::string name, std::string value) {
+    size_t entrySize = name.size() + value.size() + kEntryOverhead;
+    if (entrySize > maxSize_) {
+        // Too big to hold: adding it just empties the table
+        entries_.clear();
+        size_ = 0;
+        return;
+    }
+    size_ += entrySize;
+    entries_.emplace_front(std::move(name), std::move(value));
+    evict();
+}
+
+void DynamicTable::resize(size_t maxSize) {
+    maxSize_ = maxSize;
+    evict();
+}
+
+void DynamicTable::evict() {
+    while (size_ > maxSize_ && !entries_.empty()) {
+        const auto& oldest = entries_.back();
+        size_ -= oldest.first.size() + oldest.second.size() + kEntryOverhead;
+        entries_.pop_back();
+    }
+}
+
+void Encoder::setMaxTableSize(size_t size) {
+    size = std::min<size_t>(size, kDefaultTableSize);
+    if (size == table_.maxSize()) return;
+    table_.resize(size);
+    resized_ = true;
+}
+
+void Encoder::encode(const HeaderList& headers, std::string& out) {
+    if (resized_) {
+        encodeInteger(out, 0x20, 5, table_.maxSize());
+        resized_ = false;
+    }
+    const StaticIndex& statics = staticIndex();
+    std::string key;
+    for (const auto& [name, value] : headers) {
+        key.assign(name).append(1, '\0').append(value);
+        auto field = statics.fields.find(key);
+        if (field != statics.fields.end()) {
+            encodeInteger(out, 0x80, 7, field->second);
+            continue;
+        }
+
+        size_t nameIndex = 0;
+        auto known = statics.names.find(name);
+        if (known != statics.names.end()) nameIndex = known->second;
+        bool found = false;
+        for (size_t i = 0; i < table_.count(); ++i) {
+            const auto* entry = table_.at(i);
+            if (entry->first != name) continue;
+            if (entry->second == value) {
+                encodeInteger(out, 0x80, 7, kStaticCount + 1 + i);
+                found = true;
+                break;
+            }
+            if (nameIndex == 0) nameIndex = kStaticCount + 1 + i;
+        }
+        if (found) continue;
+
+        bool indexed = worthIndexing(name, value);
+        if (indexed) {
+            encodeInteger(out, 0x40, 6, nameIndex);
+        } else {
+            encodeInteger(out, 0x00, 4, nameIndex);
+        }
+        if (nameIndex == 0) encodeString(out, name);
+        encodeString(out, value);
+        if (indexed) table_.add(name, value);
+    }
+}
+
+bool Decoder::decode(const char* data, size_t size, HeaderList& out, size_t maxListSize) {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t pos = 0;
+    size_t listSize = 0;
+    auto lookup = [this](size_t index) -> std::pair<std::string, std::string> {
+        if (index >= 1 && index <= kStaticCount) {
+            return {kStaticTable[index - 1].name, kStaticTable[index - 1].value};
+        }
+        const auto* entry = index > kStaticCount ? table_.at(index - kStaticCount - 1) : nullptr;
+        if (!entry) return {};
+        return *entry;
+    };
+    auto known = [this](size_t index) {
+        return index >= 1 && index <= kStaticCount + table_.count();
+    };
+
+    while (pos < size) {
+        uint8_t first = bytes[pos];
+        size_t index;
+        std::string name, value;
+        if (first & 0x80) {
+            if (!decodeInteger(bytes, size, pos, 7, index) || !known(index)) return false;
+            std::tie(name, value) = lookup(index);
+        } else if ((first & 0xe0) == 0x20) {
+            // Table size update, within what SETTINGS_HEADER_TABLE_SIZE allows
+            size_t tableSize;
+            if (!decodeInteger(bytes, size, pos, 5, tableSize) || tableSize > kDefaultTableSize) {
+                return false;
+            }
+            table_.resize(tableSize);
+            continue;
+        } else {
+            bool indexed = first & 0x40;
+            if (!decodeInteger(bytes, size, pos, indexed ? 6 : 4, index)) return false;
+            if (index == 0) {
+                if (!decodeString(bytes, size, pos, name)) return false;
+            } else if (known(index)) {
+                name = lookup(index).first;
+            } else {
+                return false;
+            }
+            if (!decodeString(bytes, size, pos, value)) return false;
+            if (indexed) table_.add(name, value);
+        }
+        listSize += name.size() + value.size() + kEntryOverhead;
+        if (listSize > maxListSize) return false;
+        out.emplace_back(std::move(name), std::move(value));
+    }
+    return true;
+}
+
+}  // namespace http2
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// HTTP/2 framing and HPACK header compression (RFC 7540, RFC 7541), enough
+// for the cleartext h2c transport between the services: EventServer speaks
+// it to clients that open with the connection preface, and AsyncClient to
+// upstreams that advertise it. Both ends share these pieces; the stream
+// state machines live with each of them.
+//
+// Only what that transport needs is here. There is no server push, and
+// priorities are read past and otherwise ignored.
+namespace http2 {
+
+// What a client sends first, before its SETTINGS frame
+constexpr char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t kPrefaceSize = sizeof(kPreface) - 1;
+
+constexpr size_t kFrameHeaderSize = 9;
+constexpr uint32_t kDefaultWindow = 65535;
+constexpr uint32_t kDefaultMaxFrame = 16384;  // also the largest frame either end accepts
+constexpr int64_t kMaxWindow = 0x7fffffff;
+constexpr uint32_t kDefaultTableSize = 4096;
+
+enum class FrameType : uint8_t {
+    Data = 0x0,
+    Headers = 0x1,
+    Priority = 0x2,
+    RstStream = 0x3,
+    Settings = 0x4,
+    PushPromise = 0x5,
+    Ping = 0x6,
+    GoAway = 0x7,
+    WindowUpdate = 0x8,
+    Continuation = 0x9,
+};
+
+namespace flags {
+constexpr uint8_t kEndStream = 0x1;
+constexpr uint8_t kAck = 0x1;
+constexpr uint8_t kEndHeaders = 0x4;
+constexpr uint8_t kPadded = 0x8;
+constexpr uint8_t kPriority = 0x20;
+}  // namespace flags
+
+enum Setting : uint16_t {
+    kHeaderTableSize = 0x1,
+    kEnablePush = 0x2,
+    kMaxConcurrentStreams = 0x3,
+    kInitialWindowSize = 0x4,
+    kMaxFrameSize = 0x5,
+    kMaxHeaderListSize = 0x6,
+};
+
+enum ErrorCode : uint32_t {
+    kNoError = 0x0,
+    kProtocolError = 0x1,
+    kInternalError = 0x2,
+    kFlowControlError = 0x3,
+    kStreamClosed = 0x5,
+    kFrameSizeError = 0x6,
+    kRefusedStream = 0x7,
+    kCancel = 0x8,
+    kCompressionError = 0x9,
+};
+
+struct Frame {
+    uint32_t length = 0;
+    FrameType type = FrameType::Data;
+    uint8_t flags = 0;
+    uint32_t stream = 0;
+    const char* payload = nullptr;
+};
+
+// The frame starting at `data`, if all `size` bytes of it have arrived;
+// `frame.length` is set either way so an oversized frame can be refused
+bool parseFrame(const char* data, size_t size, Frame& frame);
+
+uint32_t readU32(const char* p);
+
+void appendFrame(std::string& out, FrameType type, uint8_t flags, uint32_t stream,
+                 const char* payload, size_t size);
+void appendSettings(std::string& out, const std::vector<std::pair<uint16_t, uint32_t>>& settings);
+void appendWindowUpdate(std::string& out, uint32_t stream, uint32_t increment);
+void appendRstStream(std::string& out, uint32_t stream, uint32_t code);
+void appendGoAway(std::string& out, uint32_t lastStream, uint32_t code);
+
+// A HEADERS frame, and CONTINUATION frames for whatever of `block` does not
+// fit in `maxFrame`
+void appendHeaders(std::string& out, uint32_t stream, const std::string& block, bool endStream,
+                   size_t maxFrame);
+
+// Strip the padding (and priority fields) a DATA or HEADERS frame may carry;
+// false if they claim more than the payload holds
+bool unpad(const Frame& frame, const char*& data, size_t& size);
+
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+// Entries added by the header blocks so far, newest first, evicted past
+// the size limit (32 bytes of overhead per entry, as RFC 7541 counts it)
+class DynamicTable {
+public:
+    const std::pair<std::string, std::string>* at(size_t index) const;
+    size_t count() const { return entries_.size(); }
+    void add(std::string name, std::string value);
+    void resize(size_t maxSize);
+    size_t maxSize() const { return maxSize_; }
+
+private:
+    void evict();
+
+    std::deque<std::pair<std::string, std::string>> entries_;
+    size_t size_ = 0;
+    size_t maxSize_ = kDefaultTableSize;
+};
+
+// One direction's HPACK state; a connection has an encoder for what it
+// sends and a decoder for what it receives, and every block has to pass
+// through them in the order it goes on the wire
+class Encoder {
+public:
+    // Fields already in the tables go out as a one-byte index; the rest are
+    // added to the dynamic table, except values that rarely repeat
+    void encode(const HeaderList& headers, std::string& out);
+
+    // The peer's SETTINGS_HEADER_TABLE_SIZE; announced at the next block
+    void setMaxTableSize(size_t size);
+
+private:
+    DynamicTable table_;
+    bool resized_ = false;
+};
+
+class Decoder {
+public:
+    // False on a malformed block, after which the connection's header state
+    // is lost (a COMPRESSION_ERROR). `maxListSize` bounds the decoded fields.
+    bool decode(const char* data, size_t size, HeaderList& out, size_t maxListSize);
+
+private:
+    DynamicTable table_;
+};
+
+}  // namespace http2
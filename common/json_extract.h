@@ -0,0 +1,274 @@
+#pragma once
+
+#include "json.hpp"
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Schema-aware extraction of integer fields from upstream JSON bodies.
+//
+// The internal responses are flat objects whose values are integers or
+// arrays of integers ({"value":N}, {"original":[...],"processed":[...]}).
+// FieldReader is a small push parser for exactly that shape: it consumes
+// the body in arbitrary chunks, writes bound fields straight into the
+// caller's variables and never builds a DOM. Anything outside the shape
+// (strings, floats, nesting, escapes) marks the reader failed, and
+// BodyExtractor then falls back to json::parse on the buffered bytes.
+namespace jsonextract {
+
+class FieldReader {
+public:
+    void bind(std::string_view key, int* scalar) { bindings_.push_back({key, scalar, nullptr}); }
+    void bind(std::string_view key, std::vector<int>* array) { bindings_.push_back({key, nullptr, array}); }
+
+    // Feed the next chunk; returns false once the input left the supported shape
+    bool feed(const char* data, size_t size) {
+        for (size_t i = 0; i < size && state_ != State::Failed; ++i) {
+            step(data[i]);
+        }
+        return state_ != State::Failed;
+    }
+
+    bool feed(std::string_view chunk) { return feed(chunk.data(), chunk.size()); }
+
+    // True when one complete object was read and every bound field was present
+    bool finish() {
+        if (state_ != State::Done) return false;
+        for (const Binding& b : bindings_) {
+            if (!b.seen) return false;
+        }
+        return true;
+    }
+
+    bool failed() const { return state_ == State::Failed; }
+
+    template <typename Fn>
+    void forEachBinding(Fn&& fn) {
+        for (Binding& b : bindings_) fn(b.key, b.scalar, b.array);
+    }
+
+private:
+    enum class State {
+        ObjectStart, KeyOrEnd, Key, Colon, Value, Number,
+        ArrayValueOrEnd, ArrayNumber, ArrayCommaOrEnd, CommaOrEnd, Done, Failed
+    };
+
+    struct Binding {
+        std::string_view key;
+        int* scalar;
+        std::vector<int>* array;
+        bool seen = false;
+    };
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    void fail() { state_ = State::Failed; }
+
+    void startNumber(char c) {
+        negative_ = (c == '-');
+        number_ = negative_ ? 0 : (c - '0');
+        digits_ = negative_ ? 0 : 1;
+    }
+
+    bool appendDigit(char c) {
+        number_ = number_ * 10 + (c - '0');
+        ++digits_;
+        // Anything beyond int range is left to the DOM parser
+        return number_ <= static_cast<long long>(INT_MAX) + 1;
+    }
+
+    bool endNumber(int& out) {
+        if (digits_ == 0) return false;
+        long long v = negative_ ? -number_ : number_;
+        if (v < INT_MIN || v > INT_MAX) return false;
+        out = static_cast<int>(v);
+        return true;
+    }
+
+    void beginValue() {
+        current_ = nullptr;
+        for (Binding& b : bindings_) {
+            if (b.key == std::string_view(key_, keyLength_)) {
+                current_ = &b;
+                break;
+            }
+        }
+        if (current_) {
+            current_->seen = true;
+            if (current_->array) current_->array->clear();
+        }
+    }
+
+    void step(char c) {
+        switch (state_) {
+            case State::ObjectStart:
+                if (c == '{') state_ = State::KeyOrEnd;
+                else if (!isSpace(c)) fail();
+                break;
+
+            case State::KeyOrEnd:
+                if (c == '"') { keyLength_ = 0; state_ = State::Key; }
+                else if (c == '}' && !afterComma_) state_ = State::Done;
+                else if (!isSpace(c)) fail();
+                break;
+
+            case State::Key:
+                if (c == '"') state_ = State::Colon;
+                else if (c == '\\' || keyLength_ == sizeof(key_)) fail();
+                else key_[keyLength_++] = c;
+                break;
+
+            case State::Colon:
+                if (c == ':') { beginValue(); state_ = State::Value; }
+                else if (!isSpace(c)) fail();
+                break;
+
+            case State::Value:
+                if (c == '-' || isDigit(c)) {
+                    if (current_ && current_->array) { fail(); break; }
+                    startNumber(c);
+                    state_ = State::Number;
+                } else if (c == '[') {
+                    if (current_ && current_->scalar) { fail(); break; }
+                    state_ = State::ArrayValueOrEnd;
+                    afterComma_ = false;
+                } else if (!isSpace(c)) {
+                    fail();
+                }
+                break;
+
+            case State::Number:
+                if (isDigit(c)) {
+                    if (!appendDigit(c)) fail();
+                } else {
+                    int v;
+                    if (!endNumber(v)) { fail(); break; }
+                    if (current_) *current_->scalar = v;
+                    state_ = State::CommaOrEnd;
+                    step(c);
+                }
+                break;
+
+            case State::ArrayValueOrEnd:
+                if (c == '-' || isDigit(c)) {
+                    startNumber(c);
+                    state_ = State::ArrayNumber;
+                } else if (c == ']' && !afterComma_) {
+                    state_ = State::CommaOrEnd;
+                } else if (!isSpace(c)) {
+                    fail();
+                }
+                break;
+
+            case State::ArrayNumber:
+                if (isDigit(c)) {
+                    if (!appendDigit(c)) fail();
+                } else {
+                    int v;
+                    if (!endNumber(v)) { fail(); break; }
+                    if (current_) current_->array->push_back(v);
+                    state_ = State::ArrayCommaOrEnd;
+                    step(c);
+                }
+                break;
+
+            case State::ArrayCommaOrEnd:
+                if (c == ',') { afterComma_ = true; state_ = State::ArrayValueOrEnd; }
+                else if (c == ']') state_ = State::CommaOrEnd;
+                else if (!isSpace(c)) fail();
+                break;
+
+            case State::CommaOrEnd:
+                if (c == ',') { afterComma_ = true; state_ = State::KeyOrEnd; }
+                else if (c == '}') state_ = State::Done;
+                else if (!isSpace(c)) fail();
+                break;
+
+            case State::Done:
+                if (!isSpace(c)) fail();
+                break;
+
+            case State::Failed:
+                break;
+        }
+    }
+
+    std::vector<Binding> bindings_;
+    Binding* current_ = nullptr;
+
+    State state_ = State::ObjectStart;
+    char key_[32];
+    size_t keyLength_ = 0;
+    bool afterComma_ = false;
+
+    bool negative_ = false;
+    long long number_ = 0;
+    int digits_ = 0;
+};
+
+// httplib ContentReceiver that parses the body while it streams in and keeps
+// the raw bytes, so finish() can fall back to the full parser when the
+// payload is not in the expected shape.
+class BodyExtractor {
+public:
+    FieldReader& fields() { return reader_; }
+
+    bool operator()(const char* data, size_t size) {
+        body_.append(data, size);
+        if (!reader_.failed()) reader_.feed(data, size);
+        return true;
+    }
+
+    // Receiver callable to pass to httplib::Client::Get
+    auto receiver() {
+        return [this](const char* data, size_t size) { return (*this)(data, size); };
+    }
+
+    // True when every bound field was filled; uses json::parse if streaming gave up
+    bool finish() {
+        if (reader_.finish()) return true;
+        return fallback();
+    }
+
+    const std::string& body() const { return body_; }
+
+private:
+    static bool toInt(const nlohmann::json& v, int& out) {
+        if (!v.is_number_integer()) return false;
+        long long n = v.get<long long>();
+        if (n < INT_MIN || n > INT_MAX) return false;
+        out = static_cast<int>(n);
+        return true;
+    }
+
+    bool fallback() {
+        nlohmann::json doc = nlohmann::json::parse(body_, nullptr, false);
+        if (!doc.is_object()) return false;
+
+        bool ok = true;
+        reader_.forEachBinding([&](std::string_view key, int* scalar, std::vector<int>* array) {
+            auto it = doc.find(std::string(key));
+            if (it == doc.end()) { ok = false; return; }
+            if (scalar) {
+                if (!toInt(*it, *scalar)) ok = false;
+                return;
+            }
+            if (!it->is_array()) { ok = false; return; }
+            array->clear();
+            for (const auto& v : *it) {
+                int n;
+                if (!toInt(v, n)) { ok = false; return; }
+                array->push_back(n);
+            }
+        });
+        return ok;
+    }
+
+    FieldReader reader_;
+    std::string body_;
+};
+
+}  // namespace jsonextract
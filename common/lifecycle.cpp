@@ -0,0 +1,140 @@
+#include "lifecycle.h"
+#include "logger.h"
+#include <poll.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// libgcov's flush entry point. It is only linked into -fprofile-generate
+// builds (the Makefiles force it in with -Wl,-u,__gcov_dump) and is null
+// everywhere else. A normal exit writes the profile on its own.
+extern "C" void __gcov_dump() __attribute__((weak));
+
+namespace lifecycle {
+
+namespace {
+
+std::atomic<bool> drainingFlag{false};
+std::mutex hooksMutex;
+std::vector<std::function<void()>> hooks;
+
+// Signal handlers only write a byte here; the watcher thread does the work
+int signalPipe[2] = {-1, -1};
+
+void onSignal(int) {
+    char byte = 1;
+    ssize_t written = write(signalPipe[1], &byte, 1);
+    (void)written;
+}
+
+// Skips static destructors, which may be what is stuck
+[[noreturn]] void exitNow(const char* reason) {
+    std::fprintf(stderr, "[WARN] %s, exiting now\n", reason);
+    std::fflush(stderr);
+    if (__gcov_dump) __gcov_dump();
+    std::_Exit(1);
+}
+
+// Block for the next stop signal; false if `timeout` (when >= 0) ran out first
+bool awaitSignal(int timeoutMs) {
+    pollfd fd{signalPipe[0], POLLIN, 0};
+    int ready;
+    do {
+        ready = poll(&fd, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) return false;
+    char byte;
+    return read(signalPipe[0], &byte, 1) == 1;
+}
+
+void drain(EventServer& svr, std::chrono::seconds delay) {
+    std::vector<std::function<void()>> pending;
+    {
+        std::lock_guard<std::mutex> lock(hooksMutex);
+        pending.swap(hooks);
+    }
+    for (auto& hook : pending) hook();
+
+    if (delay.count() > 0) {
+        LOG_INFO << "Draining: serving for " << static_cast<int64_t>(delay.count())
+                 << "s more with Connection: close";
+        std::this_thread::sleep_for(delay);
+    }
+    LOG_INFO << "Draining: no longer accepting connections, finishing requests in flight";
+    svr.stop();
+}
+
+}  // namespace
+
+bool draining() { return drainingFlag.load(std::memory_order_relaxed); }
+
+void onDrain(std::function<void()> hook) {
+    std::lock_guard<std::mutex> lock(hooksMutex);
+    hooks.push_back(std::move(hook));
+}
+
+void expose(httplib::Server& svr, const std::string& service) {
+    svr.Get("/ready", [service](const httplib::Request&, httplib::Response& res) {
+        bool ready = !draining();
+        res.status = ready ? 200 : 503;
+        res.set_content(std::string("{\"status\":\"") + (ready ? "ready" : "draining") +
+                            "\",\"service\":\"" + service + "\"}",
+                        "application/json");
+    });
+}
+
+void watch(EventServer& svr, const ServerOptions& opts) {
+    if (signalPipe[0] != -1) return;  // already watching a server
+    if (pipe(signalPipe) != 0) {
+        LOG_WARN << "Could not set up the stop signal pipe; SIGTERM will not drain";
+        return;
+    }
+
+    // Callers close connections to a draining pod after their current request.
+    // This runs after httplib has chosen its own Connection/Keep-Alive headers.
+    svr.set_post_routing_handler([](const httplib::Request&, httplib::Response& res) {
+        if (!draining() || res.get_header_value("Connection") == "close") return;
+        res.headers.erase("Keep-Alive");
+        res.set_header("Connection", "close");
+    });
+
+    struct sigaction action {};
+    action.sa_handler = onSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+
+    auto delay = std::chrono::seconds(std::max(opts.shutdownDelaySeconds, 0));
+    auto grace = std::chrono::seconds(std::max(opts.shutdownGraceSeconds, 1));
+    std::thread([&svr, delay, grace] {
+        while (!awaitSignal(-1)) {}
+        auto deadline = std::chrono::steady_clock::now() + grace;
+        drainingFlag.store(true);
+        LOG_INFO << "Stop signal received, draining (grace "
+                 << static_cast<int64_t>(grace.count()) << "s)";
+
+        // svr outlives the drain: serve() only returns once svr.stop() has run
+        std::thread(drain, std::ref(svr), delay).detach();
+
+        // A signal sent to both the process and its group arrives twice at
+        // once; only a later one means "stop now"
+        auto repeatsUntil = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+            if (!awaitSignal(static_cast<int>(std::max<int64_t>(left.count(), 0)))) break;
+            if (std::chrono::steady_clock::now() >= repeatsUntil) exitNow("Second stop signal");
+        }
+        exitNow("Drain did not finish within SHUTDOWN_GRACE_SECONDS");
+    }).detach();
+}
+
+}  // namespace lifecycle
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "event_server.h"
+#include "server_options.h"
+#include <functional>
+#include <string>
+
+// Graceful shutdown for rolling deploys.
+//
+// serve() installs SIGTERM/SIGINT handling. The first signal starts a drain:
+// /ready turns 503 (while /health stays up) so the pod leaves the Service
+// endpoints, the drain hooks run (the consumer stops its workers), and
+// replies carry `Connection: close` so callers' keep-alive pools let go of
+// this pod cleanly instead of having sockets reset under them. After
+// SHUTDOWN_DELAY_SECONDS the server stops accepting, finishes the requests
+// in flight and serve() returns.
+//
+// The delay must outlast the last caller that can still pick this pod.
+// Callers balance over the headless Service (EndpointSet), so a caller
+// drops the pod only at its next re-resolve after the readiness probe has
+// failed (periodSeconds * failureThreshold) and CoreDNS's cached record
+// has expired (its TTL, 5s by default). That requires:
+//
+//     SHUTDOWN_DELAY_SECONDS > probe time + DNS TTL + ENDPOINT_REFRESH_SECONDS
+//
+// With the manifests' 4s of probes and 3s refresh, that is 12s, and the
+// ConfigMap uses 15. A caller that dials the pod after it stopped
+// accepting charges the failure to its circuit breaker and retry budget.
+// A process still running SHUTDOWN_GRACE_SECONDS after the signal, or one
+// that gets a second signal, exits immediately.
+namespace lifecycle {
+
+// True from the first stop signal on; long-running handlers such as
+// streams use it to wind down
+bool draining();
+
+// Run `hook` when draining starts, before the server stops listening
+void onDrain(std::function<void()> hook);
+
+// Register GET /ready, which answers 503 once draining has started
+void expose(httplib::Server& svr, const std::string& service);
+
+// Drain `svr` on a stop signal, as described above; called by serve()
+void watch(EventServer& svr, const ServerOptions& opts);
+
+}  // namespace lifecycle
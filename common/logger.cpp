@@ -0,0 +1,98 @@
+#include "logger.h"
+
+namespace logging {
+
+Level parseLevel(const std::string& name) {
+    if (name == "debug") return Level::Debug;
+    if (name == "warn") return Level::Warn;
+    if (name == "error") return Level::Error;
+    return Level::Info;
+}
+
+const char* levelName(Level level) {
+    switch (level) {
+        case Level::Debug: return "debug";
+        case Level::Info: return "info";
+        case Level::Warn: return "warn";
+        case Level::Error: return "error";
+    }
+    return "info";
+}
+
+Logger::Logger() : queue_(kQueueCapacity), writer_([this] { run(); }) {}
+
+Logger::~Logger() { stop(); }
+
+void Logger::flush() {
+    uint64_t target = queued_.load(std::memory_order_relaxed);
+    while (written_.load(std::memory_order_acquire) < target &&
+           running_.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void Logger::stop() {
+    if (running_.exchange(false)) {
+        writer_.join();
+    }
+}
+
+void Logger::run() {
+    int idleRounds = 0;
+    uint64_t reportedDrops = 0;
+
+    while (true) {
+        bool wroteAny = drain();
+
+        // Surface drops in-band so they are visible without /metrics
+        uint64_t drops = dropped();
+        if (drops != reportedDrops) {
+            std::fprintf(stderr, "[WARN] Logger dropped %llu lines (ring full)\n",
+                         static_cast<unsigned long long>(drops - reportedDrops));
+            std::fflush(stderr);
+            reportedDrops = drops;
+        }
+
+        if (wroteAny) {
+            idleRounds = 0;
+            continue;
+        }
+        if (!running_.load(std::memory_order_acquire)) {
+            drain();
+            break;
+        }
+
+        // Back off while idle: spin briefly, then sleep up to a few ms
+        if (++idleRounds < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(idleRounds < 256 ? 1 : 5));
+        }
+    }
+}
+
+bool Logger::drain() {
+    bool wroteOut = false;
+    bool wroteErr = false;
+    uint64_t count = 0;
+
+    while (queue_.tryPopWith([&](Record& r) {
+        std::FILE* stream = r.level >= Level::Warn ? stderr : stdout;
+        std::fwrite(r.text, 1, r.length, stream);
+        std::fputc('\n', stream);
+        (stream == stderr ? wroteErr : wroteOut) = true;
+    })) {
+        ++count;
+    }
+
+    if (wroteOut) std::fflush(stdout);
+    if (wroteErr) std::fflush(stderr);
+    written_.fetch_add(count, std::memory_order_release);
+    return count > 0;
+}
+
+void configure(const std::string& level) {
+    Logger::instance().setLevel(parseLevel(level));
+}
+
+}  // namespace logging
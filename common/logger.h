@@ -0,0 +1,188 @@
+#pragma once
+
+#include "mpmc_queue.h"
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// Asynchronous logger shared by all services.
+//
+// Request handlers format a line into a stack buffer and push it onto a
+// lock-free ring; a background thread drains the ring and writes batches to
+// stdout (debug/info) or stderr (warn/error), flushing once per batch rather
+// than once per line. When the ring is full the line is dropped and counted
+// instead of stalling the caller. Typical use:
+//
+//     LOG_INFO << "Generated: " << value;
+//     LOG_SAMPLED(generatedSampler, logging::Level::Info) << "Generated: " << value;
+namespace logging {
+
+enum class Level { Debug = 0, Info = 1, Warn = 2, Error = 3 };
+
+Level parseLevel(const std::string& name);
+
+const char* levelName(Level level);
+
+// Longest line kept; longer lines are truncated
+constexpr size_t kMaxLineLength = 240;
+
+struct Record {
+    Level level;
+    uint16_t length;
+    char text[kMaxLineLength];
+};
+
+class Logger {
+public:
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    ~Logger();
+
+    void setLevel(Level level) { level_.store(static_cast<int>(level), std::memory_order_relaxed); }
+    Level level() const { return static_cast<Level>(level_.load(std::memory_order_relaxed)); }
+
+    bool enabled(Level level) const {
+        return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+    }
+
+    void submit(Level level, const char* text, size_t length) {
+        if (length > kMaxLineLength) length = kMaxLineLength;
+        bool queued = queue_.tryPushWith([&](Record& r) {
+            r.level = level;
+            r.length = static_cast<uint16_t>(length);
+            std::memcpy(r.text, text, length);
+        });
+        if (queued) {
+            queued_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Block until everything queued so far has been written
+    void flush();
+
+    // Drain the ring and stop the writer thread
+    void stop();
+
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    size_t capacity() const { return queue_.capacity(); }
+
+private:
+    static constexpr size_t kQueueCapacity = 4096;
+
+    Logger();
+
+    void run();
+
+    // Write every queued record; returns whether anything was written
+    bool drain();
+
+    std::atomic<int> level_{static_cast<int>(Level::Info)};
+    MpmcQueue<Record> queue_;
+    std::atomic<uint64_t> queued_{0};
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> running_{true};
+    std::thread writer_;
+};
+
+inline bool enabled(Level level) { return Logger::instance().enabled(level); }
+
+// Passes 1 in `every` calls; shared by all threads logging at one call site
+class Sampler {
+public:
+    explicit Sampler(uint32_t every = 1) : every_(every ? every : 1) {}
+
+    void setEvery(uint32_t every) { every_.store(every ? every : 1, std::memory_order_relaxed); }
+    uint32_t every() const { return every_.load(std::memory_order_relaxed); }
+
+    bool sample() {
+        uint32_t every = every_.load(std::memory_order_relaxed);
+        return every == 1 || count_.fetch_add(1, std::memory_order_relaxed) % every == 0;
+    }
+
+private:
+    std::atomic<uint32_t> every_;
+    std::atomic<uint64_t> count_{0};
+};
+
+// One log line, built in place and queued when it goes out of scope
+class LogLine {
+public:
+    explicit LogLine(Level level) : level_(level) {}
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    ~LogLine() { Logger::instance().submit(level_, buf_, length_); }
+
+    LogLine& operator<<(std::string_view text) {
+        size_t n = text.size() < room() ? text.size() : room();
+        std::memcpy(buf_ + length_, text.data(), n);
+        length_ += n;
+        return *this;
+    }
+
+    LogLine& operator<<(const char* text) { return *this << std::string_view(text); }
+    LogLine& operator<<(const std::string& text) { return *this << std::string_view(text); }
+
+    LogLine& operator<<(char c) {
+        if (room()) buf_[length_++] = c;
+        return *this;
+    }
+
+    LogLine& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+
+    template <typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
+    LogLine& operator<<(T value) {
+        auto result = std::to_chars(buf_ + length_, buf_ + kMaxLineLength, value);
+        if (result.ec == std::errc()) length_ = static_cast<size_t>(result.ptr - buf_);
+        return *this;
+    }
+
+    LogLine& operator<<(double value) {
+        char digits[32];
+        int n = std::snprintf(digits, sizeof(digits), "%g", value);
+        return n > 0 ? *this << std::string_view(digits, static_cast<size_t>(n)) : *this;
+    }
+
+private:
+    size_t room() const { return kMaxLineLength - length_; }
+
+    Level level_;
+    size_t length_ = 0;
+    char buf_[kMaxLineLength + 1];
+};
+
+// Apply LOG_LEVEL-style settings; call once at startup
+void configure(const std::string& level);
+
+}  // namespace logging
+
+// The level check happens before any formatting work
+#define LOG_AT(level) \
+    if (!::logging::enabled(level)) {} else ::logging::LogLine(level)
+
+#define LOG_DEBUG LOG_AT(::logging::Level::Debug)
+#define LOG_INFO LOG_AT(::logging::Level::Info)
+#define LOG_WARN LOG_AT(::logging::Level::Warn)
+#define LOG_ERROR LOG_AT(::logging::Level::Error)
+
+// Like LOG_AT, but only 1 in sampler.every() lines at this call site is kept
+#define LOG_SAMPLED(sampler, level) \
+    if (!::logging::enabled(level) || !(sampler).sample()) {} else ::logging::LogLine(level)
@@ -0,0 +1,163 @@
+#include "metrics.h"
+#include <cstdio>
+
+namespace metrics {
+
+Registry& Registry::instance() {
+    static Registry registry;
+    return registry;
+}
+
+void Registry::callback(const std::string& name, const std::string& help, const std::string& type,
+                        Labels labels, std::function<double()> fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Family& family = familyFor(name, help, type);
+    callbacks_.push_back(std::make_unique<std::function<double()>>(std::move(fn)));
+    family.series.push_back({formatLabels(labels), Kind::Callback, callbacks_.size() - 1});
+}
+
+std::vector<const Histogram*> Registry::histograms(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<const Histogram*> out;
+    for (const Family& family : families_) {
+        if (family.name != name) continue;
+        for (const Series& series : family.series) {
+            if (series.kind == Kind::Histogram) out.push_back(histograms_[series.index].get());
+        }
+    }
+    return out;
+}
+
+std::string Registry::render() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out;
+    out.reserve(8192);
+
+    for (const Family& family : families_) {
+        out += "# HELP " + family.name + " " + family.help + "\n";
+        out += "# TYPE " + family.name + " " + family.type + "\n";
+        for (const Series& series : family.series) {
+            switch (series.kind) {
+                case Kind::Counter:
+                    appendSample(out, family.name, series.labels,
+                                 static_cast<double>(counters_[series.index]->value()));
+                    break;
+                case Kind::Gauge:
+                    appendSample(out, family.name, series.labels,
+                                 static_cast<double>(gauges_[series.index]->value()));
+                    break;
+                case Kind::Callback:
+                    appendSample(out, family.name, series.labels, (*callbacks_[series.index])());
+                    break;
+                case Kind::Histogram:
+                    appendHistogram(out, family.name, series.labels,
+                                    histograms_[series.index]->snapshot());
+                    break;
+            }
+        }
+    }
+    return out;
+}
+
+Registry::Family& Registry::familyFor(const std::string& name, const std::string& help,
+                                      const std::string& type) {
+    for (Family& f : families_) {
+        if (f.name == name) return f;
+    }
+    families_.push_back({name, help, type, {}});
+    return families_.back();
+}
+
+std::string Registry::formatLabels(const Labels& labels) {
+    std::string out;
+    for (const auto& kv : labels) {
+        if (!out.empty()) out += ",";
+        out += kv.first + "=\"" + kv.second + "\"";
+    }
+    return out;
+}
+
+void Registry::appendNumber(std::string& out, double value) {
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%.17g", value);
+    out.append(buf, static_cast<size_t>(n));
+}
+
+void Registry::appendSample(std::string& out, const std::string& name, const std::string& labels,
+                            double value, const char* suffix) {
+    out += name;
+    out += suffix;
+    if (!labels.empty()) out += "{" + labels + "}";
+    out += " ";
+    appendNumber(out, value);
+    out += "\n";
+}
+
+void Registry::appendHistogram(std::string& out, const std::string& name,
+                               const std::string& labels, const Histogram::Snapshot& snap) {
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+
+    // Power-of-two boundaries from 1us upwards
+    for (uint64_t bound = 1; bucket < Histogram::kBuckets; bound <<= 1) {
+        while (bucket < Histogram::kBuckets && Histogram::upperBound(bucket) <= bound) {
+            cumulative += snap.counts[bucket++];
+        }
+        char le[32];
+        std::snprintf(le, sizeof(le), "%g", static_cast<double>(bound) / 1e6);
+        out += name + "_bucket{" + prefix + "le=\"" + le + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    out += name + "_bucket{" + prefix + "le=\"+Inf\"} " + std::to_string(snap.count) + "\n";
+    appendSample(out, name, labels, static_cast<double>(snap.sumMicros) / 1e6, "_sum");
+    appendSample(out, name, labels, static_cast<double>(snap.count), "_count");
+}
+
+EndpointMetrics::EndpointMetrics(const std::string& service, const std::string& path) {
+    Registry& r = Registry::instance();
+    static const char* classes[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    for (int i = 0; i < 5; ++i) {
+        requests_[i] = &r.counter("http_requests_total", "HTTP requests handled, by status class",
+                                  {{"service", service}, {"path", path}, {"code", classes[i]}});
+    }
+    latency_ = &r.histogram("http_request_duration_seconds", "HTTP request handling latency",
+                            {{"service", service}, {"path", path}});
+    inFlight_ = &r.gauge("http_requests_in_flight", "HTTP requests currently being handled",
+                         {{"service", service}, {"path", path}});
+    allocations_ = &r.counter("http_request_allocations_total",
+                              "Heap allocations made by request handlers",
+                              {{"service", service}, {"path", path}});
+    allocatedBytes_ = &r.counter("http_request_allocated_bytes_total",
+                                 "Bytes requested from the heap by request handlers",
+                                 {{"service", service}, {"path", path}});
+}
+
+UpstreamMetrics::UpstreamMetrics(const std::string& service, const std::string& upstream) {
+    Registry& r = Registry::instance();
+    Labels base = {{"service", service}, {"upstream", upstream}};
+    latency_ = &r.histogram("upstream_request_duration_seconds",
+                            "Latency of calls to upstream services", base);
+    Labels ok = base, error = base;
+    ok.push_back({"outcome", "success"});
+    error.push_back({"outcome", "error"});
+    success_ = &r.counter("upstream_requests_total", "Calls to upstream services", ok);
+    errors_ = &r.counter("upstream_requests_total", "Calls to upstream services", error);
+    inFlight_ = &r.gauge("upstream_requests_in_flight", "Calls to upstream services in progress",
+                         base);
+}
+
+void expose(httplib::Server& svr, const std::string& service) {
+    Registry& r = Registry::instance();
+    r.callback("log_lines_written_total", "Log lines written by the async logger", "counter",
+               {{"service", service}},
+               [] { return static_cast<double>(logging::Logger::instance().written()); });
+    r.callback("log_lines_dropped_total", "Log lines dropped because the ring was full", "counter",
+               {{"service", service}},
+               [] { return static_cast<double>(logging::Logger::instance().dropped()); });
+
+    svr.Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(Registry::instance().render(), "text/plain; version=0.0.4");
+    });
+}
+
+}  // namespace metrics
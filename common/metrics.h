@@ -0,0 +1,359 @@
+#pragma once
+
+#include "httplib.h"
+#include "arena.h"
+#include "event_server.h"
+#include "logger.h"
+#include "tracing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Prometheus metrics shared by all services.
+//
+// Counters and histograms are sharded: each thread is assigned one of
+// kShards cache-line-separated slots on first use and only ever increments
+// that slot with relaxed atomics, so recording on the request path never
+// contends with other workers. Shards are summed when /metrics is scraped.
+namespace metrics {
+
+constexpr size_t kShards = 16;
+
+inline size_t shardIndex() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return index;
+}
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) {
+        shards_[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const Shard& s : shards_) total += s.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    Shard shards_[kShards];
+};
+
+class Gauge {
+public:
+    void inc(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    void dec(int64_t n = 1) { value_.fetch_sub(n, std::memory_order_relaxed); }
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// HDR-style latency histogram over microseconds.
+//
+// Values below 8us get exact buckets; above that each power of two is split
+// into 8 linear sub-buckets, bounding the relative error at 12.5% from 1us
+// up to ~134s. Prometheus output collapses this to power-of-two `le`
+// boundaries; quantile() works on the full resolution.
+class Histogram {
+public:
+    static constexpr int kSubBucketBits = 3;
+    static constexpr uint64_t kSubBuckets = 1u << kSubBucketBits;
+    static constexpr int kExponents = 24;
+    static constexpr size_t kBuckets = kSubBuckets + kExponents * kSubBuckets;
+
+    struct Snapshot {
+        uint64_t counts[kBuckets] = {};
+        uint64_t count = 0;
+        uint64_t sumMicros = 0;
+
+        // Value (in microseconds) at quantile q, using bucket upper bounds.
+        // Nearest rank: the ceil(q * count)-th sample, so few samples do not
+        // pull high quantiles down to the low ones.
+        double quantile(double q) const {
+            if (count == 0) return 0;
+            double nearest = std::ceil(q * static_cast<double>(count) - 1e-9);
+            uint64_t rank = nearest > 1 ? static_cast<uint64_t>(nearest) : 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBuckets; ++i) {
+                seen += counts[i];
+                if (seen >= rank) return static_cast<double>(upperBound(i));
+            }
+            return static_cast<double>(upperBound(kBuckets - 1));
+        }
+
+        void merge(const Snapshot& other) {
+            for (size_t i = 0; i < kBuckets; ++i) counts[i] += other.counts[i];
+            count += other.count;
+            sumMicros += other.sumMicros;
+        }
+    };
+
+    static size_t bucketFor(uint64_t micros) {
+        if (micros < kSubBuckets) return static_cast<size_t>(micros);
+        int msb = 63 - __builtin_clzll(micros);
+        int exponent = msb - kSubBucketBits;
+        if (exponent >= kExponents) return kBuckets - 1;
+        uint64_t mantissa = micros >> exponent;  // in [8, 16)
+        return kSubBuckets + static_cast<size_t>(exponent) * kSubBuckets +
+               static_cast<size_t>(mantissa - kSubBuckets);
+    }
+
+    // Exclusive upper bound of a bucket, in microseconds
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < kSubBuckets) return bucket + 1;
+        size_t exponent = (bucket - kSubBuckets) / kSubBuckets;
+        uint64_t mantissa = kSubBuckets + (bucket - kSubBuckets) % kSubBuckets;
+        return (mantissa + 1) << exponent;
+    }
+
+    void record(uint64_t micros) {
+        Shard& s = shards_[shardIndex()];
+        s.counts[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+        s.sumMicros.fetch_add(micros, std::memory_order_relaxed);
+    }
+
+    void record(std::chrono::steady_clock::duration elapsed) {
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        record(static_cast<uint64_t>(micros < 0 ? 0 : micros));
+    }
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        for (size_t shard = 0; shard < kShards; ++shard) {
+            const Shard& s = shards_[shard];
+            for (size_t i = 0; i < kBuckets; ++i) {
+                uint64_t c = s.counts[i].load(std::memory_order_relaxed);
+                snap.counts[i] += c;
+                snap.count += c;
+            }
+            snap.sumMicros += s.sumMicros.load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counts[kBuckets] = {};
+        std::atomic<uint64_t> sumMicros{0};
+    };
+    std::unique_ptr<Shard[]> shards_{new Shard[kShards]};
+};
+
+// Records the time from construction to destruction into a histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() { histogram_.record(std::chrono::steady_clock::now() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class Registry {
+public:
+    static Registry& instance();
+
+    Counter& counter(const std::string& name, const std::string& help, Labels labels = {}) {
+        return add<Counter>(name, help, "counter", std::move(labels), counters_);
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help, Labels labels = {}) {
+        return add<Gauge>(name, help, "gauge", std::move(labels), gauges_);
+    }
+
+    Histogram& histogram(const std::string& name, const std::string& help, Labels labels = {}) {
+        return add<Histogram>(name, help, "histogram", std::move(labels), histograms_);
+    }
+
+    // Value computed at scrape time, e.g. pool or logger statistics
+    void callback(const std::string& name, const std::string& help, const std::string& type,
+                  Labels labels, std::function<double()> fn);
+
+    // The series of histogram family `name` registered so far, to read
+    // back. Not from a callback: those run under the registry's lock.
+    std::vector<const Histogram*> histograms(const std::string& name) const;
+
+    // Prometheus text exposition format (version 0.0.4)
+    std::string render() const;
+
+private:
+    enum class Kind { Counter, Gauge, Histogram, Callback };
+
+    struct Series {
+        std::string labels;  // pre-rendered `k="v",...` without braces
+        Kind kind;
+        size_t index;
+    };
+
+    struct Family {
+        std::string name;
+        std::string help;
+        std::string type;
+        std::vector<Series> series;
+    };
+
+    Registry() = default;
+
+    template <typename T> static Kind kindOf();
+
+    template <typename T>
+    T& add(const std::string& name, const std::string& help, const char* type, Labels labels,
+           std::vector<std::unique_ptr<T>>& store) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Family& family = familyFor(name, help, type);
+        std::string rendered = formatLabels(labels);
+        for (const Series& s : family.series) {
+            if (s.labels == rendered) return *store[s.index];
+        }
+        store.push_back(std::make_unique<T>());
+        family.series.push_back({rendered, kindOf<T>(), store.size() - 1});
+        return *store.back();
+    }
+
+    Family& familyFor(const std::string& name, const std::string& help, const std::string& type);
+
+    static std::string formatLabels(const Labels& labels);
+    static void appendNumber(std::string& out, double value);
+    static void appendSample(std::string& out, const std::string& name, const std::string& labels,
+                             double value, const char* suffix = "");
+    static void appendHistogram(std::string& out, const std::string& name, const std::string& labels,
+                                const Histogram::Snapshot& snap);
+
+    mutable std::mutex mutex_;
+    std::vector<Family> families_;
+    std::vector<std::unique_ptr<Counter>> counters_;
+    std::vector<std::unique_ptr<Gauge>> gauges_;
+    std::vector<std::unique_ptr<Histogram>> histograms_;
+    std::vector<std::unique_ptr<std::function<double()>>> callbacks_;
+};
+
+template <> inline Registry::Kind Registry::kindOf<Counter>() { return Kind::Counter; }
+template <> inline Registry::Kind Registry::kindOf<Gauge>() { return Kind::Gauge; }
+template <> inline Registry::Kind Registry::kindOf<Histogram>() { return Kind::Histogram; }
+
+// Request counters by status class, latency and in-flight gauge for one route
+class EndpointMetrics {
+public:
+    EndpointMetrics(const std::string& service, const std::string& path);
+
+    void begin() { inFlight_->inc(); }
+
+    void end(int status, std::chrono::steady_clock::duration elapsed) {
+        inFlight_->dec();
+        latency_->record(elapsed);
+        if (status == -1) status = 200;  // httplib fills in 200 after the handler returns
+        int cls = status / 100 - 1;
+        requests_[cls >= 0 && cls < 5 ? cls : 4]->inc();
+    }
+
+    // What one handler pass took from operator new
+    void allocated(const arena::Usage& usage) {
+        allocations_->inc(usage.allocations);
+        allocatedBytes_->inc(usage.bytes);
+    }
+
+private:
+    Counter* requests_[5];
+    Counter* allocations_;
+    Counter* allocatedBytes_;
+    Histogram* latency_;
+    Gauge* inFlight_;
+};
+
+// Wrap a handler so every call is counted and timed under `path`. A request
+// an EventServer::await() suspends is counted once, in flight from its first
+// pass to the end of the pass that answers it. Each pass runs in an
+// arena::Scope, and the allocations it makes are added up per route. With
+// tracing on, the request is also a server span named "GET <path>".
+template <typename Handler>
+httplib::Server::Handler instrument(const std::string& service, const std::string& path,
+                                    Handler handler) {
+    auto endpoint = std::make_shared<EndpointMetrics>(service, path);
+    auto spanName = std::make_shared<const std::string>("GET " + path);
+    return [endpoint, spanName, handler](const httplib::Request& req, httplib::Response& res) {
+        bool resumed = EventServer::resumed();
+        if (!resumed) endpoint->begin();
+        auto start = resumed ? EventServer::arrived() : std::chrono::steady_clock::now();
+        tracing::ServerSpan span(req, *spanName);
+        arena::Usage before = arena::threadUsage();
+        try {
+            arena::Scope scope;
+            handler(req, res);
+        } catch (...) {
+            endpoint->end(500, std::chrono::steady_clock::now() - start);
+            span.end(500);
+            throw;  // httplib turns this into its own 500 response
+        }
+        endpoint->allocated(arena::threadUsage() - before);
+        if (EventServer::suspended()) return;
+        endpoint->end(res.status, std::chrono::steady_clock::now() - start);
+        span.end(res.status);
+    };
+}
+
+// Timing and outcome counters for calls to one upstream service
+class UpstreamMetrics {
+public:
+    UpstreamMetrics(const std::string& service, const std::string& upstream);
+
+    // Start timing a call; finish it with Call::done(success)
+    class Call {
+    public:
+        explicit Call(UpstreamMetrics& m) : m_(m), start_(std::chrono::steady_clock::now()) {
+            m_.inFlight_->inc();
+        }
+        ~Call() { if (!finished_) done(false); }
+
+        Call(const Call&) = delete;
+        Call& operator=(const Call&) = delete;
+
+        void done(bool success) {
+            finished_ = true;
+            m_.inFlight_->dec();
+            m_.latency_->record(std::chrono::steady_clock::now() - start_);
+            (success ? m_.success_ : m_.errors_)->inc();
+        }
+
+    private:
+        UpstreamMetrics& m_;
+        std::chrono::steady_clock::time_point start_;
+        bool finished_ = false;
+    };
+
+    Call start() { return Call(*this); }
+
+private:
+    Histogram* latency_;
+    Counter* success_;
+    Counter* errors_;
+    Gauge* inFlight_;
+};
+
+// Register GET /metrics on a server, along with the shared logger statistics
+void expose(httplib::Server& svr, const std::string& service);
+
+}  // namespace metrics
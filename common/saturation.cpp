@@ -0,0 +1,163 @@
+#include "saturation.h"
+#include "config.h"
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace saturation {
+
+namespace {
+
+constexpr auto kSampleEvery = std::chrono::milliseconds(100);
+
+class Monitor {
+public:
+    Monitor(std::vector<std::pair<std::string, Signal>> signals,
+            std::vector<const metrics::Histogram*> latencies, const Config& cfg)
+        : cfg_(cfg), signals_(std::move(signals)), latencies_(std::move(latencies)),
+          sums_(signals_.size(), 0.0), values_(signals_.size() + 1) {
+        previous_ = latencySnapshot();
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~Monitor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    const std::vector<std::pair<std::string, Signal>>& signals() const { return signals_; }
+
+    // Last full window's mean of signal `i`; signals().size() is latency
+    double value(size_t i) const { return values_[i].load(std::memory_order_relaxed); }
+
+    double saturation() const {
+        double worst = 0;
+        for (const auto& v : values_) worst = std::max(worst, v.load(std::memory_order_relaxed));
+        return worst;
+    }
+
+private:
+    void run() {
+        auto windowStart = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!wake_.wait_for(lock, kSampleEvery, [this] { return stopping_; })) {
+            for (size_t i = 0; i < signals_.size(); ++i) sums_[i] += signals_[i].second();
+            ++samples_;
+            auto now = std::chrono::steady_clock::now();
+            if (now - windowStart < cfg_.window) continue;
+
+            windowStart = now;
+            for (size_t i = 0; i < signals_.size(); ++i) {
+                values_[i].store(sums_[i] / static_cast<double>(samples_), std::memory_order_relaxed);
+                sums_[i] = 0;
+            }
+            samples_ = 0;
+            values_.back().store(windowLatency(), std::memory_order_relaxed);
+        }
+    }
+
+    metrics::Histogram::Snapshot latencySnapshot() const {
+        metrics::Histogram::Snapshot all;
+        for (const metrics::Histogram* h : latencies_) all.merge(h->snapshot());
+        return all;
+    }
+
+    // p99 of the requests that finished since the last window, over the target
+    double windowLatency() {
+        if (cfg_.latencyTarget.count() <= 0) return 0;
+        metrics::Histogram::Snapshot now = latencySnapshot();
+        metrics::Histogram::Snapshot window = now;
+        for (size_t i = 0; i < metrics::Histogram::kBuckets; ++i) window.counts[i] -= previous_.counts[i];
+        window.count -= previous_.count;
+        previous_ = now;
+        double p99Micros = window.quantile(0.99);
+        return p99Micros / (static_cast<double>(cfg_.latencyTarget.count()) * 1000.0);
+    }
+
+    const Config cfg_;
+    const std::vector<std::pair<std::string, Signal>> signals_;
+    const std::vector<const metrics::Histogram*> latencies_;
+
+    // Sampler thread only
+    std::vector<double> sums_;
+    uint64_t samples_ = 0;
+    metrics::Histogram::Snapshot previous_;
+
+    std::vector<std::atomic<double>> values_;  // one per signal, then latency
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+std::unique_ptr<Monitor> monitor;
+
+}  // namespace
+
+Config loadConfig() {
+    Config cfg;
+    cfg.window = std::chrono::seconds(std::max(getEnvInt("SATURATION_WINDOW_SECONDS", 10), 1));
+    cfg.latencyTarget = std::chrono::milliseconds(std::max(getEnvInt("SATURATION_LATENCY_TARGET_MS", 0), 0));
+    return cfg;
+}
+
+std::string describe(const Config& cfg) {
+    std::ostringstream out;
+    out << cfg.window.count() << "s windows, latency target ";
+    if (cfg.latencyTarget.count() > 0) {
+        out << "p99 " << cfg.latencyTarget.count() << "ms";
+    } else {
+        out << "off";
+    }
+    return out.str();
+}
+
+void expose(EventServer& svr, const std::string& service, const ServerOptions& opts,
+            const Config& cfg, std::vector<std::pair<std::string, Signal>> extra) {
+    if (monitor) return;
+    EventServer::WorkerLoad* load = &svr.workerLoad();
+    double threads = static_cast<double>(std::max<size_t>(opts.threads, 1));
+    double queueRoom = opts.maxQueuedRequests > 0 ? static_cast<double>(opts.maxQueuedRequests) : threads;
+
+    std::vector<std::pair<std::string, Signal>> signals;
+    signals.emplace_back("workers", [load, threads] {
+        return std::max(load->busy.load(std::memory_order_relaxed), 0) / threads;
+    });
+    signals.emplace_back("queue", [load, queueRoom] {
+        return std::max(load->waiting.load(std::memory_order_relaxed), 0) / queueRoom;
+    });
+    for (auto& signal : extra) signals.push_back(std::move(signal));
+
+    metrics::Registry& r = metrics::Registry::instance();
+    monitor = std::make_unique<Monitor>(std::move(signals), r.histograms("http_request_duration_seconds"), cfg);
+    // Registered after the metrics registry exists, so the sampler stops
+    // before the histograms it reads are destroyed
+    std::atexit([] { monitor.reset(); });
+
+    Monitor* m = monitor.get();
+    const char* help = "Averaged load signals, 1 at capacity";
+    for (size_t i = 0; i < m->signals().size(); ++i) {
+        r.callback("saturation_signal", help, "gauge", {{"service", service}, {"signal", m->signals()[i].first}},
+                   [m, i] { return m->value(i); });
+    }
+    if (cfg.latencyTarget.count() > 0) {
+        size_t latency = m->signals().size();
+        r.callback("saturation_signal", help, "gauge", {{"service", service}, {"signal", "latency"}},
+                   [m, latency] { return m->value(latency); });
+    }
+    r.callback("saturation", "Largest saturation_signal: how close this pod is to capacity", "gauge",
+               {{"service", service}}, [m] { return m->saturation(); });
+}
+
+}  // namespace saturation
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "event_server.h"
+#include "server_options.h"
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How close a pod is to its capacity, as one number to autoscale on.
+//
+// Each signal is a ratio where 1 means the pod is at capacity:
+//
+//   workers  pool threads running a task, over SERVER_THREADS
+//   queue    tasks waiting for a thread, over SERVER_MAX_QUEUED_REQUESTS
+//            (or SERVER_THREADS when the queue is unbounded)
+//   latency  p99 of the instrumented routes over SATURATION_LATENCY_TARGET_MS
+//
+// plus any a service adds: the processor reports admitted requests over its
+// admission limit. A background thread samples the first two every 100ms
+// and averages them over SATURATION_WINDOW_SECONDS, and the p99 covers
+// only the requests finished in that window. The average is used because
+// a count read at scrape time is a single draw from a very noisy series.
+// /metrics shows each signal as saturation_signal{signal} and the largest
+// as saturation. A pod is as saturated as its scarcest resource, so
+// saturation is what the HorizontalPodAutoscalers target through
+// prometheus-adapter (k8s/autoscaling.yaml).
+namespace saturation {
+
+struct Config {
+    std::chrono::seconds window;
+    std::chrono::milliseconds latencyTarget;  // 0 leaves latency out
+};
+
+Config loadConfig();
+
+std::string describe(const Config& cfg);
+
+// A ratio sampled with the others, 1 at capacity
+using Signal = std::function<double()>;
+
+// Start sampling `svr` and register the gauges. Call once routes are
+// registered, so the instrumented ones count towards latency.
+void expose(EventServer& svr, const std::string& service, const ServerOptions& opts,
+            const Config& cfg, std::vector<std::pair<std::string, Signal>> extra = {});
+
+}  // namespace saturation
@@ -0,0 +1,158 @@
+#include "server_options.h"
+#include "config.h"
+#include "lifecycle.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+
+namespace {
+
+// httplib's pool for the threaded backend, counting into the server's
+// WorkerLoad as listenEvents does (httplib::ThreadPool is final)
+class CountingPool : public httplib::TaskQueue {
+public:
+    CountingPool(size_t threads, size_t maxQueued, EventServer::WorkerLoad& load)
+        : pool_(threads, maxQueued), load_(load) {}
+
+    bool enqueue(std::function<void()> fn) override {
+        load_.waiting.fetch_add(1, std::memory_order_relaxed);
+        EventServer::WorkerLoad* load = &load_;
+        if (pool_.enqueue([load, fn = std::move(fn)] {
+                EventServer::WorkerLoad::Running running(*load);
+                fn();
+            })) {
+            return true;
+        }
+        load_.waiting.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void shutdown() override { pool_.shutdown(); }
+
+private:
+    httplib::ThreadPool pool_;
+    EventServer::WorkerLoad& load_;
+};
+
+}  // namespace
+
+double cgroupCpuLimit() {
+    std::ifstream v2("/sys/fs/cgroup/cpu.max");
+    if (v2) {
+        std::string quota;
+        double period = 0;
+        if (v2 >> quota >> period && quota != "max" && period > 0) {
+            return std::stod(quota) / period;
+        }
+        return 0;
+    }
+
+    std::ifstream quotaFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream periodFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    double quota = 0, period = 0;
+    if (quotaFile >> quota && periodFile >> period && quota > 0 && period > 0) {
+        return quota / period;
+    }
+    return 0;
+}
+
+ServerOptions loadServerOptions() {
+    ServerOptions opts;
+    opts.cpuLimit = cgroupCpuLimit();
+
+    std::string backend = getEnv("SERVER_BACKEND", "threaded");
+    opts.backend = backend == "epoll" ? ServerBackend::Epoll : ServerBackend::Threaded;
+    if (backend != "epoll" && backend != "threaded") {
+        std::cerr << "Warning: unknown SERVER_BACKEND '" << backend << "', using threaded" << std::endl;
+    }
+    opts.reactors = static_cast<size_t>(std::max(getEnvInt("SERVER_REACTORS", 1), 1));
+
+    int threads = getEnvInt("SERVER_THREADS", 0);
+    if (threads > 0) {
+        opts.threads = static_cast<size_t>(threads);
+    } else {
+        // Handlers mostly wait on sockets, so run a few threads per granted core.
+        // httplib parks a worker on each keep-alive connection, so there the
+        // floor has to cover the connections a peer's pool keeps open, or new
+        // connections queue behind idle ones until those are recycled. The
+        // epoll backend only occupies a worker while a request is in progress.
+        double cores = opts.cpuLimit > 0 ? opts.cpuLimit
+                                         : static_cast<double>(std::thread::hardware_concurrency());
+        int perCpu = getEnvInt("SERVER_THREADS_PER_CPU", 4);
+        double derived = std::ceil(std::max(cores, 1.0 / perCpu) * perCpu);
+        size_t floor = opts.backend == ServerBackend::Epoll ? 4 : 16;
+        opts.threads = std::clamp<size_t>(static_cast<size_t>(derived), floor, 64);
+    }
+
+    opts.maxQueuedRequests = static_cast<size_t>(getEnvInt("SERVER_MAX_QUEUED_REQUESTS", 0));
+    opts.keepAliveMaxCount = static_cast<size_t>(getEnvInt("KEEP_ALIVE_MAX_COUNT", 100));
+    opts.keepAliveTimeoutSeconds = getEnvInt("KEEP_ALIVE_TIMEOUT_SECONDS", 5);
+    opts.readTimeoutSeconds = getEnvInt("READ_TIMEOUT_SECONDS", 5);
+    opts.writeTimeoutSeconds = getEnvInt("WRITE_TIMEOUT_SECONDS", 5);
+    opts.tcpNoDelay = getEnvBool("TCP_NODELAY", true);
+    opts.http2 = getEnvBool("SERVER_HTTP2", false);
+    if (opts.http2 && opts.backend != ServerBackend::Epoll) {
+        std::cerr << "Warning: SERVER_HTTP2 needs SERVER_BACKEND=epoll, serving HTTP/1.1 only" << std::endl;
+        opts.http2 = false;
+    }
+    opts.listenBacklog = getEnvInt("LISTEN_BACKLOG", 128);
+    opts.shutdownDelaySeconds = getEnvInt("SHUTDOWN_DELAY_SECONDS", 0);
+    opts.shutdownGraceSeconds = getEnvInt("SHUTDOWN_GRACE_SECONDS", 20);
+    return opts;
+}
+
+std::string describe(const ServerOptions& opts) {
+    std::ostringstream out;
+    if (opts.backend == ServerBackend::Epoll) {
+        out << "epoll (" << opts.reactors << (opts.reactors == 1 ? " reactor" : " reactors")
+            << (opts.http2 ? ", h2c), " : "), ");
+    }
+    out << opts.threads << " threads";
+    if (opts.cpuLimit > 0) out << " (cgroup limit " << opts.cpuLimit << " CPU)";
+    out << ", keep-alive " << opts.keepAliveMaxCount << " req/" << opts.keepAliveTimeoutSeconds << "s"
+        << ", timeouts r" << opts.readTimeoutSeconds << "s/w" << opts.writeTimeoutSeconds << "s"
+        << ", backlog " << opts.listenBacklog
+        << (opts.tcpNoDelay ? ", TCP_NODELAY" : "")
+        << ", drain " << opts.shutdownDelaySeconds << "s/grace " << opts.shutdownGraceSeconds << "s";
+    return out.str();
+}
+
+bool serve(EventServer& svr, const ServerOptions& opts, const std::string& host, int port) {
+    lifecycle::watch(svr, opts);
+
+    // Both backends answer with httplib's Keep-Alive headers
+    svr.set_keep_alive_max_count(opts.keepAliveMaxCount);
+    svr.set_keep_alive_timeout(opts.keepAliveTimeoutSeconds);
+    if (opts.backend == ServerBackend::Epoll) {
+        return svr.listenEvents(host, port, opts);
+    }
+
+    size_t threads = opts.threads;
+    size_t maxQueued = opts.maxQueuedRequests;
+    EventServer::WorkerLoad* load = &svr.workerLoad();
+    svr.new_task_queue = [threads, maxQueued, load] { return new CountingPool(threads, maxQueued, *load); };
+
+    svr.set_read_timeout(opts.readTimeoutSeconds, 0);
+    svr.set_write_timeout(opts.writeTimeoutSeconds, 0);
+    svr.set_tcp_nodelay(opts.tcpNoDelay);
+
+    auto listenSocket = std::make_shared<socket_t>(INVALID_SOCKET);
+    svr.set_socket_options([listenSocket](socket_t sock) {
+        httplib::default_socket_options(sock);
+        *listenSocket = sock;
+    });
+
+    if (!svr.bind_to_port(host, port)) {
+        return false;
+    }
+    if (*listenSocket != INVALID_SOCKET && opts.listenBacklog > 0) {
+        ::listen(*listenSocket, opts.listenBacklog);
+    }
+    return svr.listen_after_bind();
+}
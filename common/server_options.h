@@ -0,0 +1,49 @@
+#pragma once
+
+#include "event_server.h"
+#include <cstddef>
+#include <string>
+
+// Worker pool and socket tuning for the HTTP server, read from the
+// environment (ConfigMap). A SERVER_THREADS of 0 derives the pool size from
+// the container's cgroup CPU quota rather than the node's core count, which
+// is what std::thread::hardware_concurrency() (and so httplib's default)
+// reports inside a pod.
+enum class ServerBackend {
+    Threaded,  // httplib's listen: a pool thread per open connection
+    Epoll,     // EventServer::listenEvents: a pool thread per request in progress
+};
+
+struct ServerOptions {
+    ServerBackend backend;
+    size_t reactors;  // epoll threads for the epoll backend
+    size_t threads;
+    size_t maxQueuedRequests;
+    size_t keepAliveMaxCount;
+    int keepAliveTimeoutSeconds;
+    int readTimeoutSeconds;
+    int writeTimeoutSeconds;
+    bool tcpNoDelay;
+    bool http2;  // accept h2c as well (epoll backend only)
+    int listenBacklog;
+    double cpuLimit;  // cores from the cgroup quota, 0 when unlimited
+    int shutdownDelaySeconds;  // keep serving this long after SIGTERM (see lifecycle.h)
+    int shutdownGraceSeconds;  // exit regardless this long after SIGTERM
+};
+
+// CPU cores granted by the cgroup quota (v2 cpu.max or v1 cfs files), 0 if none
+double cgroupCpuLimit();
+
+ServerOptions loadServerOptions();
+
+std::string describe(const ServerOptions& opts);
+
+// Bind with the configured options and serve until the server is stopped,
+// on the backend SERVER_BACKEND selects.
+//
+// httplib hard-codes the listen(2) backlog at compile time; the listening
+// socket is captured through the socket-options hook so it can be re-armed
+// with LISTEN_BACKLOG once bound (Linux applies a repeated listen() call as
+// a backlog update). SIGTERM drains the server (lifecycle.h), after which
+// this returns true.
+bool serve(EventServer& svr, const ServerOptions& opts, const std::string& host, int port);
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Request coalescing with an optional short-lived result cache.
+//
+// Concurrent callers asking for the same key while a fetch is outstanding
+// wait for that fetch instead of starting their own, so a burst of
+// identical requests costs one upstream round trip. With a TTL, the last
+// successful result per key is also served for that long after it arrived.
+// Typical use:
+//
+//     auto outcome = flights.run(path, [&] { return fetchFromUpstream(path); });
+//     if (outcome.value->ok) ...
+//
+// V must expose `bool ok`; failed results are shared with the callers that
+// waited on them but never cached. Expired entries are dropped when they are
+// next looked up, and at most kMaxCacheEntries are kept, so callers choosing
+// the keys cannot grow the cache without bound.
+//
+// A blocked waiter gives up at its own `waitUntil` and gets Source::Expired
+// with no value; the leader's fetch carries on for the others. runAsync() is
+// the same for a fetch that completes through a callback, with waiters
+// queued instead of blocked. Those hold no thread and keep waiting for the
+// leader, so their wait is bounded by the leader's deadline rather than
+// their own.
+template <typename V>
+class SingleFlight {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Source { Fetched, Coalesced, Cached, Expired };
+
+    static constexpr size_t kMaxCacheEntries = 1024;
+
+    struct Outcome {
+        std::shared_ptr<const V> value;
+        Source source;
+    };
+
+    SingleFlight(bool coalesce, std::chrono::milliseconds ttl) : coalesce_(coalesce), ttl_(ttl) {}
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    template <typename Fn>
+    Outcome run(const std::string& key, Fn&& fetch, Clock::time_point waitUntil = Clock::time_point::max()) {
+        if (!coalesce_ && ttl_.count() <= 0) {
+            return {std::make_shared<const V>(fetch()), Source::Fetched};
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (auto cached = lookup(key)) return {std::move(cached), Source::Cached};
+
+        if (coalesce_) {
+            auto pending = inFlight_.find(key);
+            if (pending != inFlight_.end()) {
+                std::shared_future<std::shared_ptr<const V>> result = pending->second;
+                lock.unlock();
+                if (waitUntil != Clock::time_point::max() &&
+                    result.wait_until(waitUntil) == std::future_status::timeout) {
+                    return {nullptr, Source::Expired};
+                }
+                return {result.get(), Source::Coalesced};
+            }
+        }
+
+        // This caller leads the fetch; later arrivals wait on its future
+        std::promise<std::shared_ptr<const V>> promise;
+        if (coalesce_) inFlight_[key] = promise.get_future().share();
+        lock.unlock();
+
+        std::shared_ptr<const V> value;
+        try {
+            value = std::make_shared<const V>(fetch());
+        } catch (...) {
+            lock.lock();
+            if (coalesce_) inFlight_.erase(key);
+            lock.unlock();
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+
+        lock.lock();
+        if (coalesce_) inFlight_.erase(key);
+        store(key, value);
+        lock.unlock();
+
+        promise.set_value(value);
+        return {value, Source::Fetched};
+    }
+
+    // run() without blocking: `start(finish)` begins the fetch and calls
+    // `finish(V)` when it ends, on any thread. `done(Outcome)` runs inline
+    // for a cached value, otherwise where `finish` was called. Async callers
+    // coalesce with each other, not with run().
+    template <typename Start, typename Done>
+    void runAsync(const std::string& key, Start&& start, Done done) {
+        if (!coalesce_ && ttl_.count() <= 0) {
+            start([done](V value) {
+                done(Outcome{std::make_shared<const V>(std::move(value)), Source::Fetched});
+            });
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (auto cached = lookup(key)) {
+            lock.unlock();
+            done(Outcome{std::move(cached), Source::Cached});
+            return;
+        }
+        if (coalesce_) {
+            auto pending = waiting_.find(key);
+            if (pending != waiting_.end()) {
+                pending->second.push_back([done](std::shared_ptr<const V> value) {
+                    done(Outcome{std::move(value), Source::Coalesced});
+                });
+                return;
+            }
+            waiting_[key];  // this caller leads; later ones queue behind it
+        }
+        lock.unlock();
+
+        start([this, key, done](V result) {
+            auto value = std::make_shared<const V>(std::move(result));
+            std::vector<std::function<void(std::shared_ptr<const V>)>> waiters;
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (coalesce_) {
+                    auto pending = waiting_.find(key);
+                    waiters.swap(pending->second);
+                    waiting_.erase(pending);
+                }
+                store(key, value);
+            }
+            done(Outcome{value, Source::Fetched});
+            for (auto& waiter : waiters) waiter(value);
+        });
+    }
+
+    bool coalescing() const { return coalesce_; }
+    std::chrono::milliseconds ttl() const { return ttl_; }
+
+private:
+    struct Entry {
+        std::shared_ptr<const V> value;
+        Clock::time_point expires;
+    };
+
+    // Called with mutex_ held: the live cached value for `key`, if any
+    std::shared_ptr<const V> lookup(const std::string& key) {
+        if (ttl_.count() <= 0) return nullptr;
+        auto cached = cache_.find(key);
+        if (cached == cache_.end()) return nullptr;
+        if (Clock::now() >= cached->second.expires) {
+            cache_.erase(cached);
+            return nullptr;
+        }
+        return cached->second.value;
+    }
+
+    // Called with mutex_ held. A full cache is swept of expired entries
+    // first; if every entry is still live the new one is not kept.
+    void store(const std::string& key, const std::shared_ptr<const V>& value) {
+        if (ttl_.count() <= 0 || !value->ok) return;
+        auto now = Clock::now();
+        if (cache_.size() >= kMaxCacheEntries && cache_.find(key) == cache_.end()) {
+            for (auto it = cache_.begin(); it != cache_.end();) {
+                it = now >= it->second.expires ? cache_.erase(it) : std::next(it);
+            }
+            if (cache_.size() >= kMaxCacheEntries) return;
+        }
+        cache_[key] = {value, now + ttl_};
+    }
+
+    const bool coalesce_;
+    const std::chrono::milliseconds ttl_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const V>>> inFlight_;
+    std::unordered_map<std::string, Entry> cache_;
+    std::unordered_map<std::string,
+                       std::vector<std::function<void(std::shared_ptr<const V>)>>> waiting_;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Server-sent events framing for the /stream endpoints.
+//
+// Each event carries one JSON object on a single `data:` line; an optional
+// `event:` line marks out-of-band events such as a stream error. Parser is a
+// push parser so it can be fed straight from an httplib content receiver,
+// with events split across chunks at arbitrary byte boundaries.
+namespace sse {
+
+constexpr const char* kContentType = "text/event-stream";
+
+inline void appendEvent(std::string& out, std::string_view data) {
+    out += "data: ";
+    out.append(data.data(), data.size());
+    out += "\n\n";
+}
+
+inline void appendEvent(std::string& out, std::string_view event, std::string_view data) {
+    out += "event: ";
+    out.append(event.data(), event.size());
+    out += '\n';
+    appendEvent(out, data);
+}
+
+class Parser {
+public:
+    // Calls onEvent(event, data) for every complete event in the chunk;
+    // event is "message" unless the stream named it
+    template <typename Fn>
+    void feed(const char* data, size_t size, Fn&& onEvent) {
+        for (size_t i = 0; i < size; ++i) {
+            char c = data[i];
+            if (c != '\n') {
+                line_ += c;
+                continue;
+            }
+            if (!line_.empty() && line_.back() == '\r') line_.pop_back();
+            if (line_.empty()) {
+                dispatch(onEvent);
+            } else {
+                field();
+            }
+            line_.clear();
+        }
+    }
+
+private:
+    template <typename Fn>
+    void dispatch(Fn& onEvent) {
+        if (!data_.empty()) {
+            data_.pop_back();  // trailing newline added per data line
+            onEvent(std::string_view(event_.empty() ? "message" : event_), std::string_view(data_));
+        }
+        data_.clear();
+        event_.clear();
+    }
+
+    void field() {
+        if (line_[0] == ':') return;  // comment / keep-alive
+        size_t colon = line_.find(':');
+        std::string_view name(line_.data(), colon == std::string::npos ? line_.size() : colon);
+        std::string_view value;
+        if (colon != std::string::npos) {
+            value = std::string_view(line_).substr(colon + 1);
+            if (!value.empty() && value[0] == ' ') value.remove_prefix(1);
+        }
+        if (name == "data") {
+            data_.append(value.data(), value.size());
+            data_ += '\n';
+        } else if (name == "event") {
+            event_.assign(value.data(), value.size());
+        }
+    }
+
+    std::string line_;
+    std::string data_;
+    std::string event_;
+};
+
+}  // namespace sse
@@ -0,0 +1,410 @@
+#include "tracing.h"
+#include "config.h"
+#include "event_server.h"
+#include "json.hpp"
+#include "metrics.h"
+#include "mpmc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace tracing {
+
+namespace {
+
+// Set once by start(), before any handler runs
+std::atomic<bool> active{false};
+uint64_t seeds[3];
+uint64_t sampleThreshold = 0;  // a new trace is kept when its low id half is below this
+bool sampleAll = false;
+
+thread_local Context currentContext;
+
+// splitmix64's finaliser: spreads a counter over all 64 bits
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t nonZero(uint64_t id) { return id ? id : 1; }
+
+// Ids for spans that need not be reproducible, from a per-thread sequence
+uint64_t randomId() {
+    thread_local uint64_t state = mix(seeds[0] ^ std::hash<std::thread::id>()(std::this_thread::get_id()));
+    state += 0x9e3779b97f4a7c15ULL;
+    return nonZero(mix(state));
+}
+
+bool keep(uint64_t traceLow) { return sampleAll || traceLow < sampleThreshold; }
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;  // W3C allows lowercase only
+}
+
+bool parseHex(std::string_view text, uint64_t& out) {
+    uint64_t value = 0;
+    for (char c : text) {
+        int digit = hexDigit(c);
+        if (digit < 0) return false;
+        value = value << 4 | static_cast<uint64_t>(digit);
+    }
+    out = value;
+    return true;
+}
+
+void appendHex(std::string& out, uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[16];
+    for (int i = 15; i >= 0; --i) {
+        buf[i] = digits[value & 0xf];
+        value >>= 4;
+    }
+    out.append(buf, sizeof(buf));
+}
+
+int64_t unixNanos(std::chrono::system_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+// Finish `span` as having begun at `start` on the steady clock
+void stamp(Span& span, std::chrono::steady_clock::time_point start, std::string_view name) {
+    auto now = std::chrono::steady_clock::now();
+    span.endUnixNanos = unixNanos(std::chrono::system_clock::now());
+    span.startUnixNanos = span.endUnixNanos -
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    span.nameLength = static_cast<uint8_t>(std::min(name.size(), kMaxNameLength));
+    std::memcpy(span.name, name.data(), span.nameLength);
+}
+
+void appendQuotedHex(std::string& out, uint64_t value) {
+    out.push_back('"');
+    appendHex(out, value);
+    out.push_back('"');
+}
+
+// OTLP/JSON carries 64-bit integers as strings
+void appendQuotedInt(std::string& out, long long value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.push_back('"');
+    out.append(digits, static_cast<size_t>(result.ptr - digits));
+    out.push_back('"');
+}
+
+void appendIntAttribute(std::string& out, bool& first, const char* key, long long value) {
+    if (!first) out.push_back(',');
+    first = false;
+    out.append("{\"key\":\"").append(key).append("\",\"value\":{\"intValue\":");
+    appendQuotedInt(out, value);
+    out.append("}}");
+}
+
+class Exporter {
+public:
+    Exporter(const std::string& service, const Config& cfg)
+        : cfg_(cfg), queue_(cfg.bufferSpans), client_(cfg.endpoint) {
+        client_.set_connection_timeout(std::chrono::seconds(1));
+        client_.set_read_timeout(std::chrono::seconds(5));
+        client_.set_write_timeout(std::chrono::seconds(5));
+
+        nlohmann::json attributes = nlohmann::json::array();
+        attributes.push_back({{"key", "service.name"}, {"value", {{"stringValue", service}}}});
+        if (const char* pod = std::getenv("HOSTNAME")) {
+            attributes.push_back({{"key", "service.instance.id"}, {"value", {{"stringValue", pod}}}});
+        }
+        nlohmann::json resource = {{"attributes", std::move(attributes)}};
+        prefix_ = "{\"resourceSpans\":[{\"resource\":" + resource.dump() +
+                  ",\"scopeSpans\":[{\"scope\":{\"name\":\"cpp-k8-microservices\"},\"spans\":[";
+
+        metrics::Registry& r = metrics::Registry::instance();
+        metrics::Labels base = {{"service", service}};
+        metrics::Labels exported = base, dropped = base, failed = base;
+        exported.push_back({"result", "exported"});
+        dropped.push_back({"result", "dropped"});
+        failed.push_back({"result", "export_failed"});
+        const char* help = "Finished spans by what became of them";
+        exported_ = &r.counter("trace_spans_total", help, exported);
+        dropped_ = &r.counter("trace_spans_total", help, dropped);
+        failed_ = &r.counter("trace_spans_total", help, failed);
+        r.callback("trace_buffer_capacity", "Spans the export ring holds", "gauge", base,
+                   [this] { return static_cast<double>(queue_.capacity()); });
+
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~Exporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    void push(const Span& span) {
+        if (!queue_.tryPush(span)) dropped_->inc();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            wake_.wait_for(lock, cfg_.exportInterval, [this] { return stopping_; });
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+    // Send everything on the ring, a batch per request
+    void drain() {
+        std::vector<Span> batch;
+        batch.reserve(cfg_.batchSpans);
+        for (;;) {
+            batch.clear();
+            Span span;
+            while (batch.size() < cfg_.batchSpans && queue_.tryPop(span)) batch.push_back(span);
+            if (batch.empty()) return;
+            send(batch);
+            if (batch.size() < cfg_.batchSpans) return;
+        }
+    }
+
+    // A failed batch is counted and dropped; spans are not worth a backlog.
+    // The body is written straight out, as fast_json.h does for responses:
+    // the schema is fixed and this runs for every span the service records.
+    void send(const std::vector<Span>& batch) {
+        body_.assign(prefix_);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Span& s = batch[i];
+            if (i) body_.push_back(',');
+            body_.append("{\"traceId\":\"");
+            appendHex(body_, s.context.traceHigh);
+            appendHex(body_, s.context.traceLow);
+            body_.append("\",\"spanId\":");
+            appendQuotedHex(body_, s.context.spanId);
+            if (s.parentSpanId) {
+                body_.append(",\"parentSpanId\":");
+                appendQuotedHex(body_, s.parentSpanId);
+            }
+            // Names are route paths and service names; nothing to escape
+            body_.append(",\"name\":\"").append(s.name, s.nameLength);
+            body_.append("\",\"kind\":");
+            body_.push_back(static_cast<char>('0' + static_cast<int>(s.kind)));
+            body_.append(",\"startTimeUnixNano\":");
+            appendQuotedInt(body_, s.startUnixNanos);
+            body_.append(",\"endTimeUnixNano\":");
+            appendQuotedInt(body_, s.endUnixNanos);
+            body_.append(",\"attributes\":[");
+            bool first = true;
+            if (s.status > 0) appendIntAttribute(body_, first, "http.response.status_code", s.status);
+            if (s.attempt > 1) appendIntAttribute(body_, first, "http.request.resend_count", s.attempt - 1);
+            body_.push_back(']');
+            // STATUS_CODE_ERROR for 5xx and, on the client side, no reply at all
+            if (s.status >= 500 || (s.status == 0 && s.kind == Kind::Client)) {
+                body_.append(",\"status\":{\"code\":2}");
+            }
+            body_.push_back('}');
+        }
+        body_.append("]}]}]}");
+
+        auto res = client_.Post("/v1/traces", body_, "application/json");
+        if (res && res->status / 100 == 2) {
+            exported_->inc(batch.size());
+            warned_ = false;
+            return;
+        }
+        failed_->inc(batch.size());
+        if (!warned_) {
+            std::cerr << "Warning: span export to " << cfg_.endpoint << " failed ("
+                      << (res ? "status " + std::to_string(res->status) : httplib::to_string(res.error()))
+                      << "); dropping spans until it recovers" << std::endl;
+            warned_ = true;
+        }
+    }
+
+    const Config cfg_;
+    MpmcQueue<Span> queue_;
+    httplib::Client client_;
+    std::string prefix_;  // everything before the first span
+    std::string body_;    // reused between batches
+    bool warned_ = false;
+
+    metrics::Counter* exported_;
+    metrics::Counter* dropped_;
+    metrics::Counter* failed_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+std::unique_ptr<Exporter> exporter;
+
+}  // namespace
+
+bool parse(std::string_view value, Context& out) {
+    // 00-<32 hex trace id>-<16 hex parent id>-<2 hex flags>
+    if (value.size() < 55 || value.substr(0, 3) != "00-" || value[35] != '-' || value[52] != '-') {
+        return false;
+    }
+    Context ctx;
+    uint64_t flags;
+    if (!parseHex(value.substr(3, 16), ctx.traceHigh) || !parseHex(value.substr(19, 16), ctx.traceLow) ||
+        !parseHex(value.substr(36, 16), ctx.spanId) || !parseHex(value.substr(53, 2), flags)) {
+        return false;
+    }
+    if (!ctx.valid() || ctx.spanId == 0) return false;
+    ctx.sampled = flags & 1;
+    out = ctx;
+    return true;
+}
+
+std::string format(const Context& ctx) {
+    std::string out;
+    out.reserve(55);
+    out.append("00-");
+    appendHex(out, ctx.traceHigh);
+    appendHex(out, ctx.traceLow);
+    out.push_back('-');
+    appendHex(out, ctx.spanId);
+    out.append(ctx.sampled ? "-01" : "-00");
+    return out;
+}
+
+Config loadConfig() {
+    Config cfg;
+    cfg.endpoint = getEnv("TRACE_OTLP_ENDPOINT", "");
+    while (!cfg.endpoint.empty() && cfg.endpoint.back() == '/') cfg.endpoint.pop_back();
+    try {
+        cfg.sampleRatio = std::stod(getEnv("TRACE_SAMPLE_RATIO", "0"));
+    } catch (const std::exception&) {
+        std::cerr << "Warning: TRACE_SAMPLE_RATIO is not a number, using 0" << std::endl;
+        cfg.sampleRatio = 0;
+    }
+    cfg.sampleRatio = std::clamp(cfg.sampleRatio, 0.0, 1.0);
+    cfg.bufferSpans = static_cast<size_t>(std::max(getEnvInt("TRACE_BUFFER_SPANS", 16384), 64));
+    cfg.batchSpans = static_cast<size_t>(std::max(getEnvInt("TRACE_EXPORT_BATCH", 512), 1));
+    cfg.exportInterval = std::chrono::milliseconds(std::max(getEnvInt("TRACE_EXPORT_INTERVAL_MS", 1000), 10));
+    return cfg;
+}
+
+std::string describe(const Config& cfg) {
+    if (cfg.endpoint.empty()) return "off";
+    std::ostringstream out;
+    out << "OTLP " << cfg.endpoint << ", sampling " << cfg.sampleRatio << " of new traces, buffer "
+        << cfg.bufferSpans << " spans, batches of " << cfg.batchSpans << " every "
+        << cfg.exportInterval.count() << "ms";
+    return out.str();
+}
+
+void start(const std::string& service, const Config& cfg) {
+    if (cfg.endpoint.empty() || exporter) return;
+    std::random_device rd;
+    for (uint64_t& seed : seeds) seed = static_cast<uint64_t>(rd()) << 32 | rd();
+    sampleAll = cfg.sampleRatio >= 1.0;
+    sampleThreshold = static_cast<uint64_t>(cfg.sampleRatio * 18446744073709551616.0);
+    exporter = std::make_unique<Exporter>(service, cfg);
+    // Registered after the metrics registry exists, so this runs (sending
+    // what is left on the ring) before the registry is destroyed
+    std::atexit([] { exporter.reset(); });
+    active.store(true, std::memory_order_release);
+}
+
+bool enabled() { return active.load(std::memory_order_relaxed); }
+
+Context current() { return currentContext; }
+
+Context outgoing() {
+    if (!enabled()) return {};
+    if (currentContext.valid()) return currentContext;
+    if (!sampleAll && sampleThreshold == 0) return {};
+    Context root;
+    root.traceHigh = randomId();
+    root.traceLow = randomId();
+    root.sampled = keep(root.traceLow);
+    return root;
+}
+
+void record(const Span& span) {
+    if (exporter) exporter->push(span);
+}
+
+ServerSpan::ServerSpan(const httplib::Request& req, std::string_view name)
+    : previous_(currentContext), name_(name) {
+    if (!enabled()) return;
+    start_ = EventServer::arrived();
+
+    // Every id comes from the request's number, so a resumed pass lands on
+    // the same span (and, for a new trace, the same sampling decision)
+    uint64_t request = EventServer::requestId();
+    auto header = req.headers.find(kHeader);
+    if (header != req.headers.end() && parse(header->second, context_)) {
+        parentSpanId_ = context_.spanId;
+    } else if (sampleAll || sampleThreshold != 0) {
+        context_.traceHigh = nonZero(mix(seeds[0] ^ request));
+        context_.traceLow = mix(seeds[1] ^ request);
+        context_.sampled = keep(context_.traceLow);
+    } else {
+        return;
+    }
+    context_.spanId = nonZero(mix(seeds[2] ^ request));
+    currentContext = context_;
+    active_ = true;
+}
+
+ServerSpan::~ServerSpan() { currentContext = previous_; }
+
+void ServerSpan::end(int status) {
+    if (!active_ || !context_.sampled || EventServer::suspended()) return;
+    Span span;
+    span.context = context_;
+    span.parentSpanId = parentSpanId_;
+    span.status = status == -1 ? 200 : status;  // httplib fills in 200 after the handler returns
+    span.attempt = 0;
+    span.kind = Kind::Server;
+    stamp(span, start_, name_);
+    record(span);
+}
+
+ClientSpan::ClientSpan(const Context& parent, std::string_view name, int attempt)
+    : name_(name), attempt_(attempt) {
+    if (!parent.valid()) return;
+    context_ = parent;
+    context_.spanId = randomId();
+    parentSpanId_ = parent.spanId;
+    start_ = std::chrono::steady_clock::now();
+}
+
+void ClientSpan::inject(httplib::Headers& headers) const {
+    if (context_.valid()) headers.emplace(kHeader, format(context_));
+}
+
+void ClientSpan::end(const httplib::Result& result) const {
+    if (!context_.sampled) return;
+    Span span;
+    span.context = context_;
+    span.parentSpanId = parentSpanId_;
+    span.status = result ? result->status : 0;
+    span.attempt = static_cast<uint16_t>(attempt_);
+    span.kind = Kind::Client;
+    stamp(span, start_, name_);
+    record(span);
+}
+
+}  // namespace tracing
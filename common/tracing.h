@@ -0,0 +1,139 @@
+#pragma once
+
+#include "httplib.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Distributed tracing across the consumer -> processor -> producer hops.
+//
+// Every call carries a W3C `traceparent` header naming the trace and the
+// caller's span. metrics::instrument() opens a server span around each hot
+// handler, a child of the incoming traceparent when there is one, and
+// UpstreamClient opens a client span for every attempt it sends, passing
+// that span on in its own traceparent. A finished span is a fixed-size
+// record copied onto a lock-free ring, and a background thread sends the
+// ring to an OTLP/HTTP collector in batches (JSON to
+// TRACE_OTLP_ENDPOINT/v1/traces). When the ring is full the span is dropped
+// and counted; the request never waits on the exporter.
+//
+// Sampling is decided at the head of the trace: a service that starts one
+// (a request without a traceparent, or the consumer's background calls)
+// keeps TRACE_SAMPLE_RATIO of them, and every hop after it follows the
+// sampled flag it was sent. The decision is a function of the trace id, so
+// a suspended request gets the same ids and decision on every pass. Without
+// TRACE_OTLP_ENDPOINT tracing is off entirely: no header is read or sent,
+// and each span costs a branch. With an endpoint but a ratio of 0, only
+// traces a caller sampled are recorded.
+namespace tracing {
+
+constexpr const char* kHeader = "traceparent";
+
+struct Context {
+    uint64_t traceHigh = 0;  // 128-bit trace id
+    uint64_t traceLow = 0;
+    uint64_t spanId = 0;     // the span this context was taken from; 0 for a new trace
+    bool sampled = false;
+
+    bool valid() const { return (traceHigh | traceLow) != 0; }
+};
+
+// Read a version-00 traceparent value; false (and `out` untouched) if malformed
+bool parse(std::string_view value, Context& out);
+
+// traceparent value for `ctx`
+std::string format(const Context& ctx);
+
+struct Config {
+    std::string endpoint;  // collector base URL, e.g. http://otel-collector:4318; empty is off
+    double sampleRatio;    // of the traces this service starts
+    size_t bufferSpans;    // spans the ring holds before dropping
+    size_t batchSpans;     // spans per export request
+    std::chrono::milliseconds exportInterval;
+};
+
+Config loadConfig();
+
+std::string describe(const Config& cfg);
+
+// Start exporting spans for `service`; until this runs with an endpoint,
+// everything below is a no-op. Call once, before serving.
+void start(const std::string& service, const Config& cfg);
+
+bool enabled();
+
+// The server span of the handler running on this thread, if any
+Context current();
+
+// Where an outgoing call hangs off: the current server span, or else a new
+// trace sampled at TRACE_SAMPLE_RATIO. Invalid when tracing is off, or when
+// there is no current span and the ratio is 0.
+Context outgoing();
+
+enum class Kind : uint8_t { Server = 2, Client = 3 };  // OTLP SpanKind
+
+constexpr size_t kMaxNameLength = 40;
+
+// One finished span as it sits on the ring
+struct Span {
+    Context context;  // context.spanId is this span's id
+    uint64_t parentSpanId;
+    int64_t startUnixNanos;
+    int64_t endUnixNanos;
+    int status;  // HTTP status; 0 if the call got no reply
+    uint16_t attempt;  // client spans: 1 for the first try
+    Kind kind;
+    uint8_t nameLength;
+    char name[kMaxNameLength];
+};
+
+// Queue a finished span for export without blocking; dropped if the ring is full
+void record(const Span& span);
+
+// The span for one request a handler serves. Makes its context current on
+// this thread for the handler's pass and records the span at end() unless
+// the pass was suspended.
+class ServerSpan {
+public:
+    ServerSpan(const httplib::Request& req, std::string_view name);
+    ~ServerSpan();
+
+    ServerSpan(const ServerSpan&) = delete;
+    ServerSpan& operator=(const ServerSpan&) = delete;
+
+    void end(int status);
+
+private:
+    Context previous_;
+    Context context_;
+    uint64_t parentSpanId_ = 0;
+    std::string_view name_;
+    // When the request arrived: its first pass under listenEvents, this
+    // pass under httplib's listen, where arrived() is simply now
+    std::chrono::steady_clock::time_point start_;
+    bool active_ = false;
+};
+
+// The span for one attempt of an outgoing call under `parent` (from
+// outgoing(), taken when the call began). A no-op for an invalid parent.
+// Copyable, so an async attempt can carry it to its reply.
+class ClientSpan {
+public:
+    ClientSpan(const Context& parent, std::string_view name, int attempt);
+
+    // Add this span's traceparent to the attempt's headers
+    void inject(httplib::Headers& headers) const;
+
+    void end(const httplib::Result& result) const;
+
+private:
+    Context context_;
+    uint64_t parentSpanId_ = 0;
+    std::string_view name_;
+    int attempt_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace tracing
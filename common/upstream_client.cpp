@@ -0,0 +1,219 @@
+#include "upstream_client.h"
+#include "config.h"
+#include <sstream>
+
+namespace upstream {
+
+namespace {
+
+// Keep-alive connections parked per upstream pod on the async loop; enough
+// for the hundreds of calls a loop keeps in flight to reuse their sockets
+constexpr size_t kAsyncIdlePerHost = 256;
+
+// The wait a 429 or 503 asks for in Retry-After. Only the delta-seconds
+// form is read; the services never send an HTTP date.
+std::chrono::milliseconds shedDelay(const Outcome& outcome) {
+    const auto& res = outcome.result;
+    if (!res || (res->status != 429 && res->status != 503)) return std::chrono::milliseconds(0);
+    try {
+        long long seconds = std::stoll(res->get_header_value("Retry-After"));
+        return std::chrono::seconds(std::max(seconds, 0LL));
+    } catch (const std::exception&) {
+        return std::chrono::milliseconds(0);
+    }
+}
+
+}  // namespace
+
+// One callAsync() across its attempts
+struct UpstreamClient::AsyncCall {
+    Deadline deadline;
+    httplib::Headers headers;
+    std::function<AsyncRequest()> attempt;
+    std::function<void(Outcome)> done;
+    tracing::Context trace;
+    Outcome outcome;
+    int tries = 0;
+};
+
+Policy loadPolicy() {
+    Policy p;
+    p.timeout = std::chrono::milliseconds(getEnvInt("UPSTREAM_TIMEOUT_MS", 1000));
+    p.maxAttempts = std::max(getEnvInt("UPSTREAM_MAX_ATTEMPTS", 2), 1);
+    p.retryBackoff = std::chrono::milliseconds(getEnvInt("UPSTREAM_RETRY_BACKOFF_MS", 10));
+    p.retryRatio = std::stod(getEnv("RETRY_BUDGET_RATIO", "0.1"));
+    p.minRetriesPerSecond = std::stod(getEnv("RETRY_BUDGET_MIN_PER_SECOND", "5"));
+    p.breakerThreshold = getEnvInt("BREAKER_FAILURE_THRESHOLD", 5);
+    p.breakerOpen = std::chrono::milliseconds(getEnvInt("BREAKER_OPEN_MS", 2000));
+    p.async = getEnvBool("UPSTREAM_ASYNC", false);
+    p.http2 = getEnvBool("UPSTREAM_HTTP2", true);
+    return p;
+}
+
+std::string describe(const Policy& p) {
+    std::ostringstream out;
+    out << "timeout " << p.timeout.count() << "ms, " << p.maxAttempts << " attempts"
+        << ", retry budget " << p.retryRatio << " (min " << p.minRetriesPerSecond << "/s)"
+        << ", breaker ";
+    if (p.breakerThreshold > 0) {
+        out << p.breakerThreshold << " failures/" << p.breakerOpen.count() << "ms";
+    } else {
+        out << "off";
+    }
+    if (p.async) out << (p.http2 ? ", async, h2c" : ", async");
+    return out.str();
+}
+
+bool RetryBudget::withdraw() {
+    // Serialises the time-based refill; deposits never take the lock
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - refilled_).count();
+    refilled_ = now;
+    auto refill = static_cast<int64_t>(elapsed * minPerSecond_ * kScale);
+
+    int64_t current = tokens_.load(std::memory_order_relaxed);
+    for (;;) {
+        int64_t next = std::min(current + refill, cap_);
+        bool granted = next >= kScale;
+        if (granted) next -= kScale;
+        if (tokens_.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+            return granted;
+        }
+    }
+}
+
+UpstreamClient::UpstreamClient(EndpointSet& endpoints, const char* service, const char* upstream,
+                               const Policy& policy)
+    : endpoints_(endpoints),
+      policy_(policy),
+      spanName_(std::string("GET ") + upstream),
+      calls_(service, upstream),
+      breaker_(policy.breakerThreshold, policy.breakerOpen),
+      budget_(policy.retryRatio, policy.minRetriesPerSecond),
+      async_(policy.async ? std::make_unique<AsyncClient>(kAsyncIdlePerHost, policy.http2) : nullptr) {
+    metrics::Registry& r = metrics::Registry::instance();
+    metrics::Labels base = {{"service", service}, {"upstream", upstream}};
+    r.callback("upstream_circuit_state", "Circuit breaker state (0 closed, 1 half-open, 2 open)",
+               "gauge", base,
+               [this] { return static_cast<double>(static_cast<int>(breaker_.state())); });
+    r.callback("upstream_circuit_opened_total", "Times the circuit breaker opened", "counter",
+               base, [this] { return static_cast<double>(breaker_.opened()); });
+    metrics::Labels sent = base, denied = base, open = base, late = base;
+    sent.push_back({"result", "sent"});
+    denied.push_back({"result", "budget_exhausted"});
+    open.push_back({"reason", "circuit_open"});
+    late.push_back({"reason", "deadline"});
+    retriesSent_ = &r.counter("upstream_retries_total", "Retries of failed upstream calls", sent);
+    retriesDenied_ = &r.counter("upstream_retries_total", "Retries of failed upstream calls",
+                                denied);
+    rejectedOpen_ = &r.counter("upstream_fast_failures_total",
+                               "Upstream calls failed without being sent", open);
+    rejectedLate_ = &r.counter("upstream_fast_failures_total",
+                               "Upstream calls failed without being sent", late);
+
+    if (async_) {
+        AsyncClient* client = async_.get();
+        metrics::Labels hit = base, miss = base;
+        hit.push_back({"result", "hit"});
+        miss.push_back({"result", "miss"});
+        r.callback("upstream_async_connections", "Open connections on the async client loop",
+                   "gauge", base, [client] { return static_cast<double>(client->connections()); });
+        r.callback("upstream_async_http2_sessions", "Of those, HTTP/2 connections carrying streams",
+                   "gauge", base, [client] { return static_cast<double>(client->sessions()); });
+        r.callback("upstream_async_checkouts_total", "Async calls by whether a pooled connection was free",
+                   "counter", hit, [client] { return static_cast<double>(client->reuses()); });
+        r.callback("upstream_async_checkouts_total", "Async calls by whether a pooled connection was free",
+                   "counter", miss, [client] { return static_cast<double>(client->connects()); });
+    }
+}
+
+std::chrono::milliseconds UpstreamClient::admit(const Deadline& deadline, Outcome& outcome) {
+    auto remaining = deadline.remaining();
+    if (remaining.count() <= 0) {
+        rejectedLate_->inc();
+        outcome.failure = Failure::DeadlineExceeded;
+        return std::chrono::milliseconds(0);
+    }
+    if (!breaker_.allow()) {
+        rejectedOpen_->inc();
+        outcome.failure = Failure::CircuitOpen;
+        return std::chrono::milliseconds(0);
+    }
+    return remaining;
+}
+
+bool UpstreamClient::retry(int tries, const Deadline& deadline, Outcome& outcome,
+                           std::chrono::milliseconds& delay) {
+    bool failure = failed(outcome);
+    breaker_.record(!failure);
+    outcome.retryAfter = shedDelay(outcome);
+    if (!failure) {
+        outcome.failure = Failure::None;
+        return false;
+    }
+    outcome.failure = outcome.result ? Failure::Status
+                    : deadline.expired() ? Failure::DeadlineExceeded
+                                         : Failure::Transport;
+
+    // Coming straight back to a shedding upstream only adds to its load
+    if (outcome.retryAfter.count() > 0) return false;
+
+    if (tries >= policy_.maxAttempts || outcome.failure == Failure::DeadlineExceeded) {
+        return false;
+    }
+    delay = backoff(tries);
+    if (delay >= deadline.remaining()) return false;
+    if (!budget_.withdraw()) {
+        retriesDenied_->inc();
+        return false;
+    }
+    retriesSent_->inc();
+    return true;
+}
+
+void UpstreamClient::callAsync(const Deadline& deadline, const httplib::Headers& headers,
+                               std::function<AsyncRequest()> attempt,
+                               std::function<void(Outcome)> done) {
+    budget_.deposit();
+    auto call = std::make_shared<AsyncCall>(AsyncCall{deadline, headers, std::move(attempt),
+                                                      std::move(done), tracing::outgoing(),
+                                                      Outcome{}, 0});
+    attemptAsync(std::move(call));
+}
+
+void UpstreamClient::attemptAsync(std::shared_ptr<AsyncCall> call) {
+    ++call->tries;
+    auto remaining = admit(call->deadline, call->outcome);
+    if (remaining.count() <= 0) {
+        call->done(std::move(call->outcome));
+        return;
+    }
+
+    httplib::Headers attemptHeaders = call->headers;
+    attemptHeaders.emplace(kDeadlineHeader, std::to_string(remaining.count()));
+    tracing::ClientSpan span(call->trace, spanName_, call->tries);
+    span.inject(attemptHeaders);
+
+    // The endpoint and the load and timing it is charged with live until
+    // the reply is in
+    auto endpoint = endpoints_.pick();
+    auto load = std::make_shared<EndpointSet::Endpoint::Load>(*endpoint);
+    auto timing = std::make_shared<metrics::UpstreamMetrics::Call>(calls_);
+    async_->get(endpoint->address(), endpoints_.port(), call->attempt(), std::move(attemptHeaders),
+                call->deadline.at(), [this, call, endpoint, load, timing, span](httplib::Result result) {
+        call->outcome.result = std::move(result);
+        span.end(call->outcome.result);
+        timing->done(call->outcome.result && call->outcome.result->status < 400);
+        load->done(!failed(call->outcome));
+
+        std::chrono::milliseconds delay;
+        if (!retry(call->tries, call->deadline, call->outcome, delay)) {
+            call->done(std::move(call->outcome));
+            return;
+        }
+        async_->after(delay, [this, call] { attemptAsync(call); });
+    });
+}
+
+}  // namespace upstream
@@ -0,0 +1,315 @@
+#pragma once
+
+#include "httplib.h"
+#include "async_client.h"
+#include "metrics.h"
+#include "endpoint_set.h"
+#include "tracing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+// Fail-fast calls to an upstream service.
+//
+// Every call carries a deadline. The remaining budget travels to the next
+// hop in the X-Deadline-Ms header, so a service never works on a request
+// its caller has already given up on, and socket timeouts are cut to the
+// budget instead of httplib's multi-second defaults. A circuit breaker
+// rejects calls outright after a run of consecutive failures and lets a
+// single probe through once it has been open for a while. Failed attempts
+// are retried with jittered exponential backoff, but only while a retry
+// budget (a fraction of recent traffic) has tokens, so retries cannot
+// multiply the load on an upstream that is already struggling. With
+// UPSTREAM_ASYNC, callAsync() applies the same policy to non-blocking calls
+// on an AsyncClient loop, so waiting on the upstream holds no thread. Each
+// attempt is a client span (tracing.h) and carries its traceparent.
+namespace upstream {
+
+// Remaining budget in milliseconds, relative so it survives clock skew
+constexpr const char* kDeadlineHeader = "X-Deadline-Ms";
+
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static Deadline after(std::chrono::milliseconds budget) {
+        return Deadline(Clock::now() + budget);
+    }
+
+    // The caller's deadline if it sent one, capped by our own `budget`
+    static Deadline fromRequest(const httplib::Request& req, std::chrono::milliseconds budget) {
+        if (req.has_header(kDeadlineHeader)) {
+            try {
+                auto remaining = std::chrono::milliseconds(
+                    std::stoll(req.get_header_value(kDeadlineHeader)));
+                budget = std::min(budget, remaining);
+            } catch (const std::exception&) {
+                // Malformed header: fall back to our own budget
+            }
+        }
+        return after(budget);
+    }
+
+    std::chrono::milliseconds remaining() const {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(at_ - Clock::now());
+        return std::max(left, std::chrono::milliseconds(0));
+    }
+
+    bool expired() const { return Clock::now() >= at_; }
+
+    Clock::time_point at() const { return at_; }
+
+private:
+    explicit Deadline(Clock::time_point at) : at_(at) {}
+
+    Clock::time_point at_;
+};
+
+// True when the caller sent a deadline that has already run out, so any
+// work on the request would be thrown away
+inline bool exhausted(const httplib::Request& req) {
+    if (!req.has_header(kDeadlineHeader)) return false;
+    try {
+        return std::stoll(req.get_header_value(kDeadlineHeader)) <= 0;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+struct Policy {
+    std::chrono::milliseconds timeout;      // budget for calls without an inbound deadline
+    int maxAttempts;                        // first try plus retries
+    std::chrono::milliseconds retryBackoff; // base delay, doubled per retry and jittered
+    double retryRatio;                      // retries allowed per request sent
+    double minRetriesPerSecond;             // retries always allowed at low traffic
+    int breakerThreshold;                   // consecutive failures that open the circuit
+    std::chrono::milliseconds breakerOpen;  // how long it stays open before a probe
+    bool async;                             // run callAsync() on an event loop
+    bool http2;                             // ... over h2c to upstreams that offer it
+};
+
+Policy loadPolicy();
+
+std::string describe(const Policy& p);
+
+// Consecutive-failure circuit breaker; lock-free on the success path
+class CircuitBreaker {
+public:
+    enum class State { Closed = 0, HalfOpen = 1, Open = 2 };
+
+    CircuitBreaker(int threshold, std::chrono::milliseconds openFor)
+        : threshold_(threshold), openFor_(openFor) {}
+
+    // Whether a call may go out; while half-open only the single probe may
+    bool allow() {
+        if (threshold_ <= 0) return true;
+        State state = state_.load(std::memory_order_acquire);
+        if (state == State::Closed) return true;
+        if (state == State::HalfOpen) return false;
+
+        auto now = Clock::now().time_since_epoch().count();
+        if (now < openedAt_.load(std::memory_order_acquire) + openFor_.count()) return false;
+        // Open long enough: the caller that flips it to half-open is the probe
+        return state_.compare_exchange_strong(state, State::HalfOpen);
+    }
+
+    void record(bool success) {
+        if (threshold_ <= 0) return;
+        if (success) {
+            failures_.store(0, std::memory_order_relaxed);
+            if (state_.load(std::memory_order_relaxed) != State::Closed) {
+                state_.store(State::Closed, std::memory_order_release);
+            }
+            return;
+        }
+
+        State state = state_.load(std::memory_order_acquire);
+        bool trip = state == State::HalfOpen ||
+                    (state == State::Closed &&
+                     failures_.fetch_add(1, std::memory_order_relaxed) + 1 >= threshold_);
+        if (!trip) return;
+        // Stamp before the flip so allow() never pairs Open with a stale time
+        openedAt_.store(Clock::now().time_since_epoch().count(), std::memory_order_release);
+        if (state_.compare_exchange_strong(state, State::Open)) {
+            opened_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    State state() const { return state_.load(std::memory_order_relaxed); }
+    uint64_t opened() const { return opened_.load(std::memory_order_relaxed); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const int threshold_;
+    const Clock::duration openFor_;
+    std::atomic<State> state_{State::Closed};
+    std::atomic<int> failures_{0};
+    std::atomic<Clock::rep> openedAt_{0};
+    std::atomic<uint64_t> opened_{0};
+};
+
+// Token bucket that earns `ratio` of a retry per request sent, plus a
+// trickle of `minPerSecond` so a quiet service can still retry. Balances are
+// kept in thousandths of a token so deposits are a single atomic add.
+class RetryBudget {
+public:
+    RetryBudget(double ratio, double minPerSecond)
+        : ratio_(static_cast<int64_t>(ratio * kScale)),
+          minPerSecond_(minPerSecond),
+          cap_(static_cast<int64_t>(std::max(10.0, minPerSecond * 10) * kScale)),
+          tokens_(std::min(static_cast<int64_t>(minPerSecond * kScale), cap_)),
+          refilled_(std::chrono::steady_clock::now()) {}
+
+    // Called for every request; the cap is applied when tokens are spent
+    void deposit() { tokens_.fetch_add(ratio_, std::memory_order_relaxed); }
+
+    bool withdraw();
+
+private:
+    static constexpr int64_t kScale = 1000;
+
+    const int64_t ratio_;
+    const double minPerSecond_;
+    const int64_t cap_;
+    std::atomic<int64_t> tokens_;
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point refilled_;
+};
+
+// Why a call ended without a usable reply from the upstream
+enum class Failure { None, Transport, Status, CircuitOpen, DeadlineExceeded };
+
+struct Outcome {
+    httplib::Result result;
+    Failure failure = Failure::None;
+    std::chrono::milliseconds retryAfter{0};  // wait a shedding upstream (429/503) asked for
+
+    bool ok() const { return failure == Failure::None; }
+};
+
+// Pooled, balanced client for one upstream wrapped in the policy above:
+//
+//     auto outcome = producer.call(deadline, headers,
+//                                  [&](httplib::Client& cli, const httplib::Headers& h) {
+//         reply.emplace();  // fresh per-attempt state
+//         return cli.Get("/data", h, reply->receiver());
+//     });
+//
+// `attempt` may run more than once and gets the caller's headers plus the
+// remaining deadline, and each attempt picks its own endpoint, so a
+// retry usually lands on a different pod. 5xx replies and transport errors count as failures
+// (and are retried); anything below 500 is returned as is. A 429 or 503 with
+// Retry-After is an upstream shedding load: it is never retried, and the wait
+// it asks for is left in Outcome::retryAfter for the caller to honour.
+class UpstreamClient {
+public:
+    UpstreamClient(EndpointSet& endpoints, const char* service, const char* upstream,
+                   const Policy& policy);
+
+    UpstreamClient(const UpstreamClient&) = delete;
+    UpstreamClient& operator=(const UpstreamClient&) = delete;
+
+    template <typename Attempt>
+    Outcome call(const Deadline& deadline, const httplib::Headers& headers, Attempt&& attempt) {
+        Outcome outcome;
+        budget_.deposit();
+        tracing::Context trace = tracing::outgoing();
+
+        for (int tries = 1;; ++tries) {
+            auto remaining = admit(deadline, outcome);
+            if (remaining.count() <= 0) return outcome;
+
+            httplib::Headers attemptHeaders = headers;
+            attemptHeaders.emplace(kDeadlineHeader, std::to_string(remaining.count()));
+            tracing::ClientSpan span(trace, spanName_, tries);
+            span.inject(attemptHeaders);
+
+            {
+                auto endpoint = endpoints_.pick();
+                auto load = endpoint->track();
+                auto cli = endpoint->pool().acquire();
+                bound(*cli, remaining);
+                auto call = calls_.start();
+                outcome.result = attempt(*cli, attemptHeaders);
+                span.end(outcome.result);
+                call.done(outcome.result && outcome.result->status < 400);
+                load.done(!failed(outcome));
+            }
+
+            std::chrono::milliseconds delay;
+            if (!retry(tries, deadline, outcome, delay)) return outcome;
+            std::this_thread::sleep_for(delay);
+        }
+    }
+
+    // call() without blocking: `attempt()` returns each attempt's
+    // AsyncRequest (fresh per-attempt state, as above) and `done` gets the
+    // Outcome on the loop thread, or inline when no attempt could be sent.
+    // Backoff before a retry is a timer on the loop. Needs UPSTREAM_ASYNC.
+    void callAsync(const Deadline& deadline, const httplib::Headers& headers,
+                   std::function<AsyncRequest()> attempt, std::function<void(Outcome)> done);
+
+    bool async() const { return async_ != nullptr; }
+
+    EndpointSet& endpoints() { return endpoints_; }
+    const Policy& policy() const { return policy_; }
+    CircuitBreaker::State circuit() const { return breaker_.state(); }
+
+private:
+    struct AsyncCall;
+
+    static bool failed(const Outcome& outcome) {
+        return !outcome.result || outcome.result->status >= 500;
+    }
+
+    // Budget for the next attempt, or zero (with outcome.failure set) when
+    // the deadline or the circuit breaker rules it out
+    std::chrono::milliseconds admit(const Deadline& deadline, Outcome& outcome);
+
+    // Classify a finished attempt; true, with the backoff to wait, if it
+    // should be retried
+    bool retry(int tries, const Deadline& deadline, Outcome& outcome,
+               std::chrono::milliseconds& delay);
+
+    void attemptAsync(std::shared_ptr<AsyncCall> call);
+
+    // Cut the pooled client's socket timeouts down to the remaining budget
+    static void bound(httplib::Client& cli, std::chrono::milliseconds remaining) {
+        cli.set_connection_timeout(remaining);
+        cli.set_read_timeout(remaining);
+        cli.set_write_timeout(remaining);
+        cli.set_max_timeout(remaining);
+    }
+
+    // Exponential backoff with +/-50% jitter so retries from many callers spread out
+    std::chrono::milliseconds backoff(int tries) const {
+        thread_local std::mt19937 rng(std::random_device{}());
+        std::uniform_real_distribution<double> jitter(0.5, 1.5);
+        double base = static_cast<double>(policy_.retryBackoff.count()) *
+                      static_cast<double>(1 << std::min(tries - 1, 6));
+        return std::chrono::milliseconds(static_cast<int64_t>(base * jitter(rng)));
+    }
+
+    EndpointSet& endpoints_;
+    const Policy policy_;
+    const std::string spanName_;
+    metrics::UpstreamMetrics calls_;
+    CircuitBreaker breaker_;
+    RetryBudget budget_;
+    std::unique_ptr<AsyncClient> async_;  // null unless policy.async
+
+    metrics::Counter* retriesSent_;
+    metrics::Counter* retriesDenied_;
+    metrics::Counter* rejectedOpen_;
+    metrics::Counter* rejectedLate_;
+};
+
+}  // namespace upstream
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "httplib.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Pool of keep-alive httplib clients for a single upstream service.
+//
+// httplib::Client serialises requests on its one socket, so sharing a single
+// client between handler threads would queue them behind each other. Instead
+// each caller checks out a client for the duration of one call and hands it
+// back afterwards, keeping the TCP connection (and its DNS lookup) warm for
+// the next request.
+class UpstreamPool {
+public:
+    // RAII handle for a checked-out client; returns it to the pool on scope exit
+    class Lease {
+    public:
+        Lease(UpstreamPool* pool, std::unique_ptr<httplib::Client> client)
+            : pool_(pool), client_(std::move(client)) {}
+
+        Lease(Lease&& other) noexcept
+            : pool_(other.pool_), client_(std::move(other.client_)) {
+            other.pool_ = nullptr;
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        ~Lease() {
+            if (pool_ && client_) {
+                pool_->release(std::move(client_));
+            }
+        }
+
+        httplib::Client* operator->() const { return client_.get(); }
+        httplib::Client& operator*() const { return *client_; }
+
+    private:
+        UpstreamPool* pool_;
+        std::unique_ptr<httplib::Client> client_;
+    };
+
+    UpstreamPool(std::string host, int port, size_t capacity)
+        : host_(std::move(host)), port_(port), capacity_(capacity ? capacity : 1) {
+        idle_.reserve(capacity_);
+    }
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    // Check out an idle client, or open a new one if none are free
+    Lease acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                std::unique_ptr<httplib::Client> client = std::move(idle_.back());
+                idle_.pop_back();
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return Lease(this, std::move(client));
+            }
+        }
+
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return Lease(this, create());
+    }
+
+    const std::string& host() const { return host_; }
+    int port() const { return port_; }
+    size_t capacity() const { return capacity_; }
+
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    size_t idle() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return idle_.size();
+    }
+
+private:
+    std::unique_ptr<httplib::Client> create() const {
+        auto client = std::make_unique<httplib::Client>(host_, port_);
+        client->set_keep_alive(true);
+        client->set_tcp_nodelay(true);
+        return client;
+    }
+
+    void release(std::unique_ptr<httplib::Client> client) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Clients beyond capacity (burst overflow) are closed rather than kept
+        if (idle_.size() < capacity_) {
+            idle_.push_back(std::move(client));
+        }
+    }
+
+    const std::string host_;
+    const int port_;
+    const size_t capacity_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<httplib::Client>> idle_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Compact binary encoding for the internal hops, negotiated with
+// `Accept: application/x-binary`.
+//
+// A message is an 8-byte header followed by little-endian int32 columns:
+//
+//     offset 0  uint16  magic 0x4B38 ("8K")
+//            2  uint8   version (1)
+//            3  uint8   type: 1 = values, 2 = processed
+//            4  uint32  count
+//            8  int32[count]              values | original
+//               int32[count]              processed (type 2 only)
+//
+// Decoding is a bounds check on the header; View then reads the columns
+// straight out of the received body without copying or parsing them.
+namespace wire {
+
+constexpr const char* kContentType = "application/x-binary";
+
+constexpr uint16_t kMagic = 0x4B38;
+constexpr uint8_t kVersion = 1;
+constexpr size_t kHeaderSize = 8;
+
+enum class Type : uint8_t { Values = 1, Processed = 2 };
+
+// True when an Accept header lists the binary encoding
+inline bool accepts(std::string_view accept) {
+    return accept.find(kContentType) != std::string_view::npos;
+}
+
+inline bool isBinary(std::string_view contentType) {
+    return contentType.compare(0, std::strlen(kContentType), kContentType) == 0;
+}
+
+namespace detail {
+
+inline uint32_t toLittle(uint32_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(v);
+#else
+    return v;
+#endif
+}
+
+inline void put16(char* out, uint16_t v) {
+    out[0] = static_cast<char>(v & 0xFF);
+    out[1] = static_cast<char>(v >> 8);
+}
+
+inline uint16_t get16(const char* in) {
+    return static_cast<uint16_t>(static_cast<uint8_t>(in[0]) | (static_cast<uint8_t>(in[1]) << 8));
+}
+
+inline void put32(char* out, uint32_t v) {
+    v = toLittle(v);
+    std::memcpy(out, &v, sizeof(v));
+}
+
+inline uint32_t get32(const char* in) {
+    uint32_t v;
+    std::memcpy(&v, in, sizeof(v));
+    return toLittle(v);
+}
+
+inline void putColumn(char* out, const int* values, size_t count) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < count; ++i) put32(out + 4 * i, static_cast<uint32_t>(values[i]));
+#else
+    std::memcpy(out, values, count * sizeof(int32_t));
+#endif
+}
+
+// Reused per-thread output buffer, as in fastjson
+inline std::string& threadBuffer() {
+    thread_local std::string buffer;
+    return buffer;
+}
+
+inline std::string_view encode(Type type, const int* first, const int* second, size_t count) {
+    static_assert(sizeof(int) == sizeof(int32_t), "wire format assumes 32-bit int");
+    size_t columns = type == Type::Processed ? 2 : 1;
+    std::string& buf = threadBuffer();
+    buf.resize(kHeaderSize + columns * count * sizeof(int32_t));
+    char* out = &buf[0];
+    put16(out, kMagic);
+    out[2] = static_cast<char>(kVersion);
+    out[3] = static_cast<char>(type);
+    put32(out + 4, static_cast<uint32_t>(count));
+    putColumn(out + kHeaderSize, first, count);
+    if (second) putColumn(out + kHeaderSize + count * sizeof(int32_t), second, count);
+    return std::string_view(buf.data(), buf.size());
+}
+
+}  // namespace detail
+
+// The returned views point into the calling thread's buffer and are valid
+// until that thread encodes again; hand them to set_content right away.
+inline std::string_view values(const int* v, size_t count) {
+    return detail::encode(Type::Values, v, nullptr, count);
+}
+
+inline std::string_view processed(const int* original, const int* processed, size_t count) {
+    return detail::encode(Type::Processed, original, processed, count);
+}
+
+// Read-only view over an encoded message; the body must outlive it
+class View {
+public:
+    // False unless `body` is one complete, well-formed message of `type`
+    bool parse(std::string_view body, Type type) {
+        if (body.size() < kHeaderSize) return false;
+        if (detail::get16(body.data()) != kMagic) return false;
+        if (static_cast<uint8_t>(body[2]) != kVersion) return false;
+        if (static_cast<uint8_t>(body[3]) != static_cast<uint8_t>(type)) return false;
+        count_ = detail::get32(body.data() + 4);
+        size_t columns = type == Type::Processed ? 2 : 1;
+        if (body.size() != kHeaderSize + columns * count_ * sizeof(int32_t)) return false;
+        data_ = body.data() + kHeaderSize;
+        return true;
+    }
+
+    size_t size() const { return count_; }
+
+    // values / original column
+    int first(size_t i) const { return at(i); }
+
+    // processed column
+    int second(size_t i) const { return at(count_ + i); }
+
+private:
+    int at(size_t i) const { return static_cast<int32_t>(detail::get32(data_ + 4 * i)); }
+
+    const char* data_ = nullptr;
+    size_t count_ = 0;
+};
+
+}  // namespace wire
@@ -1,24 +1,55 @@
 #include "httplib.h"
 #include "json.hpp"
+#include "common/config.h"
+#include "common/event_server.h"
+#include "common/fast_json.h"
+#include "common/json_extract.h"
+#include "common/lifecycle.h"
+#include "common/logger.h"
+#include "common/metrics.h"
+#include "common/saturation.h"
+#include "common/server_options.h"
+#include "common/endpoint_set.h"
+#include "common/tracing.h"
+#include "common/upstream_client.h"
+#include "consumption_engine.h"
+#include "result_journal.h"
+#include "rolling_stats.h"
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <thread>
+#include <vector>
 #include <chrono>
-#include <cstdlib>
 
 using json = nlohmann::json;
 
-// Helper function to get env var with default
-std::string getEnv(const char* name, const std::string& defaultValue) {
-    const char* value = std::getenv(name);
-    return value ? std::string(value) : defaultValue;
-}
-
 struct Config {
     int port;
     std::string processorHost;
     std::string processorPort;
+    std::string processorEndpoints;
+    int endpointRefreshSeconds;
     int pollIntervalSeconds;
+    int batchSize;
+    int workers;
+    double targetRps;
+    int maxInFlight;
+    bool streamMode;
+    std::string wireFormat;
+    std::string logLevel;
+    int logSampleEvery;
     std::string processorUrl;
+    ServerOptions server;
+    upstream::Policy upstream;
+    tracing::Config tracing;
+};
+
+// One /consume round trip to the processor
+struct ConsumeCall {
+    upstream::Outcome outcome;
+    std::optional<ProcessedReply> reply;
 };
 
 Config loadConfig() {
@@ -26,8 +57,21 @@ Config loadConfig() {
     cfg.port = std::stoi(getEnv("PORT", "8082"));
     cfg.processorHost = getEnv("PROCESSOR_HOST", "processor");
     cfg.processorPort = getEnv("PROCESSOR_PORT", "8081");
+    cfg.processorEndpoints = getEnv("PROCESSOR_ENDPOINTS", "");
+    cfg.endpointRefreshSeconds = getEnvInt("ENDPOINT_REFRESH_SECONDS", 3);
     cfg.pollIntervalSeconds = std::stoi(getEnv("POLL_INTERVAL_SECONDS", "5"));
+    cfg.batchSize = std::stoi(getEnv("BATCH_SIZE", "1"));
+    cfg.workers = getEnvInt("CONSUMER_WORKERS", 1);
+    cfg.targetRps = std::stod(getEnv("TARGET_RPS", "0"));
+    cfg.maxInFlight = getEnvInt("MAX_IN_FLIGHT", cfg.workers);
+    cfg.streamMode = getEnvBool("STREAM_MODE", false);
+    cfg.wireFormat = getEnv("WIRE_FORMAT", "json");
+    cfg.logLevel = getEnv("LOG_LEVEL", "info");
+    cfg.logSampleEvery = std::stoi(getEnv("LOG_SAMPLE_EVERY", "1"));
     cfg.processorUrl = "http://" + cfg.processorHost + ":" + cfg.processorPort;
+    cfg.server = loadServerOptions();
+    cfg.upstream = upstream::loadPolicy();
+    cfg.tracing = tracing::loadConfig();
     return cfg;
 }
 
@@ -41,71 +85,164 @@ int main() {
     std::cout << "  Port: " << config.port << std::endl;
     std::cout << "  Processor URL: " << config.processorUrl << std::endl;
     std::cout << "  Poll interval: " << config.pollIntervalSeconds << "s" << std::endl;
-    
-    // Background consumption thread
-    std::thread consumptionThread([config]() {
-        std::cout.flush();
-        
-        // Give main thread time to start server
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        
-        while (true) {
-            std::cout.flush();
-            
-            try {
-                httplib::Client cli(config.processorUrl);
-                auto res = cli.Get("/process");
-                
-                if (res && res->status == 200) {
-                    json data = json::parse(res->body);
-                    std::cout << "[CONSUME] Original: " << data["original"] 
-                              << ", Processed: " << data["processed"] << std::endl;
-                    std::cout.flush();
-                } else {
-                    std::cerr << "[ERROR] Failed to call Processor service" << std::endl;
-                    std::cerr.flush();
-                }
-                
-            } catch (const std::exception& e) {
-                std::cerr << "[ERROR] Consumption error: " << e.what() << std::endl;
-                std::cerr.flush();
-            }
-            
-            std::cout.flush();
-            
-            std::this_thread::sleep_for(
-                std::chrono::seconds(config.pollIntervalSeconds)
-            );
+    std::cout << "  Batch size: " << config.batchSize << std::endl;
+    std::cout << "  Wire format: " << config.wireFormat << std::endl;
+    std::cout << "  Log level: " << config.logLevel
+              << " (1 in " << config.logSampleEvery << " results)" << std::endl;
+    std::cout << "  Server: " << describe(config.server) << std::endl;
+    std::cout << "  Processor calls: " << upstream::describe(config.upstream) << std::endl;
+    std::cout << "  Tracing: " << tracing::describe(config.tracing) << std::endl;
+
+    // Asynchronous logging; result lines are sampled, errors never are
+    logging::configure(config.logLevel);
+    logging::Sampler consumeSampler(config.logSampleEvery);
+    tracing::start("consumer", config.tracing);
+
+    // Keep-alive connections to each processor pod, shared by the engine and /consume
+    EndpointSet processorPool(config.processorHost, config.processorEndpoints,
+                              std::stoi(config.processorPort),
+                              static_cast<size_t>(std::max(config.maxInFlight, 1)) + config.server.threads,
+                              std::chrono::seconds(config.endpointRefreshSeconds));
+    std::cout << "  Processor endpoints: " << processorPool.describe() << std::endl;
+    metrics::Registry::instance().callback(
+        "upstream_endpoints", "Upstream pods being balanced across", "gauge",
+        {{"service", "consumer"}, {"upstream", "processor"}},
+        [&processorPool] { return static_cast<double>(processorPool.size()); });
+
+    // Deadlines, retries and circuit breaking on processor calls; call timing
+    // is reported on /metrics
+    upstream::UpstreamClient processor(processorPool, "consumer", "processor", config.upstream);
+
+    // Background consumption workers
+    ConsumptionOptions engineOptions{config.workers, config.targetRps, config.maxInFlight,
+                                     config.pollIntervalSeconds, config.batchSize, config.streamMode,
+                                     config.wireFormat == "binary"};
+
+    // Durable record of every handled result, served on /history
+    std::unique_ptr<journal::Journal> resultJournal;
+    std::string journalDir = getEnv("JOURNAL_DIR", "");
+    uint64_t historyMaxRecords = static_cast<uint64_t>(getEnvInt("HISTORY_MAX_RECORDS", 65536));
+    if (!journalDir.empty()) {
+        try {
+            resultJournal = std::make_unique<journal::Journal>(journal::Options{
+                journalDir,
+                static_cast<uint64_t>(getEnvInt("JOURNAL_SEGMENT_RECORDS", 1048576)),
+                static_cast<size_t>(getEnvInt("JOURNAL_MAX_SEGMENTS", 8)),
+                journal::parseFsync(getEnv("JOURNAL_FSYNC", "interval")),
+                std::chrono::milliseconds(getEnvInt("JOURNAL_FSYNC_INTERVAL_MS", 1000))});
+        } catch (const std::exception& e) {
+            std::cerr << "Error: Invalid journal configuration: " << e.what() << std::endl;
+            return 1;
         }
-    });
-    
-    std::cout.flush();
+        std::cout << "  Journal: " << resultJournal->describe() << std::endl;
+    } else {
+        std::cout << "  Journal: off (set JOURNAL_DIR)" << std::endl;
+    }
+
+    // 1s/10s/60s aggregates of the handled values, served on /stats
+    stats::RollingStats rollingStats;
+
+    ConsumptionEngine engine(engineOptions, processor, consumeSampler, resultJournal.get(),
+                             &rollingStats);
+    httplib::Headers processorHeaders = ProcessedReply::headers(engineOptions.binaryWire);
     
     // HTTP server for manual testing and health checks
-    httplib::Server svr;
+    EventServer svr;
     
-    // Manual consume endpoint
-    svr.Get("/consume", [config](const httplib::Request&, httplib::Response& res) {
-        std::cout << "[MANUAL] Consume endpoint called" << std::endl;
-        std::cout.flush();
+    // Manual consume endpoint (?count=N fetches a batch)
+    svr.Get("/consume", metrics::instrument("consumer", "/consume",
+                                            [&processor, &processorHeaders, &config](
+                                                const httplib::Request& req, httplib::Response& res) {
+        if (!EventServer::resumed()) {
+            LOG_INFO << "[MANUAL] Consume endpoint called";
+        }
         
-        httplib::Client cli(config.processorUrl);
-        auto processor_res = cli.Get("/process");
+        bool batched = req.has_param("count");
+        std::string path = batched ? "/process_batch?count=" +
+                                         httplib::encode_query_component(req.get_param_value("count"))
+                                   : "/process";
+        auto deadline = upstream::Deadline::fromRequest(req, config.upstream.timeout);
+
+        // With UPSTREAM_ASYNC the worker is freed while the processor works
+        // and this handler runs again once the reply is in
+        std::shared_ptr<ConsumeCall> call;
+        if (processor.async()) {
+            auto awaited = EventServer::await<std::shared_ptr<ConsumeCall>>(
+                [&](std::function<void(std::shared_ptr<ConsumeCall>)> done) {
+                auto pending = std::make_shared<ConsumeCall>();
+                auto attempt = [pending, batched, path] {
+                    pending->reply.emplace(batched);
+                    return upstream::AsyncRequest{path, pending->reply->receiver()};
+                };
+                processor.callAsync(deadline, processorHeaders, attempt,
+                                    [pending, done](upstream::Outcome outcome) {
+                    pending->outcome = std::move(outcome);
+                    done(pending);
+                });
+            });
+            if (!awaited) return;
+            call = *awaited;
+        } else {
+            call = std::make_shared<ConsumeCall>();
+            call->outcome = processor.call(deadline, processorHeaders,
+                                           [&](httplib::Client& cli, const httplib::Headers& headers) {
+                call->reply.emplace(batched);
+                return cli.Get(path, headers, call->reply->receiver());
+            });
+        }
+        auto& outcome = call->outcome;
+        auto& reply = call->reply;
+        auto& processor_res = outcome.result;
         
-        if (processor_res && processor_res->status == 200) {
-            res.set_content(processor_res->body, "application/json");
+        if (processor_res && processor_res->status == 204) {
+            // Filtered out by the processor's transform
+            res.status = 204;
+            LOG_INFO << "[MANUAL] Value filtered out by Processor";
+        } else if (processor_res && processor_res->status == 200 && reply->finish(*processor_res)) {
+            // External callers always get JSON, whatever the internal hop used
+            if (!reply->binary()) {
+                res.set_content(reply->body(), "application/json");
+            } else {
+                std::string_view body = batched
+                    ? fastjson::processedBatch(reply->original.data(), reply->processed.data(),
+                                               reply->original.size())
+                    : fastjson::processed(reply->original[0], reply->processed[0]);
+                res.set_content(body.data(), body.size(), "application/json");
+            }
             
-            json data = json::parse(processor_res->body);
-            std::cout << "[MANUAL] Original: " << data["original"] 
-                      << ", Processed: " << data["processed"] << std::endl;
-            std::cout.flush();
+            if (batched) {
+                LOG_INFO << "[MANUAL] Batch of " << reply->original.size() << " values";
+            } else {
+                LOG_INFO << "[MANUAL] Original: " << reply->original[0]
+                         << ", Processed: " << reply->processed[0];
+            }
+        } else if (processor_res && processor_res->status == 400) {
+            res.status = 400;
+            res.set_content(reply->body(), "application/json");
+        } else if (outcome.failure == upstream::Failure::CircuitOpen ||
+                   (processor_res && processor_res->status == 503)) {
+            // A processor shedding load says how long to stay away; pass that on
+            auto wait = std::chrono::duration_cast<std::chrono::seconds>(outcome.retryAfter);
+            json error;
+            error["error"] = outcome.failure == upstream::Failure::CircuitOpen
+                                 ? "Processor service unavailable (circuit open)"
+                                 : "Processor service unavailable";
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(std::max<long long>(wait.count(), 1)));
+            res.set_content(error.dump(), "application/json");
+        } else if (outcome.failure == upstream::Failure::DeadlineExceeded ||
+                   (processor_res && processor_res->status == 504)) {
+            json error;
+            error["error"] = "Deadline exceeded calling Processor service";
+            res.status = 504;
+            res.set_content(error.dump(), "application/json");
         } else {
             json error;
             error["error"] = "Failed to call Processor service";
             res.status = 500;
             res.set_content(error.dump(), "application/json");
         }
-    });
+    }));
     
     // Health check endpoint
     svr.Get("/health", [](const httplib::Request&, httplib::Response& res) {
@@ -114,15 +251,101 @@ int main() {
         health["service"] = "consumer";
         res.set_content(health.dump(), "application/json");
     });
+
+    // Journaled results from ?since=<sequence>, at most ?limit= records. The
+    // body is the raw 16-byte records written straight from the mapped
+    // segments; ?format=json renders them instead. X-Journal-Next is the
+    // `since` for the following page.
+    svr.Get("/history", [&resultJournal, historyMaxRecords](const httplib::Request& req,
+                                                             httplib::Response& res) {
+        if (!resultJournal) {
+            json error;
+            error["error"] = "Journal disabled (set JOURNAL_DIR)";
+            res.status = 404;
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+        uint64_t since = 0;
+        uint64_t limit = historyMaxRecords;
+        try {
+            if (req.has_param("since")) since = std::stoull(req.get_param_value("since"));
+            if (req.has_param("limit")) {
+                limit = std::min(limit, static_cast<uint64_t>(std::stoull(req.get_param_value("limit"))));
+            }
+        } catch (const std::exception&) {
+            json error;
+            error["error"] = "since and limit must be non-negative integers";
+            res.status = 400;
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+
+        auto range = std::make_shared<journal::Range>(journal::read(*resultJournal, since, limit));
+        res.set_header("X-Journal-First", std::to_string(range->first));
+        res.set_header("X-Journal-Next", std::to_string(range->next));
+
+        if (req.get_param_value("format") == "json") {
+            json records = json::array();
+            for (const auto& slice : range->slices) {
+                for (size_t i = 0; i < slice.count; ++i) {
+                    const journal::Record& record = slice.records[i];
+                    records.push_back({{"sequence", slice.sequence + i},
+                                       {"timestamp_us", record.timestampMicros},
+                                       {"original", record.original},
+                                       {"processed", record.processed}});
+                }
+            }
+            json body;
+            body["first"] = range->first;
+            body["next"] = range->next;
+            body["records"] = std::move(records);
+            res.set_content(body.dump(), "application/json");
+            return;
+        }
+
+        // The range holds the segments mapped until the response is sent
+        res.set_content_provider(range->bytes, journal::kContentType,
+                                 [range](size_t offset, size_t, httplib::DataSink& sink) {
+            for (const auto& slice : range->slices) {
+                size_t bytes = slice.count * sizeof(journal::Record);
+                if (offset < bytes) {
+                    return sink.write(reinterpret_cast<const char*>(slice.records) + offset,
+                                      bytes - offset);
+                }
+                offset -= bytes;
+            }
+            return false;
+        });
+    });
+
+    // Windowed aggregates of the background consumption, rebuilt once a
+    // second; ?sketch=true adds the DDSketch buckets for merging replicas
+    svr.Get("/stats", [&rollingStats](const httplib::Request& req, httplib::Response& res) {
+        auto body = rollingStats.body(req.get_param_value("sketch") == "true");
+        res.set_content_provider(body->size(), "application/json",
+                                 [body](size_t offset, size_t, httplib::DataSink& sink) {
+            return sink.write(body->data() + offset, body->size() - offset);
+        });
+    });
+
+    metrics::expose(svr, "consumer");
+    saturation::Config saturationConfig = saturation::loadConfig();
+    saturation::expose(svr, "consumer", config.server, saturationConfig);
+    lifecycle::expose(svr, "consumer");
     
     std::cout << "Listening on http://0.0.0.0:" << config.port << std::endl;
-    std::cout << "Background consumption running every " << config.pollIntervalSeconds << " seconds" << std::endl;
-    std::cout.flush();
+    std::cout << "Background consumption: " << engine.describe() << std::endl;
+    std::cout << "Saturation: " << saturation::describe(saturationConfig) << std::endl;
     
-    // Detach AFTER everything is set up
-    consumptionThread.detach();
+    // Start consuming AFTER everything is set up
+    engine.start();
+    // Draining pods stop calling the processor; results received so far are still handled
+    lifecycle::onDrain([&engine] { engine.stop(); });
     
-    svr.listen("0.0.0.0", config.port);
+    if (!serve(svr, config.server, "0.0.0.0", config.port)) {
+        std::cerr << "Error: Could not listen on port " << config.port << std::endl;
+        return 1;
+    }
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,585 @@
+#pragma once
+
+#include "common/bounded_queue.h"
+#include "common/json_extract.h"
+#include "common/logger.h"
+#include "common/metrics.h"
+#include "common/sse.h"
+#include "common/upstream_client.h"
+#include "common/wire_format.h"
+#include "result_journal.h"
+#include "rolling_stats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Background consumption of the processor service.
+//
+// A small pool of workers issues requests concurrently. A shared pacer
+// spaces send slots evenly to hold TARGET_RPS across all workers, and an
+// AIMD in-flight limit (capped at MAX_IN_FLIGHT) halves on every failed call
+// and creeps back up on success, so a struggling processor sees less load
+// instead of a growing retry storm. When the processor sheds load (a 503
+// with Retry-After) even at a limit of one call, all calls stop for as long
+// as it asks. Responses are decoded by the worker and
+// handed to a separate handler thread through a bounded queue, so the next
+// request goes out while the previous result is still being handled.
+//
+// With UPSTREAM_ASYNC the workers are replaced by a single issuing thread:
+// calls go out on the processor client's event loop and complete there, so
+// the in-flight limit rather than the thread count bounds concurrency, and
+// one thread keeps MAX_IN_FLIGHT calls outstanding. A call keeps its
+// in-flight slot until the handler has taken its result, so a slow handler
+// holds back new calls without the loop, which /consume shares, ever
+// waiting on the queue.
+//
+// In stream mode a single reader holds /process/stream open instead, feeding
+// the same handler queue; when that queue is full the reader stops draining
+// the socket and the backpressure reaches the producer.
+struct ConsumptionOptions {
+    int workers;
+    double targetRps;         // 0 = every worker waits pollIntervalSeconds between calls
+    int maxInFlight;
+    int pollIntervalSeconds;
+    int batchSize;
+    bool streamMode;          // read /process/stream instead of polling
+    bool binaryWire;          // ask the processor for the binary encoding
+};
+
+// One /process or /process_batch reply, decoded into columns whichever
+// encoding the processor answered in
+class ProcessedReply {
+public:
+    explicit ProcessedReply(bool batched) : batched_(batched) {
+        if (batched) {
+            extract_.fields().bind("original", &original);
+            extract_.fields().bind("processed", &processed);
+        } else {
+            extract_.fields().bind("original", &original_);
+            extract_.fields().bind("processed", &processed_);
+        }
+    }
+
+    auto receiver() { return extract_.receiver(); }
+
+    // Request headers for the configured encoding
+    static httplib::Headers headers(bool binaryWire) {
+        if (!binaryWire) return {};
+        return {{"Accept", std::string(wire::kContentType) + ", application/json"}};
+    }
+
+    // Fills original/processed from a 200 reply; false if it could not be read
+    bool finish(const httplib::Response& res) {
+        binary_ = wire::isBinary(res.get_header_value("Content-Type"));
+        if (binary_) {
+            wire::View view;
+            if (!view.parse(extract_.body(), wire::Type::Processed)) return false;
+            if (!batched_ && view.size() != 1) return false;
+            original.resize(view.size());
+            processed.resize(view.size());
+            for (size_t i = 0; i < view.size(); ++i) {
+                original[i] = view.first(i);
+                processed[i] = view.second(i);
+            }
+            return true;
+        }
+        if (!extract_.finish()) return false;
+        if (!batched_) {
+            original.assign(1, original_);
+            processed.assign(1, processed_);
+        }
+        return true;
+    }
+
+    bool binary() const { return binary_; }
+
+    // Raw reply body, for passing JSON replies through unchanged
+    const std::string& body() const { return extract_.body(); }
+
+    std::vector<int> original;
+    std::vector<int> processed;
+
+private:
+    bool batched_;
+    bool binary_ = false;
+    int original_ = 0;
+    int processed_ = 0;
+    jsonextract::BodyExtractor extract_;
+};
+
+// Evenly spaced send slots shared by all workers
+class Pacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Pacer(double rps)
+        : interval_(rps > 0 ? std::chrono::duration_cast<Clock::duration>(
+                                  std::chrono::duration<double>(1.0 / rps))
+                            : Clock::duration::zero()) {}
+
+    bool enabled() const { return interval_ != Clock::duration::zero(); }
+
+    // Claim the next slot; a slot in the past is moved to now so a stall
+    // does not turn into a burst of catch-up requests
+    Clock::time_point next() {
+        Clock::rep now = Clock::now().time_since_epoch().count();
+        Clock::rep slot = next_.load(std::memory_order_relaxed);
+        Clock::rep mine;
+        do {
+            mine = std::max(slot, now);
+        } while (!next_.compare_exchange_weak(slot, mine + interval_.count(),
+                                              std::memory_order_relaxed));
+        return Clock::time_point(Clock::duration(mine));
+    }
+
+private:
+    Clock::duration interval_;
+    std::atomic<Clock::rep> next_{0};
+};
+
+// Additive-increase / multiplicative-decrease cap on concurrent requests
+class InFlightLimiter {
+public:
+    explicit InFlightLimiter(int maxInFlight)
+        : max_(std::max(maxInFlight, 1)), limit_(max_) {}
+
+    // Blocks until a request may be sent; false once closed
+    bool acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return closed_ || inFlight_ < static_cast<int>(limit_); });
+        if (closed_) return false;
+        ++inFlight_;
+        return true;
+    }
+
+    void release(bool success) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --inFlight_;
+            if (success) {
+                limit_ = std::min(limit_ + 1.0 / limit_, static_cast<double>(max_));
+            } else {
+                limit_ = std::max(limit_ / 2, 1.0);
+            }
+        }
+        cv_.notify_all();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    int limit() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return static_cast<int>(limit_);
+    }
+
+private:
+    const int max_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    double limit_;
+    int inFlight_ = 0;
+    bool closed_ = false;
+};
+
+class ConsumptionEngine {
+public:
+    ConsumptionEngine(ConsumptionOptions options, upstream::UpstreamClient& processor,
+                      logging::Sampler& sampler, journal::Journal* journal = nullptr,
+                      stats::RollingStats* stats = nullptr)
+        : options_(options),
+          processor_(processor),
+          sampler_(sampler),
+          journal_(journal),
+          stats_(stats),
+          headers_(ProcessedReply::headers(options.binaryWire)),
+          pacer_(options.targetRps),
+          limiter_(options.maxInFlight),
+          results_(static_cast<size_t>(std::max(options.maxInFlight, 1)) * 4) {
+        auto& registry = metrics::Registry::instance();
+        limitGauge_ = &registry.gauge("consumer_in_flight_limit",
+                                      "Current adaptive cap on concurrent processor calls");
+        limitGauge_->set(limiter_.limit());
+        streamValues_ = &registry.counter("stream_values_total", "Values sent on streaming endpoints",
+                                          {{"service", "consumer"}});
+        holdOffs_ = &registry.counter("consumer_retry_after_total",
+                                      "Pauses for the Retry-After of a shedding processor");
+        registry.callback("consumer_pending_results", "Decoded responses waiting to be handled",
+                          "gauge", {}, [this] { return static_cast<double>(results_.size()); });
+    }
+
+    ConsumptionEngine(const ConsumptionEngine&) = delete;
+    ConsumptionEngine& operator=(const ConsumptionEngine&) = delete;
+
+    ~ConsumptionEngine() { stop(); }
+
+    void start() {
+        running_ = true;
+        handler_ = std::thread([this] { handleResults(); });
+        if (options_.streamMode) {
+            workers_.emplace_back([this] { stream(); });
+            return;
+        }
+        if (processor_.async()) {
+            workers_.emplace_back([this] { issue(); });
+            return;
+        }
+        for (int i = 0; i < std::max(options_.workers, 1); ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    // Stop issuing requests, finish handling what was received and join
+    void stop() {
+        if (!running_.exchange(false)) return;
+        {
+            // Sleepers check the flag under this lock, so none can miss the wakeup
+            std::lock_guard<std::mutex> lock(wakeMutex_);
+        }
+        wake_.notify_all();
+        limiter_.close();
+        {
+            std::lock_guard<std::mutex> lock(streamMutex_);
+            if (streamClient_) streamClient_->stop();
+        }
+        for (std::thread& t : workers_) t.join();
+        workers_.clear();
+        {
+            // Async calls still out have deadlines; let them land first
+            std::unique_lock<std::mutex> lock(wakeMutex_);
+            callsDone_.wait(lock, [this] { return outstanding_ == 0; });
+        }
+        results_.close();
+        handler_.join();
+    }
+
+    std::string describe() const {
+        std::ostringstream out;
+        if (options_.streamMode) {
+            out << "stream from /process/stream";
+            if (options_.targetRps > 0) out << " at " << options_.targetRps << " values/s";
+            return out.str();
+        }
+        if (processor_.async()) {
+            out << "async, ";
+        } else {
+            out << std::max(options_.workers, 1) << " workers, ";
+        }
+        if (options_.targetRps > 0) {
+            out << "target " << options_.targetRps << " req/s";
+        } else {
+            out << "every " << options_.pollIntervalSeconds << "s per worker";
+        }
+        out << ", max in flight " << std::max(options_.maxInFlight, 1);
+        return out.str();
+    }
+
+private:
+    struct Result {
+        std::vector<int> original;
+        std::vector<int> processed;
+        bool holdsSlot = false;  // an async call's, given back once popped
+    };
+
+    // Sleep until `deadline`; returns false if the engine was stopped meanwhile
+    bool sleepUntil(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        return !wake_.wait_until(lock, deadline, [this] { return !running_.load(); });
+    }
+
+    bool sleepFor(std::chrono::steady_clock::duration delay) {
+        return sleepUntil(std::chrono::steady_clock::now() + delay);
+    }
+
+    // Stop sending for the Retry-After a shedding processor answered with.
+    // Only once halving the in-flight limit has run out: one pod shedding
+    // a burst should slow the calls down, not stop them.
+    void holdOff(const upstream::Outcome& outcome) {
+        if (outcome.retryAfter.count() <= 0 || limiter_.limit() > 1) return;
+        holdOffs_->inc();
+        auto until = std::chrono::steady_clock::now() + outcome.retryAfter;
+        auto ticks = until.time_since_epoch().count();
+        auto current = resumeAt_.load(std::memory_order_relaxed);
+        while (current < ticks &&
+               !resumeAt_.compare_exchange_weak(current, ticks, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Sit out a hold-off in progress; false if the engine was stopped meanwhile
+    bool waitOutHoldOff() {
+        auto until = std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(resumeAt_.load(std::memory_order_relaxed)));
+        if (until <= std::chrono::steady_clock::now()) return true;
+        return sleepUntil(until);
+    }
+
+    // Back off exponentially while the processor keeps failing
+    bool backOff(int failures) {
+        auto backoff = std::chrono::milliseconds(100) * (1 << std::min(failures - 1, 6));
+        auto cap = std::chrono::seconds(std::max(options_.pollIntervalSeconds, 1));
+        return sleepFor(std::min<std::chrono::steady_clock::duration>(backoff, cap));
+    }
+
+    void work() {
+        // Give main thread time to start server
+        if (!sleepFor(std::chrono::seconds(1))) return;
+
+        int failures = 0;
+        while (running_) {
+            if (!waitOutHoldOff()) break;
+            if (pacer_.enabled() && !sleepUntil(pacer_.next())) break;
+            if (!limiter_.acquire()) break;
+
+            Result result;
+            bool ok = false;
+            try {
+                ok = fetch(result);
+                if (!ok) {
+                    LOG_ERROR << "[ERROR] Failed to call Processor service";
+                }
+            } catch (const std::exception& e) {
+                LOG_ERROR << "[ERROR] Consumption error: " << e.what();
+            }
+            limiter_.release(ok);
+            limitGauge_->set(limiter_.limit());
+
+            if (ok) {
+                failures = 0;
+                if (!results_.push(std::move(result))) break;
+            } else if (!backOff(++failures)) {
+                break;
+            }
+
+            if (!pacer_.enabled() &&
+                !sleepFor(std::chrono::seconds(options_.pollIntervalSeconds))) {
+                break;
+            }
+        }
+    }
+
+    // Pace and limit calls as work() does, but without waiting for replies.
+    // Without TARGET_RPS each round sends CONSUMER_WORKERS calls, what the
+    // workers would have between polls.
+    void issue() {
+        // Give main thread time to start server
+        if (!sleepFor(std::chrono::seconds(1))) return;
+
+        while (running_) {
+            int round = pacer_.enabled() ? 1 : std::max(options_.workers, 1);
+            for (int i = 0; i < round && running_; ++i) {
+                if (pacer_.enabled() && !sleepUntil(pacer_.next())) return;
+                if (!waitOutHoldOff()) return;
+                int failures = failures_.load(std::memory_order_relaxed);
+                if (failures > 0 && !backOff(failures)) return;
+                if (!limiter_.acquire()) return;
+                {
+                    std::lock_guard<std::mutex> lock(wakeMutex_);
+                    ++outstanding_;
+                }
+                fetchAsync();
+            }
+            if (!pacer_.enabled() &&
+                !sleepFor(std::chrono::seconds(options_.pollIntervalSeconds))) {
+                return;
+            }
+        }
+    }
+
+    // Runs on the client's loop thread once the reply is in, so it must not
+    // wait on the handler: results go on the queue with tryPush(), which
+    // cannot fail while each queued result holds one of at most
+    // MAX_IN_FLIGHT slots.
+    void fetchAsync() {
+        bool batched = options_.batchSize > 1;
+        auto reply = std::make_shared<std::optional<ProcessedReply>>();
+        std::string path = batched ? "/process_batch?count=" + std::to_string(options_.batchSize)
+                                   : "/process";
+        auto deadline = upstream::Deadline::after(processor_.policy().timeout);
+        auto attempt = [reply, batched, path] {
+            reply->emplace(batched);
+            return upstream::AsyncRequest{path, (*reply)->receiver()};
+        };
+        processor_.callAsync(deadline, headers_, attempt, [this, reply](upstream::Outcome outcome) {
+            holdOff(outcome);
+            Result result;
+            bool ok = false;
+            try {
+                ok = decode(outcome, *reply, result);
+                if (!ok) {
+                    LOG_ERROR << "[ERROR] Failed to call Processor service";
+                }
+            } catch (const std::exception& e) {
+                LOG_ERROR << "[ERROR] Consumption error: " << e.what();
+            }
+            if (ok) {
+                failures_.store(0, std::memory_order_relaxed);
+                result.holdsSlot = true;
+                if (!result.original.empty() && results_.tryPush(std::move(result))) return;
+            } else {
+                failures_.fetch_add(1, std::memory_order_relaxed);
+            }
+            finishCall(ok);
+        });
+    }
+
+    // Give back an async call's in-flight slot
+    void finishCall(bool ok) {
+        limiter_.release(ok);
+        limitGauge_->set(limiter_.limit());
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex_);
+            --outstanding_;
+        }
+        callsDone_.notify_all();
+    }
+
+    // Result of one call; a 204 (the processor's transform filtered the
+    // value out) succeeds with nothing to handle
+    static bool decode(upstream::Outcome& outcome, std::optional<ProcessedReply>& reply,
+                       Result& result) {
+        auto& res = outcome.result;
+        if (outcome.ok() && res->status == 204) return true;
+        if (!outcome.ok() || res->status != 200 || !reply->finish(*res)) return false;
+        result.original = std::move(reply->original);
+        result.processed = std::move(reply->processed);
+        return true;
+    }
+
+    bool fetch(Result& result) {
+        // Batches of more than one value go through /process_batch
+        bool batched = options_.batchSize > 1;
+        std::optional<ProcessedReply> reply;
+
+        auto deadline = upstream::Deadline::after(processor_.policy().timeout);
+        auto outcome = processor_.call(deadline, headers_,
+                                       [&](httplib::Client& cli, const httplib::Headers& headers) {
+            reply.emplace(batched);
+            return batched
+                ? cli.Get("/process_batch?count=" + std::to_string(options_.batchSize), headers,
+                          reply->receiver())
+                : cli.Get("/process", headers, reply->receiver());
+        });
+        holdOff(outcome);
+        return decode(outcome, reply, result);
+    }
+
+    // Hold one long-lived stream open, reconnecting when it ends or fails
+    void stream() {
+        // Give main thread time to start server
+        if (!sleepFor(std::chrono::seconds(1))) return;
+
+        std::string path = "/process/stream";
+        if (options_.targetRps > 0) {
+            std::ostringstream rate;
+            rate << options_.targetRps;
+            path += "?rate=" + rate.str();
+        }
+
+        int failures = 0;
+        while (running_) {
+            EndpointSet& endpoints = processor_.endpoints();
+            httplib::Client cli(endpoints.pick()->address(), endpoints.port());
+            cli.set_tcp_nodelay(true);
+            {
+                std::lock_guard<std::mutex> lock(streamMutex_);
+                if (!running_) break;
+                streamClient_ = &cli;
+            }
+
+            sse::Parser parser;
+            bool upstreamError = false;
+            uint64_t received = 0;
+            auto res = cli.Get(path, [&](const char* data, size_t size) {
+                Result result;
+                parser.feed(data, size, [&](std::string_view event, std::string_view payload) {
+                    if (event == "error") {
+                        upstreamError = true;
+                        return;
+                    }
+                    int original = 0;
+                    int processed = 0;
+                    jsonextract::FieldReader reader;
+                    reader.bind("original", &original);
+                    reader.bind("processed", &processed);
+                    reader.feed(payload);
+                    if (reader.finish()) {
+                        result.original.push_back(original);
+                        result.processed.push_back(processed);
+                    }
+                });
+                received += result.original.size();
+                streamValues_->inc(result.original.size());
+                // Blocks while the handler is behind, which stops reading the socket
+                if (!result.original.empty() && !results_.push(std::move(result))) return false;
+                return !upstreamError;
+            });
+
+            {
+                std::lock_guard<std::mutex> lock(streamMutex_);
+                streamClient_ = nullptr;
+            }
+            if (!running_) break;
+
+            if (res && res->status == 200 && !upstreamError) {
+                failures = 0;
+                LOG_INFO << "[STREAM] Stream ended after " << received << " values, reconnecting";
+            } else {
+                LOG_ERROR << "[ERROR] Processor stream failed after " << received << " values";
+                if (!backOff(++failures)) break;
+            }
+        }
+    }
+
+    void handleResults() {
+        Result result;
+        while (results_.pop(result)) {
+            if (result.holdsSlot) finishCall(true);
+            size_t n = std::min(result.original.size(), result.processed.size());
+            if (journal_) journal_->append(result.original.data(), result.processed.data(), n);
+            if (stats_) stats_->add(result.original.data(), result.processed.data(), n);
+            for (size_t i = 0; i < n; ++i) {
+                LOG_SAMPLED(sampler_, logging::Level::Info)
+                    << "[CONSUME] Original: " << result.original[i]
+                    << ", Processed: " << result.processed[i];
+            }
+        }
+    }
+
+    const ConsumptionOptions options_;
+    upstream::UpstreamClient& processor_;
+    logging::Sampler& sampler_;
+    journal::Journal* journal_;  // null when JOURNAL_DIR is unset
+    stats::RollingStats* stats_;
+    const httplib::Headers headers_;
+
+    Pacer pacer_;
+    InFlightLimiter limiter_;
+    BoundedQueue<Result> results_;
+    metrics::Gauge* limitGauge_;
+    metrics::Counter* streamValues_;
+    metrics::Counter* holdOffs_;
+
+    std::atomic<bool> running_{false};
+    std::mutex wakeMutex_;
+    std::condition_variable wake_;
+    std::condition_variable callsDone_;
+    int outstanding_ = 0;               // async calls not yet completed, under wakeMutex_
+    std::atomic<int> failures_{0};      // consecutive async failures
+    std::atomic<std::chrono::steady_clock::rep> resumeAt_{0};  // no calls before this
+    std::vector<std::thread> workers_;
+    std::thread handler_;
+    std::mutex streamMutex_;
+    httplib::Client* streamClient_ = nullptr;
+};
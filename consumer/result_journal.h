@@ -0,0 +1,425 @@
+#pragma once
+
+#include "common/logger.h"
+#include "common/metrics.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Durable journal of consumed results.
+//
+// Records are fixed 16-byte entries appended to memory-mapped segment files,
+// each preallocated for JOURNAL_SEGMENT_RECORDS records and named after the
+// sequence number of its first record. An append is a copy into the mapping
+// followed by a release store of the segment's record count, so readers
+// never take a lock, and /history writes ranges to the socket straight from
+// the mapped pages. JOURNAL_FSYNC sets durability: `batch` syncs after every
+// appended batch (one processor reply), `interval` every
+// JOURNAL_FSYNC_INTERVAL_MS from a background thread, and `off` leaves
+// write-back to the kernel, which survives a process crash but not a node
+// crash. Full segments are rotated, and the oldest are deleted beyond
+// JOURNAL_MAX_SEGMENTS. On restart the segments are mapped again and only
+// the tail of the last one is scanned to find where appends resume.
+namespace journal {
+
+constexpr const char* kContentType = "application/x-consumer-journal";
+
+// On-disk record, native (little-endian) byte order
+struct Record {
+    int64_t timestampMicros;  // unix time; 0 marks space not yet written
+    int32_t original;
+    int32_t processed;
+};
+static_assert(sizeof(Record) == 16, "journal records are 16 bytes");
+
+// First 64 bytes of every segment file; records follow
+struct SegmentHeader {
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t firstSequence;
+    uint64_t capacity;   // records the file has room for
+    uint64_t committed;  // records covered by the last sync, where recovery starts scanning
+    char padding[24];
+};
+static_assert(sizeof(SegmentHeader) == 64, "segment header is one cache line");
+
+constexpr char kMagic[8] = {'C', 'O', 'N', 'J', 'R', 'N', 'L', '1'};
+
+enum class Fsync { Off, Batch, Interval };
+
+inline Fsync parseFsync(const std::string& name) {
+    if (name == "off") return Fsync::Off;
+    if (name == "batch") return Fsync::Batch;
+    if (name == "interval") return Fsync::Interval;
+    throw std::invalid_argument("JOURNAL_FSYNC must be off, batch or interval, not '" + name + "'");
+}
+
+inline const char* fsyncName(Fsync fsync) {
+    switch (fsync) {
+        case Fsync::Off: return "off";
+        case Fsync::Batch: return "batch";
+        case Fsync::Interval: return "interval";
+    }
+    return "interval";
+}
+
+// One mapped segment file. Only the journal's writer appends; any thread
+// may read the first size() records.
+class Segment {
+public:
+    // Create and preallocate a segment; throws std::system_error
+    static std::shared_ptr<Segment> create(const std::string& path, uint64_t first,
+                                           uint64_t capacity) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) throw error("create " + path);
+        size_t bytes = sizeof(SegmentHeader) + capacity * sizeof(Record);
+        // Reserve the blocks now: running out of space under a mapping is a SIGBUS
+        int rc = posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+        if (rc == EOPNOTSUPP || rc == EINVAL) {
+            rc = ftruncate(fd, static_cast<off_t>(bytes)) == 0 ? 0 : errno;
+        }
+        if (rc != 0) {
+            ::close(fd);
+            ::unlink(path.c_str());
+            throw std::system_error(rc, std::generic_category(), "allocate " + path);
+        }
+
+        auto segment = std::shared_ptr<Segment>(new Segment(path, fd, bytes));
+        SegmentHeader* header = segment->header();
+        std::memcpy(header->magic, kMagic, sizeof(kMagic));
+        header->recordSize = sizeof(Record);
+        header->firstSequence = first;
+        header->capacity = capacity;
+        header->committed = 0;
+        return segment;
+    }
+
+    // Map an existing segment and find its end; throws std::system_error or
+    // std::runtime_error for files that are not segments
+    static std::shared_ptr<Segment> open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) throw error("open " + path);
+        struct stat st {};
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw error("stat " + path);
+        }
+        if (static_cast<size_t>(st.st_size) < sizeof(SegmentHeader)) {
+            ::close(fd);
+            throw std::runtime_error(path + " is not a journal segment");
+        }
+
+        auto segment = std::shared_ptr<Segment>(new Segment(path, fd, st.st_size));
+        const SegmentHeader* header = segment->header();
+        if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+            header->recordSize != sizeof(Record) ||
+            sizeof(SegmentHeader) + header->capacity * sizeof(Record) >
+                static_cast<size_t>(st.st_size)) {
+            throw std::runtime_error(path + " is not a journal segment");
+        }
+
+        // Everything up to the last sync is there; past it, take records
+        // until the first one that was never written
+        uint64_t count = std::min(header->committed, header->capacity);
+        const Record* records = segment->records();
+        while (count < header->capacity && records[count].timestampMicros != 0) ++count;
+        segment->count_.store(count, std::memory_order_relaxed);
+        segment->synced_ = count;
+        return segment;
+    }
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    ~Segment() {
+        munmap(base_, bytes_);
+        ::close(fd_);
+    }
+
+    uint64_t first() const { return header()->firstSequence; }
+    uint64_t capacity() const { return header()->capacity; }
+    uint64_t size() const { return count_.load(std::memory_order_acquire); }
+    bool full() const { return size() >= capacity(); }
+    const std::string& path() const { return path_; }
+
+    const Record* records() const {
+        return reinterpret_cast<const Record*>(base_ + sizeof(SegmentHeader));
+    }
+
+    // Writer only; the caller checks full() first
+    void append(const Record& record) {
+        uint64_t index = count_.load(std::memory_order_relaxed);
+        std::memcpy(base_ + sizeof(SegmentHeader) + index * sizeof(Record), &record,
+                    sizeof(Record));
+        count_.store(index + 1, std::memory_order_release);
+    }
+
+    // Flush appended records to disk, then the header that points past them
+    void sync() {
+        std::lock_guard<std::mutex> lock(syncMutex_);
+        uint64_t count = size();
+        if (count == synced_) return;
+
+        static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t from = (sizeof(SegmentHeader) + synced_ * sizeof(Record)) / page * page;
+        size_t to = sizeof(SegmentHeader) + count * sizeof(Record);
+        msync(base_ + from, to - from, MS_SYNC);
+        header()->committed = count;
+        msync(base_, page, MS_SYNC);
+        synced_ = count;
+    }
+
+    // Delete the file; the mapping, and readers of it, stay valid until the
+    // last reference goes
+    void remove() { ::unlink(path_.c_str()); }
+
+private:
+    Segment(std::string path, int fd, size_t bytes) : path_(std::move(path)), fd_(fd), bytes_(bytes) {
+        void* base = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (base == MAP_FAILED) {
+            int saved = errno;
+            ::close(fd_);
+            throw std::system_error(saved, std::generic_category(), "map " + path_);
+        }
+        base_ = static_cast<char*>(base);
+    }
+
+    static std::system_error error(const std::string& what) {
+        return std::system_error(errno, std::generic_category(), what);
+    }
+
+    SegmentHeader* header() const { return reinterpret_cast<SegmentHeader*>(base_); }
+
+    const std::string path_;
+    const int fd_;
+    const size_t bytes_;
+    char* base_ = nullptr;
+    std::atomic<uint64_t> count_{0};
+
+    std::mutex syncMutex_;
+    uint64_t synced_ = 0;
+};
+
+struct Options {
+    std::string dir;
+    uint64_t segmentRecords;
+    size_t maxSegments;
+    Fsync fsync;
+    std::chrono::milliseconds fsyncInterval;
+};
+
+class Journal {
+public:
+    using Segments = std::vector<std::shared_ptr<Segment>>;
+
+    // Opens (or creates) the journal in options.dir; throws when it cannot
+    explicit Journal(Options options) : options_(std::move(options)) {
+        if (options_.segmentRecords == 0) {
+            throw std::invalid_argument("JOURNAL_SEGMENT_RECORDS must be positive");
+        }
+        options_.maxSegments = std::max<size_t>(options_.maxSegments, 1);
+        std::filesystem::create_directories(options_.dir);
+
+        std::vector<std::string> paths;
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+            if (entry.path().extension() == ".journal") paths.push_back(entry.path().string());
+        }
+        // Zero-padded names sort in sequence order
+        std::sort(paths.begin(), paths.end());
+
+        Segments loaded;
+        for (const std::string& path : paths) loaded.push_back(Segment::open(path));
+        if (loaded.empty()) loaded.push_back(newSegment(0));
+        std::atomic_store(&segments_, std::make_shared<const Segments>(std::move(loaded)));
+
+        auto& registry = metrics::Registry::instance();
+        appended_ = &registry.counter("journal_records_total", "Results appended to the journal");
+        dropped_ = &registry.counter("journal_dropped_records_total",
+                                     "Results that could not be journaled");
+        syncLatency_ = &registry.histogram("journal_fsync_duration_seconds",
+                                           "Time to sync journal pages to disk");
+        registry.callback("journal_segments", "Journal segment files retained", "gauge", {},
+                          [this] { return static_cast<double>(snapshot()->size()); });
+
+        if (options_.fsync == Fsync::Interval) {
+            flusher_ = std::thread([this] { flushLoop(); });
+        }
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    ~Journal() {
+        {
+            std::lock_guard<std::mutex> lock(flushMutex_);
+            stopping_ = true;
+        }
+        flushWake_.notify_all();
+        if (flusher_.joinable()) flusher_.join();
+        if (options_.fsync != Fsync::Off) snapshot()->back()->sync();
+    }
+
+    // Append one batch of results, stamped with the current time
+    void append(const int* original, const int* processed, size_t n) {
+        int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        std::shared_ptr<Segment> segment = snapshot()->back();
+        for (size_t i = 0; i < n; ++i) {
+            if (segment->full()) {
+                segment = rotate(segment);
+                if (!segment) {
+                    dropped_->inc(n - i);
+                    return;
+                }
+            }
+            segment->append({now, original[i], processed[i]});
+        }
+        appended_->inc(n);
+        if (options_.fsync == Fsync::Batch) sync(*segment);
+    }
+
+    // Current segments, oldest first; holding the snapshot keeps them mapped
+    std::shared_ptr<const Segments> snapshot() const { return std::atomic_load(&segments_); }
+
+    const Options& options() const { return options_; }
+
+    std::string describe() const {
+        auto segments = snapshot();
+        uint64_t records = 0;
+        for (const auto& s : *segments) records += s->size();
+        std::string out = options_.dir + " (" + std::to_string(segments->size()) + " segments, " +
+                          std::to_string(records) + " records, " +
+                          std::to_string(options_.segmentRecords) + " per segment, keep " +
+                          std::to_string(options_.maxSegments) + ", fsync " +
+                          fsyncName(options_.fsync);
+        if (options_.fsync == Fsync::Interval) {
+            out += " every " + std::to_string(options_.fsyncInterval.count()) + "ms";
+        }
+        return out + ")";
+    }
+
+private:
+    std::shared_ptr<Segment> newSegment(uint64_t first) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%020llu.journal", static_cast<unsigned long long>(first));
+        return Segment::create((std::filesystem::path(options_.dir) / name).string(), first,
+                               options_.segmentRecords);
+    }
+
+    // Seal `full`, start the next segment and drop the oldest beyond the
+    // limit; null if the next segment could not be created (retried on the
+    // next append)
+    std::shared_ptr<Segment> rotate(const std::shared_ptr<Segment>& full) {
+        std::shared_ptr<Segment> next;
+        try {
+            next = newSegment(full->first() + full->size());
+        } catch (const std::exception& e) {
+            LOG_ERROR << "[ERROR] Journal rotation failed: " << e.what();
+            return nullptr;
+        }
+        if (options_.fsync != Fsync::Off) sync(*full);
+
+        auto current = snapshot();
+        Segments segments(*current);
+        segments.push_back(next);
+        while (segments.size() > options_.maxSegments) {
+            segments.front()->remove();
+            segments.erase(segments.begin());
+        }
+        std::atomic_store(&segments_, std::make_shared<const Segments>(std::move(segments)));
+        LOG_INFO << "Journal rotated to " << next->path();
+        return next;
+    }
+
+    void sync(Segment& segment) {
+        metrics::ScopedTimer timer(*syncLatency_);
+        segment.sync();
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(flushMutex_);
+        while (!flushWake_.wait_for(lock, options_.fsyncInterval, [this] { return stopping_; })) {
+            lock.unlock();
+            // A segment rotated away was synced by rotate()
+            sync(*snapshot()->back());
+            lock.lock();
+        }
+    }
+
+    Options options_;
+    std::shared_ptr<const Segments> segments_;
+    std::mutex writeMutex_;
+
+    metrics::Counter* appended_;
+    metrics::Counter* dropped_;
+    metrics::Histogram* syncLatency_;
+
+    std::mutex flushMutex_;
+    std::condition_variable flushWake_;
+    bool stopping_ = false;
+    std::thread flusher_;
+};
+
+// Byte ranges of the mapped records for sequence numbers [from, to), plus
+// the segments that keep them mapped
+struct Range {
+    struct Slice {
+        uint64_t sequence;  // of the slice's first record
+        const Record* records;
+        size_t count;
+    };
+
+    std::shared_ptr<const Journal::Segments> segments;
+    std::vector<Slice> slices;  // one per segment; sequence numbers may skip between them
+    uint64_t first = 0;  // oldest record retained
+    uint64_t next = 0;   // sequence number after the last record in the range
+    uint64_t count = 0;
+    size_t bytes = 0;
+};
+
+// Up to `limit` records from sequence number `since` on. Records already
+// deleted are skipped, so the range starts at range.first at the earliest;
+// a `since` past the end gives an empty range whose `next` is the end.
+inline Range read(const Journal& journal, uint64_t since, uint64_t limit) {
+    Range range;
+    range.segments = journal.snapshot();
+    range.first = range.segments->front()->first();
+    const Segment& last = *range.segments->back();
+    range.next = std::clamp(since, range.first, last.first() + last.size());
+    for (const auto& segment : *range.segments) {
+        if (range.count >= limit) break;
+        uint64_t size = segment->size();
+        uint64_t end = segment->first() + size;
+        if (end <= range.next) continue;
+
+        uint64_t from = std::max(range.next, segment->first()) - segment->first();
+        uint64_t take = std::min(size - from, limit - range.count);
+        range.slices.push_back({segment->first() + from, segment->records() + from, take});
+        range.count += take;
+        range.bytes += take * sizeof(Record);
+        range.next = segment->first() + from + take;
+    }
+    return range;
+}
+
+}  // namespace journal
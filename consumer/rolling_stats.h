@@ -0,0 +1,321 @@
+#pragma once
+
+#include "json.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Rolling aggregates of consumed values for /stats.
+//
+// Each second of traffic lands in one slot of a ring, holding count, sum,
+// min, max and a DDSketch (logarithmic buckets with 1% relative error) for
+// the original and the processed values. The engine's handler thread is the
+// only writer and only touches the slot of the current second, with relaxed
+// atomic stores, so recording takes no lock. Once a second a ticker thread
+// merges the completed slots into the 1s, 10s and 60s windows and renders
+// the /stats body, which requests then get as a prebuilt string: answering
+// costs the same however many values were seen. Sketches merge by adding
+// bucket counts, so ?sketch=true exposes them for combining replicas.
+namespace stats {
+
+// DDSketch over int32 values. Magnitude m >= 1 lands in bucket
+// ceil(log_gamma(m)); any value in a bucket is within kRelativeAccuracy of
+// the bucket's representative value.
+struct SketchMapping {
+    static constexpr double kRelativeAccuracy = 0.01;
+    static constexpr int kBuckets = 1076;  // covers magnitudes up to 2^31
+    static constexpr int kTableSize = 4096;
+
+    static double gamma() {
+        static const double g = (1 + kRelativeAccuracy) / (1 - kRelativeAccuracy);
+        return g;
+    }
+
+    static int index(uint32_t magnitude) {
+        // Transformed values are mostly small; skip the log for those
+        static const auto table = [] {
+            std::array<uint16_t, kTableSize> t{};
+            for (int m = 1; m < kTableSize; ++m) t[m] = static_cast<uint16_t>(compute(m));
+            return t;
+        }();
+        return magnitude < kTableSize ? table[magnitude] : compute(magnitude);
+    }
+
+    // Representative value of a bucket, the point equidistant (relatively)
+    // from both bounds
+    static double value(int index) { return 2 * std::pow(gamma(), index) / (gamma() + 1); }
+
+private:
+    static int compute(double magnitude) {
+        return std::min(static_cast<int>(std::ceil(std::log(magnitude) / std::log(gamma()))),
+                        kBuckets - 1);
+    }
+};
+
+// Mergeable aggregate of one window, built by the ticker
+struct Summary {
+    uint64_t count = 0;
+    int64_t sum = 0;
+    int32_t min = std::numeric_limits<int32_t>::max();
+    int32_t max = std::numeric_limits<int32_t>::min();
+    uint64_t zero = 0;
+    std::array<uint64_t, SketchMapping::kBuckets> positive{};
+    std::array<uint64_t, SketchMapping::kBuckets> negative{};
+
+    void merge(const Summary& other) {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        zero += other.zero;
+        for (int i = 0; i < SketchMapping::kBuckets; ++i) {
+            positive[i] += other.positive[i];
+            negative[i] += other.negative[i];
+        }
+    }
+
+    // Value at quantile q, clamped to the exact min and max. Nearest rank:
+    // the smallest value with at least q of the samples at or below it, so
+    // p99 of a window holding {23, 100} is 100, not 23. The epsilon keeps
+    // 0.99 * 100 from rounding up a rank.
+    double quantile(double q) const {
+        if (count == 0) return 0;
+        double nearest = std::ceil(q * static_cast<double>(count) - 1e-9);
+        uint64_t rank = nearest > 1 ? static_cast<uint64_t>(nearest) - 1 : 0;
+        uint64_t seen = 0;
+        double estimate = max;
+        for (int i = SketchMapping::kBuckets - 1; i >= 0 && seen <= rank; --i) {
+            seen += negative[i];
+            if (seen > rank) estimate = -SketchMapping::value(i);
+        }
+        if (seen <= rank) {
+            seen += zero;
+            if (seen > rank) estimate = 0;
+        }
+        for (int i = 0; i < SketchMapping::kBuckets && seen <= rank; ++i) {
+            seen += positive[i];
+            if (seen > rank) estimate = SketchMapping::value(i);
+        }
+        return std::clamp(estimate, static_cast<double>(min), static_cast<double>(max));
+    }
+
+    nlohmann::json toJson(bool withSketch) const {
+        nlohmann::json out;
+        out["count"] = count;
+        if (count > 0) {
+            out["sum"] = sum;
+            out["mean"] = static_cast<double>(sum) / static_cast<double>(count);
+            out["min"] = min;
+            out["max"] = max;
+            out["p50"] = quantile(0.5);
+            out["p90"] = quantile(0.9);
+            out["p99"] = quantile(0.99);
+            out["p999"] = quantile(0.999);
+        }
+        if (withSketch) {
+            nlohmann::json sketch;
+            sketch["gamma"] = SketchMapping::gamma();
+            sketch["zero"] = zero;
+            sketch["positive"] = buckets(positive);
+            sketch["negative"] = buckets(negative);
+            out["sketch"] = std::move(sketch);
+        }
+        return out;
+    }
+
+private:
+    // Dense counts from the first to the last non-empty bucket
+    static nlohmann::json buckets(const std::array<uint64_t, SketchMapping::kBuckets>& counts) {
+        int lo = 0;
+        int hi = SketchMapping::kBuckets - 1;
+        while (lo <= hi && counts[lo] == 0) ++lo;
+        while (hi >= lo && counts[hi] == 0) --hi;
+        nlohmann::json out;
+        out["offset"] = lo <= hi ? lo : 0;
+        out["counts"] = nlohmann::json::array();
+        for (int i = lo; i <= hi; ++i) out["counts"].push_back(counts[i]);
+        return out;
+    }
+};
+
+// One second of one value stream. Written by a single thread, read by the
+// ticker once the second is over.
+class Series {
+public:
+    Series() { reset(); }
+
+    void reset() {
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(std::numeric_limits<int32_t>::max(), std::memory_order_relaxed);
+        max_.store(std::numeric_limits<int32_t>::min(), std::memory_order_relaxed);
+        zero_.store(0, std::memory_order_relaxed);
+        for (auto& c : positive_) c.store(0, std::memory_order_relaxed);
+        for (auto& c : negative_) c.store(0, std::memory_order_relaxed);
+    }
+
+    // Single writer, so plain load/store pairs instead of read-modify-writes
+    void add(int32_t value) {
+        bump(count_);
+        sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value < min_.load(std::memory_order_relaxed)) min_.store(value, std::memory_order_relaxed);
+        if (value > max_.load(std::memory_order_relaxed)) max_.store(value, std::memory_order_relaxed);
+        if (value == 0) {
+            bump(zero_);
+        } else if (value > 0) {
+            bump(positive_[SketchMapping::index(static_cast<uint32_t>(value))]);
+        } else {
+            bump(negative_[SketchMapping::index(0u - static_cast<uint32_t>(value))]);
+        }
+    }
+
+    void mergeInto(Summary& summary) const {
+        uint64_t count = count_.load(std::memory_order_relaxed);
+        if (count == 0) return;
+        summary.count += count;
+        summary.sum += sum_.load(std::memory_order_relaxed);
+        summary.min = std::min(summary.min, min_.load(std::memory_order_relaxed));
+        summary.max = std::max(summary.max, max_.load(std::memory_order_relaxed));
+        summary.zero += zero_.load(std::memory_order_relaxed);
+        for (int i = 0; i < SketchMapping::kBuckets; ++i) {
+            summary.positive[i] += positive_[i].load(std::memory_order_relaxed);
+            summary.negative[i] += negative_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    template <typename T>
+    static void bump(std::atomic<T>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> count_;
+    std::atomic<int64_t> sum_;
+    std::atomic<int32_t> min_;
+    std::atomic<int32_t> max_;
+    std::atomic<uint32_t> zero_;
+    std::array<std::atomic<uint32_t>, SketchMapping::kBuckets> positive_;
+    std::array<std::atomic<uint32_t>, SketchMapping::kBuckets> negative_;
+};
+
+class RollingStats {
+public:
+    RollingStats() {
+        render(nowSeconds());
+        ticker_ = std::thread([this] { tick(); });
+    }
+
+    RollingStats(const RollingStats&) = delete;
+    RollingStats& operator=(const RollingStats&) = delete;
+
+    ~RollingStats() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        ticker_.join();
+    }
+
+    // Record one batch of results; handler thread only
+    void add(const int* original, const int* processed, size_t n) {
+        int64_t second = nowSeconds();
+        Slot& slot = slots_[static_cast<size_t>(second) % kSlots];
+        if (slot.second.load(std::memory_order_relaxed) != second) {
+            // The ring is longer than the widest window, so the ticker is
+            // never reading the slot being recycled
+            slot.original.reset();
+            slot.processed.reset();
+            slot.second.store(second, std::memory_order_release);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            slot.original.add(original[i]);
+            slot.processed.add(processed[i]);
+        }
+    }
+
+    // /stats body as of the last full second
+    std::shared_ptr<const std::string> body(bool withSketch) const {
+        return std::atomic_load(withSketch ? &withSketch_ : &plain_);
+    }
+
+private:
+    static constexpr size_t kSlots = 64;
+    static constexpr int kWindows[] = {1, 10, 60};
+
+    struct Slot {
+        std::atomic<int64_t> second{-1};
+        Series original;
+        Series processed;
+    };
+
+    static int64_t nowSeconds() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Merge the seconds before `now` into each window, widening as it goes
+    void render(int64_t now) {
+        auto original = std::make_unique<Summary>();
+        auto processed = std::make_unique<Summary>();
+        nlohmann::json plain;
+        nlohmann::json withSketch;
+        plain["as_of"] = now;
+        withSketch["as_of"] = now;
+
+        int age = 0;
+        for (int window : kWindows) {
+            for (; age < window; ++age) {
+                const Slot& slot = slots_[static_cast<size_t>(now - 1 - age) % kSlots];
+                if (slot.second.load(std::memory_order_acquire) != now - 1 - age) continue;
+                slot.original.mergeInto(*original);
+                slot.processed.mergeInto(*processed);
+            }
+            std::string name = std::to_string(window) + "s";
+            double rate = static_cast<double>(original->count) / window;
+            plain["windows"][name] = {{"rate", rate},
+                                      {"original", original->toJson(false)},
+                                      {"processed", processed->toJson(false)}};
+            withSketch["windows"][name] = {{"rate", rate},
+                                           {"original", original->toJson(true)},
+                                           {"processed", processed->toJson(true)}};
+        }
+        std::atomic_store(&plain_, std::make_shared<const std::string>(plain.dump()));
+        std::atomic_store(&withSketch_, std::make_shared<const std::string>(withSketch.dump()));
+    }
+
+    void tick() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            // Wake just past each second boundary
+            auto now = std::chrono::system_clock::now();
+            auto next = std::chrono::time_point_cast<std::chrono::seconds>(now) +
+                        std::chrono::seconds(1) + std::chrono::milliseconds(5);
+            if (wake_.wait_until(lock, next, [this] { return stopping_; })) return;
+            lock.unlock();
+            render(nowSeconds());
+            lock.lock();
+        }
+    }
+
+    std::array<Slot, kSlots> slots_;
+    std::shared_ptr<const std::string> plain_;
+    std::shared_ptr<const std::string> withSketch_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread ticker_;
+};
+
+}  // namespace stats
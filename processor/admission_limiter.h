@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+// Adaptive cap on the requests the processor works on at once.
+//
+// A request over the limit is turned away straight away, so when callers
+// outrun the producer the excess gets a quick 503 instead of waiting behind
+// everything else until its deadline. The limit follows latency with a
+// gradient rule. Take `noLoad` as the latency seen when nothing queues and
+// `rtt` as a window's mean latency. Each window then moves the limit a
+// fifth of the way towards
+//
+//     limit * clamp(kTolerance * noLoad / rtt, 0.5, 1) + sqrt(limit)
+//
+// With kTolerance = 2, latency may double over the baseline before the
+// limit stops growing, so the ordinary contention of a busy pod (a few
+// calls sharing producer connections and worker threads) is not read as a
+// queue; only latency beyond that pulls the limit down, by at most half per
+// window. A window in which a request ran out of time cuts it by a tenth at
+// once (the AIMD part). The limit only grows while traffic actually reaches
+// half of it.
+//
+// `noLoad` is a smoothed minimum of the window means: a faster window moves
+// it a quarter of the way down, so one window of prefetch hits does not set
+// a baseline no producer round trip can meet. Window means are used rather
+// than the fastest single reply for the same reason. Every kProbeWindows
+// windows the limit is halved for one window and that window's mean becomes
+// the new baseline, so a slower producer is learned. The limit starts at
+// `initialLimit`, a working level for a normal pod, rather than at its floor.
+class AdmissionLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    AdmissionLimiter(int minLimit, int maxLimit, int initialLimit)
+        : min_(std::max(minLimit, 1)),
+          max_(std::max(maxLimit, min_)),
+          estimate_(std::clamp(initialLimit, min_, max_)),
+          windowStart_(Clock::now()),
+          limit_(static_cast<int>(estimate_)) {}
+
+    AdmissionLimiter(const AdmissionLimiter&) = delete;
+    AdmissionLimiter& operator=(const AdmissionLimiter&) = delete;
+
+    // Take a slot; false if the limit is reached and the request should be shed
+    bool tryAcquire() {
+        int inFlight = inFlight_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        if (inFlight > limit_.load(std::memory_order_relaxed)) {
+            inFlight_.fetch_sub(1, std::memory_order_acq_rel);
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        int peak = peak_.load(std::memory_order_relaxed);
+        while (inFlight > peak &&
+               !peak_.compare_exchange_weak(peak, inFlight, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    // Give the slot back with how long the request took; `dropped` when it
+    // ran out of time. `now` closes windows, and is only passed by tests.
+    void release(Clock::duration latency, bool dropped, Clock::time_point now = Clock::now()) {
+        inFlight_.fetch_sub(1, std::memory_order_acq_rel);
+        std::lock_guard<std::mutex> lock(mutex_);
+        windowSum_ += std::chrono::duration<double, std::micro>(latency).count();
+        ++windowCount_;
+        windowDropped_ = windowDropped_ || dropped;
+        if (windowCount_ >= kMinSamples && now - windowStart_ >= kWindow) update(now);
+    }
+
+    int limit() const { return limit_.load(std::memory_order_relaxed); }
+    int inFlight() const { return inFlight_.load(std::memory_order_relaxed); }
+    uint64_t rejected() const { return rejected_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr auto kWindow = std::chrono::milliseconds(100);
+    static constexpr uint64_t kMinSamples = 10;
+    static constexpr int kProbeWindows = 300;
+    static constexpr double kTolerance = 2.0;  // latency over noLoad_ taken as contention
+    static constexpr double kSmoothing = 0.2;  // share of the way to the target per window
+    static constexpr double kBaselineGain = 0.25;
+
+    // Called with mutex_ held at the end of each window
+    void update(Clock::time_point now) {
+        double rtt = windowSum_ / static_cast<double>(windowCount_);
+        int peak = peak_.exchange(inFlight_.load(std::memory_order_relaxed),
+                                  std::memory_order_relaxed);
+        bool dropped = windowDropped_;
+        windowStart_ = now;
+        windowSum_ = 0;
+        windowCount_ = 0;
+        windowDropped_ = false;
+
+        if (++windows_ >= kProbeWindows) {
+            // Let the queue drain for a window and measure the baseline afresh
+            windows_ = 0;
+            noLoad_ = 0;
+            estimate_ /= 2;
+        } else if (noLoad_ == 0) {
+            noLoad_ = rtt;
+        } else {
+            if (rtt < noLoad_) noLoad_ += (rtt - noLoad_) * kBaselineGain;
+            double gradient = std::clamp(kTolerance * noLoad_ / rtt, 0.5, 1.0);
+            double target = estimate_ * gradient + std::sqrt(estimate_);
+            if (dropped) {
+                estimate_ *= 0.9;
+            } else if (target < estimate_ || peak * 2 >= estimate_) {
+                estimate_ += (target - estimate_) * kSmoothing;
+            }
+        }
+        estimate_ = std::clamp(estimate_, static_cast<double>(min_), static_cast<double>(max_));
+        limit_.store(static_cast<int>(estimate_), std::memory_order_relaxed);
+    }
+
+    const int min_;
+    const int max_;
+
+    std::mutex mutex_;
+    double estimate_;
+    double noLoad_ = 0;  // microseconds; 0 until measured
+    int windows_ = 0;    // since noLoad_ was last probed
+    Clock::time_point windowStart_;
+    double windowSum_ = 0;
+    uint64_t windowCount_ = 0;
+    bool windowDropped_ = false;
+
+    std::atomic<int> limit_;
+    std::atomic<int> inFlight_{0};
+    std::atomic<int> peak_{0};
+    std::atomic<uint64_t> rejected_{0};
+};
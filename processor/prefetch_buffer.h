@@ -0,0 +1,158 @@
+#pragma once
+
+#include "common/logger.h"
+#include "common/mpmc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Read-ahead of producer values for /process.
+//
+// A background thread keeps a lock-free MpmcQueue topped up: whenever the
+// buffer drops to the low watermark it fetches batches until it is back at
+// the high watermark. Handlers only pop, so a hit costs a couple of atomic
+// operations instead of a producer round trip; on a miss the caller falls
+// back to a synchronous fetch. Values can be transformed at fill time so
+// the pipeline runs once per batch with its SIMD kernels.
+class PrefetchBuffer {
+public:
+    struct Item {
+        int original;
+        int processed;
+    };
+
+    // Fetches up to `count` values into `out`; false on failure
+    using Fetch = std::function<bool(size_t count, std::vector<int>& out)>;
+    // Fills `processed` from `original` for `n` values, compacting both; returns the count kept
+    using Transform = std::function<size_t(int* original, int* processed, size_t n)>;
+
+    PrefetchBuffer(size_t lowWatermark, size_t highWatermark, size_t maxBatch, Fetch fetch,
+                   Transform transform)
+        : low_(lowWatermark),
+          high_(std::max(highWatermark, lowWatermark + 1)),
+          maxBatch_(std::max<size_t>(maxBatch, 1)),
+          fetch_(std::move(fetch)),
+          transform_(std::move(transform)),
+          queue_(high_) {}
+
+    PrefetchBuffer(const PrefetchBuffer&) = delete;
+    PrefetchBuffer& operator=(const PrefetchBuffer&) = delete;
+
+    ~PrefetchBuffer() { stop(); }
+
+    void start() {
+        running_ = true;
+        filler_ = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        if (!running_.exchange(false)) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        wake_.notify_all();
+        filler_.join();
+    }
+
+    // Take one buffered value; false when the buffer is empty
+    bool tryPop(Item& item) {
+        if (!queue_.tryPop(item)) {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            wake_.notify_one();
+            return false;
+        }
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        if (queue_.sizeApprox() <= low_) wake_.notify_one();
+        return true;
+    }
+
+    size_t size() const { return queue_.sizeApprox(); }
+    size_t lowWatermark() const { return low_; }
+    size_t highWatermark() const { return high_; }
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    void run() {
+        std::vector<int> original;
+        std::vector<int> processed;
+        int failures = 0;
+        int emptyRefills = 0;
+
+        while (running_) {
+            size_t buffered = queue_.sizeApprox();
+            if (buffered > low_) {
+                // Full enough; wait for a pop to cross the low watermark
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait_for(lock, std::chrono::milliseconds(10));
+                continue;
+            }
+
+            // Refill up to the high watermark, one producer batch at a time
+            while (running_ && (buffered = queue_.sizeApprox()) < high_) {
+                size_t want = std::min(high_ - buffered, maxBatch_);
+                original.clear();
+                if (!fetch_(want, original)) {
+                    if (failures++ == 0) {
+                        LOG_ERROR << "Error: Prefetch from Producer failed, serving synchronously";
+                    }
+                    backOff(failures);
+                    break;
+                }
+                if (failures) {
+                    LOG_INFO << "Prefetch from Producer recovered";
+                }
+                failures = 0;
+
+                processed.resize(original.size());
+                size_t kept = transform_(original.data(), processed.data(), original.size());
+                // A batch the pipeline filters out entirely would otherwise
+                // have the loop fetch again at once, and keep doing so
+                if (kept == 0) {
+                    if (emptyRefills++ == 0) {
+                        LOG_WARN << "Prefetch refill kept no values after the transform, "
+                                    "serving synchronously";
+                    }
+                    backOff(emptyRefills);
+                    break;
+                }
+                if (emptyRefills) {
+                    LOG_INFO << "Prefetch refills keeping values again";
+                }
+                emptyRefills = 0;
+
+                for (size_t i = 0; i < kept; ++i) {
+                    if (!queue_.tryPush({original[i], processed[i]})) break;
+                }
+            }
+        }
+    }
+
+    // Wait out the `attempts`th refill in a row that added nothing:
+    // 100ms, doubling up to 1.6s, or until stop()
+    void backOff(int attempts) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto backoff = std::chrono::milliseconds(50) * (1 << std::min(attempts, 5));
+        wake_.wait_for(lock, backoff, [this] { return !running_.load(); });
+    }
+
+    const size_t low_;
+    const size_t high_;
+    const size_t maxBatch_;
+    const Fetch fetch_;
+    const Transform transform_;
+
+    MpmcQueue<Item> queue_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+
+    std::atomic<bool> running_{false};
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread filler_;
+};
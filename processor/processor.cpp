@@ -1,63 +1,600 @@
 #include "httplib.h"
 #include "json.hpp"
+#include "common/arena.h"
+#include "common/config.h"
+#include "common/event_server.h"
+#include "common/fast_json.h"
+#include "common/lifecycle.h"
+#include "common/json_extract.h"
+#include "common/logger.h"
+#include "common/metrics.h"
+#include "common/saturation.h"
+#include "common/server_options.h"
+#include "common/single_flight.h"
+#include "common/tracing.h"
+#include "common/endpoint_set.h"
+#include "common/upstream_client.h"
+#include "common/wire_format.h"
+#include "admission_limiter.h"
+#include "prefetch_buffer.h"
+#include "stream_relay.h"
+#include "transform.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iostream>
-#include <cstdlib>  // for getenv
+#include <memory>
+#include <optional>
+#include <vector>
 
 using json = nlohmann::json;
 
-// Helper function to get env var with default
-std::string getEnv(const char* name, const std::string& defaultValue) {
-    const char* value = std::getenv(name);
-    return value ? std::string(value) : defaultValue;
+// One producer /data reply: the values on success, otherwise the status
+// (0 if the producer could not be reached) and body to pass through
+struct ProducerReply {
+    bool ok = false;
+    int status = 0;
+    upstream::Failure failure = upstream::Failure::None;
+    std::vector<int> values;
+    std::string body;
+};
+
+// Decoding state for one producer /data read, whichever encoding it answers
+// in. Binary bodies are read in place; JSON ones are parsed by the extractor
+// while they stream in.
+class ProducerRead {
+public:
+    explicit ProducerRead(bool single) : single_(single) {}
+
+    // Fresh decoding state for an attempt; returns its body receiver
+    httplib::ContentReceiver begin() {
+        extract_.emplace();
+        reply_.values.clear();
+        if (single_) {
+            extract_->fields().bind("value", &value_);
+        } else {
+            extract_->fields().bind("values", &reply_.values);
+        }
+        return extract_->receiver();
+    }
+
+    ProducerReply finish(const upstream::Outcome& outcome) {
+        ProducerReply& reply = reply_;
+        reply.failure = outcome.failure;
+        auto& producer_res = outcome.result;
+        if (!producer_res) return std::move(reply);
+        reply.status = producer_res->status;
+        if (producer_res->status != 200) {
+            reply.body = extract_->body();
+            return std::move(reply);
+        }
+
+        if (wire::isBinary(producer_res->get_header_value("Content-Type"))) {
+            wire::View view;
+            if (!view.parse(extract_->body(), wire::Type::Values)) return std::move(reply);
+            if (single_ && view.size() != 1) return std::move(reply);
+            reply.values.resize(view.size());
+            for (size_t i = 0; i < view.size(); ++i) reply.values[i] = view.first(i);
+        } else {
+            if (!extract_->finish()) return std::move(reply);
+            if (single_) reply.values.assign(1, value_);
+        }
+        reply.ok = true;
+        return std::move(reply);
+    }
+
+private:
+    bool single_;
+    int value_ = 0;
+    ProducerReply reply_;
+    std::optional<jsonextract::BodyExtractor> extract_;
+};
+
+// Fetch `path` from the producer within `deadline`
+ProducerReply fetchValues(upstream::UpstreamClient& producer, const httplib::Headers& headers,
+                          const upstream::Deadline& deadline, const std::string& path,
+                          bool single) {
+    ProducerRead read(single);
+    auto outcome = producer.call(deadline, headers,
+                                 [&](httplib::Client& cli, const httplib::Headers& attemptHeaders) {
+        return cli.Get(path, attemptHeaders, read.begin());
+    });
+    return read.finish(outcome);
+}
+
+// fetchValues() on the producer client's event loop; `done` gets the reply there
+void fetchValuesAsync(upstream::UpstreamClient& producer, const httplib::Headers& headers,
+                      const upstream::Deadline& deadline, const std::string& path, bool single,
+                      std::function<void(ProducerReply)> done) {
+    auto read = std::make_shared<ProducerRead>(single);
+    producer.callAsync(deadline, headers,
+                       [read, path] { return upstream::AsyncRequest{path, read->begin()}; },
+                       [read, done](upstream::Outcome outcome) { done(read->finish(outcome)); });
+}
+
+// Error response for a failed producer read: 503 while the circuit is open,
+// 504 once the deadline has run out, 500 otherwise
+void producerError(httplib::Response& res, const ProducerReply& reply) {
+    json error;
+    if (reply.failure == upstream::Failure::CircuitOpen) {
+        error["error"] = "Producer service unavailable (circuit open)";
+        res.status = 503;
+        res.set_header("Retry-After", "1");
+    } else if (reply.failure == upstream::Failure::DeadlineExceeded) {
+        error["error"] = "Deadline exceeded calling Producer service";
+        res.status = 504;
+    } else {
+        error["error"] = "Failed to call Producer service";
+        res.status = 500;
+        LOG_ERROR << "Error: Could not reach Producer";
+    }
+    res.set_content(error.dump(), "application/json");
+}
+
+// Run `handler` under `limiter` (none: as is). A request over the limit is
+// shed with a 503 and a Retry-After before any work is done on it. Otherwise
+// it holds its slot from the first pass until it is answered, across any
+// await() suspension, and its latency then feeds the limit.
+template <typename Handler>
+httplib::Server::Handler admitted(AdmissionLimiter* limiter, int retryAfterSeconds,
+                                  Handler handler) {
+    if (!limiter) return handler;
+    return [limiter, retryAfterSeconds, handler](const httplib::Request& req,
+                                                 httplib::Response& res) {
+        bool resumed = EventServer::resumed();
+        if (!resumed && !limiter->tryAcquire()) {
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(retryAfterSeconds));
+            res.set_content("{\"error\":\"Processor overloaded\"}", "application/json");
+            return;
+        }
+        auto start = resumed ? EventServer::arrived() : std::chrono::steady_clock::now();
+        try {
+            handler(req, res);
+        } catch (...) {
+            limiter->release(std::chrono::steady_clock::now() - start, false);
+            throw;
+        }
+        if (EventServer::suspended()) return;
+        limiter->release(std::chrono::steady_clock::now() - start, res.status == 504);
+    };
 }
 
 int main() {
     std::cout << "Producer starting..." << std::endl;
 
-    httplib::Server svr;
+    EventServer svr;
     
     // Read configuration from environment
     int port = std::stoi(getEnv("PORT", "8081"));
     std::string producerHost = getEnv("PRODUCER_HOST", "producer");
     std::string producerPort = getEnv("PRODUCER_PORT", "8080");
     std::string producerUrl = "http://" + producerHost + ":" + producerPort;
+    // Headless Service to balance across producer pods; empty dials PRODUCER_HOST
+    std::string producerEndpoints = getEnv("PRODUCER_ENDPOINTS", "");
+    int endpointRefreshSeconds = getEnvInt("ENDPOINT_REFRESH_SECONDS", 3);
+    std::string defaultBatchSize = getEnv("BATCH_SIZE", "10");
+    std::string wireFormat = getEnv("WIRE_FORMAT", "json");
+    bool singleFlight = getEnvBool("SINGLE_FLIGHT", false);
+    int cacheTtlMs = getEnvInt("CACHE_TTL_MS", 0);
+    ServerOptions serverOptions = loadServerOptions();
+    upstream::Policy producerPolicy = upstream::loadPolicy();
 
-    svr.Get("/process", [](const httplib::Request&, httplib::Response& res) {
-        // Call the producer service
-        httplib::Client cli("http://producer:8080");
-        auto producer_res = cli.Get("/data");
+    // Processing stages, swappable per deployment through the ConfigMap
+    std::unique_ptr<transform::Pipeline> pipeline;
+    try {
+        pipeline = std::make_unique<transform::Pipeline>(
+            getEnv("TRANSFORM_PIPELINE", "scale:2"),
+            transform::parseIsa(getEnv("TRANSFORM_ISA", "auto")));
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid transform configuration: " << e.what() << std::endl;
+        return 1;
+    }
+    size_t streamBufferChunks = static_cast<size_t>(getEnvInt("STREAM_BUFFER_CHUNKS", 16));
 
-        if (producer_res && producer_res->status == 200) {
-            // Parse the response from Producer
-            json producer_data = json::parse(producer_res->body);
-            int original_value = producer_data["value"];
+    // Producer read-ahead for /process
+    bool prefetch = getEnvBool("PREFETCH", false);
+    size_t prefetchLow = static_cast<size_t>(getEnvInt("PREFETCH_LOW_WATERMARK", 256));
+    size_t prefetchHigh = static_cast<size_t>(getEnvInt("PREFETCH_HIGH_WATERMARK", 1024));
+    size_t prefetchBatch = static_cast<size_t>(getEnvInt("PREFETCH_BATCH", 500));
+    bool prefetchTransform = getEnvBool("PREFETCH_TRANSFORM", true);
+    if (prefetch && (prefetchHigh <= prefetchLow || prefetchBatch == 0)) {
+        std::cerr << "Error: Invalid prefetch configuration: PREFETCH_HIGH_WATERMARK must exceed "
+                     "PREFETCH_LOW_WATERMARK and PREFETCH_BATCH must be positive" << std::endl;
+        return 1;
+    }
 
-            // Process it (multiply by 2)
-            int processed_value = original_value * 2;
+    // Load shedding on /process and /process_batch
+    bool admissionControl = getEnvBool("ADMISSION_CONTROL", false);
+    int admissionMin = getEnvInt("ADMISSION_MIN_LIMIT", 4);
+    int admissionMax = getEnvInt("ADMISSION_MAX_LIMIT", 512);
+    int admissionInitial = getEnvInt("ADMISSION_INITIAL_LIMIT", 32);
+    int retryAfterSeconds = std::max(getEnvInt("ADMISSION_RETRY_AFTER_SECONDS", 1), 1);
 
-            std::cout << "Recieved: " << original_value
-                        << ", Processed: " << processed_value << std::endl;
+    // Asynchronous logging; LOG_SAMPLE_EVERY=N keeps 1 in N "Recieved" lines
+    logging::configure(getEnv("LOG_LEVEL", "info"));
+    logging::Sampler receivedSampler(std::stoul(getEnv("LOG_SAMPLE_EVERY", "1")));
 
-            // Return processed result
-            json response;
-            response["original"] = original_value;
-            response["processed"] = processed_value;
+    tracing::Config traceConfig = tracing::loadConfig();
+    tracing::start("processor", traceConfig);
+
+    // WIRE_FORMAT=binary asks the producer for the compact encoding
+    httplib::Headers producerHeaders;
+    if (wireFormat == "binary") {
+        producerHeaders.emplace("Accept", std::string(wire::kContentType) + ", application/json");
+    }
+
+    // Keep-alive connections to each producer pod, one per server worker thread
+    EndpointSet producerPool(producerHost, producerEndpoints, std::stoi(producerPort),
+                             serverOptions.threads, std::chrono::seconds(endpointRefreshSeconds));
+
+    // Deadlines, retries and circuit breaking on producer calls; call timing
+    // and pool reuse are reported on /metrics
+    upstream::UpstreamClient producer(producerPool, "processor", "producer", producerPolicy);
+    metrics::Registry::instance().callback(
+        "upstream_endpoints", "Upstream pods being balanced across", "gauge",
+        {{"service", "processor"}, {"upstream", "producer"}},
+        [&producerPool] { return static_cast<double>(producerPool.size()); });
+    metrics::Registry::instance().callback(
+        "upstream_pool_checkouts_total", "Connection pool checkouts", "counter",
+        {{"service", "processor"}, {"upstream", "producer"}, {"result", "hit"}},
+        [&producerPool] { return static_cast<double>(producerPool.hits()); });
+    metrics::Registry::instance().callback(
+        "upstream_pool_checkouts_total", "Connection pool checkouts", "counter",
+        {{"service", "processor"}, {"upstream", "producer"}, {"result", "miss"}},
+        [&producerPool] { return static_cast<double>(producerPool.misses()); });
+    metrics::Registry::instance().callback(
+        "upstream_pool_idle_connections", "Idle pooled connections", "gauge",
+        {{"service", "processor"}, {"upstream", "producer"}},
+        [&producerPool] { return static_cast<double>(producerPool.idle()); });
+
+    // Optional coalescing of concurrent producer fetches, plus a short TTL
+    // cache of the last reply per path. Callers that share a fetch also share
+    // its values, so this trades distinct random values for producer load.
+    SingleFlight<ProducerReply> producerFlights(singleFlight, std::chrono::milliseconds(cacheTtlMs));
+    metrics::Counter* flightResults[4];
+    const char* flightSources[] = {"fetched", "coalesced", "cached", "expired"};
+    for (int i = 0; i < 4; ++i) {
+        flightResults[i] = &metrics::Registry::instance().counter(
+            "single_flight_requests_total", "Producer reads by how they were served",
+            {{"service", "processor"}, {"result", flightSources[i]}});
+    }
+    // Producer read for a handler. With UPSTREAM_ASYNC the call runs on the
+    // client's event loop and, on the epoll backend, the handler's worker is
+    // freed while it is out: nullptr then means the request was suspended and
+    // the handler must return; it runs again once the reply is in.
+    auto readProducer = [&producerFlights, &flightResults, &producer, &producerHeaders](
+                            const std::string& path, bool single, const upstream::Deadline& deadline)
+                            -> std::shared_ptr<const ProducerReply> {
+        using Reply = std::shared_ptr<const ProducerReply>;
+        if (!producer.async()) {
+            auto outcome = producerFlights.run(path, [&] {
+                return fetchValues(producer, producerHeaders, deadline, path, single);
+            }, deadline.at());
+            flightResults[static_cast<int>(outcome.source)]->inc();
+            if (outcome.source == SingleFlight<ProducerReply>::Source::Expired) {
+                ProducerReply expired;
+                expired.failure = upstream::Failure::DeadlineExceeded;
+                return std::make_shared<const ProducerReply>(std::move(expired));
+            }
+            return outcome.value;
+        }
+        auto reply = EventServer::await<Reply>([&](std::function<void(Reply)> done) {
+            producerFlights.runAsync(
+                path,
+                [&](std::function<void(ProducerReply)> finish) {
+                    fetchValuesAsync(producer, producerHeaders, deadline, path, single, finish);
+                },
+                [&flightResults, done](SingleFlight<ProducerReply>::Outcome outcome) {
+                    flightResults[static_cast<int>(outcome.source)]->inc();
+                    done(outcome.value);
+                });
+        });
+        return reply ? *reply : nullptr;
+    };
+
+    // Background read-ahead: /process pops a buffered value and only falls
+    // back to a synchronous producer fetch when the buffer has run dry. With
+    // PREFETCH_TRANSFORM the pipeline runs once per refill batch, so values
+    // it filters out never reach the buffer.
+    std::unique_ptr<PrefetchBuffer> prefetchBuffer;
+    if (prefetch) {
+        prefetchBuffer = std::make_unique<PrefetchBuffer>(
+            prefetchLow, prefetchHigh, prefetchBatch,
+            [&producer, &producerHeaders, &producerPolicy](size_t count, std::vector<int>& out) {
+                ProducerReply reply = fetchValues(producer, producerHeaders,
+                                                  upstream::Deadline::after(producerPolicy.timeout),
+                                                  "/data?count=" + std::to_string(count), false);
+                out = std::move(reply.values);
+                return reply.ok;
+            },
+            [&pipeline, prefetchTransform](int* original, int* processed, size_t n) {
+                if (prefetchTransform) return pipeline->run(original, processed, n);
+                std::copy(original, original + n, processed);
+                return n;
+            });
+
+        auto& registry = metrics::Registry::instance();
+        PrefetchBuffer* buffer = prefetchBuffer.get();
+        registry.callback("prefetch_requests_total", "/process calls by whether the buffer had a value",
+                          "counter", {{"service", "processor"}, {"result", "hit"}},
+                          [buffer] { return static_cast<double>(buffer->hits()); });
+        registry.callback("prefetch_requests_total", "/process calls by whether the buffer had a value",
+                          "counter", {{"service", "processor"}, {"result", "miss"}},
+                          [buffer] { return static_cast<double>(buffer->misses()); });
+        registry.callback("prefetch_buffered_values", "Values waiting in the read-ahead buffer",
+                          "gauge", {{"service", "processor"}},
+                          [buffer] { return static_cast<double>(buffer->size()); });
+    }
 
-            res.set_content(response.dump(), "application/json");
+    if (pipeline->hasStats()) {
+        const transform::Aggregates& totals = pipeline->aggregates();
+        auto& registry = metrics::Registry::instance();
+        registry.callback("transform_values_total", "Values seen by the stats stage", "counter", {},
+                          [&totals] { return static_cast<double>(totals.count.load()); });
+        registry.callback("transform_value_sum", "Sum of values seen by the stats stage", "counter",
+                          {}, [&totals] { return static_cast<double>(totals.sum.load()); });
+        registry.callback("transform_value_min", "Smallest value seen by the stats stage", "gauge",
+                          {}, [&totals] { return static_cast<double>(totals.min.load()); });
+        registry.callback("transform_value_max", "Largest value seen by the stats stage", "gauge",
+                          {}, [&totals] { return static_cast<double>(totals.max.load()); });
+    }
+
+    std::unique_ptr<AdmissionLimiter> admission;
+    if (admissionControl) {
+        admission = std::make_unique<AdmissionLimiter>(admissionMin, admissionMax, admissionInitial);
+        auto& registry = metrics::Registry::instance();
+        AdmissionLimiter* limiter = admission.get();
+        registry.callback("admission_limit", "Requests the processor currently admits at once",
+                          "gauge", {{"service", "processor"}},
+                          [limiter] { return static_cast<double>(limiter->limit()); });
+        registry.callback("admission_in_flight", "Admitted requests in progress", "gauge",
+                          {{"service", "processor"}},
+                          [limiter] { return static_cast<double>(limiter->inFlight()); });
+        registry.callback("admission_rejected_total", "Requests shed over the admission limit",
+                          "counter", {{"service", "processor"}},
+                          [limiter] { return static_cast<double>(limiter->rejected()); });
+    }
+
+    svr.Get("/process", metrics::instrument("processor", "/process", admitted(admission.get(),
+                                            retryAfterSeconds,
+                                            [&readProducer, &receivedSampler, &pipeline,
+                                             &prefetchBuffer, prefetchTransform, &producerPolicy](
+                                                const httplib::Request& req, httplib::Response& res) {
+        // Take a read-ahead value if one is buffered; a request resumed
+        // after an async producer read already found the buffer empty
+        PrefetchBuffer::Item item;
+        bool prefetched = prefetchBuffer && !EventServer::resumed() && prefetchBuffer->tryPop(item);
+        bool transformed = prefetched && prefetchTransform;
+
+        // Otherwise call the producer service (or join a fetch already in flight)
+        std::shared_ptr<const ProducerReply> producer_reply;
+        if (!prefetched) {
+            auto deadline = upstream::Deadline::fromRequest(req, producerPolicy.timeout);
+            producer_reply = readProducer("/data", true, deadline);
+            if (!producer_reply) return;  // suspended until the producer answers
+            if (producer_reply->ok) item.original = producer_reply->values[0];
+        }
+
+        if (prefetched || producer_reply->ok) {
+            // Process it through the configured pipeline
+            int original_value = item.original;
+            int processed_value = item.processed;
+            if (!transformed && pipeline->run(&original_value, &processed_value, 1) == 0) {
+                // Filtered out: nothing to return
+                res.status = 204;
+                return;
+            }
+
+            LOG_SAMPLED(receivedSampler, logging::Level::Info)
+                << "Recieved: " << original_value << ", Processed: " << processed_value;
+
+            // Return processed result
+            if (wire::accepts(req.get_header_value("Accept"))) {
+                std::string_view body = wire::processed(&original_value, &processed_value, 1);
+                res.set_content(body.data(), body.size(), wire::kContentType);
+            } else {
+                std::string_view body = fastjson::processed(original_value, processed_value);
+                res.set_content(body.data(), body.size(), "application/json");
+            }
         } else {
             // Error calling Producer
-            json error;
-            error["error"] = "Failed to call Producer service";
-            res.status = 500;
-            res.set_content(error.dump(), "application/json");
+            producerError(res, *producer_reply);
+        }
+    })));
+
+    // Batched variant: one producer round trip for ?count=N values
+    svr.Get("/process_batch", metrics::instrument("processor", "/process_batch",
+                                                  admitted(admission.get(), retryAfterSeconds,
+                                                  [&readProducer, &receivedSampler, &pipeline,
+                                                   defaultBatchSize, &producerPolicy](
+                                                      const httplib::Request& req,
+                                                      httplib::Response& res) {
+        std::string count = req.has_param("count") ? req.get_param_value("count")
+                                                   : defaultBatchSize;
+        // Forwarded as the number the producer would read from it (0 when that
+        // is none), so the single-flight key is one per count, not per spelling
+        int parsedCount = 0;
+        try {
+            parsedCount = std::stoi(count);
+        } catch (const std::exception&) {
+            parsedCount = 0;
+        }
+
+        auto producer_reply = readProducer("/data?count=" + std::to_string(parsedCount),
+                                           false,
+                                           upstream::Deadline::fromRequest(req, producerPolicy.timeout));
+        if (!producer_reply) return;  // suspended until the producer answers
+
+        if (producer_reply->ok) {
+            // Both columns are request scratch, on the handler's arena
+            const std::vector<int>& values = producer_reply->values;
+            arena::Vector<int> original_values(values.begin(), values.end(), arena::resource());
+
+            // Process the whole batch through the pipeline's SIMD kernels
+            arena::Vector<int> processed_values(original_values.size(), arena::resource());
+            size_t kept = pipeline->run(original_values.data(), processed_values.data(),
+                                        original_values.size());
+            original_values.resize(kept);
+            processed_values.resize(kept);
 
-            std::cerr << "Error: Could not reach Producer" << std::endl;
+            LOG_SAMPLED(receivedSampler, logging::Level::Info)
+                << "Recieved batch: " << original_values.size() << " values";
+
+            if (wire::accepts(req.get_header_value("Accept"))) {
+                std::string_view body = wire::processed(
+                    original_values.data(), processed_values.data(), original_values.size());
+                res.set_content(body.data(), body.size(), wire::kContentType);
+            } else {
+                std::string_view body = fastjson::processedBatch(
+                    original_values.data(), processed_values.data(), original_values.size());
+                res.set_content(body.data(), body.size(), "application/json");
+            }
+        } else if (producer_reply->status == 400) {
+            // Invalid batch size, pass the Producer's explanation through
+            res.status = 400;
+            res.set_content(producer_reply->body, "application/json");
+        } else {
+            producerError(res, *producer_reply);
+        }
+    })));
+
+    // Streaming variant: subscribe to the producer's stream once and
+    // re-stream each value as {"original":a,"processed":b} as it arrives.
+    // ?rate and ?limit are passed through to the producer.
+    auto& streamValues = metrics::Registry::instance().counter(
+        "stream_values_total", "Values sent on streaming endpoints", {{"service", "processor"}});
+    auto& streamSubscribers = metrics::Registry::instance().gauge(
+        "stream_subscribers", "Open streaming connections", {{"service", "processor"}});
+
+    svr.Get("/process/stream", [&producerPool, streamBufferChunks, &streamValues,
+                                &streamSubscribers, &pipeline](const httplib::Request& req,
+                                                    httplib::Response& res) {
+        std::string path = "/data/stream";
+        char separator = '?';
+        for (const char* name : {"rate", "limit"}) {
+            if (!req.has_param(name)) continue;
+            path += separator;
+            path += name;
+            path += '=';
+            path += httplib::encode_query_component(req.get_param_value(name));
+            separator = '&';
+        }
+
+        auto relay = std::make_shared<StreamRelay>(
+            producerPool.pick()->address(), producerPool.port(), path, streamBufferChunks,
+            [&pipeline](int* in, int* out, size_t n) { return pipeline->run(in, out, n); });
+        relay->start();
+        streamSubscribers.inc();
+        LOG_INFO << "Stream subscribed: " << path;
+
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider(
+            sse::kContentType,
+            [relay, &streamValues](size_t, httplib::DataSink& sink) {
+                StreamRelay::Chunk chunk;
+                // On shutdown the stream ends cleanly and the subscriber reconnects elsewhere
+                if (!lifecycle::draining() && relay->next(chunk)) {
+                    streamValues.inc(chunk.values);
+                    return sink.write(chunk.events.data(), chunk.events.size());
+                }
+                if (relay->failed()) {
+                    std::string error;
+                    sse::appendEvent(error, "error", "{\"error\":\"Failed to call Producer service\"}");
+                    sink.write(error.data(), error.size());
+                }
+                sink.done();
+                return true;
+            },
+            [relay, &streamSubscribers](bool) {
+                relay->close();
+                streamSubscribers.dec();
+                LOG_INFO << "Stream closed after " << relay->values() << " values";
+            });
+    });
+
+    // Active transform configuration
+    svr.Get("/transform", [&pipeline](const httplib::Request&, httplib::Response& res) {
+        json info;
+        info["pipeline"] = pipeline->spec();
+        info["isa"] = transform::isaName(pipeline->isa());
+        if (pipeline->hasStats()) {
+            const transform::Aggregates& totals = pipeline->aggregates();
+            uint64_t count = totals.count.load();
+            info["stats"]["count"] = count;
+            info["stats"]["sum"] = totals.sum.load();
+            if (count) {
+                info["stats"]["min"] = totals.min.load();
+                info["stats"]["max"] = totals.max.load();
+            }
         }
+        res.set_content(info.dump(), "application/json");
     });
+
+    // Connection pool statistics
+    svr.Get("/pool", [&producerPool](const httplib::Request&, httplib::Response& res) {
+        json stats;
+        stats["capacity"] = producerPool.capacity();
+        stats["idle"] = producerPool.idle();
+        stats["hits"] = producerPool.hits();
+        stats["misses"] = producerPool.misses();
+        stats["endpoints"] = json::array();
+        for (const auto& endpoint : *producerPool.snapshot()) {
+            json e;
+            e["address"] = endpoint->address();
+            e["in_flight"] = endpoint->inFlight();
+            e["latency_ms"] = endpoint->latencyMs();
+            e["idle"] = endpoint->pool().idle();
+            stats["endpoints"].push_back(e);
+        }
+        res.set_content(stats.dump(), "application/json");
+    });
+
+    metrics::expose(svr, "processor");
+    // Admitted requests over the limit, as the limiter sees its headroom
+    std::vector<std::pair<std::string, saturation::Signal>> admissionSignal;
+    if (admission) {
+        AdmissionLimiter* limiter = admission.get();
+        admissionSignal.emplace_back("admission", [limiter] {
+            return static_cast<double>(limiter->inFlight()) / std::max(limiter->limit(), 1);
+        });
+    }
+    saturation::Config saturationConfig = saturation::loadConfig();
+    saturation::expose(svr, "processor", serverOptions, saturationConfig, std::move(admissionSignal));
+    lifecycle::expose(svr, "processor");
     
     std::cout << "Processor listening on port " << port << std::endl;
     std::cout << "Producer URL: " << producerUrl << std::endl;
-    svr.listen("0.0.0.0", port);
+    std::cout << "Producer endpoints: " << producerPool.describe() << std::endl;
+    std::cout << "Producer pool size: " << producerPool.capacity() << std::endl;
+    std::cout << "Producer calls: " << upstream::describe(producerPolicy) << std::endl;
+    std::cout << "Wire format: " << wireFormat << std::endl;
+    std::cout << "Single-flight: " << (singleFlight ? "on" : "off")
+              << ", cache TTL " << cacheTtlMs << "ms" << std::endl;
+    std::cout << "Transform: " << pipeline->spec() << " ("
+              << transform::isaName(pipeline->isa()) << ")" << std::endl;
+    if (prefetchBuffer) {
+        std::cout << "Prefetch: watermarks " << prefetchLow << "/" << prefetchHigh << ", batch "
+                  << prefetchBatch << (prefetchTransform ? ", pre-transformed" : "") << std::endl;
+        prefetchBuffer->start();
+        // No refills while draining; /process falls back to direct fetches
+        lifecycle::onDrain([buffer = prefetchBuffer.get()] { buffer->stop(); });
+    } else {
+        std::cout << "Prefetch: off" << std::endl;
+    }
+    if (admission) {
+        std::cout << "Admission control: limit " << admissionMin << "-" << admissionMax
+                  << " from " << admission->limit() << ", Retry-After " << retryAfterSeconds << "s" << std::endl;
+    } else {
+        std::cout << "Admission control: off" << std::endl;
+    }
+    std::cout << "Server: " << describe(serverOptions) << std::endl;
+    std::cout << "Tracing: " << tracing::describe(traceConfig) << std::endl;
+    std::cout << "Saturation: " << saturation::describe(saturationConfig) << std::endl;
+    if (!serve(svr, serverOptions, "0.0.0.0", port)) {
+        std::cerr << "Error: Could not listen on port " << port << std::endl;
+        return 1;
+    }
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "httplib.h"
+#include "common/bounded_queue.h"
+#include "common/fast_json.h"
+#include "common/json_extract.h"
+#include "common/logger.h"
+#include "common/sse.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One downstream subscriber of /process/stream.
+//
+// A reader thread holds a single long-lived /data/stream request open to
+// the producer, decodes values as chunks arrive, transforms each chunk in
+// one pass and queues the re-encoded events. The queue holds a bounded
+// number of chunks: once the downstream reader falls behind, the upstream
+// content receiver blocks, the producer's socket fills and generation
+// slows to the pace of the slowest hop.
+class StreamRelay {
+public:
+    // Transforms `n` values from `in` into `out`, compacting both when values
+    // are dropped; returns how many remain
+    using Transform = std::function<size_t(int* in, int* out, size_t n)>;
+
+    // Encoded events for one upstream chunk
+    struct Chunk {
+        std::string events;
+        size_t values = 0;
+    };
+
+    StreamRelay(std::string host, int port, std::string path, size_t bufferChunks,
+                Transform transform)
+        : host_(std::move(host)),
+          port_(port),
+          path_(std::move(path)),
+          transform_(std::move(transform)),
+          chunks_(bufferChunks) {}
+
+    StreamRelay(const StreamRelay&) = delete;
+    StreamRelay& operator=(const StreamRelay&) = delete;
+
+    ~StreamRelay() {
+        close();
+        if (reader_.joinable()) reader_.join();
+    }
+
+    void start() {
+        reader_ = std::thread([this] { run(); });
+    }
+
+    // Next chunk of encoded events; false once the upstream stream has ended
+    bool next(Chunk& chunk) { return chunks_.pop(chunk); }
+
+    // Whether the stream ended because of an upstream failure
+    bool failed() const { return failed_.load(); }
+
+    // Unblock the reader and abort the upstream request
+    void close() {
+        chunks_.close();
+        std::lock_guard<std::mutex> lock(clientMutex_);
+        if (client_) client_->stop();
+    }
+
+    uint64_t values() const { return values_.load(std::memory_order_relaxed); }
+
+private:
+    void run() {
+        httplib::Client cli(host_, port_);
+        cli.set_tcp_nodelay(true);
+        {
+            std::lock_guard<std::mutex> lock(clientMutex_);
+            if (chunks_.closed()) return;
+            client_ = &cli;
+        }
+
+        sse::Parser parser;
+        std::vector<int> original;
+        std::vector<int> processed;
+        bool malformed = false;
+
+        auto res = cli.Get(path_, [&](const char* data, size_t size) {
+            original.clear();
+            parser.feed(data, size, [&](std::string_view, std::string_view event) {
+                int value = 0;
+                jsonextract::FieldReader reader;
+                reader.bind("value", &value);
+                reader.feed(event);
+                if (reader.finish()) {
+                    original.push_back(value);
+                } else {
+                    malformed = true;
+                }
+            });
+            if (malformed) return false;
+            if (original.empty()) return true;
+
+            processed.resize(original.size());
+            size_t kept = transform_(original.data(), processed.data(), original.size());
+            original.resize(kept);
+            if (original.empty()) return true;
+
+            Chunk chunk;
+            chunk.values = original.size();
+            chunk.events.reserve(original.size() * 48);
+            for (size_t i = 0; i < original.size(); ++i) {
+                sse::appendEvent(chunk.events, fastjson::processed(original[i], processed[i]));
+            }
+            values_.fetch_add(original.size(), std::memory_order_relaxed);
+
+            // Blocks while the downstream buffer is full; false once it closed
+            return chunks_.push(std::move(chunk));
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(clientMutex_);
+            client_ = nullptr;
+        }
+
+        bool downstreamGone = chunks_.closed();
+        if (!downstreamGone && (!res || res->status != 200 || malformed)) {
+            failed_ = true;
+            LOG_ERROR << "Error: Producer stream failed ("
+                      << (res ? "status " + std::to_string(res->status)
+                              : httplib::to_string(res.error()))
+                      << ")";
+        }
+        chunks_.close();
+    }
+
+    const std::string host_;
+    const int port_;
+    const std::string path_;
+    const Transform transform_;
+
+    BoundedQueue<Chunk> chunks_;
+    std::thread reader_;
+    std::mutex clientMutex_;
+    httplib::Client* client_ = nullptr;
+    std::atomic<bool> failed_{false};
+    std::atomic<uint64_t> values_{0};
+};
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRANSFORM_X86 1
+#endif
+
+// Configurable processing stage for the processor.
+//
+// TRANSFORM_PIPELINE is a comma-separated list of stages applied in order to
+// contiguous int32 arrays:
+//
+//     scale:K        v * K
+//     offset:K       v + K
+//     clamp:LO:HI    min(max(v, LO), HI)
+//     filter:LO:HI   keep only values in [LO, HI] (drops the original too)
+//     stats          fold count/sum/min/max of the values seen into /metrics
+//
+// e.g. "scale:3,offset:-1,clamp:0:250". Arithmetic wraps like int32 in two's
+// complement, matching what the SIMD instructions do. The map and stats
+// stages have SSE4.1 and AVX2 kernels next to the scalar ones; the ISA is
+// detected once at startup (or forced with TRANSFORM_ISA) and the chosen
+// kernels are bound into the pipeline, so each stage is one indirect call
+// per batch rather than per value.
+namespace transform {
+
+enum class Isa { Scalar, Sse41, Avx2 };
+
+inline const char* isaName(Isa isa) {
+    switch (isa) {
+        case Isa::Scalar: return "scalar";
+        case Isa::Sse41: return "sse4.1";
+        case Isa::Avx2: return "avx2";
+    }
+    return "scalar";
+}
+
+// Best ISA this CPU supports
+inline Isa detectIsa() {
+#ifdef TRANSFORM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Isa::Avx2;
+    if (__builtin_cpu_supports("sse4.1")) return Isa::Sse41;
+#endif
+    return Isa::Scalar;
+}
+
+// "auto" or an ISA name; never picks one the CPU lacks
+inline Isa parseIsa(const std::string& name) {
+    Isa best = detectIsa();
+    if (name == "auto" || name.empty()) return best;
+    Isa wanted;
+    if (name == "scalar") wanted = Isa::Scalar;
+    else if (name == "sse4.1") wanted = Isa::Sse41;
+    else if (name == "avx2") wanted = Isa::Avx2;
+    else throw std::invalid_argument("unknown TRANSFORM_ISA '" + name + "'");
+    if (static_cast<int>(wanted) > static_cast<int>(best)) {
+        throw std::invalid_argument(std::string("CPU does not support ") + name);
+    }
+    return wanted;
+}
+
+// Running aggregates for the stats stage
+struct Aggregates {
+    std::atomic<uint64_t> count{0};
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> min{INT_MAX};
+    std::atomic<int> max{INT_MIN};
+
+    void add(uint64_t n, int64_t batchSum, int batchMin, int batchMax) {
+        count.fetch_add(n, std::memory_order_relaxed);
+        sum.fetch_add(batchSum, std::memory_order_relaxed);
+        int seen = min.load(std::memory_order_relaxed);
+        while (batchMin < seen && !min.compare_exchange_weak(seen, batchMin)) {}
+        seen = max.load(std::memory_order_relaxed);
+        while (batchMax > seen && !max.compare_exchange_weak(seen, batchMax)) {}
+    }
+};
+
+struct BatchStats {
+    int64_t sum = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+};
+
+namespace kernels {
+
+using MapFn = void (*)(int* v, size_t n, int a, int b);
+using StatsFn = BatchStats (*)(const int* v, size_t n);
+
+// Wrapping int32 arithmetic without signed-overflow UB
+inline int wrapMul(int v, int k) {
+    return static_cast<int>(static_cast<uint32_t>(v) * static_cast<uint32_t>(k));
+}
+inline int wrapAdd(int v, int k) {
+    return static_cast<int>(static_cast<uint32_t>(v) + static_cast<uint32_t>(k));
+}
+
+inline void scaleScalar(int* v, size_t n, int k, int) {
+    for (size_t i = 0; i < n; ++i) v[i] = wrapMul(v[i], k);
+}
+inline void offsetScalar(int* v, size_t n, int k, int) {
+    for (size_t i = 0; i < n; ++i) v[i] = wrapAdd(v[i], k);
+}
+inline void clampScalar(int* v, size_t n, int lo, int hi) {
+    for (size_t i = 0; i < n; ++i) v[i] = std::min(std::max(v[i], lo), hi);
+}
+inline BatchStats statsScalar(const int* v, size_t n) {
+    BatchStats s;
+    for (size_t i = 0; i < n; ++i) {
+        s.sum += v[i];
+        s.min = std::min(s.min, v[i]);
+        s.max = std::max(s.max, v[i]);
+    }
+    return s;
+}
+
+#ifdef TRANSFORM_X86
+
+__attribute__((target("sse4.1"))) inline void scaleSse41(int* v, size_t n, int k, int b) {
+    const __m128i factor = _mm_set1_epi32(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), _mm_mullo_epi32(x, factor));
+    }
+    scaleScalar(v + i, n - i, k, b);
+}
+__attribute__((target("sse4.1"))) inline void offsetSse41(int* v, size_t n, int k, int b) {
+    const __m128i delta = _mm_set1_epi32(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), _mm_add_epi32(x, delta));
+    }
+    offsetScalar(v + i, n - i, k, b);
+}
+__attribute__((target("sse4.1"))) inline void clampSse41(int* v, size_t n, int lo, int hi) {
+    const __m128i low = _mm_set1_epi32(lo);
+    const __m128i high = _mm_set1_epi32(hi);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), _mm_min_epi32(_mm_max_epi32(x, low), high));
+    }
+    clampScalar(v + i, n - i, lo, hi);
+}
+__attribute__((target("sse4.1"))) inline BatchStats statsSse41(const int* v, size_t n) {
+    __m128i lo = _mm_set1_epi32(INT_MAX);
+    __m128i hi = _mm_set1_epi32(INT_MIN);
+    __m128i sum = _mm_setzero_si128();  // two int64 lanes
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+        lo = _mm_min_epi32(lo, x);
+        hi = _mm_max_epi32(hi, x);
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(x));
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(_mm_srli_si128(x, 8)));
+    }
+    alignas(16) int32_t los[4], his[4];
+    alignas(16) int64_t sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(los), lo);
+    _mm_store_si128(reinterpret_cast<__m128i*>(his), hi);
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), sum);
+    BatchStats s = statsScalar(v + i, n - i);
+    s.sum += sums[0] + sums[1];
+    for (int j = 0; j < 4; ++j) {
+        s.min = std::min(s.min, los[j]);
+        s.max = std::max(s.max, his[j]);
+    }
+    return s;
+}
+
+__attribute__((target("avx2"))) inline void scaleAvx2(int* v, size_t n, int k, int b) {
+    const __m256i factor = _mm256_set1_epi32(k);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), _mm256_mullo_epi32(x, factor));
+    }
+    scaleScalar(v + i, n - i, k, b);
+}
+__attribute__((target("avx2"))) inline void offsetAvx2(int* v, size_t n, int k, int b) {
+    const __m256i delta = _mm256_set1_epi32(k);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), _mm256_add_epi32(x, delta));
+    }
+    offsetScalar(v + i, n - i, k, b);
+}
+__attribute__((target("avx2"))) inline void clampAvx2(int* v, size_t n, int lo, int hi) {
+    const __m256i low = _mm256_set1_epi32(lo);
+    const __m256i high = _mm256_set1_epi32(hi);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i),
+                            _mm256_min_epi32(_mm256_max_epi32(x, low), high));
+    }
+    clampScalar(v + i, n - i, lo, hi);
+}
+__attribute__((target("avx2"))) inline BatchStats statsAvx2(const int* v, size_t n) {
+    __m256i lo = _mm256_set1_epi32(INT_MAX);
+    __m256i hi = _mm256_set1_epi32(INT_MIN);
+    __m256i sum = _mm256_setzero_si256();  // four int64 lanes
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        lo = _mm256_min_epi32(lo, x);
+        hi = _mm256_max_epi32(hi, x);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+    alignas(32) int32_t los[8], his[8];
+    alignas(32) int64_t sums[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(los), lo);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(his), hi);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+    BatchStats s = statsScalar(v + i, n - i);
+    s.sum += sums[0] + sums[1] + sums[2] + sums[3];
+    for (int j = 0; j < 8; ++j) {
+        s.min = std::min(s.min, los[j]);
+        s.max = std::max(s.max, his[j]);
+    }
+    return s;
+}
+
+#endif  // TRANSFORM_X86
+
+struct Table {
+    MapFn scale;
+    MapFn offset;
+    MapFn clamp;
+    StatsFn stats;
+};
+
+inline Table forIsa(Isa isa) {
+#ifdef TRANSFORM_X86
+    if (isa == Isa::Avx2) return {scaleAvx2, offsetAvx2, clampAvx2, statsAvx2};
+    if (isa == Isa::Sse41) return {scaleSse41, offsetSse41, clampSse41, statsSse41};
+#endif
+    (void)isa;
+    return {scaleScalar, offsetScalar, clampScalar, statsScalar};
+}
+
+}  // namespace kernels
+
+class Pipeline {
+public:
+    // Parse a TRANSFORM_PIPELINE spec; throws std::invalid_argument when malformed
+    Pipeline(const std::string& spec, Isa isa)
+        : spec_(spec), isa_(isa), aggregates_(std::make_shared<Aggregates>()) {
+        kernels::Table table = kernels::forIsa(isa);
+        std::stringstream stages(spec);
+        std::string item;
+        while (std::getline(stages, item, ',')) {
+            std::vector<std::string> parts;
+            std::stringstream fields(item);
+            std::string field;
+            while (std::getline(fields, field, ':')) parts.push_back(field);
+            if (parts.empty() || parts[0].empty()) continue;
+
+            const std::string& name = parts[0];
+            Stage stage;
+            if (name == "scale" || name == "offset") {
+                expectArgs(item, parts, 1);
+                stage.kind = Stage::Map;
+                stage.map = name == "scale" ? table.scale : table.offset;
+                stage.a = number(item, parts[1]);
+            } else if (name == "clamp" || name == "filter") {
+                expectArgs(item, parts, 2);
+                stage.kind = name == "clamp" ? Stage::Map : Stage::Filter;
+                if (stage.kind == Stage::Map) stage.map = table.clamp;
+                stage.a = number(item, parts[1]);
+                stage.b = number(item, parts[2]);
+                if (stage.a > stage.b) throw std::invalid_argument("empty range in '" + item + "'");
+            } else if (name == "stats") {
+                expectArgs(item, parts, 0);
+                stage.kind = Stage::Stats;
+                stage.stats = table.stats;
+                hasStats_ = true;
+            } else {
+                throw std::invalid_argument("unknown transform stage '" + name + "'");
+            }
+            stages_.push_back(stage);
+        }
+        if (stages_.empty()) throw std::invalid_argument("TRANSFORM_PIPELINE has no stages");
+    }
+
+    // Transform `n` values of `in` into `out` (which may alias `in`); filter
+    // stages compact `in` alongside `out`. Returns how many values remain.
+    size_t run(int* in, int* out, size_t n) const {
+        if (out != in) std::copy(in, in + n, out);
+        for (const Stage& stage : stages_) {
+            switch (stage.kind) {
+                case Stage::Map:
+                    stage.map(out, n, stage.a, stage.b);
+                    break;
+                case Stage::Filter: {
+                    size_t kept = 0;
+                    for (size_t i = 0; i < n; ++i) {
+                        in[kept] = in[i];
+                        out[kept] = out[i];
+                        kept += (out[i] >= stage.a && out[i] <= stage.b);
+                    }
+                    n = kept;
+                    break;
+                }
+                case Stage::Stats:
+                    if (n) {
+                        BatchStats s = stage.stats(out, n);
+                        aggregates_->add(n, s.sum, s.min, s.max);
+                    }
+                    break;
+            }
+        }
+        return n;
+    }
+
+    const std::string& spec() const { return spec_; }
+    Isa isa() const { return isa_; }
+    bool hasStats() const { return hasStats_; }
+    const Aggregates& aggregates() const { return *aggregates_; }
+
+private:
+    struct Stage {
+        enum Kind { Map, Filter, Stats } kind = Map;
+        kernels::MapFn map = nullptr;
+        kernels::StatsFn stats = nullptr;
+        int a = 0;
+        int b = 0;
+    };
+
+    static void expectArgs(const std::string& item, const std::vector<std::string>& parts,
+                           size_t count) {
+        if (parts.size() != count + 1) {
+            throw std::invalid_argument("'" + item + "' takes " + std::to_string(count) +
+                                        " argument(s)");
+        }
+    }
+
+    static int number(const std::string& item, const std::string& text) {
+        size_t used = 0;
+        long long v = 0;
+        try {
+            v = std::stoll(text, &used);
+        } catch (const std::exception&) {
+            used = 0;
+        }
+        if (used != text.size() || text.empty() || v < INT_MIN || v > INT_MAX) {
+            throw std::invalid_argument("bad number '" + text + "' in '" + item + "'");
+        }
+        return static_cast<int>(v);
+    }
+
+    std::string spec_;
+    Isa isa_;
+    std::vector<Stage> stages_;
+    bool hasStats_ = false;
+    std::shared_ptr<Aggregates> aggregates_;
+};
+
+}  // namespace transform
@@ -1,39 +1,215 @@
 #include "httplib.h"
 #include "json.hpp"
-#include <random>
+#include "common/arena.h"
+#include "common/config.h"
+#include "common/event_server.h"
+#include "common/fast_json.h"
+#include "common/lifecycle.h"
+#include "common/logger.h"
+#include "common/metrics.h"
+#include "common/saturation.h"
+#include "common/server_options.h"
+#include "common/sse.h"
+#include "common/tracing.h"
+#include "common/upstream_client.h"
+#include "common/wire_format.h"
+#include "random_source.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <iostream>
-#include <cstdlib>  // for getenv
 
 using json = nlohmann::json;
 
-// Helper function to get env var with default
-std::string getEnv(const char* name, const std::string& defaultValue) {
-    const char* value = std::getenv(name);
-    return value ? std::string(value) : defaultValue;
-}
+// Range of generated values
+constexpr int kMinValue = 1;
+constexpr int kMaxValue = 100;
+
+// Values generated per chunk of /data/stream when the reader sets the pace
+constexpr size_t kStreamChunkValues = 64;
 
 int main() {
     std::cout << "Producer starting...:" << std::endl;
 
-    httplib::Server svr;
+    EventServer svr;
 
     int port = std::stoi(getEnv("PORT", "8080"));
+    int maxBatchSize = std::stoi(getEnv("MAX_BATCH_SIZE", "1000"));
+    ServerOptions serverOptions = loadServerOptions();
+
+    // Asynchronous logging; LOG_SAMPLE_EVERY=N keeps 1 in N "Generated" lines
+    logging::configure(getEnv("LOG_LEVEL", "info"));
+    logging::Sampler generatedSampler(std::stoul(getEnv("LOG_SAMPLE_EVERY", "1")));
+
+    tracing::Config traceConfig = tracing::loadConfig();
+    tracing::start("producer", traceConfig);
+
+    // Per-thread generators; RNG_SEED makes the streams reproducible
+    std::unique_ptr<RandomSource> random;
+    try {
+        std::string seed = getEnv("RNG_SEED", "");
+        random = std::make_unique<RandomSource>(
+            parseEngineKind(getEnv("RNG_ENGINE", "xoshiro256pp")),
+            seed.empty() ? std::nullopt : std::optional<uint64_t>(std::stoull(seed)));
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid RNG configuration: " << e.what() << std::endl;
+        return 1;
+    }
+
+    svr.Get("/data", metrics::instrument("producer", "/data",
+                                         [maxBatchSize, &random, &generatedSampler](
+                                             const httplib::Request& req, httplib::Response& res) {
+        // The caller has already given up on this request
+        if (upstream::exhausted(req)) {
+            res.status = 504;
+            res.set_content("{\"error\":\"Deadline exceeded\"}", "application/json");
+            return;
+        }
+
+        // Internal callers may ask for the binary encoding instead of JSON
+        bool binary = wire::accepts(req.get_header_value("Accept"));
+
+        // Single value unless a batch was requested with ?count=N
+        if (!req.has_param("count")) {
+            int value = random->next(kMinValue, kMaxValue);
+
+            if (binary) {
+                std::string_view body = wire::values(&value, 1);
+                res.set_content(body.data(), body.size(), wire::kContentType);
+            } else {
+                // Create JSON Response
+                std::string_view body = fastjson::value(value);
+                res.set_content(body.data(), body.size(), "application/json");
+            }
+            LOG_SAMPLED(generatedSampler, logging::Level::Info) << "Generated: " << value;
+            return;
+        }
+
+        int count = 0;
+        try {
+            count = std::stoi(req.get_param_value("count"));
+        } catch (const std::exception&) {
+            count = 0;
+        }
 
-    svr.Get("/data", [](const httplib::Request& req, httplib::Response& res) {
-        // Generate random number
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(1, 100);
-        int value = dis(gen);
-    
-        // Create JSON Response
-        json response;
-        response["value"] = value;
-    
-        res.set_content(response.dump(), "application/json");
-        std::cout << "Generated: " << value << std::endl;
+        if (count < 1 || count > maxBatchSize) {
+            json error;
+            error["error"] = "count must be between 1 and " + std::to_string(maxBatchSize);
+            res.status = 400;
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+
+        // Scratch for this request only; the body is copied out of it
+        arena::Vector<int> values(count, arena::resource());
+        random->fill(values.data(), values.size(), kMinValue, kMaxValue);
+
+        if (binary) {
+            std::string_view body = wire::values(values.data(), values.size());
+            res.set_content(body.data(), body.size(), wire::kContentType);
+        } else {
+            std::string_view body = fastjson::values(values.data(), values.size());
+            res.set_content(body.data(), body.size(), "application/json");
+        }
+        LOG_SAMPLED(generatedSampler, logging::Level::Info)
+            << "Generated batch: " << count << " values";
+    }));
+
+    // Long-lived SSE stream of {"value":N} events. ?rate=R paces it at R
+    // values/sec (default: as fast as the reader drains the socket, which
+    // blocks the writer and so pushes back on generation); ?limit=N ends it
+    // after N values.
+    auto& streamValues = metrics::Registry::instance().counter(
+        "stream_values_total", "Values sent on streaming endpoints", {{"service", "producer"}});
+    auto& streamSubscribers = metrics::Registry::instance().gauge(
+        "stream_subscribers", "Open streaming connections", {{"service", "producer"}});
+
+    svr.Get("/data/stream", [&random, &streamValues, &streamSubscribers](
+                                const httplib::Request& req, httplib::Response& res) {
+        double rate = 0;
+        long long limit = 0;
+        try {
+            if (req.has_param("rate")) rate = std::stod(req.get_param_value("rate"));
+            if (req.has_param("limit")) limit = std::stoll(req.get_param_value("limit"));
+        } catch (const std::exception&) {
+            rate = -1;
+        }
+        if (rate < 0 || limit < 0) {
+            json error;
+            error["error"] = "rate and limit must be non-negative numbers";
+            res.status = 400;
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+
+        struct StreamState {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            long long sent = 0;
+            std::vector<int> values;
+            std::string chunk;
+        };
+        auto state = std::make_shared<StreamState>();
+        streamSubscribers.inc();
+        LOG_INFO << "Stream opened (rate " << rate << "/s, limit " << limit << ")";
+
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider(
+            sse::kContentType,
+            [state, rate, limit, &random, &streamValues](size_t, httplib::DataSink& sink) {
+                // End the stream on shutdown so the subscriber reconnects elsewhere
+                if (lifecycle::draining()) {
+                    sink.done();
+                    return true;
+                }
+                size_t n = kStreamChunkValues;
+                if (rate > 0) {
+                    // Emit whatever is due by now, sleeping until the next value otherwise
+                    auto elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - state->start).count();
+                    long long due = static_cast<long long>(elapsed * rate) + 1 - state->sent;
+                    if (due <= 0) {
+                        std::this_thread::sleep_for(std::chrono::duration<double>(
+                            std::min(1.0 / rate, 0.1)));
+                        return true;
+                    }
+                    n = std::min<size_t>(static_cast<size_t>(due), kStreamChunkValues);
+                }
+                if (limit > 0) n = std::min<size_t>(n, static_cast<size_t>(limit - state->sent));
+
+                state->values.resize(n);
+                random->fill(state->values.data(), n, kMinValue, kMaxValue);
+                state->chunk.clear();
+                for (int v : state->values) sse::appendEvent(state->chunk, fastjson::value(v));
+                state->sent += static_cast<long long>(n);
+                streamValues.inc(n);
+
+                if (!sink.write(state->chunk.data(), state->chunk.size())) return false;
+                if (limit > 0 && state->sent >= limit) sink.done();
+                return true;
+            },
+            [state, &streamSubscribers](bool) {
+                streamSubscribers.dec();
+                LOG_INFO << "Stream closed after " << state->sent << " values";
+            });
     });
 
+    metrics::expose(svr, "producer");
+    saturation::Config saturationConfig = saturation::loadConfig();
+    saturation::expose(svr, "producer", serverOptions, saturationConfig);
+    lifecycle::expose(svr, "producer");
+
     std::cout << "Listening on port " << port <<  std::endl;
-    svr.listen("0.0.0.0", port);
+    std::cout << "Max batch size: " << maxBatchSize << std::endl;
+    std::cout << "RNG engine: " << engineName(random->kind())
+              << (random->seed() ? " (seed " + std::to_string(*random->seed()) + ")" : "")
+              << std::endl;
+    std::cout << "Server: " << describe(serverOptions) << std::endl;
+    std::cout << "Tracing: " << tracing::describe(traceConfig) << std::endl;
+    std::cout << "Saturation: " << saturation::describe(saturationConfig) << std::endl;
+    if (!serve(svr, serverOptions, "0.0.0.0", port)) {
+        std::cerr << "Error: Could not listen on port " << port << std::endl;
+        return 1;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+// Thread-local random value generation for the producer.
+//
+// Every httplib worker thread lazily builds its own pre-seeded engine the
+// first time it generates a value, so the request path never touches
+// std::random_device or re-initialises engine state. With a fixed seed
+// (RNG_SEED) each thread's stream is derived from that seed and the order in
+// which threads first generate, which makes load tests reproducible.
+
+enum class EngineKind { Mt19937, Xoshiro256pp, Pcg32 };
+
+inline EngineKind parseEngineKind(const std::string& name) {
+    if (name == "mt19937") return EngineKind::Mt19937;
+    if (name == "xoshiro256pp" || name == "xoshiro256++") return EngineKind::Xoshiro256pp;
+    if (name == "pcg32") return EngineKind::Pcg32;
+    throw std::invalid_argument("Unknown RNG_ENGINE: " + name +
+                                " (expected mt19937, xoshiro256pp or pcg32)");
+}
+
+inline const char* engineName(EngineKind kind) {
+    switch (kind) {
+        case EngineKind::Mt19937: return "mt19937";
+        case EngineKind::Xoshiro256pp: return "xoshiro256pp";
+        case EngineKind::Pcg32: return "pcg32";
+    }
+    return "unknown";
+}
+
+// SplitMix64, used to expand one seed into independent engine states
+inline uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Map a uniform 32-bit value onto [lo, hi] with a multiply-shift instead of
+// a division (Lemire). The bias is below range / 2^32, i.e. negligible here.
+inline int scaleToRange(uint32_t x, int lo, uint64_t range) {
+    return lo + static_cast<int>((static_cast<uint64_t>(x) * range) >> 32);
+}
+
+class ValueEngine {
+public:
+    virtual ~ValueEngine() = default;
+
+    virtual uint32_t next32() = 0;
+
+    // Bulk generation; engines override this with a loop the compiler can vectorise
+    virtual void fill(int* out, size_t n, int lo, int hi) {
+        const uint64_t range = static_cast<uint64_t>(hi) - lo + 1;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = scaleToRange(next32(), lo, range);
+        }
+    }
+};
+
+class Mt19937Engine final : public ValueEngine {
+public:
+    explicit Mt19937Engine(uint64_t seed) {
+        std::seed_seq seq{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+        gen_.seed(seq);
+    }
+
+    uint32_t next32() override { return static_cast<uint32_t>(gen_()); }
+
+private:
+    std::mt19937 gen_;
+};
+
+// PCG32 (XSH-RR); 16 bytes of state
+class Pcg32Engine final : public ValueEngine {
+public:
+    explicit Pcg32Engine(uint64_t seed) {
+        uint64_t sm = seed;
+        inc_ = (splitMix64(sm) << 1) | 1u;
+        state_ = 0;
+        next32();
+        state_ += splitMix64(sm);
+        next32();
+    }
+
+    uint32_t next32() override {
+        uint64_t old = state_;
+        state_ = old * 6364136223846793005ULL + inc_;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+private:
+    uint64_t state_;
+    uint64_t inc_;
+};
+
+// xoshiro256++ run as four independent lanes in structure-of-arrays layout.
+// Each step advances all lanes at once, which keeps the state updates free
+// of cross-lane dependencies so fill() vectorises (e.g. to AVX2) at -O2/-O3.
+class Xoshiro256x4Engine final : public ValueEngine {
+public:
+    static constexpr size_t kLanes = 4;
+
+    explicit Xoshiro256x4Engine(uint64_t seed) {
+        uint64_t sm = seed;
+        for (size_t l = 0; l < kLanes; ++l) {
+            s0_[l] = splitMix64(sm);
+            s1_[l] = splitMix64(sm);
+            s2_[l] = splitMix64(sm);
+            s3_[l] = splitMix64(sm);
+        }
+    }
+
+    uint32_t next32() override {
+        if (buffered_ == kLanes) {
+            step(buffer_);
+            buffered_ = 0;
+        }
+        return buffer_[buffered_++];
+    }
+
+    void fill(int* out, size_t n, int lo, int hi) override {
+        const uint64_t range = static_cast<uint64_t>(hi) - lo + 1;
+        uint32_t block[kLanes];
+
+        size_t i = 0;
+        for (; i + kLanes <= n; i += kLanes) {
+            step(block);
+            for (size_t l = 0; l < kLanes; ++l) {
+                out[i + l] = scaleToRange(block[l], lo, range);
+            }
+        }
+        for (; i < n; ++i) {
+            out[i] = scaleToRange(next32(), lo, range);
+        }
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    void step(uint32_t* out) {
+        for (size_t l = 0; l < kLanes; ++l) {
+            const uint64_t result = rotl(s0_[l] + s3_[l], 23) + s0_[l];
+            const uint64_t t = s1_[l] << 17;
+            s2_[l] ^= s0_[l];
+            s3_[l] ^= s1_[l];
+            s1_[l] ^= s2_[l];
+            s0_[l] ^= s3_[l];
+            s2_[l] ^= t;
+            s3_[l] = rotl(s3_[l], 45);
+            out[l] = static_cast<uint32_t>(result >> 32);
+        }
+    }
+
+    alignas(32) uint64_t s0_[kLanes];
+    alignas(32) uint64_t s1_[kLanes];
+    alignas(32) uint64_t s2_[kLanes];
+    alignas(32) uint64_t s3_[kLanes];
+    uint32_t buffer_[kLanes] = {};
+    size_t buffered_ = kLanes;
+};
+
+inline std::unique_ptr<ValueEngine> makeEngine(EngineKind kind, uint64_t seed) {
+    switch (kind) {
+        case EngineKind::Mt19937: return std::make_unique<Mt19937Engine>(seed);
+        case EngineKind::Pcg32: return std::make_unique<Pcg32Engine>(seed);
+        case EngineKind::Xoshiro256pp: break;
+    }
+    return std::make_unique<Xoshiro256x4Engine>(seed);
+}
+
+class RandomSource {
+public:
+    RandomSource(EngineKind kind, std::optional<uint64_t> seed)
+        : kind_(kind), seed_(seed) {}
+
+    RandomSource(const RandomSource&) = delete;
+    RandomSource& operator=(const RandomSource&) = delete;
+
+    int next(int lo, int hi) {
+        const uint64_t range = static_cast<uint64_t>(hi) - lo + 1;
+        return scaleToRange(local().next32(), lo, range);
+    }
+
+    void fill(int* out, size_t n, int lo, int hi) { local().fill(out, n, lo, hi); }
+
+    EngineKind kind() const { return kind_; }
+    const std::optional<uint64_t>& seed() const { return seed_; }
+
+private:
+    // The calling thread's engine, created and seeded on first use
+    ValueEngine& local() {
+        thread_local const RandomSource* owner = nullptr;
+        thread_local std::unique_ptr<ValueEngine> engine;
+
+        if (owner != this || !engine) {
+            engine = makeEngine(kind_, threadSeed());
+            owner = this;
+        }
+        return *engine;
+    }
+
+    uint64_t threadSeed() {
+        if (seed_) {
+            uint64_t sm = *seed_ + streams_.fetch_add(1, std::memory_order_relaxed);
+            return splitMix64(sm);
+        }
+        std::random_device rd;
+        return (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+
+    const EngineKind kind_;
+    const std::optional<uint64_t> seed_;
+    std::atomic<uint64_t> streams_{0};
+};
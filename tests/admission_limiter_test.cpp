@@ -0,0 +1,94 @@
+#include "processor/admission_limiter.h"
+#include "test.h"
+#include <chrono>
+
+// AdmissionLimiter::update() driven window by window on a fake clock: the
+// limit has to grow under steady latency, sit out ordinary contention, and
+// give way to a real queue or to calls running out of time.
+
+namespace {
+
+using Clock = AdmissionLimiter::Clock;
+using std::chrono::milliseconds;
+
+// Fills the limit (or `calls`, if fewer) and releases every call with
+// `latency` one window after the last, which closes the window
+struct Driver {
+    AdmissionLimiter limiter;
+    Clock::time_point now = Clock::now();
+
+    Driver(int minLimit, int maxLimit, int initialLimit) : limiter(minLimit, maxLimit, initialLimit) {}
+
+    void window(milliseconds latency, int calls = 1 << 20, bool dropped = false) {
+        now += milliseconds(101);
+        int admitted = 0;
+        while (admitted < calls && limiter.tryAcquire()) ++admitted;
+        for (int i = 0; i < admitted; ++i) limiter.release(latency, dropped && i == 0, now);
+    }
+
+    void windows(int count, milliseconds latency, int calls = 1 << 20) {
+        for (int i = 0; i < count; ++i) window(latency, calls);
+    }
+};
+
+}  // namespace
+
+TEST(starts_at_the_initial_limit) {
+    CHECK_EQ(AdmissionLimiter(4, 512, 32).limit(), 32);
+    CHECK_EQ(AdmissionLimiter(4, 512, 1).limit(), 4);
+    CHECK_EQ(AdmissionLimiter(4, 16, 32).limit(), 16);
+}
+
+TEST(grows_under_steady_latency) {
+    Driver d(4, 512, 32);
+    d.windows(20, milliseconds(10));
+    int after20 = d.limiter.limit();
+    CHECK(after20 > 32);
+    d.windows(20, milliseconds(10));
+    CHECK(d.limiter.limit() > after20);
+    CHECK(d.limiter.rejected() > 0);  // each window asked for more than the limit
+}
+
+TEST(tolerates_ordinary_contention) {
+    Driver d(4, 512, 32);
+    d.windows(5, milliseconds(10));
+    int before = d.limiter.limit();
+    // Latency 80% over the baseline is still under kTolerance
+    d.windows(20, milliseconds(18));
+    CHECK(d.limiter.limit() > before);
+}
+
+TEST(shrinks_behind_a_queue) {
+    Driver d(4, 512, 64);
+    d.windows(5, milliseconds(10));
+    int before = d.limiter.limit();
+    d.windows(20, milliseconds(60));
+    CHECK(d.limiter.limit() < before / 2);
+    // A queue that never drains holds it at the floor
+    d.windows(100, milliseconds(60));
+    CHECK(d.limiter.limit() <= 5);
+}
+
+TEST(cuts_on_dropped_calls) {
+    Driver d(4, 512, 100);
+    d.windows(3, milliseconds(10));
+    int before = d.limiter.limit();
+    d.window(milliseconds(10), 1 << 20, true);
+    CHECK(d.limiter.limit() <= before * 9 / 10 + 1);
+}
+
+TEST(grows_only_while_traffic_reaches_it) {
+    Driver d(4, 512, 64);
+    d.windows(30, milliseconds(10), 20);  // callers only ever use 20
+    CHECK_EQ(d.limiter.limit(), 64);
+}
+
+TEST(stays_within_its_range) {
+    Driver d(4, 48, 32);
+    d.windows(100, milliseconds(10));
+    CHECK_EQ(d.limiter.limit(), 48);
+    d.windows(200, milliseconds(100));
+    CHECK_EQ(d.limiter.limit(), 4);
+}
+
+TEST_MAIN("admission_limiter")
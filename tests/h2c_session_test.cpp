@@ -0,0 +1,220 @@
+#include "common/event_server.h"
+#include "common/http2.h"
+#include "common/server_options.h"
+#include "test.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+
+// The h2c session against a live epoll server: well-formed requests, split
+// and padded header blocks, and the connection errors a peer's malformed
+// frames must end in.
+
+namespace {
+
+// An unused port, as the kernel hands one out
+int freePort() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+int connectTo(int port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) return fd;
+    ::close(fd);
+    return -1;
+}
+
+// One server for the whole suite, stopped as the binary exits
+struct Server {
+    EventServer server;
+    std::thread thread;
+    int port = freePort();
+
+    Server() {
+        server.Get("/ping", [](const httplib::Request&, httplib::Response& res) {
+            res.set_content("pong", "text/plain");
+        });
+        ServerOptions opts{ServerBackend::Epoll, 1, 2, 0, 100, 5, 5, 5, true, true, 16, 0, 0, 0};
+        thread = std::thread([this, opts] { server.listenEvents("127.0.0.1", port, opts); });
+        for (int i = 0; i < 200; ++i) {
+            int fd = connectTo(port);
+            if (fd >= 0) {
+                ::close(fd);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    ~Server() {
+        server.stop();
+        thread.join();
+    }
+};
+
+int serverPort() {
+    static Server server;
+    return server.port;
+}
+
+// What the server sent back on a connection: the response status on stream
+// 1, or the GOAWAY it ended the connection with
+struct Outcome {
+    std::string status;
+    bool goAway = false;
+    uint32_t errorCode = 0;
+};
+
+// Opens h2c, sends `frames` after the preface and client SETTINGS, and reads
+// until stream 1 is answered, a GOAWAY arrives or the server hangs up
+Outcome exchange(const std::string& frames) {
+    Outcome outcome;
+    int fd = connectTo(serverPort());
+    if (fd < 0) return outcome;
+    std::string out(http2::kPreface, http2::kPrefaceSize);
+    http2::appendSettings(out, {});
+    out += frames;
+    ::send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+
+    http2::Decoder decoder;
+    std::string in;
+    char buf[16384];
+    while (outcome.status.empty() && !outcome.goAway) {
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        in.append(buf, n);
+        http2::Frame frame;
+        while (http2::parseFrame(in.data(), in.size(), frame)) {
+            if (frame.type == http2::FrameType::GoAway && frame.length >= 8) {
+                outcome.goAway = true;
+                outcome.errorCode = http2::readU32(frame.payload + 4);
+            } else if (frame.type == http2::FrameType::Headers && frame.stream == 1) {
+                http2::HeaderList headers;
+                decoder.decode(frame.payload, frame.length, headers, 65536);
+                for (const auto& [name, value] : headers) {
+                    if (name == ":status") outcome.status = value;
+                }
+            }
+            in.erase(0, http2::kFrameHeaderSize + frame.length);
+        }
+    }
+    ::close(fd);
+    return outcome;
+}
+
+std::string requestBlock() {
+    http2::Encoder encoder;
+    std::string block;
+    encoder.encode({{":method", "GET"}, {":scheme", "http"}, {":path", "/ping"},
+                    {":authority", "localhost"}}, block);
+    return block;
+}
+
+std::string frame(http2::FrameType type, uint8_t flags, uint32_t stream, const std::string& payload) {
+    std::string out;
+    http2::appendFrame(out, type, flags, stream, payload.data(), payload.size());
+    return out;
+}
+
+constexpr uint8_t kEndRequest = http2::flags::kEndStream | http2::flags::kEndHeaders;
+
+}  // namespace
+
+TEST(serves_a_request) {
+    Outcome outcome = exchange(frame(http2::FrameType::Headers, kEndRequest, 1, requestBlock()));
+    CHECK_EQ(outcome.status, "200");
+    CHECK(!outcome.goAway);
+}
+
+TEST(joins_continuation_frames) {
+    std::string block = requestBlock();
+    std::string frames;
+    http2::appendHeaders(frames, 1, block, true, 4);
+    Outcome outcome = exchange(frames);
+    CHECK_EQ(outcome.status, "200");
+}
+
+TEST(strips_padded_headers) {
+    std::string payload = std::string(1, 5) + requestBlock() + std::string(5, '\0');
+    Outcome outcome = exchange(frame(http2::FrameType::Headers, kEndRequest | http2::flags::kPadded, 1, payload));
+    CHECK_EQ(outcome.status, "200");
+}
+
+TEST(rejects_frames_inside_a_header_block) {
+    std::string block = requestBlock();
+    std::string frames = frame(http2::FrameType::Headers, http2::flags::kEndStream, 1, block.substr(0, 3)) +
+                         frame(http2::FrameType::Ping, 0, 0, std::string(8, '\0'));
+    Outcome outcome = exchange(frames);
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kProtocolError);
+    CHECK(outcome.status.empty());
+}
+
+TEST(rejects_continuation_on_another_stream) {
+    std::string block = requestBlock();
+    std::string frames = frame(http2::FrameType::Headers, http2::flags::kEndStream, 1, block.substr(0, 3)) +
+                         frame(http2::FrameType::Continuation, http2::flags::kEndHeaders, 3, block.substr(3));
+    Outcome outcome = exchange(frames);
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kProtocolError);
+}
+
+TEST(rejects_continuation_without_headers) {
+    Outcome outcome = exchange(frame(http2::FrameType::Continuation, http2::flags::kEndHeaders, 1, requestBlock()));
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kProtocolError);
+}
+
+TEST(rejects_truncated_header_block) {
+    // END_HEADERS on a block cut short: the decoder runs out mid-field
+    std::string block = requestBlock();
+    std::string frames;
+    http2::appendHeaders(frames, 1, block.substr(0, block.size() - 2) + "\x41\x0a", true, 4);
+    Outcome outcome = exchange(frames);
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kCompressionError);
+}
+
+TEST(rejects_bad_padding) {
+    std::string payload = std::string(1, 100) + requestBlock();
+    Outcome outcome = exchange(frame(http2::FrameType::Headers, kEndRequest | http2::flags::kPadded, 1, payload));
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kProtocolError);
+}
+
+TEST(rejects_even_stream_ids) {
+    Outcome outcome = exchange(frame(http2::FrameType::Headers, kEndRequest, 2, requestBlock()));
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kProtocolError);
+}
+
+TEST(rejects_oversized_frames) {
+    // Only the header: the server refuses on the length alone
+    std::string header = frame(http2::FrameType::Headers, kEndRequest, 1, "").substr(0, http2::kFrameHeaderSize);
+    header[0] = 0;
+    header[1] = 0x40;
+    header[2] = 1;  // 16385
+    Outcome outcome = exchange(header);
+    CHECK(outcome.goAway);
+    CHECK_EQ(outcome.errorCode, http2::kFrameSizeError);
+}
+
+TEST_MAIN("h2c_session")
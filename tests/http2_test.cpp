@@ -0,0 +1,326 @@
+#include "common/http2.h"
+#include "test.h"
+#include <cstdint>
+#include <string>
+
+// HPACK and frame parsing: the RFC 7541 appendix C examples, encoder round
+// trips, and blocks and frames that are malformed or cut short.
+
+namespace {
+
+std::string fromHex(const std::string& hex) {
+    std::string out;
+    int high = -1;
+    for (char c : hex) {
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) continue;  // spaces between groups
+        if (high < 0) {
+            high = digit;
+        } else {
+            out += static_cast<char>(high << 4 | digit);
+            high = -1;
+        }
+    }
+    return out;
+}
+
+bool decode(http2::Decoder& decoder, const std::string& block, http2::HeaderList& out,
+            size_t maxListSize = 65536) {
+    out.clear();
+    return decoder.decode(block.data(), block.size(), out, maxListSize);
+}
+
+bool rejects(const std::string& hex) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    return !decode(decoder, fromHex(hex), headers);
+}
+
+using List = http2::HeaderList;
+
+}  // namespace
+
+// --- RFC 7541 appendix C ----------------------------------------------------
+
+TEST(c1_integers_in_table_size_updates) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    CHECK(decode(decoder, fromHex("2a"), headers));        // C.1.1: 10, 5-bit prefix
+    CHECK(decode(decoder, fromHex("3f9a0a"), headers));    // C.1.2: 1337, 5-bit prefix
+    CHECK(headers.empty());
+    CHECK(rejects("3fe21f"));                              // 4097: above SETTINGS_HEADER_TABLE_SIZE
+}
+
+TEST(c2_literal_and_indexed_fields) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    CHECK(decode(decoder, fromHex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"),
+                 headers));
+    CHECK(headers == (List{{"custom-key", "custom-header"}}));
+    // C.2.1 added it to the dynamic table at index 62
+    CHECK(decode(decoder, fromHex("be"), headers));
+    CHECK(headers == (List{{"custom-key", "custom-header"}}));
+
+    CHECK(decode(decoder, fromHex("040c 2f73 616d 706c 652f 7061 7468"), headers));
+    CHECK(headers == (List{{":path", "/sample/path"}}));
+    CHECK(decode(decoder, fromHex("1008 7061 7373 776f 7264 0673 6563 7265 74"), headers));
+    CHECK(headers == (List{{"password", "secret"}}));
+    CHECK(decode(decoder, fromHex("82"), headers));
+    CHECK(headers == (List{{":method", "GET"}}));
+}
+
+TEST(c3_requests_without_huffman) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    CHECK(decode(decoder, fromHex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"), headers));
+    CHECK(headers == (List{{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                           {":authority", "www.example.com"}}));
+    CHECK(decode(decoder, fromHex("8286 84be 5808 6e6f 2d63 6163 6865"), headers));
+    CHECK(headers == (List{{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                           {":authority", "www.example.com"}, {"cache-control", "no-cache"}}));
+    CHECK(decode(decoder, fromHex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65"),
+                 headers));
+    CHECK(headers == (List{{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                           {":authority", "www.example.com"}, {"custom-key", "custom-value"}}));
+}
+
+TEST(c4_requests_with_huffman) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    CHECK(decode(decoder, fromHex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"), headers));
+    CHECK(headers == (List{{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                           {":authority", "www.example.com"}}));
+    CHECK(decode(decoder, fromHex("8286 84be 5886 a8eb 1064 9cbf"), headers));
+    CHECK(headers == (List{{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                           {":authority", "www.example.com"}, {"cache-control", "no-cache"}}));
+    CHECK(decode(decoder, fromHex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"), headers));
+    CHECK(headers == (List{{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                           {":authority", "www.example.com"}, {"custom-key", "custom-value"}}));
+}
+
+// --- Encoder round trips ----------------------------------------------------
+
+TEST(encoder_round_trips_through_decoder) {
+    http2::Encoder encoder;
+    http2::Decoder decoder;
+    const List requests[] = {
+        {{":method", "GET"}, {":scheme", "http"}, {":path", "/data?count=10"},
+         {":authority", "producer:8080"}, {"accept", "application/x-binary"}, {"x-deadline-ms", "950"}},
+        {{":method", "GET"}, {":scheme", "http"}, {":path", "/data?count=10"},
+         {":authority", "producer:8080"}, {"accept", "application/x-binary"}, {"x-deadline-ms", "812"}},
+        {{":status", "200"}, {"content-type", "application/json"}, {"content-length", "17"},
+         {"traceparent", "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01"}},
+        {{"x-long", std::string(300, 'z')}, {"x-binary", std::string("\x00\x01\xfe\xff", 4)}},
+    };
+    size_t previous = 0;
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); ++i) {
+        std::string block;
+        encoder.encode(requests[i], block);
+        http2::HeaderList headers;
+        CHECK(decode(decoder, block, headers));
+        CHECK(headers == requests[i]);
+        // The repeat reuses the dynamic table for all but :path and the deadline
+        if (i == 1) CHECK(block.size() < previous);
+        previous = block.size();
+    }
+}
+
+TEST(encoder_announces_a_smaller_table) {
+    http2::Encoder encoder;
+    http2::Decoder decoder;
+    List fields = {{"x-service", "processor"}, {"x-pod", "processor-7d9f-abcde"}};
+    std::string block;
+    encoder.encode(fields, block);
+    http2::HeaderList headers;
+    CHECK(decode(decoder, block, headers));
+
+    encoder.setMaxTableSize(0);
+    block.clear();
+    encoder.encode(fields, block);
+    CHECK_EQ(static_cast<uint8_t>(block[0]), 0x20);  // size update to 0 leads the block
+    CHECK(decode(decoder, block, headers));
+    CHECK(headers == fields);
+}
+
+// --- Malformed blocks ---------------------------------------------------------
+
+TEST(rejects_bad_indexes) {
+    CHECK(rejects("80"));    // index 0
+    CHECK(rejects("be"));    // 62, but the dynamic table is empty
+    CHECK(rejects("7f00"));  // literal naming entry 63
+}
+
+TEST(rejects_truncated_blocks) {
+    CHECK(rejects("ff808080"));                 // integer still continuing at the end
+    CHECK(rejects("ff8080808080"));             // and one too long for 32 bits
+    CHECK(rejects("400a 6375 7374"));           // name shorter than its length
+    CHECK(rejects("400a 6375 7374 6f6d 2d6b 6579"));  // value missing
+    // C.3.1 cut one byte short, as a block whose CONTINUATION never came
+    CHECK(rejects("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f"));
+}
+
+TEST(rejects_bad_huffman) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    CHECK(decode(decoder, fromHex("0081 1f 81 1f"), headers));  // "a" padded with three ones
+    CHECK(headers == (List{{"a", "a"}}));
+
+    CHECK(rejects("0081 18 81 1f"));         // padding of zeros
+    CHECK(rejects("0082 1fff 81 1f"));       // padding longer than seven bits
+    CHECK(rejects("0084 ffff ffff 81 1f"));  // EOS inside the string
+}
+
+TEST(enforces_header_list_limit) {
+    http2::Decoder decoder;
+    http2::HeaderList headers;
+    // custom-key: custom-header counts 10 + 13 + 32 = 55 bytes
+    std::string block = fromHex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572");
+    CHECK(!decode(decoder, block, headers, 54));
+    http2::Decoder fresh;
+    CHECK(decode(fresh, block, headers, 55));
+}
+
+// --- Frames -----------------------------------------------------------------
+
+TEST(parses_frame_headers) {
+    std::string wire;
+    http2::appendFrame(wire, http2::FrameType::Data, http2::flags::kEndStream, 3, "hello", 5);
+    CHECK_EQ(wire, fromHex("000005 00 01 00000003") + "hello");
+
+    http2::Frame frame;
+    CHECK(http2::parseFrame(wire.data(), wire.size(), frame));
+    CHECK_EQ(frame.length, 5u);
+    CHECK(frame.type == http2::FrameType::Data);
+    CHECK_EQ(frame.flags, http2::flags::kEndStream);
+    CHECK_EQ(frame.stream, 3u);
+    CHECK_EQ(std::string(frame.payload, frame.length), "hello");
+
+    // The reserved bit is not part of the stream id
+    std::string reserved = fromHex("000000 08 00 80000001");
+    CHECK(http2::parseFrame(reserved.data(), reserved.size(), frame));
+    CHECK_EQ(frame.stream, 1u);
+}
+
+TEST(waits_for_whole_frames) {
+    std::string wire;
+    http2::appendFrame(wire, http2::FrameType::Headers, 0, 1, "abcdef", 6);
+    http2::Frame frame;
+    CHECK(!http2::parseFrame(wire.data(), http2::kFrameHeaderSize - 1, frame));
+    CHECK(!http2::parseFrame(wire.data(), wire.size() - 1, frame));
+    CHECK_EQ(frame.length, 6u);  // known before the payload is, to refuse oversized frames
+
+    std::string huge = fromHex("ffffff 00 00 00000001");
+    CHECK(!http2::parseFrame(huge.data(), huge.size(), frame));
+    CHECK(frame.length > http2::kDefaultMaxFrame);
+}
+
+TEST(splits_header_blocks_into_continuations) {
+    std::string block(40, 'h');
+    std::string wire;
+    http2::appendHeaders(wire, 5, block, true, 16);
+
+    const char* at = wire.data();
+    size_t left = wire.size();
+    http2::Frame frames[3];
+    for (http2::Frame& frame : frames) {
+        CHECK(http2::parseFrame(at, left, frame));
+        at += http2::kFrameHeaderSize + frame.length;
+        left -= http2::kFrameHeaderSize + frame.length;
+    }
+    CHECK_EQ(left, 0u);
+    CHECK(frames[0].type == http2::FrameType::Headers);
+    CHECK_EQ(frames[0].flags, http2::flags::kEndStream);
+    CHECK(frames[1].type == http2::FrameType::Continuation);
+    CHECK_EQ(frames[1].flags, 0);
+    CHECK(frames[2].type == http2::FrameType::Continuation);
+    CHECK_EQ(frames[2].flags, http2::flags::kEndHeaders);
+    CHECK_EQ(frames[0].length + frames[1].length + frames[2].length, 40u);
+    CHECK_EQ(frames[2].stream, 5u);
+
+    wire.clear();
+    http2::appendHeaders(wire, 7, "short", false, 16);
+    http2::Frame single;
+    CHECK(http2::parseFrame(wire.data(), wire.size(), single));
+    CHECK_EQ(single.flags, http2::flags::kEndHeaders);
+    CHECK_EQ(wire.size(), http2::kFrameHeaderSize + 5);
+}
+
+TEST(strips_padding_and_priority) {
+    std::string payload = fromHex("03") + "abc" + std::string(3, '\0');
+    http2::Frame frame;
+    frame.type = http2::FrameType::Data;
+    frame.flags = http2::flags::kPadded;
+    frame.payload = payload.data();
+    frame.length = static_cast<uint32_t>(payload.size());
+    const char* data;
+    size_t size;
+    CHECK(http2::unpad(frame, data, size));
+    CHECK_EQ(std::string(data, size), "abc");
+
+    std::string headers = fromHex("02 80000003 10") + "block" + std::string(2, '\0');
+    frame.type = http2::FrameType::Headers;
+    frame.flags = http2::flags::kPadded | http2::flags::kPriority;
+    frame.payload = headers.data();
+    frame.length = static_cast<uint32_t>(headers.size());
+    CHECK(http2::unpad(frame, data, size));
+    CHECK_EQ(std::string(data, size), "block");
+
+    // Only padding left is fine
+    std::string allPadding = fromHex("02 0000");
+    frame.type = http2::FrameType::Data;
+    frame.flags = http2::flags::kPadded;
+    frame.payload = allPadding.data();
+    frame.length = 3;
+    CHECK(http2::unpad(frame, data, size));
+    CHECK_EQ(size, 0u);
+}
+
+TEST(rejects_bad_padding) {
+    http2::Frame frame;
+    const char* data;
+    size_t size;
+
+    std::string overlong = fromHex("04") + "abc";
+    frame.type = http2::FrameType::Data;
+    frame.flags = http2::flags::kPadded;
+    frame.payload = overlong.data();
+    frame.length = static_cast<uint32_t>(overlong.size());
+    CHECK(!http2::unpad(frame, data, size));
+
+    frame.length = 0;  // PADDED without the pad length
+    CHECK(!http2::unpad(frame, data, size));
+
+    std::string shortPriority = fromHex("80000003");
+    frame.type = http2::FrameType::Headers;
+    frame.flags = http2::flags::kPriority;
+    frame.payload = shortPriority.data();
+    frame.length = static_cast<uint32_t>(shortPriority.size());
+    CHECK(!http2::unpad(frame, data, size));
+
+    // A priority block counts towards what the padding may cover
+    std::string covered = fromHex("01 80000003 10");
+    frame.flags = http2::flags::kPadded | http2::flags::kPriority;
+    frame.payload = covered.data();
+    frame.length = static_cast<uint32_t>(covered.size());
+    CHECK(!http2::unpad(frame, data, size));
+}
+
+TEST(writes_control_frames) {
+    std::string wire;
+    http2::appendSettings(wire, {{http2::kMaxConcurrentStreams, 100}, {http2::kInitialWindowSize, 1 << 20}});
+    CHECK_EQ(wire, fromHex("00000c 04 00 00000000 0003 00000064 0004 00100000"));
+
+    wire.clear();
+    http2::appendWindowUpdate(wire, 1, 0x80001000);  // reserved bit dropped
+    CHECK_EQ(wire, fromHex("000004 08 00 00000001 00001000"));
+
+    wire.clear();
+    http2::appendRstStream(wire, 3, http2::kCancel);
+    CHECK_EQ(wire, fromHex("000004 03 00 00000003 00000008"));
+
+    wire.clear();
+    http2::appendGoAway(wire, 7, http2::kProtocolError);
+    CHECK_EQ(wire, fromHex("000008 07 00 00000000 00000007 00000001"));
+}
+
+TEST_MAIN("http2")
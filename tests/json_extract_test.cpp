@@ -0,0 +1,181 @@
+#include "common/json_extract.h"
+#include "test.h"
+#include <climits>
+#include <string>
+#include <vector>
+
+// FieldReader on the internal body shapes, whole and split at every byte,
+// the inputs that must send it to BodyExtractor's json::parse fallback, and
+// that fallback itself.
+
+namespace {
+
+struct Processed {
+    jsonextract::FieldReader reader;
+    std::vector<int> original;
+    std::vector<int> processed;
+    int value = -1;
+
+    Processed() {
+        reader.bind("original", &original);
+        reader.bind("processed", &processed);
+        reader.bind("value", &value);
+    }
+};
+
+// Whether the body reads in one chunk with only `value` bound
+bool readsValue(const std::string& body, int& value) {
+    jsonextract::FieldReader reader;
+    reader.bind("value", &value);
+    return reader.feed(body) && reader.finish();
+}
+
+bool readsValue(const std::string& body) {
+    int value;
+    return readsValue(body, value);
+}
+
+}  // namespace
+
+TEST(reads_scalars_and_arrays) {
+    Processed p;
+    CHECK(p.reader.feed(R"({"original":[1,-2,3],"processed":[2,-4,6],"value":42})"));
+    CHECK(p.reader.finish());
+    CHECK(p.original == (std::vector<int>{1, -2, 3}));
+    CHECK(p.processed == (std::vector<int>{2, -4, 6}));
+    CHECK_EQ(p.value, 42);
+}
+
+TEST(allows_whitespace_empty_arrays_and_unbound_fields) {
+    Processed p;
+    CHECK(p.reader.feed(" {\n\t\"value\" : 7 ,\"original\":[ ],\"skipped\":[9, 10],\r\n"
+                        " \"processed\" : [ 0 ] , \"count\":3 }\n"));
+    CHECK(p.reader.finish());
+    CHECK_EQ(p.value, 7);
+    CHECK(p.original.empty());
+    CHECK(p.processed == (std::vector<int>{0}));
+}
+
+TEST(reads_the_same_in_any_chunking) {
+    const std::string body = R"({"original":[10,200,-3000],"processed":[20,400,-6000],"value":-2147483648})";
+    for (size_t split = 0; split <= body.size(); ++split) {
+        Processed p;
+        CHECK(p.reader.feed(body.data(), split));
+        CHECK(p.reader.feed(body.data() + split, body.size() - split));
+        CHECK(p.reader.finish());
+        CHECK(p.processed == (std::vector<int>{20, 400, -6000}));
+        CHECK_EQ(p.value, INT_MIN);
+    }
+    // and a byte at a time
+    Processed p;
+    for (char c : body) CHECK(p.reader.feed(&c, 1));
+    CHECK(p.reader.finish());
+    CHECK(p.original == (std::vector<int>{10, 200, -3000}));
+}
+
+TEST(keeps_int_range) {
+    int value = 0;
+    CHECK(readsValue(R"({"value":2147483647})", value));
+    CHECK_EQ(value, INT_MAX);
+    CHECK(readsValue(R"({"value":-2147483648})", value));
+    CHECK_EQ(value, INT_MIN);
+    CHECK(!readsValue(R"({"value":2147483648})"));
+    CHECK(!readsValue(R"({"value":-2147483649})"));
+    CHECK(!readsValue(R"({"value":99999999999999999999999})"));
+}
+
+TEST(fails_outside_the_shape) {
+    CHECK(!readsValue(R"({"value":"5"})"));          // string
+    CHECK(!readsValue(R"({"value":1.5})"));          // float
+    CHECK(!readsValue(R"({"value":1e3})"));          // exponent
+    CHECK(!readsValue(R"({"value":{"n":1}})"));      // nesting
+    CHECK(!readsValue(R"({"value":[1]})"));          // array for a scalar
+    CHECK(!readsValue(R"({"va\"lue":1})"));          // escape in a key
+    CHECK(!readsValue(R"({"value":true})"));
+    CHECK(!readsValue(R"({"value":null})"));
+    CHECK(!readsValue(R"({"value":-})"));
+    CHECK(!readsValue(R"([1,2])"));
+
+    std::vector<int> array;
+    jsonextract::FieldReader reader;
+    reader.bind("processed", &array);
+    CHECK(!reader.feed(R"({"processed":5})"));       // scalar for an array
+    CHECK(reader.failed());
+}
+
+TEST(fails_on_bad_punctuation) {
+    CHECK(!readsValue(R"({"value":1,})"));
+    CHECK(!readsValue(R"({,"value":1})"));
+    CHECK(!readsValue(R"({"value" 1})"));
+    CHECK(!readsValue(R"({"value":1 "other":2})"));
+    CHECK(!readsValue(R"({"value":1,"a":[1,]})"));
+    CHECK(!readsValue(R"({"value":1,"a":[,1]})"));
+    CHECK(!readsValue(R"({"value":1}})"));           // trailing garbage
+    CHECK(!readsValue(R"({"value":1} x)"));
+    CHECK(readsValue("{\"value\":1}\n  "));          // but whitespace is fine
+}
+
+TEST(limits_key_length) {
+    const std::string fits(32, 'k');
+    CHECK(readsValue("{\"" + fits + "\":1,\"value\":2}"));
+    CHECK(!readsValue("{\"" + fits + "k\":1,\"value\":2}"));
+}
+
+TEST(needs_every_bound_field_and_the_whole_object) {
+    Processed p;
+    CHECK(p.reader.feed(R"({"original":[1],"value":1})"));
+    CHECK(!p.reader.failed());
+    CHECK(!p.reader.finish());  // no "processed"
+
+    int value = 0;
+    jsonextract::FieldReader reader;
+    reader.bind("value", &value);
+    CHECK(reader.feed(R"({"value":1)"));
+    CHECK(!reader.finish());    // cut short
+    CHECK(!jsonextract::FieldReader().finish());
+    CHECK(!readsValue("{}"));
+}
+
+TEST(body_extractor_streams_the_shape) {
+    jsonextract::BodyExtractor extractor;
+    int value = 0;
+    extractor.fields().bind("value", &value);
+    auto receive = extractor.receiver();
+    CHECK(receive("{\"val", 5));
+    CHECK(receive("ue\":17}", 7));
+    CHECK(extractor.finish());
+    CHECK_EQ(value, 17);
+    CHECK_EQ(extractor.body(), R"({"value":17})");
+}
+
+TEST(body_extractor_falls_back_to_json_parse) {
+    jsonextract::BodyExtractor extractor;
+    int value = 0;
+    std::vector<int> processed;
+    extractor.fields().bind("value", &value);
+    extractor.fields().bind("processed", &processed);
+    std::string body = R"({"service":"processor","value":9,"processed":[1,2],"meta":{"ok":true}})";
+    extractor(body.data(), body.size());
+    CHECK(extractor.fields().failed());
+    CHECK(extractor.finish());
+    CHECK_EQ(value, 9);
+    CHECK(processed == (std::vector<int>{1, 2}));
+}
+
+TEST(body_extractor_fallback_checks_types) {
+    auto extracts = [](const std::string& body) {
+        jsonextract::BodyExtractor extractor;
+        int value = 0;
+        extractor.fields().bind("value", &value);
+        extractor(body.data(), body.size());
+        return extractor.finish();
+    };
+    CHECK(extracts(R"({"value":3,"note":"x"})"));
+    CHECK(!extracts(R"({"value":1.5})"));
+    CHECK(!extracts(R"({"value":"3"})"));
+    CHECK(!extracts(R"({"value":4294967296})"));
+    CHECK(!extracts(R"({"note":"x"})"));
+    CHECK(!extracts("not json"));
+}
+
+TEST_MAIN("json_extract")
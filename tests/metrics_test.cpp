@@ -0,0 +1,82 @@
+#include "common/metrics.h"
+#include "test.h"
+#include <cstdint>
+#include <initializer_list>
+
+// Histogram snapshots: nearest-rank quantiles on the documented examples,
+// the bucket bounds' 12.5% error, and merging snapshots.
+
+namespace {
+
+using metrics::Histogram;
+
+Histogram::Snapshot snapshotOf(std::initializer_list<uint64_t> micros) {
+    Histogram histogram;
+    for (uint64_t m : micros) histogram.record(m);
+    return histogram.snapshot();
+}
+
+}  // namespace
+
+TEST(p99_of_two_samples_is_the_larger) {
+    Histogram::Snapshot s = snapshotOf({23, 100});
+    CHECK_EQ(s.count, 2u);
+    // Upper bounds of the buckets for 100us ([96, 104)) and 23us ([22, 24))
+    CHECK_EQ(s.quantile(0.99), 104.0);
+    CHECK_EQ(s.quantile(0.999), 104.0);
+    CHECK_EQ(s.quantile(0.5), 24.0);
+    CHECK_EQ(s.quantile(0.51), 104.0);
+}
+
+TEST(nearest_rank_on_exact_buckets) {
+    // Below 8us every value has its own bucket
+    Histogram::Snapshot s = snapshotOf({0, 1, 2, 3, 4, 5, 6, 7});
+    CHECK_EQ(s.quantile(0.5), 4.0);     // the 4th sample, 3us, bounded by 4
+    CHECK_EQ(s.quantile(0.99), 8.0);    // the 8th, 7us
+    CHECK_EQ(s.quantile(0.125), 1.0);   // the 1st, 0us
+    CHECK_EQ(s.quantile(0.0), 1.0);
+}
+
+TEST(empty_snapshot) {
+    Histogram histogram;
+    Histogram::Snapshot s = histogram.snapshot();
+    CHECK_EQ(s.count, 0u);
+    CHECK_EQ(s.quantile(0.5), 0.0);
+    CHECK_EQ(s.quantile(0.99), 0.0);
+}
+
+TEST(single_sample) {
+    Histogram::Snapshot s = snapshotOf({5000});
+    // 5000us lands in [4864, 5120)
+    for (double q : {0.0, 0.5, 0.9, 0.99, 0.999, 1.0}) CHECK_EQ(s.quantile(q), 5120.0);
+    CHECK_EQ(s.sumMicros, 5000u);
+}
+
+TEST(bucket_bounds_stay_within_an_eighth) {
+    for (uint64_t m = 1; m < (1ull << 27); m += m / 61 + 1) {
+        uint64_t bound = Histogram::upperBound(Histogram::bucketFor(m));
+        CHECK(bound > m);
+        CHECK(static_cast<double>(bound - m) <= 0.125 * static_cast<double>(m) + 1);
+    }
+    // Beyond ~134s everything shares the last bucket
+    CHECK_EQ(Histogram::bucketFor(1ull << 40), Histogram::kBuckets - 1);
+}
+
+TEST(merging_equals_recording_into_one) {
+    Histogram first, second, both;
+    for (uint64_t m = 0; m < 20000; m += 7) {
+        (m % 3 ? first : second).record(m);
+        both.record(m);
+    }
+    Histogram::Snapshot merged = first.snapshot();
+    merged.merge(second.snapshot());
+    Histogram::Snapshot whole = both.snapshot();
+    CHECK_EQ(merged.count, whole.count);
+    CHECK_EQ(merged.sumMicros, whole.sumMicros);
+    bool same = true;
+    for (size_t i = 0; i < Histogram::kBuckets; ++i) same = same && merged.counts[i] == whole.counts[i];
+    CHECK(same);
+    for (double q : {0.0, 0.5, 0.9, 0.99, 0.999, 1.0}) CHECK_EQ(merged.quantile(q), whole.quantile(q));
+}
+
+TEST_MAIN("metrics")
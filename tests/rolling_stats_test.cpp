@@ -0,0 +1,120 @@
+#include "consumer/rolling_stats.h"
+#include "test.h"
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
+// The /stats window aggregates: nearest-rank quantiles on the documented
+// examples, the sketch's 1% bound, and merging windows.
+
+namespace {
+
+stats::Summary summarise(std::initializer_list<int32_t> values) {
+    stats::Series series;
+    for (int32_t v : values) series.add(v);
+    stats::Summary summary;
+    series.mergeInto(summary);
+    return summary;
+}
+
+// Deterministic values across the int32 range, both signs and zero
+std::vector<int32_t> spread(size_t n, uint32_t seed) {
+    std::vector<int32_t> v(n);
+    for (size_t i = 0; i < n; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        v[i] = i % 5 == 0 ? 0 : static_cast<int32_t>(seed) >> (seed % 31);
+    }
+    return v;
+}
+
+}  // namespace
+
+TEST(p99_of_two_samples_is_the_larger) {
+    stats::Summary s = summarise({23, 100});
+    CHECK_EQ(s.quantile(0.99), 100.0);
+    CHECK_EQ(s.quantile(0.999), 100.0);
+    CHECK_EQ(s.quantile(0.5), 23.0);
+    CHECK_EQ(s.quantile(0.51), 100.0);
+}
+
+TEST(nearest_rank_on_a_hundred_samples) {
+    stats::Series series;
+    for (int v = 1; v <= 100; ++v) series.add(v);
+    stats::Summary s;
+    series.mergeInto(s);
+    // The 99th sample is 99, and the sketch's answer is within 1% of it
+    CHECK(std::fabs(s.quantile(0.99) - 99) <= 0.99);
+    CHECK(std::fabs(s.quantile(0.5) - 50) <= 0.5);
+    CHECK_EQ(s.quantile(1.0), 100.0);
+    CHECK_EQ(s.quantile(0.0), 1.0);
+}
+
+TEST(empty_window) {
+    stats::Summary s;
+    CHECK_EQ(s.count, 0u);
+    CHECK_EQ(s.quantile(0.5), 0.0);
+    CHECK_EQ(s.quantile(0.99), 0.0);
+    nlohmann::json body = s.toJson(false);
+    CHECK_EQ(body["count"], 0);
+    CHECK(!body.contains("p99"));
+    CHECK(!body.contains("min"));
+}
+
+TEST(single_sample) {
+    for (int32_t v : {0, 1, -1, 777, -123456, std::numeric_limits<int32_t>::max(),
+                      std::numeric_limits<int32_t>::min()}) {
+        stats::Summary s = summarise({v});
+        for (double q : {0.0, 0.5, 0.9, 0.99, 0.999, 1.0}) CHECK_EQ(s.quantile(q), static_cast<double>(v));
+    }
+}
+
+TEST(sketch_buckets_stay_within_one_percent) {
+    const double accuracy = stats::SketchMapping::kRelativeAccuracy;
+    auto within = [&](uint32_t m) {
+        double value = stats::SketchMapping::value(stats::SketchMapping::index(m));
+        return std::fabs(value - m) <= accuracy * m * (1 + 1e-9);
+    };
+    for (uint32_t m = 1; m < 100000; ++m) {
+        if (!within(m)) {
+            CHECK(within(m));
+            break;
+        }
+    }
+    for (uint32_t m = 100000; m < 0x80000000u; m += m / 997) CHECK(within(m));
+    CHECK(within(0x7fffffffu));
+    CHECK(within(0x80000000u));  // INT_MIN's magnitude
+    CHECK(stats::SketchMapping::index(0x80000000u) < stats::SketchMapping::kBuckets);
+}
+
+TEST(merging_equals_recording_into_one) {
+    std::vector<int32_t> a = spread(5000, 1), b = spread(3000, 2);
+    stats::Series first, second, both;
+    for (int32_t v : a) {
+        first.add(v);
+        both.add(v);
+    }
+    for (int32_t v : b) {
+        second.add(v);
+        both.add(v);
+    }
+    stats::Summary merged, left, right, whole;
+    first.mergeInto(left);
+    second.mergeInto(right);
+    merged.merge(left);
+    merged.merge(right);
+    both.mergeInto(whole);
+
+    CHECK_EQ(merged.count, whole.count);
+    CHECK_EQ(merged.sum, whole.sum);
+    CHECK_EQ(merged.min, whole.min);
+    CHECK_EQ(merged.max, whole.max);
+    CHECK_EQ(merged.zero, whole.zero);
+    CHECK(merged.positive == whole.positive);
+    CHECK(merged.negative == whole.negative);
+    for (double q : {0.0, 0.1, 0.5, 0.9, 0.99, 0.999, 1.0}) CHECK_EQ(merged.quantile(q), whole.quantile(q));
+    CHECK(merged.toJson(true) == whole.toJson(true));
+}
+
+TEST_MAIN("rolling_stats")
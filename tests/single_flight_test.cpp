@@ -0,0 +1,191 @@
+#include "common/single_flight.h"
+#include "test.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+// SingleFlight coalescing and caching: blocked and async waiters sharing
+// one fetch, a waiter giving up at its deadline, what is and is not cached,
+// and the cap on cache entries.
+
+namespace {
+
+struct Reply {
+    bool ok;
+    int value;
+};
+
+using Flights = SingleFlight<Reply>;
+using std::chrono::milliseconds;
+
+// Waits until `count` reaches `n`, or about a second has passed
+void awaitCount(const std::atomic<int>& count, int n) {
+    for (int i = 0; i < 200 && count.load() < n; ++i) std::this_thread::sleep_for(milliseconds(5));
+}
+
+}  // namespace
+
+TEST(concurrent_callers_share_one_fetch) {
+    Flights flights(true, milliseconds(0));
+    std::promise<void> release;
+    std::shared_future<void> gate = release.get_future().share();
+    std::atomic<int> fetches{0};
+    std::atomic<int> started{0};
+
+    std::vector<Flights::Outcome> outcomes(6);
+    std::vector<std::thread> callers;
+    for (size_t i = 0; i < outcomes.size(); ++i) {
+        callers.emplace_back([&, i] {
+            ++started;
+            outcomes[i] = flights.run("/data?count=1", [&] {
+                ++fetches;
+                gate.wait();
+                return Reply{true, 42};
+            });
+        });
+    }
+    awaitCount(started, 6);
+    std::this_thread::sleep_for(milliseconds(50));  // let the followers reach the wait
+    release.set_value();
+    for (auto& caller : callers) caller.join();
+
+    CHECK_EQ(fetches.load(), 1);
+    int fetched = 0;
+    for (const auto& outcome : outcomes) {
+        CHECK(outcome.value && outcome.value->value == 42);
+        fetched += outcome.source == Flights::Source::Fetched;
+        CHECK(outcome.source == Flights::Source::Fetched ||
+              outcome.source == Flights::Source::Coalesced);
+    }
+    CHECK_EQ(fetched, 1);
+}
+
+TEST(waiter_expires_while_the_leader_carries_on) {
+    Flights flights(true, milliseconds(0));
+    std::promise<void> release;
+    std::shared_future<void> gate = release.get_future().share();
+    std::atomic<int> leading{0};
+
+    Flights::Outcome leader;
+    std::thread first([&] {
+        leader = flights.run("k", [&] {
+            ++leading;
+            gate.wait();
+            return Reply{true, 1};
+        });
+    });
+    awaitCount(leading, 1);
+
+    auto start = Flights::Clock::now();
+    Flights::Outcome waiter = flights.run("k", [] { return Reply{true, 2}; },
+                                          start + milliseconds(30));
+    CHECK(waiter.source == Flights::Source::Expired);
+    CHECK(!waiter.value);
+    CHECK(Flights::Clock::now() - start >= milliseconds(30));
+
+    release.set_value();
+    first.join();
+    CHECK(leader.source == Flights::Source::Fetched);
+    CHECK_EQ(leader.value->value, 1);
+}
+
+TEST(caches_successes_for_the_ttl) {
+    Flights flights(false, milliseconds(50));
+    int fetches = 0;
+    auto fetch = [&] { return Reply{true, ++fetches}; };
+    CHECK(flights.run("k", fetch).source == Flights::Source::Fetched);
+    Flights::Outcome cached = flights.run("k", fetch);
+    CHECK(cached.source == Flights::Source::Cached);
+    CHECK_EQ(cached.value->value, 1);
+    CHECK(flights.run("other", fetch).source == Flights::Source::Fetched);
+
+    std::this_thread::sleep_for(milliseconds(60));
+    Flights::Outcome refetched = flights.run("k", fetch);
+    CHECK(refetched.source == Flights::Source::Fetched);
+    CHECK_EQ(refetched.value->value, 3);
+}
+
+TEST(never_caches_failures) {
+    Flights flights(true, milliseconds(10000));
+    int fetches = 0;
+    auto fail = [&] {
+        ++fetches;
+        return Reply{false, 0};
+    };
+    CHECK(flights.run("k", fail).source == Flights::Source::Fetched);
+    CHECK(flights.run("k", fail).source == Flights::Source::Fetched);
+    CHECK_EQ(fetches, 2);
+}
+
+TEST(caps_live_entries) {
+    Flights flights(false, milliseconds(10000));
+    auto fetch = [] { return Reply{true, 0}; };
+    for (size_t i = 0; i < Flights::kMaxCacheEntries; ++i) flights.run(std::to_string(i), fetch);
+    CHECK(flights.run("0", fetch).source == Flights::Source::Cached);
+    CHECK(flights.run("1023", fetch).source == Flights::Source::Cached);
+
+    // Full of live entries: a new key is served but not kept
+    CHECK(flights.run("new", fetch).source == Flights::Source::Fetched);
+    CHECK(flights.run("new", fetch).source == Flights::Source::Fetched);
+    // while the keys already there are still served
+    CHECK(flights.run("512", fetch).source == Flights::Source::Cached);
+}
+
+TEST(full_cache_drops_expired_entries) {
+    Flights flights(false, milliseconds(40));
+    auto fetch = [] { return Reply{true, 0}; };
+    for (size_t i = 0; i < Flights::kMaxCacheEntries; ++i) flights.run(std::to_string(i), fetch);
+    std::this_thread::sleep_for(milliseconds(50));
+
+    // The sweep makes room, so the new key is kept
+    CHECK(flights.run("new", fetch).source == Flights::Source::Fetched);
+    CHECK(flights.run("new", fetch).source == Flights::Source::Cached);
+    CHECK(flights.run("0", fetch).source == Flights::Source::Fetched);
+}
+
+TEST(async_waiters_get_the_leaders_value) {
+    Flights flights(true, milliseconds(10000));
+    std::function<void(Reply)> finish;
+    int starts = 0;
+    std::vector<Flights::Outcome> outcomes;
+    auto start = [&](auto done) {
+        ++starts;
+        finish = done;
+    };
+    auto record = [&](Flights::Outcome outcome) { outcomes.push_back(outcome); };
+
+    for (int i = 0; i < 4; ++i) flights.runAsync("k", start, record);
+    CHECK_EQ(starts, 1);
+    CHECK(outcomes.empty());
+
+    finish(Reply{true, 7});
+    CHECK_EQ(outcomes.size(), 4u);
+    int fetched = 0;
+    for (const auto& outcome : outcomes) {
+        CHECK_EQ(outcome.value->value, 7);
+        fetched += outcome.source == Flights::Source::Fetched;
+    }
+    CHECK_EQ(fetched, 1);
+    CHECK(outcomes[1].source == Flights::Source::Coalesced);
+
+    // Then straight from the cache, inline
+    flights.runAsync("k", start, record);
+    CHECK_EQ(starts, 1);
+    CHECK_EQ(outcomes.size(), 5u);
+    CHECK(outcomes.back().source == Flights::Source::Cached);
+}
+
+TEST(passes_through_when_off) {
+    Flights flights(false, milliseconds(0));
+    int fetches = 0;
+    auto fetch = [&] { return Reply{true, ++fetches}; };
+    flights.run("k", fetch);
+    CHECK(flights.run("k", fetch).source == Flights::Source::Fetched);
+    CHECK_EQ(fetches, 2);
+}
+
+TEST_MAIN("single_flight")
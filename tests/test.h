@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Just enough of a test harness for the parsers: each *_test.cpp is its own
+// binary, registers cases with TEST(name) and ends with TEST_MAIN(). A
+// failed CHECK reports the file, line and expression and the case carries
+// on, so one run lists every broken assertion. `make test` runs them all.
+//
+//     TEST(decodes_indexed_field) {
+//         CHECK(decoder.decode(block.data(), block.size(), headers, 4096));
+//         CHECK_EQ(headers.size(), 1u);
+//     }
+namespace test {
+
+struct Case {
+    const char* name;
+    void (*fn)();
+};
+
+inline std::vector<Case>& cases() {
+    static std::vector<Case> all;
+    return all;
+}
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+struct Register {
+    Register(const char* name, void (*fn)()) { cases().push_back({name, fn}); }
+};
+
+inline void fail(const char* file, int line, const std::string& what) {
+    ++failures();
+    std::fprintf(stderr, "  %s:%d: %s\n", file, line, what.c_str());
+}
+
+inline int run(const char* suite) {
+    int failedCases = 0;
+    for (const Case& c : cases()) {
+        int before = failures();
+        c.fn();
+        bool ok = failures() == before;
+        if (!ok) ++failedCases;
+        std::fprintf(stderr, "%s %s/%s\n", ok ? "PASS" : "FAIL", suite, c.name);
+    }
+    std::fprintf(stderr, "%s: %zu cases, %d failed\n", suite, cases().size(), failedCases);
+    return failedCases ? 1 : 0;
+}
+
+}  // namespace test
+
+#define TEST(name)                                              \
+    static void test_##name();                                  \
+    static const test::Register register_##name(#name, test_##name); \
+    static void test_##name()
+
+#define CHECK(expr) \
+    do { if (!(expr)) test::fail(__FILE__, __LINE__, "CHECK(" #expr ")"); } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+    do {                                                                       \
+        if (!((a) == (b))) test::fail(__FILE__, __LINE__, "CHECK_EQ(" #a ", " #b ")"); \
+    } while (0)
+
+#define TEST_MAIN(suite) \
+    int main() { return test::run(suite); }
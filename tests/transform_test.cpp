@@ -0,0 +1,245 @@
+#include "processor/transform.h"
+#include "test.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The SSE4.1 and AVX2 kernels against the scalar ones, over every ISA this
+// CPU has: tail lengths, int32 wraparound and the extremes, then filter
+// compaction and the pipeline spec parser.
+
+namespace {
+
+using transform::Isa;
+
+const size_t kLengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1000, 1001};
+
+// The ISAs above scalar that this CPU can run
+std::vector<Isa> vectorIsas() {
+    std::vector<Isa> isas;
+    for (Isa isa : {Isa::Sse41, Isa::Avx2}) {
+        if (static_cast<int>(isa) <= static_cast<int>(transform::detectIsa())) isas.push_back(isa);
+    }
+    return isas;
+}
+
+// Deterministic values mixing small numbers with the int32 extremes
+std::vector<int> values(size_t n) {
+    std::vector<int> v(n);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < n; ++i) {
+        state = state * 1664525u + 1013904223u;
+        switch (i % 7) {
+            case 0: v[i] = INT_MAX; break;
+            case 3: v[i] = INT_MIN; break;
+            case 5: v[i] = static_cast<int>(state % 201) - 100; break;
+            default: v[i] = static_cast<int>(state); break;
+        }
+    }
+    return v;
+}
+
+// Whether `map` with (a, b) gives the scalar result on every length
+bool mapAgrees(transform::kernels::MapFn map, transform::kernels::MapFn scalar, int a, int b) {
+    for (size_t n : kLengths) {
+        std::vector<int> want = values(n);
+        std::vector<int> got = want;
+        scalar(want.data(), n, a, b);
+        map(got.data(), n, a, b);
+        if (got != want) return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+TEST(scalar_kernels_wrap_like_int32) {
+    int v[] = {INT_MAX, INT_MIN, -1, 3};
+    transform::kernels::scaleScalar(v, 4, 2, 0);
+    CHECK_EQ(v[0], -2);
+    CHECK_EQ(v[1], 0);
+    CHECK_EQ(v[2], -2);
+    CHECK_EQ(v[3], 6);
+
+    int w[] = {INT_MAX, INT_MIN};
+    transform::kernels::offsetScalar(w, 2, 1, 0);
+    CHECK_EQ(w[0], INT_MIN);
+    CHECK_EQ(w[1], INT_MIN + 1);
+
+    transform::BatchStats s = transform::kernels::statsScalar(nullptr, 0);
+    CHECK_EQ(s.sum, 0);
+    CHECK_EQ(s.min, INT_MAX);
+    CHECK_EQ(s.max, INT_MIN);
+}
+
+TEST(scale_matches_scalar) {
+    transform::kernels::Table scalar = transform::kernels::forIsa(Isa::Scalar);
+    for (Isa isa : vectorIsas()) {
+        transform::kernels::Table table = transform::kernels::forIsa(isa);
+        for (int k : {2, -3, 0, 1, 65537, INT_MAX, INT_MIN}) {
+            CHECK(mapAgrees(table.scale, scalar.scale, k, 0));
+        }
+    }
+}
+
+TEST(offset_matches_scalar) {
+    transform::kernels::Table scalar = transform::kernels::forIsa(Isa::Scalar);
+    for (Isa isa : vectorIsas()) {
+        transform::kernels::Table table = transform::kernels::forIsa(isa);
+        for (int k : {0, -1, 100, INT_MAX, INT_MIN}) {
+            CHECK(mapAgrees(table.offset, scalar.offset, k, 0));
+        }
+    }
+}
+
+TEST(clamp_matches_scalar) {
+    transform::kernels::Table scalar = transform::kernels::forIsa(Isa::Scalar);
+    for (Isa isa : vectorIsas()) {
+        transform::kernels::Table table = transform::kernels::forIsa(isa);
+        CHECK(mapAgrees(table.clamp, scalar.clamp, INT_MIN, INT_MAX));
+        CHECK(mapAgrees(table.clamp, scalar.clamp, -5, 5));
+        CHECK(mapAgrees(table.clamp, scalar.clamp, 0, 0));
+        CHECK(mapAgrees(table.clamp, scalar.clamp, INT_MAX, INT_MAX));
+        CHECK(mapAgrees(table.clamp, scalar.clamp, INT_MIN, INT_MIN));
+    }
+}
+
+TEST(stats_matches_scalar) {
+    for (Isa isa : vectorIsas()) {
+        transform::kernels::Table table = transform::kernels::forIsa(isa);
+        for (size_t n : kLengths) {
+            std::vector<int> v = values(n);
+            transform::BatchStats want = transform::kernels::statsScalar(v.data(), n);
+            transform::BatchStats got = table.stats(v.data(), n);
+            CHECK_EQ(got.sum, want.sum);
+            CHECK_EQ(got.min, want.min);
+            CHECK_EQ(got.max, want.max);
+        }
+        // A batch of nothing but one extreme
+        std::vector<int> highs(9, INT_MAX);
+        transform::BatchStats s = table.stats(highs.data(), highs.size());
+        CHECK_EQ(s.sum, 9 * static_cast<int64_t>(INT_MAX));
+        CHECK_EQ(s.min, INT_MAX);
+        std::vector<int> lows(17, INT_MIN);
+        s = table.stats(lows.data(), lows.size());
+        CHECK_EQ(s.sum, 17 * static_cast<int64_t>(INT_MIN));
+        CHECK_EQ(s.max, INT_MIN);
+    }
+}
+
+TEST(pipelines_match_scalar) {
+    const char* specs[] = {"scale:3,offset:-1,clamp:0:250", "offset:2147483647,scale:-2",
+                           "scale:2,filter:-100:100,stats", "clamp:-1000:1000,stats,offset:7"};
+    for (const char* spec : specs) {
+        for (Isa isa : vectorIsas()) {
+            transform::Pipeline scalar(spec, Isa::Scalar);
+            transform::Pipeline pipeline(spec, isa);
+            for (size_t n : kLengths) {
+                std::vector<int> wantIn = values(n), wantOut(n);
+                std::vector<int> gotIn = wantIn, gotOut(n);
+                size_t want = scalar.run(wantIn.data(), wantOut.data(), n);
+                size_t got = pipeline.run(gotIn.data(), gotOut.data(), n);
+                CHECK_EQ(got, want);
+                wantIn.resize(want);
+                wantOut.resize(want);
+                gotIn.resize(got);
+                gotOut.resize(got);
+                CHECK(gotIn == wantIn);
+                CHECK(gotOut == wantOut);
+
+                // and in place, with `out` aliasing `in`
+                std::vector<int> inPlace = values(n);
+                CHECK_EQ(pipeline.run(inPlace.data(), inPlace.data(), n), want);
+                inPlace.resize(std::min(want, n));
+                CHECK(inPlace == wantOut);
+            }
+            // The in-place runs counted twice into `pipeline`
+            transform::Pipeline twice(spec, Isa::Scalar);
+            for (int pass = 0; pass < 2; ++pass) {
+                for (size_t n : kLengths) {
+                    std::vector<int> v = values(n);
+                    twice.run(v.data(), v.data(), n);
+                }
+            }
+            const transform::Aggregates& want = twice.aggregates();
+            const transform::Aggregates& got = pipeline.aggregates();
+            CHECK_EQ(got.count.load(), want.count.load());
+            CHECK_EQ(got.sum.load(), want.sum.load());
+            CHECK_EQ(got.min.load(), want.min.load());
+            CHECK_EQ(got.max.load(), want.max.load());
+        }
+    }
+}
+
+TEST(filter_compacts_in_place) {
+    transform::Pipeline pipeline("filter:0:10", Isa::Scalar);
+    std::vector<int> v = {5, -1, 10, 11, 0, 3, 99};
+    size_t kept = pipeline.run(v.data(), v.data(), v.size());
+    CHECK_EQ(kept, 4u);
+    v.resize(kept);
+    CHECK(v == (std::vector<int>{5, 10, 0, 3}));
+}
+
+TEST(filter_compacts_originals_alongside) {
+    transform::Pipeline pipeline("scale:2,filter:0:10", Isa::Scalar);
+    std::vector<int> in = {1, 6, -2, 5, 3}, out(in.size());
+    size_t kept = pipeline.run(in.data(), out.data(), in.size());
+    CHECK_EQ(kept, 3u);
+    in.resize(kept);
+    out.resize(kept);
+    CHECK(in == (std::vector<int>{1, 5, 3}));
+    CHECK(out == (std::vector<int>{2, 10, 6}));
+
+    std::vector<int> none = {50, 60};
+    CHECK_EQ(pipeline.run(none.data(), none.data(), none.size()), 0u);
+}
+
+TEST(stats_stage_folds_kept_values) {
+    transform::Pipeline pipeline("filter:0:100,stats", Isa::Scalar);
+    std::vector<int> v = {10, -5, 30, 200};
+    pipeline.run(v.data(), v.data(), v.size());
+    CHECK_EQ(pipeline.aggregates().count.load(), 2u);
+    CHECK_EQ(pipeline.aggregates().sum.load(), 40);
+    CHECK_EQ(pipeline.aggregates().min.load(), 10);
+    CHECK_EQ(pipeline.aggregates().max.load(), 30);
+}
+
+TEST(rejects_bad_specs) {
+    auto rejects = [](const std::string& spec) {
+        try {
+            transform::Pipeline pipeline(spec, Isa::Scalar);
+        } catch (const std::invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    CHECK(rejects("clamp:5:1"));
+    CHECK(rejects("filter:5:1"));
+    CHECK(rejects("scale"));
+    CHECK(rejects("scale:1x"));
+    CHECK(rejects("scale:"));
+    CHECK(rejects("scale:1:2"));
+    CHECK(rejects("scale:2147483648"));
+    CHECK(rejects("stats:1"));
+    CHECK(rejects("bogus:1"));
+    CHECK(rejects(""));
+    CHECK(rejects(",,"));
+    CHECK(!rejects("scale:-2147483648,clamp:3:3,stats"));
+}
+
+TEST(never_picks_a_missing_isa) {
+    CHECK(transform::parseIsa("auto") == transform::detectIsa());
+    CHECK(transform::parseIsa("scalar") == Isa::Scalar);
+    bool threw = false;
+    try {
+        transform::parseIsa("neon");
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+TEST_MAIN("transform")
@@ -0,0 +1,127 @@
+#include "common/wire_format.h"
+#include "test.h"
+#include <climits>
+#include <string>
+#include <utility>
+
+// The binary hop encoding: the exact header bytes, View::parse over what the
+// encoders wrote, and messages that are short, mislabelled or miscounted.
+
+namespace {
+
+std::string valuesMessage(const int* v, size_t count) {
+    return std::string(wire::values(v, count));
+}
+
+// An 8-byte header as written, before any column
+std::string header(uint16_t magic, uint8_t version, uint8_t type, uint32_t count) {
+    std::string out(wire::kHeaderSize, '\0');
+    wire::detail::put16(&out[0], magic);
+    out[2] = static_cast<char>(version);
+    out[3] = static_cast<char>(type);
+    wire::detail::put32(&out[4], count);
+    return out;
+}
+
+}  // namespace
+
+TEST(writes_the_documented_header) {
+    const int v[] = {1, -1};
+    std::string body = valuesMessage(v, 2);
+    CHECK_EQ(body, std::string("\x38\x4b\x01\x01\x02\x00\x00\x00"
+                               "\x01\x00\x00\x00\xff\xff\xff\xff", 16));
+}
+
+TEST(parses_values) {
+    const int v[] = {0, 42, -7, INT_MAX, INT_MIN};
+    std::string body = valuesMessage(v, 5);
+    wire::View view;
+    CHECK(view.parse(body, wire::Type::Values));
+    CHECK_EQ(view.size(), 5u);
+    for (size_t i = 0; i < 5; ++i) CHECK_EQ(view.first(i), v[i]);
+}
+
+TEST(parses_processed) {
+    const int original[] = {3, -4, 5};
+    const int processed[] = {6, -8, 10};
+    std::string body(wire::processed(original, processed, 3));
+    CHECK_EQ(body.size(), wire::kHeaderSize + 2 * 3 * 4);
+    wire::View view;
+    CHECK(view.parse(body, wire::Type::Processed));
+    CHECK_EQ(view.size(), 3u);
+    for (size_t i = 0; i < 3; ++i) {
+        CHECK_EQ(view.first(i), original[i]);
+        CHECK_EQ(view.second(i), processed[i]);
+    }
+}
+
+TEST(parses_empty_messages) {
+    std::string body = valuesMessage(nullptr, 0);
+    wire::View view;
+    CHECK(view.parse(body, wire::Type::Values));
+    CHECK_EQ(view.size(), 0u);
+    CHECK(view.parse(header(wire::kMagic, wire::kVersion, 2, 0), wire::Type::Processed));
+}
+
+TEST(rejects_short_bodies) {
+    const int v[] = {1, 2};
+    std::string body = valuesMessage(v, 2);
+    wire::View view;
+    CHECK(!view.parse("", wire::Type::Values));
+    for (size_t n = 0; n < body.size(); ++n) {
+        CHECK(!view.parse(std::string_view(body.data(), n), wire::Type::Values));
+    }
+}
+
+TEST(rejects_bad_headers) {
+    const int v[] = {1};
+    std::string good = valuesMessage(v, 1);
+    wire::View view;
+    CHECK(view.parse(good, wire::Type::Values));
+
+    std::string magic = good;
+    magic[0] = 'x';
+    CHECK(!view.parse(magic, wire::Type::Values));
+    std::string swapped = good;
+    std::swap(swapped[0], swapped[1]);  // big-endian magic
+    CHECK(!view.parse(swapped, wire::Type::Values));
+
+    std::string version = good;
+    version[2] = 2;
+    CHECK(!view.parse(version, wire::Type::Values));
+
+    CHECK(!view.parse(good, wire::Type::Processed));  // values where processed was asked for
+    std::string unknown = good;
+    unknown[3] = 3;
+    CHECK(!view.parse(unknown, wire::Type::Values));
+}
+
+TEST(rejects_miscounted_bodies) {
+    const int v[] = {1, 2, 3};
+    std::string body = valuesMessage(v, 3);
+    wire::View view;
+    CHECK(!view.parse(body + '\0', wire::Type::Values));       // trailing byte
+    CHECK(!view.parse(body + body, wire::Type::Values));       // two messages
+    CHECK(!view.parse(header(wire::kMagic, wire::kVersion, 1, 4) + body.substr(wire::kHeaderSize),
+                      wire::Type::Values));                    // count beyond the columns
+    // A processed message needs both columns
+    CHECK(!view.parse(header(wire::kMagic, wire::kVersion, 2, 3) + body.substr(wire::kHeaderSize),
+                      wire::Type::Processed));
+}
+
+TEST(rejects_huge_counts) {
+    wire::View view;
+    CHECK(!view.parse(header(wire::kMagic, wire::kVersion, 1, 0xFFFFFFFFu), wire::Type::Values));
+    CHECK(!view.parse(header(wire::kMagic, wire::kVersion, 2, 0x80000000u) + std::string(8, '\0'),
+                      wire::Type::Processed));
+}
+
+TEST(recognises_content_types) {
+    CHECK(wire::accepts("application/json, application/x-binary;q=0.9"));
+    CHECK(!wire::accepts("application/json"));
+    CHECK(wire::isBinary("application/x-binary"));
+    CHECK(!wire::isBinary("application/json"));
+    CHECK(!wire::isBinary(""));
+}
+
+TEST_MAIN("wire_format")